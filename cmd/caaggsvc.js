@@ -20,7 +20,9 @@ var mod_cahttp = require('../lib/ca/ca-http');
 var mod_dbg = require('../lib/ca/ca-dbg');
 var mod_log = require('../lib/ca/ca-log');
 var mod_cageoip = require('../lib/ca/ca-geo');
+var mod_caheap = require('../lib/ca/ca-heap');
 var mod_heatmap = require('heatmap');
+var mod_native = require('ca-native');
 var mod_os = require('os');
 var HTTP = require('../lib/ca/http-constants');
 var ASSERT = require('assert');
@@ -36,9 +38,12 @@ var agg_http_port;			/* actual http port */
 var agg_profile = false;
 
 var agg_insts = {};		/* active instrumentations by id */
+var agg_deadlines;		/* waiting value requests by deadline */
 var agg_start;			/* start time (in ms) */
 var agg_http;			/* http server */
 var agg_cap;			/* cap wrapper */
+var agg_ingest;			/* native data ingest (see aggIngest) */
+var agg_ingest_maxshards = 4;	/* max threads parsing data */
 var agg_log;			/* log handle */
 var agg_sysinfo;		/* system info config */
 
@@ -46,8 +51,10 @@ var agg_transforms = {};	/* available transformations by name */
 
 var agg_stash_min_interval = 60 * 1000;		/* min freq for stash updates */
 var agg_stash_timeout = 10 * 1000;		/* timeout for stash ops */
-var agg_stash_load_retry = 60 * 1000;		/* time between load retries */
+var agg_stash_load_retry_min = 2 * 1000;	/* first load retry delay */
+var agg_stash_load_retry = 60 * 1000;		/* max time between retries */
 var agg_stash_saved = 0;				/* last global save */
+var agg_stash_max_segments = 30;		/* max appends between fills */
 
 var agg_recent_interval = 2 * agg_http_req_timeout;	/* see aggExpected() */
 
@@ -65,6 +72,7 @@ function main()
 	var dbg_log, queue, ips, ii, ipe;
 
 	agg_start = new Date().getTime();
+	agg_deadlines = new mod_caheap.caHeap();
 
 	/*
 	 * Try and determine the IP address that we should tell someone.
@@ -95,6 +103,7 @@ function main()
 	caDbg.set('agg_start', agg_start);
 	caDbg.set('agg_transforms', agg_transforms);
 	caDbg.set('agg_future_interval', agg_future_interval);
+	caDbg.set('agg_ingest_maxshards', agg_ingest_maxshards);
 	caDbg.set('agg_future_warns', agg_future_warns);
 	caDbg.set('agg_future_warn_interval', agg_future_warn_interval);
 
@@ -113,8 +122,12 @@ function main()
 	}
 
 	queue = mod_cap.ca_amqp_key_base_aggregator + agg_sysinfo.ca_hostname;
+	agg_ingest = new mod_native.Ingest(Math.max(0,
+	    Math.min(mod_os.cpus().length - 1, agg_ingest_maxshards)));
+	caDbg.set('agg_ingest', agg_ingest);
 	agg_cap = new mod_cap.capAmqpCap({
 	    dbglog: dbg_log,
+	    ingest: aggIngest,
 	    keepalive: true,
 	    log: agg_log,
 	    queue: queue,
@@ -200,6 +213,7 @@ function aggCmdEnableAggregation(msg)
 		agg_cap.sendCmdAckEnableAggSuc(destkey, msg.ca_id, id);
 		agg_insts[id] = new aggInstn(id, msg.ag_instrumentation,
 		    datakey);
+		agg_insts[id].register();
 	});
 }
 
@@ -224,6 +238,7 @@ function aggCmdDisableAggregation(msg)
 	agg_log.info('disabling aggregation for instn %s', fqid);
 	instn = agg_insts[fqid];
 	delete (agg_insts[fqid]);
+	agg_ingest.unregister(fqid);
 	instn.deleteData();
 }
 
@@ -258,8 +273,7 @@ function aggCmdStatus(msg)
  */
 function aggData(msg)
 {
-	var id, time, hostname, value, now;
-	var inst, dataset, interval, rq, ii;
+	var id, time, hostname, value, now, inst, start;
 
 	id = msg.d_inst_id;
 	time = msg.d_time;
@@ -289,21 +303,69 @@ function aggData(msg)
 	if (!aggDataFutureCheck(hostname, time, now))
 		return;
 
+	start = mod_native.hrtime();
+	inst.agi_dataset.update(hostname, time, value);
+	mod_native.phaseRecord('dataset.update', start);
+	aggDataReceived(inst, time, now);
+}
+
+/*
+ * Receive a batch of raw messages.  Data messages for instrumentations whose
+ * datasets support it are parsed and added to the datasets natively (see
+ * ca-native's Ingest), without creating JavaScript objects for their values, so
+ * all that's left for us is the bookkeeping for each distinct source and time.
+ * We hand everything else to "callback" to be decoded and dispatched as usual.
+ * That includes data messages that need more attention, like those that are
+ * malformed or from the future, which aggData() handles as before.
+ *
+ * Large batches are parsed on the Ingest's shards (other threads) while we go
+ * on handling other events, but values are always added to the datasets here
+ * on the main thread, and batches complete in the order they were received.
+ */
+function aggIngest(bodies, callback)
+{
+	var now;
+
+	now = new Date().getTime();
+	agg_ingest.ingestAsync(bodies, now / 1000 + agg_future_interval,
+	    function (rv) {
+		var done, data, inst, ii;
+
+		done = new Date().getTime();
+		data = rv['data'];
+
+		for (ii = 0; ii < data.length; ii++) {
+			inst = agg_insts[data[ii][0]];
+			inst.agi_dataset.report(data[ii][1], data[ii][2]);
+			aggDataReceived(inst, data[ii][2], done);
+		}
+
+		callback(rv['rest']);
+	    });
+}
+
+/*
+ * Invoked after data for "time" has been added to the dataset for "inst".
+ */
+function aggDataReceived(inst, time, now)
+{
+	var dataset, interval;
+
 	if (inst.agi_last < time)
 		inst.agi_last = time;
 
+	inst.dirty(time);
 	dataset = inst.agi_dataset;
-	dataset.update(hostname, time, value);
 
 	/*
 	 * If we have all the data we're expecting for this time index, save it
 	 * to the stash and then wake up HTTP requests which may now be
-	 * satisfied.  We examine all of the requests waiting on data for this
-	 * instrumentation and we wake up those that were waiting for data for
-	 * this time index as well as those waiting for data from earlier times,
-	 * on the assumption that if we got data from all instrumenters for this
-	 * time, we won't some time later get data from any of them for some
-	 * previous time index.
+	 * satisfied.  We wake up the requests waiting for data for this time
+	 * index as well as those waiting for data from earlier times, on the
+	 * assumption that if we got data from all instrumenters for this time,
+	 * we won't some time later get data from any of them for some previous
+	 * time index.  Waiting requests are kept in a heap ordered by the time
+	 * they're waiting for, so this only looks at the ones we wake up.
 	 */
 	interval = dataset.normalizeInterval(time, time);
 	time = interval['start_time'];
@@ -313,14 +375,9 @@ function aggData(msg)
 
 	inst.save();
 
-	for (ii = 0; ii < inst.agi_requests.length; ii++) {
-		rq = inst.agi_requests[ii];
-
-		if (rq.latest() <= time) {
-			inst.agi_requests.splice(ii--, 1);
-			rq.complete(now);
-		}
-	}
+	while (inst.agi_requests.size() > 0 &&
+	    inst.agi_requests.peekKey() <= time)
+		inst.agi_requests.peek().finish(now);
 }
 
 function aggDataFutureCheck(hostname, datatime, now)
@@ -350,7 +407,13 @@ function aggNotifyConfigRestarted()
  */
 function aggNotifyConfigReset()
 {
+	var id;
+
 	agg_log.info('config reset');
+
+	for (id in agg_insts)
+		agg_ingest.unregister(id);
+
 	agg_insts = {};
 }
 
@@ -372,6 +435,8 @@ function aggAdminStatus()
 	ret['agg_recent_interval'] = agg_recent_interval;
 	ret['agg_http_port'] = agg_http_port;
 	ret['agg_profile'] = agg_profile;
+	ret['agg_ingest'] = agg_ingest.stats();
+	ret['agg_phases'] = mod_native.phaseStats();
 	ret['agg_transforms'] = {};
 
 	for (key in agg_transforms) {
@@ -393,10 +458,14 @@ function aggAdminStatus()
 		    type: obj.agi_dataset.constructor.name,
 		    nsources: obj.agi_dataset.nsources(),
 		    last: obj.agi_last,
-		    pending_requests: obj.agi_requests.length,
+		    pending_requests: obj.agi_requests.size(),
 		    inst: obj.agi_instrumentation
 		};
 
+		if (mod_caagg.caAggrSupportsHeatmap(obj))
+			ret['agg_insts'][key]['render_cache'] =
+			    obj.agi_dataset.renderStats();
+
 		ntotal++;
 	}
 
@@ -430,12 +499,17 @@ function aggExpected(dataset, time)
 
 /*
  * Invoked once/second to time out old HTTP requests and expire old data.
+ * Waiting requests are kept in a heap ordered by deadline, so we only look at
+ * the ones that have timed out.
  */
 function aggTick()
 {
-	var id, inst, ii, rq, globalsave;
+	var id, inst, globalsave;
 	var now = new Date().getTime();
 
+	while (agg_deadlines.size() > 0 && agg_deadlines.peekKey() <= now)
+		agg_deadlines.peek().finish(now);
+
 	if (agg_stash_saved - now > agg_stash_min_interval) {
 		globalsave = true;
 		agg_stash_saved = now;
@@ -446,19 +520,8 @@ function aggTick()
 	for (id in agg_insts) {
 		inst = agg_insts[id];
 
-		for (ii = 0; ii < inst.agi_requests.length; ii++) {
-			rq = inst.agi_requests[ii];
-
-			ASSERT.ok(rq.rqtime() <= now);
-
-			if (now - rq.rqtime() >= rq.timeout()) {
-				inst.agi_requests.splice(ii--, 1);
-				rq.complete(now);
-			}
-		}
-
 		if (inst.agi_load == 'waiting' &&
-		    now - inst.agi_load_last > agg_stash_load_retry) {
+		    now - inst.agi_load_last > inst.agi_load_retry) {
 			inst.agi_load = 'idle';
 			inst.load();
 		} else if (globalsave) {
@@ -492,10 +555,11 @@ function aggInstn(id, instn, datakey)
 	this.agi_since = new Date();
 	this.agi_dataset = mod_caagg.caDatasetForInstrumentation(instn);
 	this.agi_last = 0;
-	this.agi_requests = [];
+	this.agi_requests = new mod_caheap.caHeap();	/* by latest() */
 	this.agi_instrumentation = instn;
 	this.agi_datakey = datakey;
 	this.agi_bucket = 'ca.instn.data.' + this.agi_id;
+	this.agi_stash_full = true;
 
 	if (!instn['persist-data']) {
 		this.agi_load = 'non-persistent';
@@ -528,10 +592,14 @@ aggInstn.prototype.load = function ()
 		if (err) {
 			/*
 			 * We failed to complete the "get" command at all.
-			 * We'll try again in a little while.
+			 * We'll try again in a little while, backing off
+			 * exponentially if the stash remains unavailable.
 			 */
 			instn.agi_load = 'waiting';
 			instn.agi_load_last = new Date().getTime();
+			instn.agi_load_retry = instn.agi_load_retry ===
+			    undefined ? agg_stash_load_retry_min : Math.min(
+			    instn.agi_load_retry * 2, agg_stash_load_retry);
 			log.error('instn %s stash load failed: %r',
 			    instn.agi_id, err);
 			return;
@@ -563,6 +631,8 @@ aggInstn.prototype.load = function ()
 
 /*
  * Given data saved in the stash, load it into this instrumentation's dataset.
+ * Older versions saved JSON, while newer ones save the binary format in base64
+ * (which the dataset decodes itself).
  */
 aggInstn.prototype.unstash = function (result)
 {
@@ -572,23 +642,44 @@ aggInstn.prototype.unstash = function (result)
 	contents = result['data'];
 
 	try {
-		data = JSON.parse(contents);
+		if (metadata.ca_agg_stash_vers_minor >=
+		    mod_caagg.caDatasetStashBinary)
+			data = contents;
+		else
+			data = JSON.parse(contents);
 		agg_log.info('instn %s stash load: found results from %j',
 		    this.agi_id, metadata.ca_creator);
-		this.agi_dataset.unstash(metadata, data);
+		this.agi_dataset.unstash(metadata, data, result['segments']);
 	} catch (ex) {
 		agg_log.warn('instn %s stash load: failed to parse results: %r',
 		    this.agi_id, ex);
 	}
 };
 
+/*
+ * Records that data for "time" has changed since the last save.
+ */
+aggInstn.prototype.dirty = function (time)
+{
+	if (this.agi_dirty === undefined || time < this.agi_dirty)
+		this.agi_dirty = time;
+};
+
 /*
  * Save the current state to the stash, but only if it hasn't been saved too
  * recently and we're not currently trying to save it.
+ *
+ * Rewriting all of an instrumentation's data each time would mostly rewrite
+ * history that hasn't changed, so after the first save (and after the dataset
+ * is rebuilt), each save only appends a segment containing the data at or after
+ * the earliest time that's changed since the last save (see caDataset's
+ * stash()).  Once enough segments have accumulated that loading them would cost
+ * more than the data they replace, the next save replaces the whole bucket
+ * instead, which discards the segments.
  */
 aggInstn.prototype.save = function ()
 {
-	var instn, now, rq;
+	var instn, now, rq, append, since, nbytes;
 
 	/*
 	 * Non-persistent instrumentations don't get saved.
@@ -622,46 +713,88 @@ aggInstn.prototype.save = function ()
 			return;
 	}
 
+	append = !this.agi_stash_full;
+
+	if (append && this.agi_dirty === undefined)
+		return;
+
 	instn = this;
-	rq = this.agi_dataset.stash();
+	since = this.agi_dirty;
+	this.agi_dirty = undefined;
+	rq = this.agi_dataset.stash(append ? since : undefined);
+	nbytes = rq['data'].length;
 	rq['bucket'] = this.agi_bucket;
-	rq['data'] = JSON.stringify(rq['data']);
+	rq['data'] = rq['data'].toString('base64');
+	rq['encoding'] = 'base64';
 	rq['metadata'].ca_creator = agg_sysinfo;
 
-	agg_log.dbg('instn %s: saving to stash', instn.agi_id);
+	if (append)
+		rq['append'] = true;
+
+	agg_log.dbg('instn %s: saving to stash (%s, %d bytes)', instn.agi_id,
+	    append ? 'append' : 'full', nbytes);
 
 	this.agi_saving = true;
 	agg_cap.cmdDataPut(mod_cap.ca_amqp_key_stash, agg_stash_timeout,
 	    [ rq ], function (err, results) {
 		instn.agi_saving = false;
 
-		if (err) {
+		if (err)
 			agg_log.error('instn %s stash save failed: %r',
 			    instn.agi_id, err);
-			return;
-		}
-
-		if ('error' in results[0]) {
+		else if ('error' in results[0])
 			agg_log.error('instn %s stash save failed remotely: %s',
 			    instn.agi_id, results[0]['error']['message']);
+
+		if (err || 'error' in results[0]) {
+			/*
+			 * The data we tried to save still needs saving.  If we
+			 * were appending, the bucket may not be in the state
+			 * we expect (e.g., if it was removed), so save
+			 * everything next time.
+			 */
+			if (since !== undefined)
+				instn.dirty(since);
+			instn.agi_stash_full = true;
 			return;
 		}
 
 		instn.agi_last_saved = now;
+
+		if (!append) {
+			instn.agi_stash_full = false;
+			instn.agi_stash_nbytes = nbytes;
+			instn.agi_stash_nsegments = 0;
+			instn.agi_stash_segbytes = 0;
+			return;
+		}
+
+		instn.agi_stash_nsegments++;
+		instn.agi_stash_segbytes += nbytes;
+
+		if (instn.agi_stash_nsegments >= agg_stash_max_segments ||
+		    instn.agi_stash_segbytes > instn.agi_stash_nbytes)
+			instn.agi_stash_full = true;
 	    });
 };
 
 aggInstn.prototype.update = function (newinst, datakey)
 {
+	var retention;
+
 	if (datakey != this.agi_datakey) {
 		agg_log.error('asked to re-aggregate instn "%s" with ' +
 		    'different datakey (was "%s", now "%s")', this.agi_id,
 		    this.agi_datakey, datakey);
 	}
 
+	retention = this.agi_instrumentation['retention-time'];
 	this.agi_instrumentation = newinst;
 	this.agi_dataset.updateSources(newinst['nsources']);
 
+	if (newinst['retention-time'] != retention)
+		this.rebuild();
+
 	if (newinst['persist-data'] && this.agi_load == 'non-persistent') {
 		this.agi_load = 'idle';
 		this.load();
@@ -674,6 +807,37 @@ aggInstn.prototype.update = function (newinst, datakey)
 	}
 };
 
+/*
+ * Registers the dataset with the native ingest, if it supports that.
+ */
+aggInstn.prototype.register = function ()
+{
+	var targets;
+
+	targets = this.agi_dataset.ingestTargets();
+	if (targets !== undefined)
+		agg_ingest.register(this.agi_id, targets);
+};
+
+/*
+ * The granularities at which a dataset stores data depend on the retention time
+ * (see caDataTiers()), so when that changes, move the data into a new dataset.
+ */
+aggInstn.prototype.rebuild = function ()
+{
+	var stash;
+
+	agg_log.info('instn %s: rebuilding dataset for retention time %s',
+	    this.agi_id, this.agi_instrumentation['retention-time']);
+
+	stash = this.agi_dataset.stash();
+	this.agi_dataset = mod_caagg.caDatasetForInstrumentation(
+	    this.agi_instrumentation);
+	this.agi_dataset.unstash(stash['metadata'], stash['data']);
+	this.agi_stash_full = true;
+	this.register();
+};
+
 aggInstn.prototype.deleteData = function ()
 {
 	var instn = this;
@@ -724,6 +888,8 @@ function aggHttpRouter(server)
 		server.get(base + '/heatmap/percentile',
 		    aggHttpValueRetrieve.bind(null,
 		    mod_caagg.caAggrHeatmapPercentileImpl));
+		server.get(base + '/quantile', aggHttpValueRetrieve.bind(
+		    null, mod_caagg.caAggrQuantileImpl));
 	}
 }
 
@@ -735,7 +901,7 @@ function aggHttpRouter(server)
 function aggHttpInstn(request, response)
 {
 	var custid, instid, fqid;
-	var iarity, igran, dataset, instn;
+	var iarity, igran, isketch, dataset, instn;
 
 	custid = request.params['custid'];
 	instid = request.params['instid'];
@@ -746,6 +912,7 @@ function aggHttpInstn(request, response)
 
 	iarity = request.headers['x-ca-instn-arity'];
 	igran = parseInt(request.headers['x-ca-instn-granularity'], 10);
+	isketch = request.headers['x-ca-instn-sketch'] === 'true';
 
 	if (!iarity || !igran) {
 		response.send(HTTP.ENOTFOUND);
@@ -765,7 +932,8 @@ function aggHttpInstn(request, response)
 	    'nsources': 0,
 	    'granularity': igran,
 	    'value-dimension': iarity == mod_ca.ca_arity_scalar ? 1 : 2,
-	    'value-arity': iarity
+	    'value-arity': iarity,
+	    'value-sketch': isketch
 	});
 
 	instn = {
@@ -774,7 +942,8 @@ function aggHttpInstn(request, response)
 	    'agi_instrumentation': {
 		'granularity': igran,
 		'transformations': [],
-		'value-arity': iarity
+		'value-arity': iarity,
+		'value-sketch': isketch
 	    }
 	};
 
@@ -817,6 +986,13 @@ function aggHttpValueList(request, response)
 		});
 	}
 
+	if (mod_caagg.caAggrSupportsQuantiles(instn)) {
+		rv.push({
+			name: 'value_quantile',
+			uri: url + '/quantile'
+		});
+	}
+
 	response.send(HTTP.OK, rv);
 }
 
@@ -993,10 +1169,26 @@ caAggrValueRequest.prototype.start = function ()
 	 * aggExpected() for such instns should have been zero.
 	 */
 	ASSERT.ok(this.avr_instn.agi_requests);
-	this.avr_instn.agi_requests.push(this);
+	this.avr_waiting = this.avr_instn.agi_requests.insert(this.latest(),
+	    this);
+	this.avr_deadline = agg_deadlines.insert(
+	    this.avr_rqtime + this.avr_timeout, this);
 	return (undefined);
 };
 
+/*
+ * Stops waiting for data and completes the request.  This is invoked when
+ * either the data we're waiting for arrives or the request times out.
+ */
+caAggrValueRequest.prototype.finish = function (now)
+{
+	this.avr_instn.agi_requests.remove(this.avr_waiting);
+	agg_deadlines.remove(this.avr_deadline);
+	this.avr_waiting = undefined;
+	this.avr_deadline = undefined;
+	this.complete(now);
+};
+
 /*
  * Used internally to load instance state from the request parameters.
  */
@@ -1087,53 +1279,114 @@ caAggrValueRequest.prototype.validate = function ()
 /*
  * Complete the request.  This function is invoked when we either have
  * sufficient data to satisfy the request or we've timed out waiting for that
- * data.
+ * data.  Implementations that can compute values asynchronously (like heatmap
+ * images, which are rendered on other threads) do so, and the response is sent
+ * once all of the values are ready.
  */
 caAggrValueRequest.prototype.complete = function (delaynow)
 {
-	var response, xform, dataset, ret, val, point, ii;
+	var aggrq, impl, xform, dataset, ret, nleft, failed, point, val, ii;
+	var done;
 
-	response = this.avr_response;
+	aggrq = this;
+	impl = this.avr_impl;
 	dataset = this.avr_instn.agi_dataset;
 	xform = aggHttpValueTransform.bind(null, this.avr_xforms);
 	ret = [];
+	nleft = this.avr_points.length;
+	failed = false;
 
-	for (ii = 0; ii < this.avr_points.length; ii++) {
+	done = function (which, err, value) {
+		if (failed)
+			return;
+
+		if (err) {
+			failed = true;
+			aggrq.fail(which, err);
+			return;
+		}
+
+		ret[which] = aggrq.annotate(which, value, delaynow);
+
+		if (--nleft === 0)
+			aggrq.send(ret);
+	};
+
+	for (ii = 0; ii < this.avr_points.length && !failed; ii++) {
 		point = this.avr_points[ii];
 
+		if (impl.ai_value_async) {
+			try {
+				impl.ai_value_async(dataset,
+				    point['start_time'], point['duration'],
+				    xform, this.avr_request,
+				    done.bind(null, ii));
+			} catch (ex) {
+				done(ii, ex);
+			}
+
+			continue;
+		}
+
 		try {
-			val = this.avr_impl.ai_value(dataset,
-			    point['start_time'], point['duration'], xform,
-			    this.avr_request);
+			val = impl.ai_value(dataset, point['start_time'],
+			    point['duration'], xform, this.avr_request);
 		} catch (ex) {
-			agg_log.error('failed to process value request: %r',
-			    ex);
-			response.sendError(new caError(
-			    ex instanceof caError ? ex.code() : ECA_UNKNOWN, ex,
-			    'failed to process data point "%s" (%j)', ii + 1,
-			    point));
-			return;
+			done(ii, ex);
+			break;
 		}
 
-		if (delaynow)
-			val['delay'] = delaynow - this.avr_rqtime;
-		val['start_time'] = point['start_time'];
-		val['duration'] = point['duration'];
-		val['end_time'] = point['start_time'] + point['duration'];
-		val['nsources'] = dataset.nsources();
-		val['minreporting'] = dataset.nreporting(
-		    point['start_time'], point['duration']);
-		val['requested_start_time'] = point['requested_start_time'];
-		val['requested_duration'] = point['requested_duration'];
-		val['requested_end_time'] = point['requested_end_time'];
-		ret.push(val);
+		done(ii, null, val);
 	}
+};
 
+/*
+ * Fills in the common fields of the value for data point "which".
+ */
+caAggrValueRequest.prototype.annotate = function (which, val, delaynow)
+{
+	var dataset, point;
+
+	dataset = this.avr_instn.agi_dataset;
+	point = this.avr_points[which];
+
+	if (delaynow)
+		val['delay'] = delaynow - this.avr_rqtime;
+	val['start_time'] = point['start_time'];
+	val['duration'] = point['duration'];
+	val['end_time'] = point['start_time'] + point['duration'];
+	val['nsources'] = dataset.nsources();
+	val['minreporting'] = dataset.nreporting(
+	    point['start_time'], point['duration']);
+	val['requested_start_time'] = point['requested_start_time'];
+	val['requested_duration'] = point['requested_duration'];
+	val['requested_end_time'] = point['requested_end_time'];
+	return (val);
+};
+
+/*
+ * Sends the error "ex" encountered while computing the value for data point
+ * "which".
+ */
+caAggrValueRequest.prototype.fail = function (which, ex)
+{
+	agg_log.error('failed to process value request: %r', ex);
+	this.avr_response.sendError(new caError(
+	    ex instanceof caError ? ex.code() : ECA_UNKNOWN, ex,
+	    'failed to process data point "%s" (%j)', which + 1,
+	    this.avr_points[which]));
+};
+
+/*
+ * Sends the computed values.
+ */
+caAggrValueRequest.prototype.send = function (ret)
+{
 	if (this.avr_usearray)
-		return (response.send(HTTP.OK, ret));
+		return (this.avr_response.send(HTTP.OK, ret));
 
 	ASSERT.equal(ret.length, 1);
-	return (response.send(HTTP.OK, ret[0]));
+	return (this.avr_response.send(HTTP.OK, ret[0]));
 };
 
 caAggrValueRequest.prototype.instn = function ()
@@ -16,6 +16,7 @@ var mod_assert = require('assert');
 var ASSERT = mod_assert.ok;
 
 var mod_kstat = require('kstat');
+var mod_native = require('ca-native');
 var mod_ca = require('../../../lib/ca/ca-common');
 var mod_capred = require('../../../lib/ca/ca-pred');
 var mod_instr = require('../../../lib/ca/ca-instr');
@@ -52,7 +53,7 @@ function inskInitAutoMetrics(instr)
 
 	for (ii = 0; ii < inskMetrics.length; ii++) {
 		inskMetrics[ii]['fields']['hostname'] = {
-			values: function () { return ([ inskHostname ]); }
+			values: inskValuesConstant([ inskHostname ])
 		};
 
 		inskAutoMetricValidate(inskMetrics[ii], metadata);
@@ -239,74 +240,36 @@ var inskMetrics = [ {
 	filter: inskNicFilter,
 	extract: inskResourceExtract,
 	fields: {
-		nic: {
-			values: function (kstat) {
-				return ([ kstat['name'] ]);
-			}
-		},
+		nic: { values: inskValuesMember('name') },
 		packets: {
 			bucketize: mod_instr.caInstrLogLinearBucketize(
 			    10, 0, 11, 100),
-			values: function (kstat, kprev) {
-				var oldd, newd, oldsum, newsum;
-				oldd = kprev['data'];
-				newd = kstat['data'];
-				oldsum = oldd['ipackets64'] +
-				    oldd['opackets64'];
-				newsum = newd['ipackets64'] +
-				    newd['opackets64'];
-				return ([ newsum - oldsum ]);
-			}
+			values: inskValuesDelta([ 'ipackets64', 'opackets64' ])
 		},
 		packets_in: {
 			bucketize: mod_instr.caInstrLogLinearBucketize(
 			    10, 0, 11, 100),
-			values: function (kstat, kprev) {
-				var newd = kstat['data'];
-				var oldd = kprev['data'];
-				return ([newd['ipackets64'] -
-				    oldd['ipackets64']]);
-			}
+			values: inskValuesDelta([ 'ipackets64' ])
 		},
 		packets_out: {
 			bucketize: mod_instr.caInstrLogLinearBucketize(
 			    10, 0, 11, 100),
-			values: function (kstat, kprev) {
-				var newd = kstat['data'];
-				var oldd = kprev['data'];
-				return ([newd['opackets64'] -
-				    oldd['opackets64']]);
-			}
+			values: inskValuesDelta([ 'opackets64' ])
 		},
 		bytes: {
 			bucketize: mod_instr.caInstrLogLinearBucketize(
 			    10, 2, 11, 100),
-			values: function (kstat, kprev) {
-				var oldd, newd, oldsum, newsum;
-				oldd = kprev['data'];
-				newd = kstat['data'];
-				oldsum = oldd['rbytes64'] + oldd['obytes64'];
-				newsum = newd['rbytes64'] + newd['obytes64'];
-				return ([ newsum - oldsum ]);
-			}
+			values: inskValuesDelta([ 'rbytes64', 'obytes64' ])
 		},
 		bytes_read: {
 			bucketize: mod_instr.caInstrLogLinearBucketize(
 			    10, 2, 11, 100),
-			values: function (kstat, kprev) {
-				var newd = kstat['data'];
-				var oldd = kprev['data'];
-				return ([newd['rbytes64'] - oldd['rbytes64']]);
-			}
+			values: inskValuesDelta([ 'rbytes64' ])
 		},
 		bytes_write: {
 			bucketize: mod_instr.caInstrLogLinearBucketize(
 			    10, 2, 11, 100),
-			values: function (kstat, kprev) {
-				var newd = kstat['data'];
-				var oldd = kprev['data'];
-				return ([newd['obytes64'] - oldd['obytes64']]);
-			}
+			values: inskValuesDelta([ 'obytes64' ])
 		}
 	}
 }, {
@@ -314,21 +277,12 @@ var inskMetrics = [ {
 	stat: 'bytes',
 	kstat: { module: 'link', class: 'net' },
 	filter: inskNicFilter,
-	extract: function (fields, kstat, kprev) {
-		var newd = kstat['data'];
-		var oldd = kprev['data'];
-		var key = (fields['direction'] == 'sent') ?
-		    'obytes64' : 'rbytes64';
-		return (newd[key] - oldd[key]);
-	},
+	extract: inskExtractDelta('direction',
+	    { sent: 'obytes64', received: 'rbytes64' }),
 	fields: {
-		nic: {
-			values: function (kstat) {
-				return ([ kstat['name'] ]);
-			}
-		},
+		nic: { values: inskValuesMember('name') },
 		direction: {
-			values: function () { return ([ 'sent', 'received' ]); }
+			values: inskValuesConstant([ 'sent', 'received' ])
 		}
 	}
 }, {
@@ -336,21 +290,12 @@ var inskMetrics = [ {
 	stat: 'packets',
 	kstat: { module: 'link', class: 'net' },
 	filter: inskNicFilter,
-	extract: function (fields, kstat, kprev) {
-		var newd = kstat['data'];
-		var oldd = kprev['data'];
-		var key = (fields['direction'] == 'sent') ?
-		    'opackets64' : 'ipackets64';
-		return (newd[key] - oldd[key]);
-	},
+	extract: inskExtractDelta('direction',
+	    { sent: 'opackets64', received: 'ipackets64' }),
 	fields: {
-		nic: {
-			values: function (kstat) {
-				return ([ kstat['name'] ]);
-			}
-		},
+		nic: { values: inskValuesMember('name') },
 		direction: {
-			values: function () { return ([ 'sent', 'received' ]); }
+			values: inskValuesConstant([ 'sent', 'received' ])
 		}
 	}
 }, {
@@ -358,21 +303,12 @@ var inskMetrics = [ {
 	stat: 'vnic_bytes',
 	kstat: { module: 'link', class: 'net' },
 	filter: inskVnicFilter,
-	extract: function (fields, kstat, kprev) {
-		var newd = kstat['data'];
-		var oldd = kprev['data'];
-		var key = (fields['direction'] == 'sent') ?
-		    'obytes64' : 'rbytes64';
-		return (newd[key] - oldd[key]);
-	},
+	extract: inskExtractDelta('direction',
+	    { sent: 'obytes64', received: 'rbytes64' }),
 	fields: {
-		zonename: {
-			values: function (kstat) {
-				return ([ kstat['data']['zonename'] ]);
-			}
-		},
+		zonename: { values: inskValuesStat('zonename') },
 		direction: {
-			values: function () { return ([ 'sent', 'received' ]); }
+			values: inskValuesConstant([ 'sent', 'received' ])
 		}
 	}
 }, {
@@ -380,21 +316,12 @@ var inskMetrics = [ {
 	stat: 'vnic_packets',
 	kstat: { module: 'link', class: 'net' },
 	filter: inskVnicFilter,
-	extract: function (fields, kstat, kprev) {
-		var newd = kstat['data'];
-		var oldd = kprev['data'];
-		var key = (fields['direction'] == 'sent') ?
-		    'opackets64' : 'ipackets64';
-		return (newd[key] - oldd[key]);
-	},
+	extract: inskExtractDelta('direction',
+	    { sent: 'opackets64', received: 'ipackets64' }),
 	fields: {
-		zonename: {
-			values: function (kstat) {
-				return ([ kstat['data']['zonename'] ]);
-			}
-		},
+		zonename: { values: inskValuesStat('zonename') },
 		direction: {
-			values: function () { return ([ 'sent', 'received' ]); }
+			values: inskValuesConstant([ 'sent', 'received' ])
 		}
 	}
 }, {
@@ -404,78 +331,40 @@ var inskMetrics = [ {
 	filter: inskDiskFilter,
 	extract: inskResourceExtract,
 	fields: {
-		disk: {
-			values: function (kstat) {
-				return ([ kstat['name'] ]);
-			}
-		},
+		disk: { values: inskValuesMember('name') },
 		iops: {
 			bucketize: mod_instr.caInstrLogLinearBucketize(
 			    10, 0, 11, 100),
-			values: function (kstat, kprev) {
-				var newd = kstat['data'];
-				var oldd = kprev['data'];
-				var newsum = newd['writes'] + newd['reads'];
-				var oldsum = oldd['writes'] + oldd['reads'];
-				return ([ newsum - oldsum ]);
-			}
+			values: inskValuesDelta([ 'writes', 'reads' ])
 		},
 		iops_read: {
 			bucketize: mod_instr.caInstrLogLinearBucketize(
 			    10, 0, 11, 100),
-			values: function (kstat, kprev) {
-				var newd = kstat['data'];
-				var oldd = kprev['data'];
-				return ([ newd['reads'] - oldd['reads'] ]);
-			}
+			values: inskValuesDelta([ 'reads' ])
 		},
 		iops_write: {
 			bucketize: mod_instr.caInstrLogLinearBucketize(
 			    10, 0, 11, 100),
-			values: function (kstat, kprev) {
-				var newd = kstat['data'];
-				var oldd = kprev['data'];
-				return ([ newd['writes'] - oldd['writes'] ]);
-			}
+			values: inskValuesDelta([ 'writes' ])
 		},
 		bytes: {
 			bucketize: mod_instr.caInstrLogLinearBucketize(
 			    10, 2, 11, 100),
-			values: function (kstat, kprev) {
-				var newd = kstat['data'];
-				var oldd = kprev['data'];
-				var newsum = newd['nwritten'] + newd['nread'];
-				var oldsum = oldd['nwritten'] + oldd['nread'];
-				return ([ newsum - oldsum ]);
-			}
+			values: inskValuesDelta([ 'nwritten', 'nread' ])
 		},
 		bytes_read: {
 			bucketize: mod_instr.caInstrLogLinearBucketize(
 			    10, 2, 11, 100),
-			values: function (kstat, kprev) {
-				var newd = kstat['data'];
-				var oldd = kprev['data'];
-				return ([ newd['nread'] - oldd['nread'] ]);
-			}
+			values: inskValuesDelta([ 'nread' ])
 		},
 		bytes_write: {
 			bucketize: mod_instr.caInstrLogLinearBucketize(
 			    10, 2, 11, 100),
-			values: function (kstat, kprev) {
-				var newd = kstat['data'];
-				var oldd = kprev['data'];
-				return ([ newd['nwritten'] -
-				    oldd['nwritten'] ]);
-			}
+			values: inskValuesDelta([ 'nwritten' ])
 		},
 		busytime: {
 			bucketize: mod_instr.caInstrLinearBucketize(1),
-			values: function (kstat, kprev, interval) {
-				var newd = kstat['data'];
-				var oldd = kprev['data'];
-				return ([ Math.floor(100 * (newd['rtime'] -
-				    oldd['rtime']) / interval) ]);
-			}
+			values: inskValuesPercent([ 'rtime' ])
 		}
 	}
 }, {
@@ -485,14 +374,8 @@ var inskMetrics = [ {
 	filter: inskDiskFilter,
 	extract: inskIoExtractOps,
 	fields: {
-		disk: {
-			values: function (kstat) {
-				return ([ kstat['name'] ]);
-			}
-		},
-		optype: {
-			values: function () { return ([ 'read', 'write' ]); }
-		}
+		disk: { values: inskValuesMember('name') },
+		optype: { values: inskValuesConstant([ 'read', 'write' ]) }
 	}
 }, {
 	module: 'disk',
@@ -501,14 +384,8 @@ var inskMetrics = [ {
 	filter: inskDiskFilter,
 	extract: inskIoExtractBytes,
 	fields: {
-		disk: {
-			values: function (kstat) {
-				return ([ kstat['name'] ]);
-			}
-		},
-		optype: {
-			values: function () { return ([ 'read', 'write' ]); }
-		}
+		disk: { values: inskValuesMember('name') },
+		optype: { values: inskValuesConstant([ 'read', 'write' ]) }
 	}
 }, {
 	module: 'tcp',
@@ -790,12 +667,24 @@ function inskIoExtractOps(fields, kstat, kprev)
 	return (kstat['data'][key] - kprev['data'][key]);
 }
 
+inskKstatParams(inskIoExtractOps, {
+    type: 'delta',
+    field: 'optype',
+    stats: { read: 'reads', write: 'writes' }
+});
+
 function inskIoExtractBytes(fields, kstat, klast)
 {
 	var key = (fields['optype'] == 'read') ? 'nread' : 'nwritten';
 	return (kstat['data'][key] - klast['data'][key]);
 }
 
+inskKstatParams(inskIoExtractBytes, {
+    type: 'delta',
+    field: 'optype',
+    stats: { read: 'nread', write: 'nwritten' }
+});
+
 /*
  * "Resource" metrics return "1" for each kstat, since they're just counting up
  * the instances of a resource.
@@ -805,6 +694,8 @@ function inskResourceExtract()
 	return (1);
 }
 
+inskKstatParams(inskResourceExtract, { type: 'constant', value: 1 });
+
 function inskTcpSegmentsExtract(fields, kstat, kprev)
 {
 	var direction, kstatkey;
@@ -854,6 +745,121 @@ function inskMemLimit(value)
 	return (value);
 }
 
+/*
+ * Many of the fields' "values" functions and the metrics' "extract" functions
+ * take one of a few common forms.  The functions below construct these, and
+ * each records the parameters it was constructed with as its "caKstatParams" so
+ * that a metric whose fields and extract function were all constructed this way
+ * can be computed natively instead (see inskKstatDiff() and ca-native's
+ * KstatDiff).
+ */
+function inskKstatParams(func, params)
+{
+	func.caKstatParams = params;
+	return (func);
+}
+
+/*
+ * The value of the kstat's "member" ("module", "instance", "class", or "name").
+ */
+function inskValuesMember(member)
+{
+	return (inskKstatParams(function (kstat) {
+		return ([ kstat[member] ]);
+	}, { type: 'ident', member: member }));
+}
+
+/*
+ * The value of the kstat's statistic "stat".
+ */
+function inskValuesStat(stat)
+{
+	return (inskKstatParams(function (kstat) {
+		return ([ kstat['data'][stat] ]);
+	}, { type: 'stat', stat: stat }));
+}
+
+/*
+ * Each of "values", regardless of the kstat.
+ */
+function inskValuesConstant(values)
+{
+	return (inskKstatParams(function () {
+		return (values.slice(0));
+	}, { type: 'constant', values: values }));
+}
+
+/*
+ * The change in the sum of the kstat's statistics named in "stats".
+ */
+function inskValuesDelta(stats)
+{
+	return (inskKstatParams(function (kstat, kprev) {
+		return ([ inskSum(kstat, stats) - inskSum(kprev, stats) ]);
+	}, { type: 'delta', stats: stats }));
+}
+
+/*
+ * Like inskValuesDelta(), but as a percentage of the interval.
+ */
+function inskValuesPercent(stats)
+{
+	return (inskKstatParams(function (kstat, kprev, interval) {
+		return ([ Math.floor(100 * (inskSum(kstat, stats) -
+		    inskSum(kprev, stats)) / interval) ]);
+	}, { type: 'percent', stats: stats }));
+}
+
+/*
+ * Extracts the change in the statistic that "stats" maps the data point's value
+ * of field "field" to.
+ */
+function inskExtractDelta(field, stats)
+{
+	return (inskKstatParams(function (fields, kstat, kprev) {
+		var key = stats[fields[field]];
+		return (kstat['data'][key] - kprev['data'][key]);
+	}, { type: 'delta', field: field, stats: stats }));
+}
+
+function inskSum(kstat, stats)
+{
+	var sum, ii;
+
+	for (sum = 0, ii = 0; ii < stats.length; ii++)
+		sum += kstat['data'][stats[ii]];
+
+	return (sum);
+}
+
+/*
+ * Returns a KstatDiff for the metric described by "desc" if its fields and
+ * extract function were all constructed by the functions above, or null
+ * otherwise.
+ */
+function inskKstatDiff(desc)
+{
+	var fields, field, params;
+
+	if (!desc['extract'].caKstatParams)
+		return (null);
+
+	fields = [];
+	for (field in desc['fields']) {
+		if (!desc['fields'][field]['values'] ||
+		    !desc['fields'][field]['values'].caKstatParams)
+			return (null);
+
+		params = caDeepCopy(
+		    desc['fields'][field]['values'].caKstatParams);
+		params['name'] = field;
+		fields.push(params);
+	}
+
+	return (new mod_native.KstatDiff(fields,
+	    desc['extract'].caKstatParams));
+}
+
 /*
  * Implements the instrumenter's Metric interface for the kstat-based metric
  * desribed by "desc" and the actual instrumentation request described by
@@ -870,6 +876,7 @@ function insKstatAutoMetric(desc, metric, instrbei)
 	this.iam_metric = caDeepCopy(metric);
 	this.iam_reader = new mod_kstat.Reader(this.iam_kstat);
 	this.iam_last = null;
+	this.iam_diff = inskKstatDiff(desc);
 	this.iam_decompositions = [];
 	this.iam_metadata = instrbei.metadata();
 
@@ -929,6 +936,8 @@ function insKstatAutoMetric(desc, metric, instrbei)
 
 	this.iam_compute = instrbei.computeValue.bind(instrbei,
 	    bucketizers, this.iam_decompositions);
+	this.iam_computebatch = instrbei.computeBatch.bind(instrbei,
+	    bucketizers, this.iam_decompositions, this.iam_predicate);
 }
 
 exports.insKstatAutoMetric = insKstatAutoMetric; /* for testing */
@@ -1020,13 +1029,29 @@ insKstatAutoMetric.prototype.read = function ()
  *
  *	    (c) If a numeric decomposition was specified, bucketize the values
  *	        according to the "bucketize" function specified for this field.
+ *
+ * If the metric's fields and extract function were all constructed from
+ * parameters (see inskKstatParams()), steps (2) and (3) are instead done by a
+ * native KstatDiff, which keeps the previous snapshot itself and produces the
+ * data points as a batch, and steps (6) and (7) are done by the backend
+ * interface's computeBatch() without converting the batch back to JavaScript
+ * objects.
  */
 insKstatAutoMetric.prototype.value = function (callback)
 {
-	var kdata, klast, datapts, interval, key;
+	var kdata, klast, datapts, interval, key, points;
 
 	kdata = this.read();
 
+	if (this.iam_diff !== null) {
+		points = this.iam_diff.update(kdata);
+
+		if (points === undefined)
+			return (callback(caDeepCopy(this.iam_zero)));
+
+		return (callback(this.iam_computebatch(points)));
+	}
+
 	/*
 	 * We save the first data point but return zero for its value because we
 	 * don't have meaningful per-second data without a delta.
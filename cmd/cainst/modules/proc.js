@@ -31,12 +31,9 @@ exports.insinit = function (instr, log, callback) {
 	inspLog = log;
 	inspHostname = mod_ca.caSysinfo().ca_hostname;
 
-	mod_caproc.caProcLoadCTF(function (err, ctype) {
-		inspDataCache = new mod_caproc.caProcDataCache(ctype,
-		    inspRefresh);
-		inspInitMetrics(instr);
-		callback();
-	});
+	inspDataCache = new mod_caproc.caProcDataCache(inspRefresh, log);
+	inspInitMetrics(instr);
+	callback();
 };
 
 var inspMetrics = [ {
@@ -115,35 +112,30 @@ inspProcessImpl.prototype.value = function (callback)
 	var impl, res;
 
 	impl = this;
-	inspDataCache.data(function (objects) {
-		var datapts, datapt, key;
+	inspDataCache.snapshot(function (snapshot) {
+		var datapts, ii;
 
-		if (!objects)
+		if (!snapshot)
 			return (callback(undefined));
 
-		datapts = [];
-		for (key in objects) {
-			datapt = {
+		datapts = new Array(snapshot['length']);
+		for (ii = 0; ii < snapshot['length']; ii++) {
+			datapts[ii] = {
 			    fields: {
 				hostname: inspHostname,
-			        execname: objects[key]['pr_fname'],
-				zonename: objects[key]['pr_zonename'],
-				ppid: objects[key]['pr_ppid'].toString(),
-				pid: objects[key]['pr_pid'].toString(),
-				rss: objects[key]['pr_rssize'] * 1024,
-				contract: objects[key]['pr_contract'],
-				psargs: objects[key]['pr_psargs'],
-				pmodel: objects[key]['pr_dmodel'] == 1 ?
+				execname: snapshot['fname'][ii],
+				zonename: snapshot['zonename'][ii],
+				ppid: snapshot['ppid'][ii].toString(),
+				pid: snapshot['pid'][ii].toString(),
+				rss: snapshot['rssize'][ii] * 1024,
+				contract: snapshot['contract'][ii],
+				psargs: snapshot['psargs'][ii],
+				pmodel: snapshot['dmodel'][ii] == 1 ?
 				    '32-bit' : '64-bit',
-				nthreads: objects[key]['pr_nlwp']
+				nthreads: snapshot['nlwp'][ii]
 			    },
 			    value: 1
 			};
-
-			if (datapt['value'] === undefined)
-				continue;
-
-			datapts.push(datapt);
 		}
 
 		datapts = impl.ipm_applypred(datapts);
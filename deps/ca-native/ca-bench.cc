@@ -0,0 +1,326 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright (c) 2014, Joyent, Inc.
+ */
+
+/*
+ * ca-bench.cc: microbenchmarks for the addon's hot kernels
+ *
+ * Each benchmark runs one kernel in a tight loop over synthetic data generated
+ * natively (with a fixed seed, so runs are comparable), without crossing into
+ * JavaScript, so the results measure only the kernel.  The JavaScript
+ * interface is:
+ *
+ *	benchmark(kernel, iterations)
+ *
+ * which returns an object with "kernel", "iterations", and "nsec", the total
+ * time taken.  The kernels are:
+ *
+ *	add		adding a message's worth of values to a distribution and
+ *			merging it into a slot's distribution, as ingest does
+ *
+ *	bucketize	bucketizing a heatmap's worth of columns (every column
+ *			misses the cache)
+ *
+ *	render		the rest of rendering a decomposed heatmap from its
+ *			bucketized columns (see ca_heatmap_paint())
+ *
+ *	png		encoding a rendered heatmap as a base64 PNG
+ *
+ * The data (and, for "png", the rendered image) is set up before the clock
+ * starts.  See tools/cabench.js.
+ */
+
+#include <v8.h>
+#include <node.h>
+
+#include <string.h>
+#include <sys/time.h>
+
+#include <string>
+#include <vector>
+
+#include "ca-native.h"
+#include "ca-dist.h"
+#include "ca-png.h"
+#include "ca-render.h"
+
+using namespace v8;
+using std::string;
+using std::vector;
+
+#define	CA_BENCH_NPOINTS	80	/* values per message */
+#define	CA_BENCH_NCOLUMNS	60	/* heatmap columns */
+#define	CA_BENCH_NKEYS		4	/* selected keys */
+#define	CA_BENCH_WIDTH		600
+#define	CA_BENCH_HEIGHT		300
+#define	CA_BENCH_NBUCKETS	100
+
+/*
+ * A deterministic pseudo-random sequence.
+ */
+class caBenchRandom {
+public:
+	caBenchRandom() : br_seed(1) {}
+
+	uint32_t next(uint32_t max) {
+		br_seed = (br_seed * 1103515245 + 12345) % 2147483648U;
+		return (br_seed % max);
+	}
+
+private:
+	uint32_t	br_seed;
+};
+
+/*
+ * Generates values loosely like the fake backend's "latency" field: most small,
+ * the rest clustered in the milliseconds.
+ */
+static double
+ca_bench_value(caBenchRandom *rand)
+{
+	if (rand->next(10) < 6)
+		return (rand->next(10000));
+
+	return (5000000 + rand->next(4000000));
+}
+
+/*
+ * Fills "dists" with distributions shaped like ingested heatmap data.
+ */
+static void
+ca_bench_dists(caBenchRandom *rand, caDistLayout *layout, size_t ndists,
+    vector<caDist *> *dists)
+{
+	uint32_t bucket;
+	size_t ii, jj;
+
+	for (ii = 0; ii < ndists; ii++) {
+		dists->push_back(new caDist(layout));
+
+		for (jj = 0; jj < CA_BENCH_NPOINTS; jj++) {
+			if (layout->bucket(ca_bench_value(rand), &bucket))
+				dists->back()->add(bucket, 1);
+		}
+	}
+}
+
+static void
+ca_bench_conf(caHeatmapConf *hcp, size_t nsources)
+{
+	size_t ii;
+
+	for (ii = 0; ii < CA_BENCH_NCOLUMNS; ii++)
+		hcp->hc_times.push_back(ii);
+
+	hcp->hc_width = CA_BENCH_WIDTH;
+	hcp->hc_height = CA_BENCH_HEIGHT;
+	hcp->hc_nbuckets = CA_BENCH_NBUCKETS;
+	hcp->hc_min = 0;
+	hcp->hc_max = 10000000;
+	hcp->hc_hasmax = true;
+	hcp->hc_weighbyrange = false;
+	hcp->hc_linear = false;
+	hcp->hc_isolate = false;
+	hcp->hc_exclude = false;
+	hcp->hc_saturation[0] = 0;
+	hcp->hc_saturation[1] = 0.9;
+	hcp->hc_value = 0.95;
+
+	for (ii = 0; ii < nsources; ii++)
+		hcp->hc_hue.push_back(ii * 360 / nsources);
+}
+
+/*
+ * Fills "cells" with bucketized columns for the total and each selected key.
+ */
+static void
+ca_bench_cells(caBenchRandom *rand, const caHeatmapConf *hcp, size_t nsources,
+    vector<double> *cells)
+{
+	size_t ii;
+
+	cells->resize(nsources * CA_BENCH_NCOLUMNS * hcp->hc_nbuckets);
+
+	for (ii = 0; ii < cells->size(); ii++)
+		(*cells)[ii] = rand->next(4) == 0 ? rand->next(100) : 0;
+}
+
+static hrtime_t
+ca_bench_add(uint32_t iterations)
+{
+	caBenchRandom rand;
+	caDistLayout *layout;
+	vector<double> values;
+	uint32_t bucket, ii, jj;
+	hrtime_t start;
+
+	layout = caDistLayout::loglinear(10, 0, 11, 100);
+	caDist scratch(layout), slot(layout);
+	layout->rele();
+
+	for (ii = 0; ii < 64 * CA_BENCH_NPOINTS; ii++)
+		values.push_back(ca_bench_value(&rand));
+
+	start = gethrtime();
+
+	for (ii = 0; ii < iterations; ii++) {
+		scratch.clear();
+
+		for (jj = 0; jj < CA_BENCH_NPOINTS; jj++) {
+			if (layout->bucket(values[(ii % 64) *
+			    CA_BENCH_NPOINTS + jj], &bucket))
+				scratch.add(bucket, 1);
+		}
+
+		slot.merge(scratch);
+	}
+
+	return (gethrtime() - start);
+}
+
+static hrtime_t
+ca_bench_bucketize(uint32_t iterations)
+{
+	caBenchRandom rand;
+	caDistLayout *layout;
+	vector<caDist *> dists;
+	caHeatmapConf conf;
+	hrtime_t start, rv;
+	uint32_t ii;
+	size_t jj;
+
+	layout = caDistLayout::loglinear(10, 0, 11, 100);
+	ca_bench_dists(&rand, layout, CA_BENCH_NCOLUMNS, &dists);
+	layout->rele();
+	ca_bench_conf(&conf, 1);
+
+	start = gethrtime();
+
+	for (ii = 0; ii < iterations; ii++) {
+		caHeatmapCache cache;
+
+		cache.begin();
+		cache.params(&conf);
+
+		for (jj = 0; jj < dists.size(); jj++)
+			(void) cache.column(dists[jj]);
+
+		cache.end();
+	}
+
+	rv = gethrtime() - start;
+
+	for (jj = 0; jj < dists.size(); jj++)
+		delete (dists[jj]);
+
+	return (rv);
+}
+
+static hrtime_t
+ca_bench_render(uint32_t iterations)
+{
+	caBenchRandom rand;
+	caHeatmapConf conf;
+	vector<double> cells, scratch;
+	vector<uint8_t> pixels;
+	hrtime_t start;
+	uint32_t ii;
+
+	ca_bench_conf(&conf, 1 + CA_BENCH_NKEYS);
+	ca_bench_cells(&rand, &conf, 1 + CA_BENCH_NKEYS, &cells);
+	pixels.resize(CA_BENCH_WIDTH * CA_BENCH_HEIGHT * 3);
+
+	start = gethrtime();
+
+	for (ii = 0; ii < iterations; ii++) {
+		scratch = cells;
+		(void) ca_heatmap_paint(&conf, 1 + CA_BENCH_NKEYS, &scratch,
+		    &pixels[0]);
+	}
+
+	return (gethrtime() - start);
+}
+
+static hrtime_t
+ca_bench_png(uint32_t iterations)
+{
+	caBenchRandom rand;
+	caHeatmapConf conf;
+	caPngOptions options;
+	vector<double> cells;
+	vector<uint8_t> pixels;
+	string text;
+	hrtime_t start;
+	uint32_t ii;
+
+	ca_bench_conf(&conf, 1 + CA_BENCH_NKEYS);
+	ca_bench_cells(&rand, &conf, 1 + CA_BENCH_NKEYS, &cells);
+	pixels.resize(CA_BENCH_WIDTH * CA_BENCH_HEIGHT * 3);
+	(void) ca_heatmap_paint(&conf, 1 + CA_BENCH_NKEYS, &cells, &pixels[0]);
+	options.po_level = 6;
+
+	start = gethrtime();
+
+	for (ii = 0; ii < iterations; ii++)
+		(void) ca_png_encode(&pixels[0], CA_BENCH_WIDTH,
+		    CA_BENCH_HEIGHT, &options, &text);
+
+	return (gethrtime() - start);
+}
+
+static struct {
+	const char	*cb_name;
+	hrtime_t	(*cb_func)(uint32_t);
+} ca_benchmarks[] = {
+	{ "add",	ca_bench_add },
+	{ "bucketize",	ca_bench_bucketize },
+	{ "render",	ca_bench_render },
+	{ "png",	ca_bench_png },
+	{ NULL,		NULL }
+};
+
+static Handle<Value>
+ca_benchmark(const Arguments& args)
+{
+	HandleScope scope;
+	Local<Object> rv;
+	uint32_t iterations;
+	hrtime_t nsec;
+	int ii;
+
+	if (args.Length() < 2 || !args[0]->IsString() || !args[1]->IsNumber())
+		return (ca_throw("expected kernel and iterations"));
+
+	String::Utf8Value name(args[0]);
+	iterations = args[1]->Uint32Value();
+
+	for (ii = 0; ca_benchmarks[ii].cb_name != NULL; ii++) {
+		if (strcmp(*name, ca_benchmarks[ii].cb_name) == 0)
+			break;
+	}
+
+	if (ca_benchmarks[ii].cb_name == NULL)
+		return (ca_throw("unknown kernel"));
+
+	nsec = ca_benchmarks[ii].cb_func(iterations);
+
+	rv = Object::New();
+	rv->Set(String::New("kernel"), args[0]);
+	rv->Set(String::New("iterations"), Number::New(iterations));
+	rv->Set(String::New("nsec"), Number::New((double)nsec));
+	return (scope.Close(rv));
+}
+
+void
+ca_bench_init(Handle<Object> target)
+{
+	Local<FunctionTemplate> templ = FunctionTemplate::New(ca_benchmark);
+
+	target->Set(String::NewSymbol("benchmark"), templ->GetFunction());
+}
@@ -0,0 +1,253 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright (c) 2014, Joyent, Inc.
+ */
+
+/*
+ * ca-compute.cc: one-pass computation of instrumenter values
+ *
+ * The JavaScript interface is:
+ *
+ *	computeValue(points, decomps[, layout])
+ *
+ *		Computes the value of a batch of data points, "points" (a
+ *		DataPoints object; see ca-points.h), decomposed by the fields
+ *		named in "decomps", exactly as caInstrComputeValue() does.  All
+ *		but the last field must be discrete.  The last may be numeric,
+ *		in which case "layout" is the linear or loglinear DistLayout
+ *		with which to bucketize it.  Returns the value, or undefined if
+ *		some point's numeric field can't be bucketized with "layout"
+ *		(e.g., because it's negative) or has a value of zero, in which
+ *		case the caller should compute the value the slow way.
+ *
+ * caInstrComputeValue() computes each level of a decomposition by filtering the
+ * data points once for each key at that level, so the cost grows with the
+ * product of the number of points and the number of keys.  Here we instead make
+ * a single pass over the points, looking up each point's group by the tuple of
+ * its discrete fields' key identifiers, and adding its value to the group's
+ * sum, or to the right bucket of the group's distribution.  The buckets for the
+ * whole numeric column are computed up front (see caDistLayout::bucketize()).
+ * Only then do we build the nested JavaScript objects for the result.
+ */
+
+#include <v8.h>
+#include <node.h>
+
+#include <map>
+#include <vector>
+
+#include "ca-native.h"
+#include "ca-dist.h"
+#include "ca-phase.h"
+#include "ca-points.h"
+
+using namespace v8;
+using std::string;
+using std::vector;
+
+typedef std::map<vector<uint32_t>, size_t> ca_groups_t;
+
+/*
+ * Accumulates the value of each group of points.
+ */
+class caComputeState {
+public:
+	caComputeState(caDistLayout *layout) : cs_layout(layout) {}
+	~caComputeState();
+
+	size_t group(const vector<uint32_t> &);
+	bool add(size_t, uint32_t, double);
+	Local<Value> tojs(size_t) const;
+
+	const ca_groups_t &groups() const { return (cs_groups); }
+
+private:
+	caDistLayout		*cs_layout;	/* NULL for scalar values */
+	ca_groups_t		cs_groups;
+	vector<double>		cs_sums;
+	vector<caDist *>	cs_dists;
+};
+
+caComputeState::~caComputeState()
+{
+	size_t ii;
+
+	for (ii = 0; ii < cs_dists.size(); ii++)
+		delete (cs_dists[ii]);
+}
+
+/*
+ * Returns the index of the group for the given tuple of keys, creating it if
+ * necessary.
+ */
+size_t
+caComputeState::group(const vector<uint32_t> &keys)
+{
+	ca_groups_t::iterator it;
+
+	if ((it = cs_groups.find(keys)) != cs_groups.end())
+		return (it->second);
+
+	cs_groups.insert(ca_groups_t::value_type(keys, cs_sums.size()));
+	cs_sums.push_back(0);
+
+	if (cs_layout != NULL)
+		cs_dists.push_back(new caDist(cs_layout));
+
+	return (cs_sums.size() - 1);
+}
+
+/*
+ * Adds a point with the given value (and bucket, if we're bucketizing) to group
+ * "which".  caDist doesn't keep empty buckets, but the JavaScript bucketizers
+ * do, so this fails for points with a value of zero rather than return a
+ * different distribution.
+ */
+bool
+caComputeState::add(size_t which, uint32_t bucket, double value)
+{
+	if (cs_layout == NULL) {
+		cs_sums[which] += value;
+		return (true);
+	}
+
+	if (value == 0)
+		return (false);
+
+	cs_dists[which]->add(bucket, value);
+	return (true);
+}
+
+Local<Value>
+caComputeState::tojs(size_t which) const
+{
+	HandleScope scope;
+
+	if (cs_layout == NULL)
+		return (scope.Close(Number::New(cs_sums[which])));
+
+	return (scope.Close(cs_dists[which]->tojs()));
+}
+
+static Handle<Value>
+ca_compute_value(const Arguments& args)
+{
+	HandleScope scope;
+	caPoints *pp;
+	caDistLayout *layout;
+	Local<Array> decomps;
+	Local<Object> root;
+	vector<size_t> fields;
+	vector<uint32_t> keys, prev, buckets;
+	vector<Local<Object> > objects;
+	ca_groups_t::const_iterator it;
+	size_t field, ndiscrete, numeric, which, ii, jj;
+
+	if (args.Length() < 2 || (pp = ca_points_unwrap(args[0])) == NULL ||
+	    !args[1]->IsArray())
+		return (ca_throw("expected DataPoints and array of fields"));
+
+	decomps = Local<Array>::Cast(args[1]);
+
+	for (ii = 0; ii < decomps->Length(); ii++) {
+		String::Utf8Value name(decomps->Get(ii));
+
+		if (!pp->field(string(*name, name.length()), &field))
+			return (ca_throw("field is not part of the batch"));
+
+		if (pp->numeric(field) && ii != decomps->Length() - 1)
+			return (ca_throw("numeric field must be last"));
+
+		fields.push_back(field);
+	}
+
+	ndiscrete = fields.size();
+	numeric = 0;
+	layout = NULL;
+
+	if (ndiscrete > 0 && pp->numeric(fields[ndiscrete - 1])) {
+		numeric = fields[--ndiscrete];
+
+		if (args.Length() < 3 ||
+		    (layout = ca_dist_layout(args[2])) == NULL ||
+		    layout->type() == CA_DIST_RANGES)
+			return (ca_throw("expected linear or loglinear "
+			    "DistLayout"));
+	}
+
+	caPhaseTimer timer(ca_phase_compute, pp->size());
+	caComputeState state(layout);
+
+	keys.resize(ndiscrete);
+
+	if (layout != NULL && pp->size() > 0) {
+		buckets.resize(pp->size());
+		if (!layout->bucketize(pp->numbers(numeric), pp->size(),
+		    &buckets[0]))
+			return (Undefined());
+	}
+
+	for (ii = 0; ii < pp->size(); ii++) {
+		for (jj = 0; jj < ndiscrete; jj++)
+			keys[jj] = pp->key(fields[jj], ii);
+
+		/* Consecutive points are often in the same group. */
+		if (ii == 0 || keys != prev) {
+			which = state.group(keys);
+			prev = keys;
+		}
+
+		if (!state.add(which, layout != NULL ? buckets[ii] : 0,
+		    pp->value(ii)))
+			return (Undefined());
+	}
+
+	if (ndiscrete == 0) {
+		if (pp->size() == 0)
+			(void) state.group(keys);
+
+		return (scope.Close(state.tojs(0)));
+	}
+
+	/*
+	 * Groups are sorted by their tuples of keys, so all the groups with a
+	 * given prefix are adjacent.  objects[jj] is the object holding the
+	 * keys at level jj for the current prefix.
+	 */
+	root = Object::New();
+	objects.resize(ndiscrete, root);
+	prev.clear();
+
+	for (it = state.groups().begin(); it != state.groups().end(); it++) {
+		const vector<uint32_t> &group = it->first;
+
+		for (jj = 0; jj < prev.size() && group[jj] == prev[jj]; jj++)
+			continue;
+
+		for (; jj < ndiscrete - 1; jj++) {
+			const string &name = pp->keyName(group[jj]);
+			objects[jj + 1] = Object::New();
+			objects[jj]->Set(String::New(name.c_str(), name.size()),
+			    objects[jj + 1]);
+		}
+
+		const string &name = pp->keyName(group[ndiscrete - 1]);
+		objects[ndiscrete - 1]->Set(String::New(name.c_str(),
+		    name.size()), state.tojs(it->second));
+		prev = group;
+	}
+
+	return (scope.Close(root));
+}
+
+void
+ca_compute_init(Handle<Object> target)
+{
+	target->Set(String::NewSymbol("computeValue"),
+	    FunctionTemplate::New(ca_compute_value)->GetFunction());
+}
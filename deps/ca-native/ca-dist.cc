@@ -0,0 +1,1034 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright (c) 2014, Joyent, Inc.
+ */
+
+/*
+ * ca-dist.cc: native distributions (see ca-dist.h)
+ *
+ * In addition to the caDist and caDistLayout classes used by other parts of
+ * the addon, this file implements the JavaScript classes:
+ *
+ *	new DistLayout(params)		Creates a layout.  "params" is one of
+ *					{ type: 'linear', step: S },
+ *					{ type: 'loglinear', base: B, min: M,
+ *					  max: X, nbuckets: N }, or
+ *					{ type: 'ranges' }.
+ *
+ *	new Distribution([layout])	Creates an empty distribution using the
+ *					given layout (or a new "ranges" layout).
+ *
+ *	    add(array)			Adds a distribution in wire format.
+ *
+ *	    insert(value[, count])	Adds "count" (default: 1) to the bucket
+ *					containing "value".  Only supported for
+ *					linear and loglinear layouts.
+ *
+ *	    merge(distribution)		Adds another distribution with the same
+ *					layout.
+ *
+ *	    toArray()			Returns the distribution in wire format.
+ *
+ *	    total()			Returns the sum of all counts.
+ */
+
+#include <v8.h>
+#include <node.h>
+
+#include <math.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "ca-native.h"
+#include "ca-dist.h"
+#include "ca-stash.h"
+
+using namespace v8;
+using std::vector;
+
+/*
+ * Loglinear layouts precompute at most this many powers of their base, which
+ * covers values up to 2^128 even for base 2.
+ */
+#define	CA_DIST_MAXPOWERS	128
+
+static int ca_logfloor(double, double);
+
+caDistLayout::caDistLayout(ca_dist_type type) :
+    dl_type(type), dl_refs(1), dl_step(0), dl_base(0), dl_min(0), dl_max(0),
+    dl_nbuckets(0), dl_perpower(0), dl_logbase(0)
+{
+}
+
+caDistLayout *
+caDistLayout::linear(double step)
+{
+	caDistLayout *dlp = new caDistLayout(CA_DIST_LINEAR);
+	dlp->dl_step = step;
+	return (dlp);
+}
+
+/*
+ * Like caInstrLogLinearBucketize(), the "max" parameter is recorded but doesn't
+ * actually bound the layout.
+ */
+caDistLayout *
+caDistLayout::loglinear(double base, int min, int max, int nbuckets)
+{
+	caDistLayout *dlp = new caDistLayout(CA_DIST_LOGLINEAR);
+	double least;
+	int ii;
+
+	dlp->dl_base = base;
+	dlp->dl_min = min;
+	dlp->dl_max = max;
+	dlp->dl_nbuckets = nbuckets;
+	dlp->dl_perpower = (uint32_t)ceil(nbuckets - nbuckets / base);
+	dlp->dl_logbase = log(base);
+
+	/*
+	 * ca_logfloor() divides repeatedly, so its result for values near a
+	 * power of the base may differ from the mathematical floor of the log.
+	 * It's monotonic, though, so we find the least value for which it
+	 * returns each power by starting at that power and stepping one
+	 * representable value at a time.
+	 */
+	dlp->dl_floors.push_back(0);
+	dlp->dl_powers.push_back(1);
+
+	for (ii = 1; ii < CA_DIST_MAXPOWERS; ii++) {
+		least = pow(base, ii);
+		if (isinf(least) || isinf(pow(base, ii + 1)))
+			break;
+
+		while (ca_logfloor(base, least) < ii)
+			least = nextafter(least, INFINITY);
+
+		while (ca_logfloor(base, nextafter(least, 0)) >= ii)
+			least = nextafter(least, 0);
+
+		dlp->dl_floors.push_back(least);
+		dlp->dl_powers.push_back(pow(base, ii));
+	}
+
+	dlp->dl_powers.push_back(pow(base, ii));
+	return (dlp);
+}
+
+caDistLayout *
+caDistLayout::ranges()
+{
+	return (new caDistLayout(CA_DIST_RANGES));
+}
+
+/*
+ * Computes floor(log-base-"base"(value)) exactly the way caLogFloor() does.
+ */
+static int
+ca_logfloor(double base, double value)
+{
+	int exp;
+
+	for (exp = 0; value >= base; exp++)
+		value /= base;
+
+	return (exp);
+}
+
+/*
+ * Returns ca_logfloor(dl_base, value) using the table of powers.
+ */
+int
+caDistLayout::logfloor(double value) const
+{
+	int exp, last;
+
+	last = dl_floors.size() - 1;
+
+	if (value >= dl_floors[last])
+		return (ca_logfloor(dl_base, value));
+
+	exp = (int)(log(value) / dl_logbase);
+	if (exp < 0)
+		exp = 0;
+	else if (exp > last)
+		exp = last;
+
+	while (exp < last && value >= dl_floors[exp + 1])
+		exp++;
+
+	while (exp > 0 && value < dl_floors[exp])
+		exp--;
+
+	return (exp);
+}
+
+/*
+ * Returns the bucket for the given value.  This is only supported for linear
+ * and loglinear layouts.
+ */
+bool
+caDistLayout::bucket(double value, uint32_t *bucketp) const
+{
+	double step, which;
+	uint32_t kk;
+	int exp;
+
+	if (isnan(value))
+		return (false);
+
+	switch (dl_type) {
+	case CA_DIST_LINEAR:
+		which = floor(value / dl_step);
+		if (which < 0 || which >= UINT32_MAX)
+			return (false);
+
+		*bucketp = (uint32_t)which;
+		return (true);
+
+	case CA_DIST_LOGLINEAR:
+		if (value < 0)
+			return (false);
+
+		if (value < power(dl_min)) {
+			*bucketp = 0;
+			return (true);
+		}
+
+		exp = logfloor(value);
+		step = power(exp + 1) / dl_nbuckets;
+		kk = (uint32_t)floor((value - power(exp)) / step);
+
+		if (kk >= dl_perpower)
+			kk = dl_perpower - 1;
+
+		*bucketp = 1 + (exp - dl_min) * dl_perpower + kk;
+		return (true);
+
+	default:
+		return (false);
+	}
+}
+
+/*
+ * Stores the buckets for "nvalues" values into "buckets".  Returns false if
+ * any of the values isn't supported by the layout, in which case the contents
+ * of "buckets" are undefined.
+ */
+bool
+caDistLayout::bucketize(const double *values, size_t nvalues,
+    uint32_t *buckets) const
+{
+	double which;
+	bool ok;
+	size_t ii;
+
+	if (dl_type != CA_DIST_LINEAR) {
+		for (ii = 0; ii < nvalues; ii++) {
+			if (!bucket(values[ii], &buckets[ii]))
+				return (false);
+		}
+
+		return (true);
+	}
+
+	/*
+	 * This loop has no early exits so that it can be vectorized.  NaN
+	 * fails both comparisons, so it's caught along with out-of-range
+	 * values.
+	 */
+	ok = true;
+	for (ii = 0; ii < nvalues; ii++) {
+		which = floor(values[ii] / dl_step);
+		ok &= which >= 0 && which < UINT32_MAX;
+		buckets[ii] = which >= 0 && which < UINT32_MAX ?
+		    (uint32_t)which : 0;
+	}
+
+	return (ok);
+}
+
+/*
+ * Returns the bucket corresponding to the range [low, high].  For "ranges"
+ * layouts, this assigns a new bucket if we haven't seen this range before.
+ * For the others, this fails if the range isn't exactly one of the layout's
+ * buckets.
+ */
+bool
+caDistLayout::index(double low, double high, uint32_t *bucketp)
+{
+	std::pair<double, double> range(low, high);
+	std::map<std::pair<double, double>, uint32_t>::iterator it;
+	double blow, bhigh;
+	uint32_t id, rank, ii;
+
+	if (dl_type != CA_DIST_RANGES) {
+		if (!bucket(low, bucketp))
+			return (false);
+
+		this->range(*bucketp, &blow, &bhigh);
+		return (fabs(blow - low) <= 1e-9 * (fabs(low) + 1) &&
+		    fabs(bhigh - high) <= 1e-9 * (fabs(high) + 1));
+	}
+
+	if ((it = dl_ids.find(range)) != dl_ids.end()) {
+		*bucketp = it->second;
+		return (true);
+	}
+
+	/*
+	 * Ranges are numbered in the order we first see them, but we also keep
+	 * track of each one's rank in sorted order so that we can emit
+	 * distributions sorted by range.  New ranges are rare enough that a
+	 * linear update is fine.
+	 */
+	id = dl_ranges.size();
+	rank = 0;
+	for (ii = 0; ii < id; ii++) {
+		if (dl_ranges[ii] < range)
+			rank++;
+		else
+			dl_rank[ii]++;
+	}
+
+	dl_ranges.push_back(range);
+	dl_rank.push_back(rank);
+	dl_ids[range] = id;
+	*bucketp = id;
+	return (true);
+}
+
+void
+caDistLayout::range(uint32_t bucket, double *lowp, double *highp) const
+{
+	double step;
+	int exp;
+
+	switch (dl_type) {
+	case CA_DIST_LINEAR:
+		*lowp = bucket * dl_step;
+		*highp = *lowp + dl_step - 1;
+		break;
+
+	case CA_DIST_LOGLINEAR:
+		if (bucket == 0) {
+			*lowp = 0;
+			*highp = power(dl_min);
+			break;
+		}
+
+		exp = dl_min + (bucket - 1) / dl_perpower;
+		step = power(exp + 1) / dl_nbuckets;
+		*lowp = power(exp) + ((bucket - 1) % dl_perpower) * step;
+		*highp = *lowp + step - (step / dl_base);
+		break;
+
+	default:
+		*lowp = dl_ranges[bucket].first;
+		*highp = dl_ranges[bucket].second;
+		break;
+	}
+}
+
+
+uint64_t caDist::cd_generation = 0;
+
+/*
+ * "ranges" layouts assign bucket numbers densely, so distributions using them
+ * always use dense storage.  Other distributions start out sparse and become
+ * dense once most of the buckets up to the highest one in use are non-empty.
+ */
+caDist::caDist(caDistLayout *layout) :
+    cd_layout(layout), cd_version(++cd_generation),
+    cd_dense(layout->type() == CA_DIST_RANGES)
+{
+	cd_layout->hold();
+}
+
+caDist::caDist(const caDist &rhs) :
+    cd_layout(rhs.cd_layout), cd_version(++cd_generation),
+    cd_dense(rhs.cd_dense), cd_counts(rhs.cd_counts),
+    cd_sparse(rhs.cd_sparse)
+{
+	cd_layout->hold();
+}
+
+caDist::~caDist()
+{
+	cd_layout->rele();
+}
+
+static bool
+ca_bucket_lt(const ca_bucket_t &lhs, const ca_bucket_t &rhs)
+{
+	return (lhs.first < rhs.first);
+}
+
+void
+caDist::densify()
+{
+	size_t ii;
+
+	if (cd_dense)
+		return;
+
+	cd_counts.assign(
+	    cd_sparse.empty() ? 0 : cd_sparse.back().first + 1, 0);
+	for (ii = 0; ii < cd_sparse.size(); ii++)
+		cd_counts[cd_sparse[ii].first] = cd_sparse[ii].second;
+
+	vector<ca_bucket_t>().swap(cd_sparse);
+	cd_dense = true;
+}
+
+void
+caDist::maybeDensify()
+{
+	if (!cd_dense && cd_sparse.size() >= 8 &&
+	    cd_sparse.back().first < 2 * cd_sparse.size())
+		densify();
+}
+
+void
+caDist::add(uint32_t bucket, double count)
+{
+	vector<ca_bucket_t>::iterator it;
+	ca_bucket_t entry(bucket, count);
+	size_t ii;
+
+	touch();
+
+	if (cd_dense) {
+		if (bucket < cd_counts.size()) {
+			cd_counts[bucket] += count;
+			return;
+		}
+
+		if (cd_layout->type() == CA_DIST_RANGES ||
+		    bucket < 2 * cd_counts.size() + 64) {
+			cd_counts.resize(bucket + 1, 0);
+			cd_counts[bucket] += count;
+			return;
+		}
+
+		/* Too sparse for dense storage: switch to sparse. */
+		for (ii = 0; ii < cd_counts.size(); ii++) {
+			if (cd_counts[ii] != 0)
+				cd_sparse.push_back(ca_bucket_t(ii,
+				    cd_counts[ii]));
+		}
+
+		vector<double>().swap(cd_counts);
+		cd_dense = false;
+	}
+
+	it = std::lower_bound(cd_sparse.begin(), cd_sparse.end(), entry,
+	    ca_bucket_lt);
+
+	if (it != cd_sparse.end() && it->first == bucket) {
+		it->second += count;
+		return;
+	}
+
+	cd_sparse.insert(it, entry);
+	maybeDensify();
+}
+
+/*
+ * Adds "rhs" into this distribution.  In the common case, both are dense and
+ * this is just a vector add.
+ */
+void
+caDist::merge(const caDist &rhs)
+{
+	vector<ca_bucket_t> sum;
+	size_t ii, ll, rr;
+
+	touch();
+
+	if (!rhs.cd_dense) {
+		if (cd_dense) {
+			for (ii = 0; ii < rhs.cd_sparse.size(); ii++)
+				add(rhs.cd_sparse[ii].first,
+				    rhs.cd_sparse[ii].second);
+			return;
+		}
+
+		sum.reserve(cd_sparse.size() + rhs.cd_sparse.size());
+
+		for (ll = 0, rr = 0; ll < cd_sparse.size() ||
+		    rr < rhs.cd_sparse.size(); ) {
+			if (rr == rhs.cd_sparse.size() ||
+			    (ll < cd_sparse.size() &&
+			    cd_sparse[ll].first < rhs.cd_sparse[rr].first)) {
+				sum.push_back(cd_sparse[ll++]);
+			} else if (ll == cd_sparse.size() ||
+			    rhs.cd_sparse[rr].first < cd_sparse[ll].first) {
+				sum.push_back(rhs.cd_sparse[rr++]);
+			} else {
+				sum.push_back(ca_bucket_t(cd_sparse[ll].first,
+				    cd_sparse[ll].second +
+				    rhs.cd_sparse[rr].second));
+				ll++;
+				rr++;
+			}
+		}
+
+		cd_sparse.swap(sum);
+		maybeDensify();
+		return;
+	}
+
+	densify();
+
+	if (cd_counts.size() < rhs.cd_counts.size())
+		cd_counts.resize(rhs.cd_counts.size(), 0);
+
+	for (ii = 0; ii < rhs.cd_counts.size(); ii++)
+		cd_counts[ii] += rhs.cd_counts[ii];
+}
+
+void
+caDist::clear()
+{
+	touch();
+	vector<double>().swap(cd_counts);
+	vector<ca_bucket_t>().swap(cd_sparse);
+	cd_dense = cd_layout->type() == CA_DIST_RANGES;
+}
+
+bool
+caDist::empty() const
+{
+	size_t ii;
+
+	for (ii = 0; ii < cd_counts.size(); ii++) {
+		if (cd_counts[ii] != 0)
+			return (false);
+	}
+
+	for (ii = 0; ii < cd_sparse.size(); ii++) {
+		if (cd_sparse[ii].second != 0)
+			return (false);
+	}
+
+	return (true);
+}
+
+double
+caDist::total() const
+{
+	double sum = 0;
+	size_t ii;
+
+	for (ii = 0; ii < cd_counts.size(); ii++)
+		sum += cd_counts[ii];
+
+	for (ii = 0; ii < cd_sparse.size(); ii++)
+		sum += cd_sparse[ii].second;
+
+	return (sum);
+}
+
+size_t
+caDist::memsize() const
+{
+	return (sizeof (*this) + cd_counts.capacity() * sizeof (double) +
+	    cd_sparse.capacity() * sizeof (ca_bucket_t));
+}
+
+class caBucketRankLess {
+public:
+	caBucketRankLess(const caDistLayout *layout) : brl_layout(layout) {}
+
+	bool operator()(const ca_bucket_t &lhs, const ca_bucket_t &rhs) const
+	{
+		return (brl_layout->rank(lhs.first) <
+		    brl_layout->rank(rhs.first));
+	}
+
+private:
+	const caDistLayout *brl_layout;
+};
+
+/*
+ * Stores the non-empty buckets of this distribution into "out", sorted by
+ * range.
+ */
+void
+caDist::buckets(vector<ca_bucket_t> *out) const
+{
+	size_t ii;
+
+	out->clear();
+
+	if (cd_dense) {
+		for (ii = 0; ii < cd_counts.size(); ii++) {
+			if (cd_counts[ii] != 0)
+				out->push_back(ca_bucket_t(ii, cd_counts[ii]));
+		}
+	} else {
+		for (ii = 0; ii < cd_sparse.size(); ii++) {
+			if (cd_sparse[ii].second != 0)
+				out->push_back(cd_sparse[ii]);
+		}
+	}
+
+	if (cd_layout->type() == CA_DIST_RANGES)
+		std::sort(out->begin(), out->end(),
+		    caBucketRankLess(cd_layout));
+}
+
+/*
+ * Adds the distribution "value", which is in wire format, to this one.  On
+ * failure, returns false and sets *errp to an error message.  Buckets added
+ * before the failure remain added.
+ */
+bool
+caDist::addjs(Handle<Value> value, const char **errp)
+{
+	Local<Array> array, entry, range;
+	uint32_t ii, bucket;
+
+	if (!value->IsArray()) {
+		*errp = "distribution must be an array";
+		return (false);
+	}
+
+	array = Local<Array>::Cast(value);
+
+	for (ii = 0; ii < array->Length(); ii++) {
+		if (!array->Get(ii)->IsArray()) {
+			*errp = "distribution entry must be an array";
+			return (false);
+		}
+
+		entry = Local<Array>::Cast(array->Get(ii));
+		if (!entry->Get(0)->IsArray()) {
+			*errp = "distribution range must be an array";
+			return (false);
+		}
+
+		range = Local<Array>::Cast(entry->Get(0));
+		if (!cd_layout->index(range->Get(0)->NumberValue(),
+		    range->Get(1)->NumberValue(), &bucket)) {
+			*errp = "distribution range doesn't match layout";
+			return (false);
+		}
+
+		add(bucket, entry->Get(1)->NumberValue());
+	}
+
+	return (true);
+}
+
+Local<Array>
+caDist::tojs() const
+{
+	HandleScope scope;
+	vector<ca_bucket_t> entries;
+	Local<Array> rv, entry, range;
+	double low, high;
+	size_t ii;
+
+	buckets(&entries);
+	rv = Array::New(entries.size());
+
+	for (ii = 0; ii < entries.size(); ii++) {
+		cd_layout->range(entries[ii].first, &low, &high);
+		range = Array::New(2);
+		range->Set(0, Number::New(low));
+		range->Set(1, Number::New(high));
+		entry = Array::New(2);
+		entry->Set(0, range);
+		entry->Set(1, Number::New(entries[ii].second));
+		rv->Set(ii, entry);
+	}
+
+	return (scope.Close(rv));
+}
+
+/*
+ * Encodes this distribution as the number of non-empty buckets followed by
+ * each bucket's range (see ca-stash.h) and count.
+ */
+void
+caDist::stash(caStashWriter *wp) const
+{
+	vector<ca_bucket_t> entries;
+	double low, high;
+	size_t ii;
+
+	buckets(&entries);
+	wp->putVarint(entries.size());
+
+	for (ii = 0; ii < entries.size(); ii++) {
+		cd_layout->range(entries[ii].first, &low, &high);
+		wp->putRange(low, high);
+		wp->putNumber(entries[ii].second);
+	}
+}
+
+/*
+ * Adds a distribution encoded by stash() to this one.  Like addjs(), buckets
+ * added before a failure remain added.
+ */
+bool
+caDist::unstash(caStashReader *rp)
+{
+	uint64_t nentries, ii;
+	double low, high, count;
+	uint32_t bucket;
+
+	if (!rp->getVarint(&nentries))
+		return (false);
+
+	for (ii = 0; ii < nentries; ii++) {
+		if (!rp->getRange(&low, &high) || !rp->getNumber(&count) ||
+		    !cd_layout->index(low, high, &bucket))
+			return (false);
+
+		add(bucket, count);
+	}
+
+	return (true);
+}
+
+static bool
+ca_prefix_lt(const std::pair<int64_t, caDist *> &lhs, int64_t index)
+{
+	return (lhs.first < index);
+}
+
+caDistPrefix::caDistPrefix(caDistLayout *layout) :
+    dp_base(new caDist(layout))
+{
+}
+
+caDistPrefix::~caDistPrefix()
+{
+	expire(INT64_MAX);
+	delete (dp_base);
+}
+
+/*
+ * Returns the running total for all data before "index".
+ */
+const caDist *
+caDistPrefix::before(int64_t index) const
+{
+	std::deque<entry_t>::const_iterator it;
+
+	it = std::lower_bound(dp_sums.begin(), dp_sums.end(), index,
+	    ca_prefix_lt);
+
+	if (it == dp_sums.begin())
+		return (dp_base);
+
+	return ((--it)->second);
+}
+
+/*
+ * Records that "dist" was added to the data for time index "index".  Every
+ * running total from "index" onward includes it.
+ */
+void
+caDistPrefix::add(int64_t index, const caDist &dist)
+{
+	std::deque<entry_t>::iterator it;
+	entry_t entry(index, NULL);
+
+	it = std::lower_bound(dp_sums.begin(), dp_sums.end(), index,
+	    ca_prefix_lt);
+
+	if (it == dp_sums.end() || it->first != index) {
+		entry.second = new caDist(*before(index));
+		it = dp_sums.insert(it, entry);
+	}
+
+	for (; it != dp_sums.end(); it++)
+		it->second->merge(dist);
+}
+
+/*
+ * Discards running totals before time index "first".  Later totals still
+ * include the expired data, which we remember as the new base.
+ */
+void
+caDistPrefix::expire(int64_t first)
+{
+	while (!dp_sums.empty() && dp_sums.front().first < first) {
+		delete (dp_base);
+		dp_base = dp_sums.front().second;
+		dp_sums.pop_front();
+	}
+}
+
+/*
+ * Stores into "out" the sum of the data for time indexes in [first, last).
+ */
+void
+caDistPrefix::sum(int64_t first, int64_t last, caDist *out) const
+{
+	vector<ca_bucket_t> buckets;
+	size_t ii;
+
+	out->clear();
+
+	if (last <= first)
+		return;
+
+	out->merge(*before(last));
+	before(first)->buckets(&buckets);
+
+	for (ii = 0; ii < buckets.size(); ii++)
+		out->add(buckets[ii].first, -buckets[ii].second);
+}
+
+
+class DistLayout : public node::ObjectWrap {
+public:
+	static void Initialize(Handle<Object>);
+	static Persistent<FunctionTemplate> dl_templ;
+
+	caDistLayout *layout() { return (dl_layout); }
+
+protected:
+	static Handle<Value> New(const Arguments&);
+
+private:
+	DistLayout(caDistLayout *layout) : dl_layout(layout) {}
+	~DistLayout() { dl_layout->rele(); }
+
+	caDistLayout *dl_layout;
+};
+
+Persistent<FunctionTemplate> DistLayout::dl_templ;
+
+void
+DistLayout::Initialize(Handle<Object> target)
+{
+	HandleScope scope;
+	Local<FunctionTemplate> templ = FunctionTemplate::New(DistLayout::New);
+
+	dl_templ = Persistent<FunctionTemplate>::New(templ);
+	dl_templ->InstanceTemplate()->SetInternalFieldCount(1);
+	dl_templ->SetClassName(String::NewSymbol("DistLayout"));
+
+	target->Set(String::NewSymbol("DistLayout"), dl_templ->GetFunction());
+}
+
+Handle<Value>
+DistLayout::New(const Arguments& args)
+{
+	HandleScope scope;
+	Local<Object> params;
+	caDistLayout *layout;
+	double step, base;
+	int min, max, nbuckets;
+
+	if (args.Length() < 1 || !args[0]->IsObject())
+		return (ca_throw("expected layout parameters"));
+
+	params = args[0]->ToObject();
+	String::Utf8Value type(params->Get(String::New("type")));
+
+	if (strcmp(*type, "linear") == 0) {
+		step = params->Get(String::New("step"))->NumberValue();
+		if (!(step > 0))
+			return (ca_throw("\"step\" must be positive"));
+
+		layout = caDistLayout::linear(step);
+	} else if (strcmp(*type, "loglinear") == 0) {
+		base = params->Get(String::New("base"))->NumberValue();
+		min = params->Get(String::New("min"))->Int32Value();
+		max = params->Get(String::New("max"))->Int32Value();
+		nbuckets = params->Get(String::New("nbuckets"))->Int32Value();
+
+		if (!(base > 1) || min < 0 || nbuckets < 1)
+			return (ca_throw("invalid loglinear parameters"));
+
+		layout = caDistLayout::loglinear(base, min, max, nbuckets);
+	} else if (strcmp(*type, "ranges") == 0) {
+		layout = caDistLayout::ranges();
+	} else {
+		return (ca_throw("unsupported layout type"));
+	}
+
+	(new DistLayout(layout))->Wrap(args.Holder());
+	return (args.This());
+}
+
+/*
+ * Returns the layout for the given DistLayout object, or NULL if "value" is
+ * not a DistLayout.
+ */
+caDistLayout *
+ca_dist_layout(Handle<Value> value)
+{
+	if (!value->IsObject() || !DistLayout::dl_templ->HasInstance(value))
+		return (NULL);
+
+	return (node::ObjectWrap::Unwrap<DistLayout>(
+	    value->ToObject())->layout());
+}
+
+
+class Distribution : public node::ObjectWrap {
+public:
+	static void Initialize(Handle<Object>);
+	static Persistent<FunctionTemplate> di_templ;
+
+	caDist *dist() { return (&di_dist); }
+
+protected:
+	static Handle<Value> New(const Arguments&);
+	static Handle<Value> Add(const Arguments&);
+	static Handle<Value> Insert(const Arguments&);
+	static Handle<Value> Merge(const Arguments&);
+	static Handle<Value> ToArray(const Arguments&);
+	static Handle<Value> Total(const Arguments&);
+
+private:
+	Distribution(caDistLayout *layout) : di_dist(layout) {}
+
+	caDist di_dist;
+};
+
+Persistent<FunctionTemplate> Distribution::di_templ;
+
+void
+Distribution::Initialize(Handle<Object> target)
+{
+	HandleScope scope;
+	Local<FunctionTemplate> templ =
+	    FunctionTemplate::New(Distribution::New);
+
+	di_templ = Persistent<FunctionTemplate>::New(templ);
+	di_templ->InstanceTemplate()->SetInternalFieldCount(1);
+	di_templ->SetClassName(String::NewSymbol("Distribution"));
+
+	NODE_SET_PROTOTYPE_METHOD(di_templ, "add", Distribution::Add);
+	NODE_SET_PROTOTYPE_METHOD(di_templ, "insert", Distribution::Insert);
+	NODE_SET_PROTOTYPE_METHOD(di_templ, "merge", Distribution::Merge);
+	NODE_SET_PROTOTYPE_METHOD(di_templ, "toArray", Distribution::ToArray);
+	NODE_SET_PROTOTYPE_METHOD(di_templ, "total", Distribution::Total);
+
+	target->Set(String::NewSymbol("Distribution"),
+	    di_templ->GetFunction());
+}
+
+Handle<Value>
+Distribution::New(const Arguments& args)
+{
+	HandleScope scope;
+	caDistLayout *layout;
+
+	if (args.Length() > 0 && !args[0]->IsUndefined()) {
+		if ((layout = ca_dist_layout(args[0])) == NULL)
+			return (ca_throw("expected DistLayout"));
+
+		layout->hold();
+	} else {
+		layout = caDistLayout::ranges();
+	}
+
+	(new Distribution(layout))->Wrap(args.Holder());
+	layout->rele();
+	return (args.This());
+}
+
+Handle<Value>
+Distribution::Add(const Arguments& args)
+{
+	HandleScope scope;
+	Distribution *dp = ObjectWrap::Unwrap<Distribution>(args.Holder());
+	const char *err;
+
+	if (!dp->di_dist.addjs(args[0], &err))
+		return (ca_throw(err));
+
+	return (Undefined());
+}
+
+Handle<Value>
+Distribution::Insert(const Arguments& args)
+{
+	HandleScope scope;
+	Distribution *dp = ObjectWrap::Unwrap<Distribution>(args.Holder());
+	uint32_t bucket;
+	double count;
+
+	if (args.Length() < 1 || !args[0]->IsNumber())
+		return (ca_throw("expected value"));
+
+	count = args.Length() > 1 ? args[1]->NumberValue() : 1;
+
+	if (!dp->di_dist.layout()->bucket(args[0]->NumberValue(), &bucket))
+		return (ca_throw("value not supported by layout"));
+
+	dp->di_dist.add(bucket, count);
+	return (Undefined());
+}
+
+Handle<Value>
+Distribution::Merge(const Arguments& args)
+{
+	HandleScope scope;
+	Distribution *dp = ObjectWrap::Unwrap<Distribution>(args.Holder());
+	caDist *rhs;
+
+	if ((rhs = ca_dist_unwrap(args[0])) == NULL)
+		return (ca_throw("expected Distribution"));
+
+	if (rhs->layout() != dp->di_dist.layout())
+		return (ca_throw("distributions have different layouts"));
+
+	dp->di_dist.merge(*rhs);
+	return (Undefined());
+}
+
+Handle<Value>
+Distribution::ToArray(const Arguments& args)
+{
+	HandleScope scope;
+	Distribution *dp = ObjectWrap::Unwrap<Distribution>(args.Holder());
+
+	return (scope.Close(dp->di_dist.tojs()));
+}
+
+Handle<Value>
+Distribution::Total(const Arguments& args)
+{
+	HandleScope scope;
+	Distribution *dp = ObjectWrap::Unwrap<Distribution>(args.Holder());
+
+	return (scope.Close(Number::New(dp->di_dist.total())));
+}
+
+/*
+ * Returns the distribution for the given Distribution object, or NULL if
+ * "value" is not a Distribution.
+ */
+caDist *
+ca_dist_unwrap(Handle<Value> value)
+{
+	if (!value->IsObject() || !Distribution::di_templ->HasInstance(value))
+		return (NULL);
+
+	return (node::ObjectWrap::Unwrap<Distribution>(
+	    value->ToObject())->dist());
+}
+
+void
+ca_dist_init(Handle<Object> target)
+{
+	DistLayout::Initialize(target);
+	Distribution::Initialize(target);
+}
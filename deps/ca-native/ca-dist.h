@@ -0,0 +1,187 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright (c) 2014, Joyent, Inc.
+ */
+
+/*
+ * ca-dist.h: native distributions
+ *
+ * On the wire (and in the JavaScript parts of CA), a distribution is an array
+ * of [ [ low, high ], count ] entries sorted by "low".  Natively, a caDist
+ * stores an array of counts indexed by bucket, and a caDistLayout describes
+ * which range of values corresponds to each bucket.  Layouts may be:
+ *
+ *	linear		buckets of fixed width "step", as created by
+ *			caInstrLinearBucketize()
+ *
+ *	loglinear	"nbuckets" linear buckets per power of "base", starting
+ *			at base^min, as created by caInstrLogLinearBucketize()
+ *
+ *	ranges		arbitrary ranges, assigned bucket numbers in the order
+ *			in which they're first seen.  This is used by the
+ *			aggregator, which receives distributions in the wire
+ *			format without the parameters that generated them.
+ *
+ * Finding the bucket for a value takes constant time for both linear and
+ * loglinear layouts: loglinear layouts precompute the powers of "base" and the
+ * least value whose log is at least each power, so that the estimate from log()
+ * need only be checked against a table.  bucketize() computes the buckets for
+ * a whole array of values in a loop simple enough for the compiler to
+ * vectorize in the linear case.
+ *
+ * All distributions that share a layout use the same bucket numbers, so adding
+ * two distributions is just adding two arrays of counts.  Counts are stored
+ * densely (an array with one count per bucket) when most buckets are in use and
+ * sparsely (a sorted array of (bucket, count) pairs) otherwise.
+ *
+ * Layouts are reference-counted because they're shared by many distributions,
+ * some of which may be referenced from JavaScript.
+ *
+ * Each distribution also has a version, which changes whenever its contents
+ * do.  Versions come from a single global counter, so no two distributions
+ * (including one created later at the same address) ever share a version, and
+ * a version identifies a distribution's contents for caching purposes.
+ *
+ * A caDistPrefix keeps running totals of a series of distributions by time
+ * index: for each index with data, the sum of all distributions up to and
+ * including that index.  The sum over any interval is then the difference of
+ * two running totals, which costs the same no matter how long the interval is.
+ * Data almost always arrives for the latest index or one just before it, so
+ * keeping the totals up to date is cheap, too.
+ */
+
+#ifndef _CA_DIST_H
+#define	_CA_DIST_H
+
+#include <v8.h>
+
+#include <math.h>
+#include <stdint.h>
+
+#include <deque>
+#include <map>
+#include <utility>
+#include <vector>
+
+class caStashReader;
+class caStashWriter;
+
+enum ca_dist_type {
+	CA_DIST_LINEAR,
+	CA_DIST_LOGLINEAR,
+	CA_DIST_RANGES
+};
+
+typedef std::pair<uint32_t, double> ca_bucket_t;
+
+class caDistLayout {
+public:
+	static caDistLayout *linear(double);
+	static caDistLayout *loglinear(double, int, int, int);
+	static caDistLayout *ranges();
+
+	void hold() { dl_refs++; }
+	void rele() { if (--dl_refs == 0) delete (this); }
+
+	ca_dist_type type() const { return (dl_type); }
+	bool bucket(double, uint32_t *) const;
+	bool bucketize(const double *, size_t, uint32_t *) const;
+	bool index(double, double, uint32_t *);
+	void range(uint32_t, double *, double *) const;
+	uint32_t rank(uint32_t bucket) const {
+		return (dl_type == CA_DIST_RANGES ? dl_rank[bucket] : bucket);
+	}
+
+private:
+	caDistLayout(ca_dist_type);
+	int logfloor(double) const;
+	double power(int exp) const {
+		return (exp >= 0 && (size_t)exp < dl_powers.size() ?
+		    dl_powers[exp] : pow(dl_base, exp));
+	}
+
+	ca_dist_type	dl_type;
+	uint32_t	dl_refs;
+
+	/* linear and loglinear layouts */
+	double		dl_step;
+	double		dl_base;
+	int		dl_min;
+	int		dl_max;
+	int		dl_nbuckets;
+	uint32_t	dl_perpower;	/* loglinear buckets per power */
+	double		dl_logbase;	/* log(base) */
+	std::vector<double> dl_powers;	/* base^ii */
+	std::vector<double> dl_floors;	/* least value with logfloor ii */
+
+	/* ranges layouts */
+	std::map<std::pair<double, double>, uint32_t>	dl_ids;
+	std::vector<std::pair<double, double> >		dl_ranges;
+	std::vector<uint32_t>				dl_rank;
+};
+
+class caDist {
+public:
+	caDist(caDistLayout *);
+	caDist(const caDist &);
+	~caDist();
+
+	caDistLayout *layout() const { return (cd_layout); }
+	uint64_t version() const { return (cd_version); }
+	void add(uint32_t, double);
+	void merge(const caDist &);
+	void clear();
+	bool empty() const;
+	double total() const;
+	size_t memsize() const;
+	void buckets(std::vector<ca_bucket_t> *) const;
+
+	bool addjs(v8::Handle<v8::Value>, const char **);
+	v8::Local<v8::Array> tojs() const;
+	void stash(caStashWriter *) const;
+	bool unstash(caStashReader *);
+
+private:
+	caDist &operator=(const caDist &);
+	void densify();
+	void maybeDensify();
+	void touch() { cd_version = ++cd_generation; }
+
+	static uint64_t			cd_generation;
+
+	caDistLayout			*cd_layout;
+	uint64_t			cd_version;
+	bool				cd_dense;
+	std::vector<double>		cd_counts;	/* dense counts */
+	std::vector<ca_bucket_t>	cd_sparse;	/* sparse counts */
+};
+
+class caDistPrefix {
+public:
+	caDistPrefix(caDistLayout *);
+	~caDistPrefix();
+
+	void add(int64_t, const caDist &);
+	void expire(int64_t);
+	void sum(int64_t, int64_t, caDist *) const;
+
+private:
+	typedef std::pair<int64_t, caDist *> entry_t;
+
+	caDistPrefix(const caDistPrefix &);
+	caDistPrefix &operator=(const caDistPrefix &);
+	const caDist *before(int64_t) const;
+
+	caDist			*dp_base;	/* total of expired data */
+	std::deque<entry_t>	dp_sums;	/* sorted by index */
+};
+
+extern caDistLayout *ca_dist_layout(v8::Handle<v8::Value>);
+extern caDist *ca_dist_unwrap(v8::Handle<v8::Value>);
+
+#endif	/* _CA_DIST_H */
@@ -0,0 +1,874 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright (c) 2014, Joyent, Inc.
+ */
+
+/*
+ * ca-heatmap.cc: native storage for decomposed heatmap data
+ *
+ * A HeatmapDecomp stores data for heatmap instrumentations with an additional
+ * discrete decomposition: for each time index, a distribution for each key.
+ * Decompositions by fields like remote address or executable name can have
+ * tens of thousands of keys, so rather than nested JavaScript objects we keep:
+ *
+ *	keys		a table interning each key as a small integer id
+ *
+ *	bykey		for each key id, the key's distributions sorted by time
+ *			index.  Since data almost always arrives in time order,
+ *			adding and expiring entries happens at the ends.
+ *
+ *	ring		a caTimeRing with a slot for each time index holding
+ *			the sum of all keys' distributions at that time and a
+ *			bitset of the key ids present at that time.
+ *
+ *	prefix		running totals of the sum over all keys (see
+ *			caDistPrefix in ca-dist.h), so that the total over
+ *			any interval can be computed in constant time.
+ *
+ * All distributions share one "ranges" layout (see ca-dist.h), so summing them
+ * is just adding arrays of counts.  The JavaScript interface is:
+ *
+ *	new HeatmapDecomp(granularity, nslots)
+ *
+ *	add(time, datum)		Adds "datum", an object mapping keys to
+ *					distributions, to the data for "time"
+ *
+ *	value(start, duration)		Returns an object mapping each key
+ *					present in the given interval to the sum
+ *					of its distributions over the interval
+ *
+ *	keys(start, duration)		Returns the keys present in the interval
+ *
+ *	byKey(key[, start, duration])	Returns an object mapping each time in
+ *					the given interval (or all time) for
+ *					which "key" has data to its distribution
+ *
+ *	total([start, duration])	Like byKey(), but for the sum over all
+ *					keys
+ *
+ *	totalValue(start, duration)	Returns the sum over all keys and all
+ *					times in the interval
+ *
+ *	expire(exptime)			Removes data for times before exptime
+ *
+ *	render(conf, selected)		Renders a heatmap of the total and the
+ *					keys in "selected" (see ca-render.h)
+ *
+ *	renderAsync(conf, selected,	Like render(), but finishes rendering
+ *	    options, callback)		and encodes the image as a base64 PNG
+ *					(see ca-png.cc for "options") on the
+ *					thread pool, then invokes "callback"
+ *					with an error or the image
+ *
+ *	renderStats()			Returns statistics about the cache of
+ *					bucketized heatmap columns
+ */
+
+#include <v8.h>
+#include <node.h>
+
+#include <algorithm>
+#include <deque>
+
+#include "ca-native.h"
+#include "ca-dist.h"
+#include "ca-ingest.h"
+#include "ca-render.h"
+#include "ca-ring.h"
+#include "ca-stash.h"
+
+using namespace v8;
+using std::string;
+using std::vector;
+
+struct ca_hd_slot {
+	ca_hd_slot() : hds_total(NULL) {}
+
+	void swap(ca_hd_slot &other) {
+		std::swap(hds_total, other.hds_total);
+		hds_present.swap(other.hds_present);
+	}
+
+	caDist			*hds_total;	/* sum over all keys */
+	vector<uint32_t>	hds_present;	/* bitset of key ids */
+};
+
+typedef std::pair<int64_t, caDist *> ca_hd_entry_t;
+typedef std::deque<ca_hd_entry_t> ca_hd_entries_t;
+
+static bool
+ca_hd_entry_lt(const ca_hd_entry_t &lhs, const ca_hd_entry_t &rhs)
+{
+	return (lhs.first < rhs.first);
+}
+
+class HeatmapDecomp : public node::ObjectWrap, public caIngestTarget,
+    public caStashable {
+public:
+	static void Initialize(Handle<Object>);
+	static Persistent<FunctionTemplate> hd_templ;
+
+	bool ingest(int64_t, const caIngestDatum &);
+	ca_stash_kind stashKind(double *) const;
+	void stashSlot(caStashWriter *, int64_t);
+	bool unstashSlot(caStashReader *, int64_t);
+
+protected:
+	static Handle<Value> New(const Arguments&);
+	static Handle<Value> Add(const Arguments&);
+	static Handle<Value> Sum(const Arguments&);
+	static Handle<Value> Keys(const Arguments&);
+	static Handle<Value> ByKey(const Arguments&);
+	static Handle<Value> Total(const Arguments&);
+	static Handle<Value> TotalValue(const Arguments&);
+	static Handle<Value> Expire(const Arguments&);
+	static Handle<Value> Render(const Arguments&);
+	static Handle<Value> RenderAsync(const Arguments&);
+	static Handle<Value> RenderStats(const Arguments&);
+
+private:
+	HeatmapDecomp(int64_t, size_t);
+	~HeatmapDecomp();
+
+	bool interval(const Arguments&, int, int64_t *, int64_t *);
+	caDist *entry(uint32_t, int64_t);
+	ca_hd_slot *claim(int64_t);
+	void addKey(ca_hd_slot *, int64_t, const string &, const caDist &);
+	void present(int64_t, int64_t, vector<uint32_t> *);
+	void columns(const caHeatmapConf &, Handle<Value>,
+	    vector<ca_columns_t> *);
+	void expire(int64_t);
+
+	int64_t			hd_granularity;
+	caDistLayout		*hd_layout;
+	caInternTable		hd_keys;
+	vector<ca_hd_entries_t>	hd_bykey;	/* indexed by key id */
+	caTimeRing<ca_hd_slot>	hd_ring;
+	caDist			hd_scratch;	/* used to parse input */
+	caDistPrefix		hd_prefix;
+	caHeatmapCache		hd_cache;	/* for render() */
+};
+
+Persistent<FunctionTemplate> HeatmapDecomp::hd_templ;
+
+HeatmapDecomp::HeatmapDecomp(int64_t granularity, size_t nslots) :
+    node::ObjectWrap(), hd_granularity(granularity),
+    hd_layout(caDistLayout::ranges()), hd_ring(nslots),
+    hd_scratch(hd_layout), hd_prefix(hd_layout)
+{
+	/* hd_scratch holds the only reference we need. */
+	hd_layout->rele();
+}
+
+HeatmapDecomp::~HeatmapDecomp()
+{
+	expire(INT64_MAX);
+}
+
+/*
+ * Reads the optional interval starting at args[argn] as the range of time
+ * indexes [*firstp, *lastp).  Without an interval, this returns all time.
+ */
+bool
+HeatmapDecomp::interval(const Arguments& args, int argn, int64_t *firstp,
+    int64_t *lastp)
+{
+	int64_t start, duration;
+
+	if (args.Length() < argn + 2 || args[argn]->IsUndefined()) {
+		*firstp = 0;
+		*lastp = INT64_MAX;
+		return (true);
+	}
+
+	if ((!args[argn]->IsNumber() && !args[argn]->IsString()) ||
+	    !args[argn + 1]->IsNumber())
+		return (false);
+
+	start = args[argn]->IntegerValue();
+	duration = args[argn + 1]->IntegerValue();
+	*firstp = start / hd_granularity;
+	*lastp = (start + duration + hd_granularity - 1) / hd_granularity;
+	return (true);
+}
+
+/*
+ * Returns the distribution for key "id" at time index "index", creating it if
+ * necessary.
+ */
+caDist *
+HeatmapDecomp::entry(uint32_t id, int64_t index)
+{
+	ca_hd_entries_t &entries = hd_bykey[id];
+	ca_hd_entries_t::iterator it;
+	ca_hd_entry_t ent(index, NULL);
+
+	if (!entries.empty() && entries.back().first == index)
+		return (entries.back().second);
+
+	if (entries.empty())
+		hd_keys.hold(id);
+
+	ent.second = new caDist(hd_layout);
+
+	if (entries.empty() || entries.back().first < index) {
+		entries.push_back(ent);
+		return (ent.second);
+	}
+
+	it = std::lower_bound(entries.begin(), entries.end(), ent,
+	    ca_hd_entry_lt);
+
+	if (it != entries.end() && it->first == index) {
+		delete (ent.second);
+		return (it->second);
+	}
+
+	entries.insert(it, ent);
+	return (ent.second);
+}
+
+/*
+ * Returns the slot for time index "index", first expiring whatever data is too
+ * old to be kept alongside it, or NULL if the ring refuses the index (see
+ * ca-ring.h).  Data for refused indexes is dropped.
+ */
+ca_hd_slot *
+HeatmapDecomp::claim(int64_t index)
+{
+	if (!hd_ring.admits(index))
+		return (NULL);
+
+	if (hd_ring.evicts(index))
+		expire(hd_ring.horizon(index));
+
+	return (hd_ring.claim(index));
+}
+
+/*
+ * Stores into "ids" the ids of keys present at any time index in [first, last).
+ */
+void
+HeatmapDecomp::present(int64_t first, int64_t last, vector<uint32_t> *ids)
+{
+	vector<ca_hd_slot *> slots;
+	vector<uint32_t> bits;
+	size_t ii, jj;
+	uint32_t word;
+
+	hd_ring.slots(first, last, &slots);
+
+	for (ii = 0; ii < slots.size(); ii++) {
+		const vector<uint32_t> &bitset = slots[ii]->hds_present;
+
+		if (bits.size() < bitset.size())
+			bits.resize(bitset.size());
+
+		for (jj = 0; jj < bitset.size(); jj++)
+			bits[jj] |= bitset[jj];
+	}
+
+	ids->clear();
+
+	for (ii = 0; ii < bits.size(); ii++) {
+		for (word = bits[ii]; word != 0; word &= word - 1)
+			ids->push_back(ii * 32 + __builtin_ctz(word));
+	}
+}
+
+/*
+ * Removes data for all time indexes before "first".  The keys to expire are
+ * exactly those present in the expired slots, and each key's entries are sorted
+ * by time, so the cost is proportional to the amount of data removed.
+ */
+void
+HeatmapDecomp::expire(int64_t first)
+{
+	vector<ca_hd_slot> expired;
+	size_t ii, jj;
+	uint32_t word, id;
+
+	hd_ring.expire(first, &expired);
+
+	for (ii = 0; ii < expired.size(); ii++) {
+		const vector<uint32_t> &bitset = expired[ii].hds_present;
+
+		for (jj = 0; jj < bitset.size(); jj++) {
+			for (word = bitset[jj]; word != 0;
+			    word &= word - 1) {
+				id = jj * 32 + __builtin_ctz(word);
+				ca_hd_entries_t &entries = hd_bykey[id];
+
+				/* Already expired via an earlier slot. */
+				if (entries.empty())
+					continue;
+
+				while (!entries.empty() &&
+				    entries.front().first < first) {
+					delete (entries.front().second);
+					entries.pop_front();
+				}
+
+				if (entries.empty()) {
+					ca_hd_entries_t().swap(entries);
+					hd_keys.release(id);
+				}
+			}
+		}
+
+		delete (expired[ii].hds_total);
+	}
+
+	hd_prefix.expire(first);
+}
+
+void
+HeatmapDecomp::Initialize(Handle<Object> target)
+{
+	HandleScope scope;
+	Local<FunctionTemplate> templ =
+	    FunctionTemplate::New(HeatmapDecomp::New);
+
+	hd_templ = Persistent<FunctionTemplate>::New(templ);
+	hd_templ->InstanceTemplate()->SetInternalFieldCount(1);
+	hd_templ->SetClassName(String::NewSymbol("HeatmapDecomp"));
+
+	NODE_SET_PROTOTYPE_METHOD(hd_templ, "add", HeatmapDecomp::Add);
+	NODE_SET_PROTOTYPE_METHOD(hd_templ, "value", HeatmapDecomp::Sum);
+	NODE_SET_PROTOTYPE_METHOD(hd_templ, "keys", HeatmapDecomp::Keys);
+	NODE_SET_PROTOTYPE_METHOD(hd_templ, "byKey", HeatmapDecomp::ByKey);
+	NODE_SET_PROTOTYPE_METHOD(hd_templ, "total", HeatmapDecomp::Total);
+	NODE_SET_PROTOTYPE_METHOD(hd_templ, "totalValue",
+	    HeatmapDecomp::TotalValue);
+	NODE_SET_PROTOTYPE_METHOD(hd_templ, "expire", HeatmapDecomp::Expire);
+	NODE_SET_PROTOTYPE_METHOD(hd_templ, "render", HeatmapDecomp::Render);
+	NODE_SET_PROTOTYPE_METHOD(hd_templ, "renderAsync",
+	    HeatmapDecomp::RenderAsync);
+	NODE_SET_PROTOTYPE_METHOD(hd_templ, "renderStats",
+	    HeatmapDecomp::RenderStats);
+
+	target->Set(String::NewSymbol("HeatmapDecomp"),
+	    hd_templ->GetFunction());
+}
+
+Handle<Value>
+HeatmapDecomp::New(const Arguments& args)
+{
+	HandleScope scope;
+	HeatmapDecomp *hd;
+
+	if (args.Length() < 2 || !args[0]->IsNumber() || !args[1]->IsNumber())
+		return (ca_throw("expected granularity and nslots"));
+
+	if (args[0]->IntegerValue() < 1)
+		return (ca_throw("granularity must be positive"));
+
+	if (args[1]->IntegerValue() < 1)
+		return (ca_throw("nslots must be positive"));
+
+	hd = new HeatmapDecomp(args[0]->IntegerValue(),
+	    (size_t)args[1]->IntegerValue());
+	hd->Wrap(args.Holder());
+	return (args.This());
+}
+
+Handle<Value>
+HeatmapDecomp::Add(const Arguments& args)
+{
+	HandleScope scope;
+	HeatmapDecomp *hd = ObjectWrap::Unwrap<HeatmapDecomp>(args.Holder());
+	Local<Object> datum;
+	Local<Array> keys;
+	Local<Value> key;
+	ca_hd_slot *sp;
+	int64_t time, index;
+	uint32_t ii;
+	const char *err;
+
+	if (args.Length() < 1 ||
+	    (!args[0]->IsNumber() && !args[0]->IsString()))
+		return (ca_throw("expected time"));
+
+	if ((time = args[0]->IntegerValue()) < 0)
+		return (ca_throw("time must be non-negative"));
+
+	if (args.Length() < 2 || args[1]->IsUndefined())
+		return (Undefined());
+
+	if (!args[1]->IsObject())
+		return (ca_throw("expected decomposition object"));
+
+	caDist delta(hd->hd_layout);
+
+	index = time / hd->hd_granularity;
+	datum = args[1]->ToObject();
+	keys = datum->GetPropertyNames();
+	if ((sp = hd->claim(index)) == NULL)
+		return (Undefined());
+
+	if (sp->hds_total == NULL)
+		sp->hds_total = new caDist(hd->hd_layout);
+
+	for (ii = 0; ii < keys->Length(); ii++) {
+		key = keys->Get(ii);
+		hd->hd_scratch.clear();
+
+		if (!hd->hd_scratch.addjs(datum->Get(key), &err)) {
+			/* Keys added so far remain added. */
+			hd->hd_prefix.add(index, delta);
+			return (ca_throw(err));
+		}
+
+		String::Utf8Value name(key);
+		hd->addKey(sp, index, string(*name, name.length()),
+		    hd->hd_scratch);
+		delta.merge(hd->hd_scratch);
+	}
+
+	hd->hd_prefix.add(index, delta);
+	return (Undefined());
+}
+
+/*
+ * Adds "dist" to the data for key "name" at time index "index", whose slot is
+ * "sp".  The caller is responsible for updating hd_prefix.
+ */
+void
+HeatmapDecomp::addKey(ca_hd_slot *sp, int64_t index, const string &name,
+    const caDist &dist)
+{
+	uint32_t id;
+
+	id = hd_keys.intern(name);
+
+	if (id >= hd_bykey.size())
+		hd_bykey.resize(id + 1);
+
+	if (id / 32 >= sp->hds_present.size())
+		sp->hds_present.resize(id / 32 + 1);
+
+	sp->hds_present[id / 32] |= 1U << (id % 32);
+	entry(id, index)->merge(dist);
+	sp->hds_total->merge(dist);
+}
+
+/*
+ * Adds a value parsed by an Ingest (see ca-ingest.h).  Each key's entries are
+ * contiguous in the datum.  hd_layout is a "ranges" layout, which accepts any
+ * range, so nothing can fail once we've checked the datum's kind.
+ */
+bool
+HeatmapDecomp::ingest(int64_t time, const caIngestDatum &datum)
+{
+	int64_t index = time / hd_granularity;
+	caDist delta(hd_layout);
+	ca_hd_slot *sp;
+	uint32_t bucket;
+	size_t kk, ii;
+
+	if (datum.id_kind != CA_IN_DECOMP_DIST &&
+	    (datum.id_kind != CA_IN_DECOMP || datum.id_nkeys != 0))
+		return (false);
+
+	if ((sp = claim(index)) == NULL)
+		return (true);
+
+	if (sp->hds_total == NULL)
+		sp->hds_total = new caDist(hd_layout);
+
+	for (kk = 0, ii = 0; kk < datum.id_nkeys; kk++) {
+		hd_scratch.clear();
+
+		for (; ii < datum.id_entries.size() &&
+		    datum.id_entries[ii].ie_key == kk; ii++) {
+			const ca_ingest_entry &entry = datum.id_entries[ii];
+
+			(void) hd_layout->index(entry.ie_low, entry.ie_high,
+			    &bucket);
+			hd_scratch.add(bucket, entry.ie_value);
+		}
+
+		addKey(sp, index, datum.id_keys[kk], hd_scratch);
+		delta.merge(hd_scratch);
+	}
+
+	hd_prefix.add(index, delta);
+	return (true);
+}
+
+caIngestTarget *
+ca_heatmap_target(Handle<Value> value)
+{
+	if (!value->IsObject() || !HeatmapDecomp::hd_templ->HasInstance(value))
+		return (NULL);
+
+	return (node::ObjectWrap::Unwrap<HeatmapDecomp>(value->ToObject()));
+}
+
+ca_stash_kind
+HeatmapDecomp::stashKind(double *paramp) const
+{
+	*paramp = 0;
+	return (CA_ST_HEATMAP);
+}
+
+/*
+ * Encodes the data for "time" for a stash (see ca-stash.h) as the number of
+ * keys present followed by each key and its distribution.  The total is just
+ * the sum of these, so it's recomputed when the data is loaded.
+ */
+void
+HeatmapDecomp::stashSlot(caStashWriter *wp, int64_t time)
+{
+	int64_t index = time / hd_granularity;
+	ca_hd_entries_t::iterator it;
+	vector<uint32_t> ids;
+	size_t ii;
+
+	present(index, index + 1, &ids);
+	wp->putVarint(ids.size());
+
+	for (ii = 0; ii < ids.size(); ii++) {
+		ca_hd_entries_t &entries = hd_bykey[ids[ii]];
+
+		/* Each key present at this index has an entry for it. */
+		it = std::lower_bound(entries.begin(), entries.end(),
+		    ca_hd_entry_t(index, NULL), ca_hd_entry_lt);
+
+		wp->putString(hd_keys.name(ids[ii]));
+		it->second->stash(wp);
+	}
+}
+
+/*
+ * Adds data encoded by stashSlot() to the data for "time".
+ */
+bool
+HeatmapDecomp::unstashSlot(caStashReader *rp, int64_t time)
+{
+	int64_t index = time / hd_granularity;
+	caDist delta(hd_layout);
+	const string *name;
+	uint64_t nkeys, ii;
+	ca_hd_slot *sp;
+	bool ok = true;
+
+	if (!rp->getVarint(&nkeys))
+		return (false);
+
+	if ((sp = claim(index)) == NULL) {
+		/* Skip over data we won't keep. */
+		for (ii = 0; ii < nkeys; ii++) {
+			if (!rp->getString(&name) || !hd_scratch.unstash(rp))
+				return (false);
+		}
+
+		return (true);
+	}
+
+	if (sp->hds_total == NULL)
+		sp->hds_total = new caDist(hd_layout);
+
+	for (ii = 0; ii < nkeys; ii++) {
+		hd_scratch.clear();
+
+		if (!rp->getString(&name) || !hd_scratch.unstash(rp)) {
+			ok = false;
+			break;
+		}
+
+		addKey(sp, index, *name, hd_scratch);
+		delta.merge(hd_scratch);
+	}
+
+	hd_prefix.add(index, delta);
+	return (ok);
+}
+
+caStashable *
+ca_heatmap_stashable(Handle<Value> value)
+{
+	if (!value->IsObject() || !HeatmapDecomp::hd_templ->HasInstance(value))
+		return (NULL);
+
+	return (node::ObjectWrap::Unwrap<HeatmapDecomp>(value->ToObject()));
+}
+
+Handle<Value>
+HeatmapDecomp::Sum(const Arguments& args)
+{
+	HandleScope scope;
+	HeatmapDecomp *hd = ObjectWrap::Unwrap<HeatmapDecomp>(args.Holder());
+	ca_hd_entries_t::iterator it;
+	vector<uint32_t> ids;
+	int64_t first, last;
+	Local<Object> rv;
+	size_t ii;
+
+	if (args.Length() < 2 || !hd->interval(args, 0, &first, &last))
+		return (ca_throw("expected start and duration"));
+
+	hd->present(first, last, &ids);
+	rv = Object::New();
+
+	for (ii = 0; ii < ids.size(); ii++) {
+		ca_hd_entries_t &entries = hd->hd_bykey[ids[ii]];
+		const string &name = hd->hd_keys.name(ids[ii]);
+		caDist sum(hd->hd_layout);
+
+		it = std::lower_bound(entries.begin(), entries.end(),
+		    ca_hd_entry_t(first, NULL), ca_hd_entry_lt);
+
+		for (; it != entries.end() && it->first < last; it++)
+			sum.merge(*it->second);
+
+		rv->Set(String::New(name.c_str(), name.size()), sum.tojs());
+	}
+
+	return (scope.Close(rv));
+}
+
+Handle<Value>
+HeatmapDecomp::Keys(const Arguments& args)
+{
+	HandleScope scope;
+	HeatmapDecomp *hd = ObjectWrap::Unwrap<HeatmapDecomp>(args.Holder());
+	vector<uint32_t> ids;
+	int64_t first, last;
+	Local<Array> rv;
+	size_t ii;
+
+	if (args.Length() < 2 || !hd->interval(args, 0, &first, &last))
+		return (ca_throw("expected start and duration"));
+
+	hd->present(first, last, &ids);
+	rv = Array::New(ids.size());
+
+	for (ii = 0; ii < ids.size(); ii++) {
+		const string &name = hd->hd_keys.name(ids[ii]);
+		rv->Set(ii, String::New(name.c_str(), name.size()));
+	}
+
+	return (scope.Close(rv));
+}
+
+Handle<Value>
+HeatmapDecomp::ByKey(const Arguments& args)
+{
+	HandleScope scope;
+	HeatmapDecomp *hd = ObjectWrap::Unwrap<HeatmapDecomp>(args.Holder());
+	ca_hd_entries_t::iterator it;
+	int64_t first, last;
+	Local<Object> rv;
+	uint32_t id;
+
+	if (args.Length() < 1)
+		return (ca_throw("expected key"));
+
+	if (!hd->interval(args, 1, &first, &last))
+		return (ca_throw("expected start and duration"));
+
+	String::Utf8Value name(args[0]);
+	rv = Object::New();
+
+	if (!hd->hd_keys.lookup(string(*name, name.length()), &id))
+		return (scope.Close(rv));
+
+	ca_hd_entries_t &entries = hd->hd_bykey[id];
+	it = std::lower_bound(entries.begin(), entries.end(),
+	    ca_hd_entry_t(first, NULL), ca_hd_entry_lt);
+
+	for (; it != entries.end() && it->first < last; it++)
+		rv->Set(Number::New((double)(it->first * hd->hd_granularity)),
+		    it->second->tojs());
+
+	return (scope.Close(rv));
+}
+
+Handle<Value>
+HeatmapDecomp::Total(const Arguments& args)
+{
+	HandleScope scope;
+	HeatmapDecomp *hd = ObjectWrap::Unwrap<HeatmapDecomp>(args.Holder());
+	vector<ca_hd_slot *> slots;
+	int64_t first, last;
+	Local<Object> rv;
+	size_t ii;
+
+	if (!hd->interval(args, 0, &first, &last))
+		return (ca_throw("expected start and duration"));
+
+	hd->hd_ring.slots(first, last, &slots);
+	rv = Object::New();
+
+	for (ii = 0; ii < slots.size(); ii++) {
+		rv->Set(Number::New((double)(hd->hd_ring.index(slots[ii]) *
+		    hd->hd_granularity)), slots[ii]->hds_total->tojs());
+	}
+
+	return (scope.Close(rv));
+}
+
+Handle<Value>
+HeatmapDecomp::TotalValue(const Arguments& args)
+{
+	HandleScope scope;
+	HeatmapDecomp *hd = ObjectWrap::Unwrap<HeatmapDecomp>(args.Holder());
+	caDist sum(hd->hd_layout);
+	int64_t first, last;
+
+	if (args.Length() < 2 || !hd->interval(args, 0, &first, &last))
+		return (ca_throw("expected start and duration"));
+
+	hd->hd_prefix.sum(first, last, &sum);
+	return (scope.Close(sum.tojs()));
+}
+
+Handle<Value>
+HeatmapDecomp::Expire(const Arguments& args)
+{
+	HandleScope scope;
+	HeatmapDecomp *hd = ObjectWrap::Unwrap<HeatmapDecomp>(args.Holder());
+	int64_t exptime;
+
+	if (args.Length() < 1 || !args[0]->IsNumber())
+		return (ca_throw("expected expiration time"));
+
+	exptime = args[0]->IntegerValue();
+	if (exptime <= 0)
+		return (Undefined());
+
+	hd->expire((exptime + hd->hd_granularity - 1) / hd->hd_granularity);
+	return (Undefined());
+}
+
+/*
+ * Returns the time index corresponding to heatmap column time "time", or -1 if
+ * there can be no data for that time.
+ */
+static int64_t
+ca_hd_column_index(double time, int64_t granularity)
+{
+	int64_t itime = (int64_t)time;
+
+	if (itime != time || itime < 0 || itime % granularity != 0)
+		return (-1);
+
+	return (itime / granularity);
+}
+
+/*
+ * Collects the distributions for each column of the heatmap described by
+ * "conf": first the total, then each key in "selected".
+ */
+void
+HeatmapDecomp::columns(const caHeatmapConf &conf, Handle<Value> arg,
+    vector<ca_columns_t> *sources)
+{
+	ca_hd_entries_t::iterator it;
+	Local<Array> selected;
+	ca_hd_slot *sp;
+	int64_t index;
+	size_t ii, kk;
+	uint32_t id;
+
+	if (arg->IsArray())
+		selected = Local<Array>::Cast(arg);
+	else
+		selected = Array::New(0);
+
+	sources->resize(1 + selected->Length());
+
+	for (kk = 0; kk < sources->size(); kk++)
+		(*sources)[kk].resize(conf.hc_times.size(), NULL);
+
+	for (ii = 0; ii < conf.hc_times.size(); ii++) {
+		index = ca_hd_column_index(conf.hc_times[ii], hd_granularity);
+
+		if ((sp = hd_ring.slot(index)) != NULL)
+			(*sources)[0][ii] = sp->hds_total;
+	}
+
+	for (kk = 1; kk < sources->size(); kk++) {
+		String::Utf8Value name(selected->Get(kk - 1));
+
+		if (!hd_keys.lookup(string(*name, name.length()), &id))
+			continue;
+
+		ca_hd_entries_t &entries = hd_bykey[id];
+
+		for (ii = 0; ii < conf.hc_times.size(); ii++) {
+			index = ca_hd_column_index(conf.hc_times[ii],
+			    hd_granularity);
+
+			if (index == -1)
+				continue;
+
+			it = std::lower_bound(entries.begin(), entries.end(),
+			    ca_hd_entry_t(index, NULL), ca_hd_entry_lt);
+
+			if (it != entries.end() && it->first == index)
+				(*sources)[kk][ii] = it->second;
+		}
+	}
+}
+
+Handle<Value>
+HeatmapDecomp::Render(const Arguments& args)
+{
+	HandleScope scope;
+	HeatmapDecomp *hd = ObjectWrap::Unwrap<HeatmapDecomp>(args.Holder());
+	vector<ca_columns_t> sources;
+	caHeatmapConf conf;
+	const char *err;
+
+	if (!ca_heatmap_conf(args[0], &conf, &err))
+		return (ca_throw(err));
+
+	hd->columns(conf, args[1], &sources);
+	return (scope.Close(ca_heatmap_render(args[0], &conf, sources,
+	    &hd->hd_cache)));
+}
+
+Handle<Value>
+HeatmapDecomp::RenderAsync(const Arguments& args)
+{
+	HandleScope scope;
+	HeatmapDecomp *hd = ObjectWrap::Unwrap<HeatmapDecomp>(args.Holder());
+	vector<ca_columns_t> sources;
+	caHeatmapConf conf;
+	caPngOptions pngopts;
+	const char *err;
+
+	if (args.Length() < 4)
+		return (ca_throw("expected conf, selected, options, and "
+		    "callback"));
+
+	if (!ca_heatmap_conf(args[0], &conf, &err) ||
+	    !ca_png_options(args[2], &pngopts, &err))
+		return (ca_throw(err));
+
+	hd->columns(conf, args[1], &sources);
+	return (scope.Close(ca_heatmap_render_async(args[0], &conf, sources,
+	    &hd->hd_cache, &pngopts, args[3])));
+}
+
+Handle<Value>
+HeatmapDecomp::RenderStats(const Arguments& args)
+{
+	HandleScope scope;
+	HeatmapDecomp *hd = ObjectWrap::Unwrap<HeatmapDecomp>(args.Holder());
+
+	return (scope.Close(hd->hd_cache.stats()));
+}
+
+void
+ca_heatmap_init(Handle<Object> target)
+{
+	HeatmapDecomp::Initialize(target);
+}
@@ -0,0 +1,1138 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright (c) 2014, Joyent, Inc.
+ */
+
+/*
+ * ca-ingest.cc: native ingest of raw data messages (see ca-ingest.h)
+ *
+ * The JavaScript interface is:
+ *
+ *	new Ingest([nshards])
+ *
+ *	register(id, dataset)		Adds data for instrumentation "id" to
+ *					"dataset", a TimeSeries or HeatmapDecomp
+ *
+ *	unregister(id)			Stops adding data for "id"
+ *
+ *	ingest(bodies, maxtime)		Processes "bodies", an array of Buffers
+ *					each containing one JSON-encoded
+ *					message.  Data messages for registered
+ *					instrumentations at times (in seconds)
+ *					up to "maxtime" are added to their
+ *					datasets.  Returns an object with
+ *					"data", an array of [ id, hostname,
+ *					time ] entries (one for each distinct
+ *					combination ingested), and "rest", an
+ *					array of the bodies that were not
+ *					ingested.
+ *
+ *	ingestAsync(bodies, maxtime, callback)
+ *
+ *					Like ingest(), but parses the bodies on
+ *					the Ingest's shards (see below) and
+ *					invokes callback(result) when done
+ *
+ *	stats()				Returns counters of messages processed
+ *
+ * Most of the work of ingesting a message is parsing its JSON, which doesn't
+ * involve any JavaScript objects.  An Ingest constructed with "nshards" greater
+ * than zero runs that many worker threads (see ca-shard.h), and ingestAsync()
+ * splits each batch into chunks and parses the chunks on those threads.  Each
+ * message is only added to its datasets once the whole batch has been parsed,
+ * back on the main thread, because the datasets are also read from JavaScript
+ * and aren't safe to modify concurrently.  Batches complete in the order they
+ * were submitted, so the caller sees messages in the order they arrived.
+ * Small batches submitted while nothing else is in flight aren't worth handing
+ * off, so they're processed immediately, before ingestAsync() returns.
+ */
+
+#include <v8.h>
+#include <node.h>
+#include <node_buffer.h>
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <set>
+#include <vector>
+
+#include "ca-native.h"
+#include "ca-ingest.h"
+#include "ca-phase.h"
+#include "ca-shard.h"
+
+using namespace v8;
+using std::string;
+using std::vector;
+
+/*
+ * Maximum nesting depth of JSON values we're willing to skip over.  CA
+ * messages nest only a few levels deep.
+ */
+#define	CA_JSON_MAXDEPTH	32
+
+/*
+ * Batches are split into chunks of at least this many messages, and batches
+ * smaller than that are processed immediately when nothing else is in flight.
+ */
+#define	CA_INGEST_CHUNK_MIN	64
+
+/*
+ * Maximum number of chunks outstanding on each shard.
+ */
+#define	CA_INGEST_SHARD_DEPTH	64
+
+void
+caIngestDatum::reset(ca_ingest_kind kind)
+{
+	id_kind = kind;
+	id_scalar = 0;
+	id_nkeys = 0;
+	id_entries.clear();
+}
+
+/*
+ * Returns storage for another key, reusing strings from previous messages.
+ */
+string *
+caIngestDatum::newKey()
+{
+	if (id_nkeys == id_keys.size())
+		id_keys.push_back(string());
+
+	id_keys[id_nkeys].clear();
+	return (&id_keys[id_nkeys++]);
+}
+
+/*
+ * A caJsonCursor reads JSON values from a buffer in place.  Each method skips
+ * leading whitespace.  On malformed input, methods return false and the cursor
+ * remains failed from then on.
+ */
+class caJsonCursor {
+public:
+	caJsonCursor(const char *buf, size_t len) :
+	    jc_buf(buf), jc_len(len), jc_off(0), jc_failed(false) {}
+
+	int peek();
+	bool expect(char);
+	bool more(bool *, char);
+	bool string(std::string *);
+	bool number(double *);
+	bool skip(int depth = 0);
+	bool done() { return (peek() == -1 && !jc_failed); }
+	bool failed() const { return (jc_failed); }
+	size_t offset() const { return (jc_off); }
+	void seek(size_t off) { jc_off = off; }
+
+private:
+	bool fail() { jc_failed = true; return (false); }
+	bool literal(const char *);
+	bool hex(uint32_t *);
+	void utf8(std::string *, uint32_t);
+
+	const char	*jc_buf;
+	size_t		jc_len;
+	size_t		jc_off;
+	bool		jc_failed;
+};
+
+int
+caJsonCursor::peek()
+{
+	if (jc_failed)
+		return (-1);
+
+	while (jc_off < jc_len && (jc_buf[jc_off] == ' ' ||
+	    jc_buf[jc_off] == '\t' || jc_buf[jc_off] == '\n' ||
+	    jc_buf[jc_off] == '\r'))
+		jc_off++;
+
+	return (jc_off < jc_len ? (unsigned char)jc_buf[jc_off] : -1);
+}
+
+bool
+caJsonCursor::expect(char c)
+{
+	if (peek() != c)
+		return (fail());
+
+	jc_off++;
+	return (true);
+}
+
+/*
+ * For iterating the elements of an array or members of an object whose opening
+ * bracket has been consumed: returns true if another element follows (having
+ * consumed the separating comma) or false at the closing bracket "close"
+ * (having consumed it) or on error.  "*firstp" must be true before the first
+ * call.
+ */
+bool
+caJsonCursor::more(bool *firstp, char close)
+{
+	if (peek() == close) {
+		jc_off++;
+		return (false);
+	}
+
+	if (*firstp) {
+		*firstp = false;
+		return (!jc_failed);
+	}
+
+	return (expect(','));
+}
+
+bool
+caJsonCursor::literal(const char *word)
+{
+	size_t len = strlen(word);
+
+	if (jc_len - jc_off < len || memcmp(jc_buf + jc_off, word, len) != 0)
+		return (fail());
+
+	jc_off += len;
+	return (true);
+}
+
+bool
+caJsonCursor::hex(uint32_t *valp)
+{
+	uint32_t val = 0;
+	int ii;
+	char c;
+
+	if (jc_len - jc_off < 4)
+		return (fail());
+
+	for (ii = 0; ii < 4; ii++) {
+		c = jc_buf[jc_off++];
+		val <<= 4;
+
+		if (c >= '0' && c <= '9')
+			val |= c - '0';
+		else if (c >= 'a' && c <= 'f')
+			val |= c - 'a' + 10;
+		else if (c >= 'A' && c <= 'F')
+			val |= c - 'A' + 10;
+		else
+			return (fail());
+	}
+
+	*valp = val;
+	return (true);
+}
+
+void
+caJsonCursor::utf8(std::string *strp, uint32_t cp)
+{
+	if (cp < 0x80) {
+		*strp += (char)cp;
+	} else if (cp < 0x800) {
+		*strp += (char)(0xc0 | (cp >> 6));
+		*strp += (char)(0x80 | (cp & 0x3f));
+	} else if (cp < 0x10000) {
+		*strp += (char)(0xe0 | (cp >> 12));
+		*strp += (char)(0x80 | ((cp >> 6) & 0x3f));
+		*strp += (char)(0x80 | (cp & 0x3f));
+	} else {
+		*strp += (char)(0xf0 | (cp >> 18));
+		*strp += (char)(0x80 | ((cp >> 12) & 0x3f));
+		*strp += (char)(0x80 | ((cp >> 6) & 0x3f));
+		*strp += (char)(0x80 | (cp & 0x3f));
+	}
+}
+
+/*
+ * Reads a string into "*strp" (which may be NULL to skip it).
+ */
+bool
+caJsonCursor::string(std::string *strp)
+{
+	size_t start;
+	uint32_t cp, lo;
+	char c;
+
+	if (!expect('"'))
+		return (false);
+
+	for (;;) {
+		start = jc_off;
+
+		while (jc_off < jc_len && jc_buf[jc_off] != '"' &&
+		    jc_buf[jc_off] != '\\' &&
+		    (unsigned char)jc_buf[jc_off] >= 0x20)
+			jc_off++;
+
+		if (strp != NULL)
+			strp->append(jc_buf + start, jc_off - start);
+
+		if (jc_off == jc_len || (unsigned char)jc_buf[jc_off] < 0x20)
+			return (fail());
+
+		if (jc_buf[jc_off++] == '"')
+			return (true);
+
+		if (jc_off == jc_len)
+			return (fail());
+
+		switch (c = jc_buf[jc_off++]) {
+		case '"':
+		case '\\':
+		case '/':
+			break;
+		case 'b':
+			c = '\b';
+			break;
+		case 'f':
+			c = '\f';
+			break;
+		case 'n':
+			c = '\n';
+			break;
+		case 'r':
+			c = '\r';
+			break;
+		case 't':
+			c = '\t';
+			break;
+		case 'u':
+			if (!hex(&cp))
+				return (false);
+
+			if (cp >= 0xd800 && cp < 0xdc00 &&
+			    jc_len - jc_off >= 6 && jc_buf[jc_off] == '\\' &&
+			    jc_buf[jc_off + 1] == 'u') {
+				jc_off += 2;
+				if (!hex(&lo))
+					return (false);
+
+				if (lo >= 0xdc00 && lo < 0xe000)
+					cp = 0x10000 + ((cp - 0xd800) << 10) +
+					    (lo - 0xdc00);
+				else
+					jc_off -= 6;
+			}
+
+			if (strp != NULL)
+				utf8(strp, cp);
+			continue;
+		default:
+			return (fail());
+		}
+
+		if (strp != NULL)
+			*strp += c;
+	}
+}
+
+bool
+caJsonCursor::number(double *valp)
+{
+	char buf[64];
+	size_t start, len;
+	char *end;
+
+	(void) peek();
+	start = jc_off;
+
+	while (jc_off < jc_len && ((jc_buf[jc_off] != '\0' &&
+	    strchr("+-.eE", jc_buf[jc_off]) != NULL) ||
+	    (jc_buf[jc_off] >= '0' && jc_buf[jc_off] <= '9')))
+		jc_off++;
+
+	len = jc_off - start;
+
+	if (len == 0 || len >= sizeof (buf) || jc_buf[start] == '+')
+		return (fail());
+
+	(void) memcpy(buf, jc_buf + start, len);
+	buf[len] = '\0';
+	*valp = strtod(buf, &end);
+
+	if (end != buf + len)
+		return (fail());
+
+	return (true);
+}
+
+/*
+ * Skips over a value of any type.
+ */
+bool
+caJsonCursor::skip(int depth)
+{
+	bool first = true;
+	double num;
+	int c;
+
+	if (depth > CA_JSON_MAXDEPTH)
+		return (fail());
+
+	switch (c = peek()) {
+	case '"':
+		return (string(NULL));
+	case '[':
+		jc_off++;
+		while (more(&first, ']')) {
+			if (!skip(depth + 1))
+				return (false);
+		}
+		return (!jc_failed);
+	case '{':
+		jc_off++;
+		while (more(&first, '}')) {
+			if (!string(NULL) || !expect(':') || !skip(depth + 1))
+				return (false);
+		}
+		return (!jc_failed);
+	case 't':
+		return (literal("true"));
+	case 'f':
+		return (literal("false"));
+	case 'n':
+		return (literal("null"));
+	default:
+		return (number(&num));
+	}
+}
+
+static bool
+ca_ingest_isnumber(int c)
+{
+	return (c == '-' || (c >= '0' && c <= '9'));
+}
+
+/*
+ * Parses a distribution in the wire format, recording its entries for key
+ * "key".
+ */
+static bool
+ca_ingest_dist(caJsonCursor *jc, uint32_t key, caIngestDatum *dp)
+{
+	ca_ingest_entry entry;
+	bool first = true;
+
+	entry.ie_key = key;
+
+	if (!jc->expect('['))
+		return (false);
+
+	while (jc->more(&first, ']')) {
+		if (!jc->expect('[') || !jc->expect('[') ||
+		    !jc->number(&entry.ie_low) || !jc->expect(',') ||
+		    !jc->number(&entry.ie_high) || !jc->expect(']') ||
+		    !jc->expect(',') || !jc->number(&entry.ie_value) ||
+		    !jc->expect(']'))
+			return (false);
+
+		dp->id_entries.push_back(entry);
+	}
+
+	return (!jc->failed());
+}
+
+/*
+ * Parses a data message's value into "dp".  Returns false if it's malformed or
+ * isn't one of the forms described in ca-ingest.h.
+ */
+static bool
+ca_ingest_value(caJsonCursor *jc, caIngestDatum *dp)
+{
+	ca_ingest_entry entry;
+	bool first = true;
+	uint32_t key;
+	int c;
+
+	c = jc->peek();
+
+	if (ca_ingest_isnumber(c)) {
+		dp->reset(CA_IN_SCALAR);
+		return (jc->number(&dp->id_scalar));
+	}
+
+	if (c == '[') {
+		dp->reset(CA_IN_DIST);
+		return (ca_ingest_dist(jc, 0, dp));
+	}
+
+	if (c != '{')
+		return (false);
+
+	/*
+	 * Decompositions are objects whose values are either all numbers or
+	 * all distributions.  An empty object is an empty decomposition of
+	 * either type.
+	 */
+	dp->reset(CA_IN_DECOMP);
+	(void) jc->expect('{');
+
+	while (jc->more(&first, '}')) {
+		key = dp->id_nkeys;
+
+		if (!jc->string(dp->newKey()) || !jc->expect(':'))
+			return (false);
+
+		c = jc->peek();
+
+		if (key == 0 && c == '[')
+			dp->id_kind = CA_IN_DECOMP_DIST;
+
+		if (dp->id_kind == CA_IN_DECOMP_DIST) {
+			if (!ca_ingest_dist(jc, key, dp))
+				return (false);
+			continue;
+		}
+
+		if (!ca_ingest_isnumber(c))
+			return (false);
+
+		entry.ie_key = key;
+		entry.ie_low = entry.ie_high = 0;
+		if (!jc->number(&entry.ie_value))
+			return (false);
+
+		dp->id_entries.push_back(entry);
+	}
+
+	return (!jc->failed());
+}
+
+
+/*
+ * A data message parsed from its JSON body.  Parsing doesn't depend on any
+ * state shared with other messages, so messages may be parsed on any thread.
+ */
+struct ca_ingest_msg {
+	ca_ingest_msg() : im_ok(false), im_time(0) {}
+
+	bool		im_ok;		/* successfully parsed */
+	string		im_type;	/* for parsing only */
+	string		im_id;
+	string		im_hostname;
+	int64_t		im_time;
+	caIngestDatum	im_datum;
+};
+
+/*
+ * Parses a single message body into "mp".  Returns false if the body isn't a
+ * well-formed data message at or before "maxtime".
+ */
+static bool
+ca_ingest_parse(const char *buf, size_t len, double maxtime,
+    ca_ingest_msg *mp)
+{
+	caJsonCursor jc(buf, len);
+	size_t valoff = 0;
+	bool first = true;
+	bool hasid = false, hashost = false, hastime = false;
+	string key;
+	double time;
+
+	mp->im_type.clear();
+
+	if (!jc.expect('{'))
+		return (false);
+
+	while (jc.more(&first, '}')) {
+		key.clear();
+
+		if (!jc.string(&key) || !jc.expect(':'))
+			return (false);
+
+		if (key == "ca_type") {
+			if (!jc.string(&mp->im_type))
+				return (false);
+		} else if (key == "d_inst_id" && jc.peek() == '"') {
+			mp->im_id.clear();
+			hasid = jc.string(&mp->im_id);
+		} else if (key == "ca_hostname" && jc.peek() == '"') {
+			mp->im_hostname.clear();
+			hashost = jc.string(&mp->im_hostname);
+		} else if (key == "d_time" && ca_ingest_isnumber(jc.peek())) {
+			hastime = jc.number(&time);
+		} else {
+			if (key == "d_value")
+				valoff = jc.offset();
+
+			if (!jc.skip())
+				return (false);
+		}
+	}
+
+	if (!jc.done() || mp->im_type != "data" || !hasid || !hashost ||
+	    !hastime || valoff == 0)
+		return (false);
+
+	mp->im_time = (int64_t)floor(time / 1000);
+
+	if (mp->im_time < 0 || mp->im_time > maxtime)
+		return (false);
+
+	jc.seek(valoff);
+	return (ca_ingest_value(&jc, &mp->im_datum));
+}
+
+class Ingest;
+
+/*
+ * A batch of message bodies submitted with ingestAsync().  The Buffers are
+ * referenced from JavaScript (via ib_bodies) until the batch completes, so
+ * the shards can read their contents directly.
+ */
+struct ca_ingest_batch {
+	Persistent<Array>		ib_bodies;
+	Persistent<Function>		ib_callback;
+	double				ib_maxtime;
+	std::vector<const char *>	ib_data;
+	std::vector<size_t>		ib_lens;
+	std::vector<ca_ingest_msg>	ib_msgs;
+	size_t				ib_nchunks;
+	size_t				ib_ndone;	/* chunks parsed */
+};
+
+/*
+ * Parses the messages [first, last) of a batch.
+ */
+class caIngestChunk : public caShardTask {
+public:
+	caIngestChunk(Ingest *ip, ca_ingest_batch *bp, size_t first,
+	    size_t last) :
+	    ic_ingest(ip), ic_batch(bp), ic_first(first), ic_last(last) {}
+
+	void run();
+	void done();
+
+private:
+	Ingest			*ic_ingest;
+	ca_ingest_batch		*ic_batch;
+	size_t			ic_first;
+	size_t			ic_last;
+};
+
+/*
+ * Accumulates the result of ingesting a batch, which reports each (id,
+ * hostname, time) only once.
+ */
+class caIngestResult {
+public:
+	caIngestResult() : ir_data(Array::New()), ir_rest(Array::New()),
+	    ir_ndata(0), ir_nrest(0) {}
+
+	void ingested(const ca_ingest_msg &);
+	void rest(Local<Object> body) { ir_rest->Set(ir_nrest++, body); }
+	Local<Object> result();
+
+private:
+	std::set<string>	ir_seen;
+	Local<Array>		ir_data;
+	Local<Array>		ir_rest;
+	uint32_t		ir_ndata;
+	uint32_t		ir_nrest;
+};
+
+void
+caIngestResult::ingested(const ca_ingest_msg &msg)
+{
+	Local<Array> entry;
+	char tbuf[32];
+	string key;
+
+	(void) snprintf(tbuf, sizeof (tbuf), "%lld", (long long)msg.im_time);
+	key = msg.im_id;
+	key += '\0';
+	key += msg.im_hostname;
+	key += '\0';
+	key += tbuf;
+
+	if (!ir_seen.insert(key).second)
+		return;
+
+	entry = Array::New(3);
+	entry->Set(0, String::New(msg.im_id.data(), msg.im_id.size()));
+	entry->Set(1, String::New(msg.im_hostname.data(),
+	    msg.im_hostname.size()));
+	entry->Set(2, Number::New((double)msg.im_time));
+	ir_data->Set(ir_ndata++, entry);
+}
+
+Local<Object>
+caIngestResult::result()
+{
+	Local<Object> rv;
+
+	rv = Object::New();
+	rv->Set(String::New("data"), ir_data);
+	rv->Set(String::New("rest"), ir_rest);
+	return (rv);
+}
+
+class Ingest : public node::ObjectWrap {
+public:
+	static void Initialize(Handle<Object>);
+
+	void chunkDone(ca_ingest_batch *);
+
+protected:
+	static Handle<Value> New(const Arguments&);
+	static Handle<Value> Register(const Arguments&);
+	static Handle<Value> Unregister(const Arguments&);
+	static Handle<Value> DoIngest(const Arguments&);
+	static Handle<Value> IngestAsync(const Arguments&);
+	static Handle<Value> Stats(const Arguments&);
+
+private:
+	struct target {
+		caIngestTarget		*t_target;
+		Persistent<Object>	t_object;	/* holds t_target */
+	};
+
+	typedef std::map<string, std::vector<target> > targets_t;
+
+	Ingest(size_t);
+	~Ingest();
+
+	static void dispose(std::vector<target> *);
+	bool apply(const ca_ingest_msg &);
+	void account(const ca_ingest_msg &, Local<Object>, caIngestResult *);
+	void flush();
+	void finish(ca_ingest_batch *);
+
+	targets_t	in_targets;
+	ca_ingest_msg	in_msg;		/* reused for each message */
+
+	caShardPool			*in_pool;	/* NULL if no shards */
+	std::deque<ca_ingest_batch *>	in_batches;	/* in flight */
+	size_t				in_nextshard;
+	bool				in_flushing;
+
+	uint64_t	in_nmessages;	/* bodies processed */
+	uint64_t	in_ningested;	/* data messages ingested */
+	uint64_t	in_nrest;	/* bodies handed back */
+	uint64_t	in_nbatches;	/* batches handed to shards */
+};
+
+void
+caIngestChunk::run()
+{
+	caPhaseTimer timer(ca_phase_parse, ic_last - ic_first);
+	size_t ii;
+
+	for (ii = ic_first; ii < ic_last; ii++) {
+		ic_batch->ib_msgs[ii].im_ok = ca_ingest_parse(
+		    ic_batch->ib_data[ii], ic_batch->ib_lens[ii],
+		    ic_batch->ib_maxtime, &ic_batch->ib_msgs[ii]);
+	}
+}
+
+void
+caIngestChunk::done()
+{
+	Ingest *ip = ic_ingest;
+	ca_ingest_batch *bp = ic_batch;
+
+	delete (this);
+	ip->chunkDone(bp);
+}
+
+Ingest::Ingest(size_t nshards) :
+    node::ObjectWrap(), in_pool(NULL), in_nextshard(0), in_flushing(false),
+    in_nmessages(0), in_ningested(0), in_nrest(0), in_nbatches(0)
+{
+	if (nshards > 0)
+		in_pool = new caShardPool(nshards, CA_INGEST_SHARD_DEPTH);
+}
+
+/*
+ * Each batch in flight holds a reference to the callback, which in practice
+ * holds a reference to us, so we can't be destroyed while batches are pending.
+ */
+Ingest::~Ingest()
+{
+	targets_t::iterator it;
+
+	for (it = in_targets.begin(); it != in_targets.end(); it++)
+		dispose(&it->second);
+
+	delete (in_pool);
+}
+
+void
+Ingest::dispose(std::vector<target> *targets)
+{
+	size_t ii;
+
+	for (ii = 0; ii < targets->size(); ii++)
+		(*targets)[ii].t_object.Dispose();
+
+	targets->clear();
+}
+
+void
+Ingest::Initialize(Handle<Object> target)
+{
+	HandleScope scope;
+	Local<FunctionTemplate> templ = FunctionTemplate::New(Ingest::New);
+
+	templ->InstanceTemplate()->SetInternalFieldCount(1);
+	templ->SetClassName(String::NewSymbol("Ingest"));
+
+	NODE_SET_PROTOTYPE_METHOD(templ, "register", Ingest::Register);
+	NODE_SET_PROTOTYPE_METHOD(templ, "unregister", Ingest::Unregister);
+	NODE_SET_PROTOTYPE_METHOD(templ, "ingest", Ingest::DoIngest);
+	NODE_SET_PROTOTYPE_METHOD(templ, "ingestAsync", Ingest::IngestAsync);
+	NODE_SET_PROTOTYPE_METHOD(templ, "stats", Ingest::Stats);
+
+	target->Set(String::NewSymbol("Ingest"), templ->GetFunction());
+}
+
+Handle<Value>
+Ingest::New(const Arguments& args)
+{
+	HandleScope scope;
+	int64_t nshards = 0;
+
+	if (args.Length() > 0 && !args[0]->IsUndefined()) {
+		if (!args[0]->IsNumber())
+			return (ca_throw("expected number of shards"));
+
+		nshards = args[0]->IntegerValue();
+
+		if (nshards < 0)
+			return (ca_throw("nshards must be non-negative"));
+	}
+
+	(new Ingest((size_t)nshards))->Wrap(args.Holder());
+	return (args.This());
+}
+
+/*
+ * register(id, datasets): "datasets" is a TimeSeries or HeatmapDecomp, or an
+ * array of them, to which each value for instrumentation "id" is added.  All of
+ * the datasets for an instrumentation must store the same kind of data, since a
+ * value is only handed back if the first one rejects it.
+ */
+Handle<Value>
+Ingest::Register(const Arguments& args)
+{
+	HandleScope scope;
+	Ingest *ip = ObjectWrap::Unwrap<Ingest>(args.Holder());
+	std::vector<target> targets;
+	Local<Array> array;
+	Local<Value> arg;
+	caIngestTarget *tp;
+	uint32_t ii;
+
+	if (args.Length() < 2 || !args[0]->IsString())
+		return (ca_throw("expected id and datasets"));
+
+	if (args[1]->IsArray()) {
+		array = Local<Array>::Cast(args[1]);
+	} else {
+		array = Array::New(1);
+		array->Set(0, args[1]);
+	}
+
+	if (array->Length() == 0)
+		return (ca_throw("expected at least one dataset"));
+
+	for (ii = 0; ii < array->Length(); ii++) {
+		arg = array->Get(ii);
+
+		if ((tp = ca_timeseries_target(arg)) == NULL &&
+		    (tp = ca_heatmap_target(arg)) == NULL)
+			return (ca_throw(
+			    "expected TimeSeries or HeatmapDecomp"));
+
+		targets.push_back(target());
+		targets.back().t_target = tp;
+	}
+
+	String::Utf8Value id(args[0]);
+	std::vector<target> &tgts = ip->in_targets[string(*id, id.length())];
+
+	dispose(&tgts);
+	tgts = targets;
+
+	for (ii = 0; ii < tgts.size(); ii++)
+		tgts[ii].t_object =
+		    Persistent<Object>::New(array->Get(ii)->ToObject());
+
+	return (Undefined());
+}
+
+Handle<Value>
+Ingest::Unregister(const Arguments& args)
+{
+	HandleScope scope;
+	Ingest *ip = ObjectWrap::Unwrap<Ingest>(args.Holder());
+	targets_t::iterator it;
+
+	if (args.Length() < 1 || !args[0]->IsString())
+		return (ca_throw("expected id"));
+
+	String::Utf8Value id(args[0]);
+
+	if ((it = ip->in_targets.find(string(*id, id.length()))) ==
+	    ip->in_targets.end())
+		return (Undefined());
+
+	dispose(&it->second);
+	ip->in_targets.erase(it);
+	return (Undefined());
+}
+
+/*
+ * Adds a parsed message's value to the datasets registered for its
+ * instrumentation.  Returns false if there are none or they reject the value.
+ */
+bool
+Ingest::apply(const ca_ingest_msg &msg)
+{
+	caPhaseTimer timer(ca_phase_update);
+	targets_t::iterator it;
+	size_t ii;
+
+	if ((it = in_targets.find(msg.im_id)) == in_targets.end())
+		return (false);
+
+	if (!it->second[0].t_target->ingest(msg.im_time, msg.im_datum))
+		return (false);
+
+	for (ii = 1; ii < it->second.size(); ii++)
+		(void) it->second[ii].t_target->ingest(msg.im_time,
+		    msg.im_datum);
+
+	return (true);
+}
+
+/*
+ * Applies a message that's been parsed (or failed to parse) and records the
+ * outcome in "result".
+ */
+void
+Ingest::account(const ca_ingest_msg &msg, Local<Object> body,
+    caIngestResult *result)
+{
+	in_nmessages++;
+
+	if (!msg.im_ok || !apply(msg)) {
+		result->rest(body);
+		in_nrest++;
+		return;
+	}
+
+	in_ningested++;
+	result->ingested(msg);
+}
+
+Handle<Value>
+Ingest::DoIngest(const Arguments& args)
+{
+	HandleScope scope;
+	Ingest *ip = ObjectWrap::Unwrap<Ingest>(args.Holder());
+	caIngestResult result;
+	Local<Array> bodies;
+	Local<Object> body;
+	double maxtime;
+	hrtime_t start;
+	uint32_t ii;
+
+	if (args.Length() < 2 || !args[0]->IsArray() || !args[1]->IsNumber())
+		return (ca_throw("expected array of bodies and maxtime"));
+
+	bodies = Local<Array>::Cast(args[0]);
+	maxtime = args[1]->NumberValue();
+
+	for (ii = 0; ii < bodies->Length(); ii++) {
+		if (!node::Buffer::HasInstance(bodies->Get(ii)))
+			return (ca_throw("expected array of Buffers"));
+	}
+
+	for (ii = 0; ii < bodies->Length(); ii++) {
+		body = bodies->Get(ii)->ToObject();
+		start = gethrtime();
+		ip->in_msg.im_ok = ca_ingest_parse(node::Buffer::Data(body),
+		    node::Buffer::Length(body), maxtime, &ip->in_msg);
+		ca_phase_parse->record(gethrtime() - start);
+		ip->account(ip->in_msg, body, &result);
+	}
+
+	return (scope.Close(result.result()));
+}
+
+Handle<Value>
+Ingest::IngestAsync(const Arguments& args)
+{
+	HandleScope scope;
+	Ingest *ip = ObjectWrap::Unwrap<Ingest>(args.Holder());
+	std::vector<caIngestChunk *> local;
+	caIngestChunk *chunk;
+	ca_ingest_batch *bp;
+	Local<Array> bodies;
+	Local<Object> body;
+	size_t nchunks, first, last, ii;
+	uint32_t nbodies;
+	bool handoff;
+
+	if (args.Length() < 3 || !args[0]->IsArray() || !args[1]->IsNumber() ||
+	    !args[2]->IsFunction())
+		return (ca_throw("expected array of bodies, maxtime, and "
+		    "callback"));
+
+	bodies = Local<Array>::Cast(args[0]);
+	nbodies = bodies->Length();
+
+	for (ii = 0; ii < nbodies; ii++) {
+		if (!node::Buffer::HasInstance(bodies->Get(ii)))
+			return (ca_throw("expected array of Buffers"));
+	}
+
+	bp = new ca_ingest_batch();
+	bp->ib_bodies = Persistent<Array>::New(bodies);
+	bp->ib_callback = Persistent<Function>::New(
+	    Local<Function>::Cast(args[2]));
+	bp->ib_maxtime = args[1]->NumberValue();
+	bp->ib_msgs.resize(nbodies);
+
+	for (ii = 0; ii < nbodies; ii++) {
+		body = bodies->Get(ii)->ToObject();
+		bp->ib_data.push_back(node::Buffer::Data(body));
+		bp->ib_lens.push_back(node::Buffer::Length(body));
+	}
+
+	/*
+	 * Small batches aren't worth handing off unless other batches are in
+	 * flight, in which case they have to wait for those anyway.
+	 */
+	handoff = ip->in_pool != NULL &&
+	    (!ip->in_batches.empty() || nbodies >= CA_INGEST_CHUNK_MIN);
+	nchunks = 1;
+
+	if (handoff) {
+		nchunks = std::min(ip->in_pool->nshards(),
+		    (size_t)(nbodies + CA_INGEST_CHUNK_MIN - 1) /
+		    CA_INGEST_CHUNK_MIN);
+		nchunks = std::max(nchunks, (size_t)1);
+		ip->in_nbatches++;
+	}
+
+	bp->ib_nchunks = nchunks;
+	bp->ib_ndone = 0;
+	ip->in_batches.push_back(bp);
+
+	/*
+	 * Chunks that we can't hand off, including any for which the shard is
+	 * full, are parsed right here.
+	 */
+	for (ii = 0; ii < nchunks; ii++) {
+		first = ii * nbodies / nchunks;
+		last = (ii + 1) * nbodies / nchunks;
+		chunk = new caIngestChunk(ip, bp, first, last);
+
+		if (!handoff ||
+		    !ip->in_pool->submit(ip->in_nextshard++, chunk))
+			local.push_back(chunk);
+	}
+
+	for (ii = 0; ii < local.size(); ii++) {
+		local[ii]->run();
+		local[ii]->done();
+	}
+
+	return (Undefined());
+}
+
+void
+Ingest::chunkDone(ca_ingest_batch *bp)
+{
+	bp->ib_ndone++;
+	flush();
+}
+
+/*
+ * Completes batches at the head of the queue whose chunks have all been
+ * parsed.  Callbacks may submit more batches (or even complete them), so we
+ * don't process batches recursively.
+ */
+void
+Ingest::flush()
+{
+	ca_ingest_batch *bp;
+
+	if (in_flushing)
+		return;
+
+	in_flushing = true;
+
+	while (!in_batches.empty() &&
+	    in_batches.front()->ib_ndone == in_batches.front()->ib_nchunks) {
+		bp = in_batches.front();
+		in_batches.pop_front();
+		finish(bp);
+	}
+
+	in_flushing = false;
+}
+
+void
+Ingest::finish(ca_ingest_batch *bp)
+{
+	HandleScope scope;
+	caIngestResult result;
+	Local<Value> argv[1];
+	size_t ii;
+
+	for (ii = 0; ii < bp->ib_msgs.size(); ii++)
+		account(bp->ib_msgs[ii], bp->ib_bodies->Get(ii)->ToObject(),
+		    &result);
+
+	argv[0] = result.result();
+
+	TryCatch trycatch;
+	bp->ib_callback->Call(Context::GetCurrent()->Global(), 1, argv);
+
+	bp->ib_bodies.Dispose();
+	bp->ib_callback.Dispose();
+	delete (bp);
+
+	if (trycatch.HasCaught())
+		node::FatalException(trycatch);
+}
+
+Handle<Value>
+Ingest::Stats(const Arguments& args)
+{
+	HandleScope scope;
+	Ingest *ip = ObjectWrap::Unwrap<Ingest>(args.Holder());
+	Local<Object> rv;
+
+	rv = Object::New();
+	rv->Set(String::New("ntargets"), Number::New(ip->in_targets.size()));
+	rv->Set(String::New("nmessages"), Number::New(ip->in_nmessages));
+	rv->Set(String::New("ningested"), Number::New(ip->in_ningested));
+	rv->Set(String::New("nrest"), Number::New(ip->in_nrest));
+	rv->Set(String::New("nshards"), Number::New(
+	    ip->in_pool == NULL ? 0 : ip->in_pool->nshards()));
+	rv->Set(String::New("nbatches"), Number::New(ip->in_nbatches));
+	rv->Set(String::New("pending"), Number::New(ip->in_batches.size()));
+	return (scope.Close(rv));
+}
+
+void
+ca_ingest_init(Handle<Object> target)
+{
+	Ingest::Initialize(target);
+}
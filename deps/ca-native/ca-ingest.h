@@ -0,0 +1,91 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright (c) 2014, Joyent, Inc.
+ */
+
+/*
+ * ca-ingest.h: native ingest of raw data messages
+ *
+ * The aggregator receives one AMQP message per instrumentation per instrumenter
+ * per second, each a JSON object whose "d_value" is a scalar, a decomposition
+ * (an object mapping keys to scalars or distributions), or a distribution in
+ * the wire format.  Parsing these with JSON.parse() and then walking the
+ * resulting objects to add them to native datasets creates many short-lived
+ * JavaScript objects for each message.  Instead, an Ingest object parses
+ * batches of raw message bodies natively and adds each value directly to the
+ * native datasets (TimeSeries or HeatmapDecomps, one for each of the
+ * instrumentation's granularity tiers) registered for its instrumentation.
+ *
+ * Each value is first parsed into a caIngestDatum, whose storage is reused
+ * from one message to the next, and only then added to the dataset.  So a
+ * malformed value never leaves a dataset partially updated: the message is
+ * simply handed back to the caller to process the usual way, as are messages
+ * that aren't data messages or are for instrumentations that aren't
+ * registered.
+ *
+ * Datasets that can be targets of an Ingest implement caIngestTarget.
+ */
+
+#ifndef _CA_INGEST_H
+#define	_CA_INGEST_H
+
+#include <v8.h>
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+enum ca_ingest_kind {
+	CA_IN_SCALAR,		/* a number */
+	CA_IN_DECOMP,		/* an object mapping keys to numbers */
+	CA_IN_DIST,		/* a distribution */
+	CA_IN_DECOMP_DIST	/* an object mapping keys to distributions */
+};
+
+/*
+ * An entry of a parsed value: a key's scalar value (for CA_IN_DECOMP) or one
+ * [ [ low, high ], count ] entry of a distribution, possibly for a key (for
+ * CA_IN_DIST and CA_IN_DECOMP_DIST).  Keys are indexes into id_keys.
+ */
+struct ca_ingest_entry {
+	uint32_t	ie_key;
+	double		ie_low;
+	double		ie_high;
+	double		ie_value;
+};
+
+class caIngestDatum {
+public:
+	caIngestDatum() : id_kind(CA_IN_SCALAR), id_scalar(0), id_nkeys(0) {}
+
+	void reset(ca_ingest_kind);
+	std::string *newKey();
+
+	ca_ingest_kind			id_kind;
+	double				id_scalar;
+	size_t				id_nkeys;	/* keys in use */
+	std::vector<std::string>	id_keys;
+	std::vector<ca_ingest_entry>	id_entries;
+};
+
+class caIngestTarget {
+public:
+	virtual ~caIngestTarget() {}
+
+	/*
+	 * Adds "datum" to the data for "time".  Returns false without
+	 * changing anything if the datum's kind isn't supported.
+	 */
+	virtual bool ingest(int64_t, const caIngestDatum &) = 0;
+};
+
+extern caIngestTarget *ca_timeseries_target(v8::Handle<v8::Value>);
+extern caIngestTarget *ca_heatmap_target(v8::Handle<v8::Value>);
+
+#endif	/* _CA_INGEST_H */
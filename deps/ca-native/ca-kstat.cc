@@ -0,0 +1,686 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright (c) 2014, Joyent, Inc.
+ */
+
+/*
+ * ca-kstat.cc: data points from successive snapshots of kstats
+ *
+ * The JavaScript interface is:
+ *
+ *	new KstatDiff(fields, value)
+ *
+ *		Creates an object that computes the data points of a
+ *		kstat-based metric (see cmd/cainst/modules/kstat.js) from the
+ *		changes between successive snapshots of its kstats.  "fields"
+ *		is an array describing each of the metric's fields with "name",
+ *		"type", and depending on "type":
+ *
+ *		ident		discrete: the kstat's "member" ("module",
+ *				"instance", "class", or "name")
+ *
+ *		stat		discrete: the kstat's statistic "stat"
+ *
+ *		constant	discrete: each of the strings in array "values"
+ *				in turn, so that each kstat yields a data point
+ *				for each combination of the values of all
+ *				constant fields
+ *
+ *		delta		numeric: the change in the sum of the
+ *				statistics named in array "stats"
+ *
+ *		percent		numeric: like "delta", as a percentage of the
+ *				time between the snapshots, rounded down
+ *
+ *		"value" describes the value of each data point with "type":
+ *
+ *		constant	the number "value"
+ *
+ *		delta		the change in the sum of the statistics named
+ *				in array "stats", or, if "field" names a
+ *				constant field, the change in the statistic that
+ *				object "stats" maps that field's value to
+ *
+ *	update(kstats)
+ *
+ *		Takes a snapshot of "kstats", an array of kstats (or an object
+ *		whose values are kstats) as returned by node-kstat's read().
+ *		Returns a DataPoints batch (see ca-points.h) with a field for
+ *		each of the metric's fields and the data points for each kstat
+ *		present in both this snapshot and the previous one, or
+ *		undefined if this is the first snapshot.  The same batch is
+ *		returned by every call, so it's only valid until the next one.
+ *
+ * Each kstat is identified by its module, instance, class, and name, which we
+ * intern into a slot that's stable for as long as the kstat is present.  When
+ * a kstat first appears, the keys of the discrete fields that come from the
+ * kstat itself are interned and stored with its slot, so later snapshots only
+ * read the statistics the metric uses.  These are read into a table with a row
+ * per kstat, and the previous snapshot's rows are gathered alongside them so
+ * that the deltas for all kstats are computed in one pass over both tables.
+ */
+
+#include <v8.h>
+#include <node.h>
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "ca-native.h"
+#include "ca-phase.h"
+#include "ca-points.h"
+
+using namespace v8;
+using std::string;
+using std::vector;
+
+enum ca_kstat_type {
+	CA_KSTAT_IDENT,
+	CA_KSTAT_STAT,
+	CA_KSTAT_CONSTANT,
+	CA_KSTAT_DELTA,
+	CA_KSTAT_PERCENT
+};
+
+struct ca_kstat_field {
+	ca_kstat_type	kf_type;
+	size_t		kf_column;	/* column in the batch */
+	string		kf_member;	/* "ident" member or "stat" name */
+	vector<uint32_t> kf_keys;	/* "constant" values' keys */
+	size_t		kf_stride;	/* "constant" combinations per value */
+	vector<size_t>	kf_stats;	/* "delta" or "percent" statistics */
+};
+
+static const char *ca_kstat_members[] = { "module", "instance", "class",
+    "name" };
+
+class KstatDiff : public node::ObjectWrap {
+public:
+	static void Initialize(Handle<Object>);
+
+protected:
+	static Handle<Value> New(const Arguments&);
+	static Handle<Value> Update(const Arguments&);
+
+private:
+	KstatDiff() : kd_points(NULL), kd_gen(0) {}
+	~KstatDiff() { kd_batch.Dispose(); }
+
+	const char *init(Handle<Array>, Handle<Object>);
+	bool stats(Handle<Value>, vector<size_t> *);
+	uint32_t slot(Handle<Object>, Handle<Value>);
+	void diff(const vector<uint32_t> &, const vector<bool> &,
+	    const vector<double> &, const vector<double> &);
+
+	Persistent<Object>	kd_batch;
+	caPoints		*kd_points;
+	vector<ca_kstat_field>	kd_fields;
+	vector<size_t>		kd_dynamic;	/* "ident" and "stat" fields */
+	vector<string>		kd_stats;	/* statistics read */
+	size_t			kd_ncombos;	/* points per kstat */
+
+	ca_kstat_type		kd_vtype;
+	double			kd_vconst;	/* constant value */
+	size_t			kd_vfield;	/* field keying kd_vstats */
+	vector<size_t>		kd_vstats;	/* statistics for value */
+
+	caInternTable		kd_idents;	/* kstat identities */
+	uint64_t		kd_gen;		/* snapshots taken */
+	vector<uint64_t>	kd_seen;	/* per slot: last snapshot */
+	vector<uint32_t>	kd_keys;	/* per slot: dynamic keys */
+	vector<double>		kd_last;	/* per slot: statistics */
+	vector<double>		kd_lasttime;	/* per slot: snaptime */
+};
+
+/*
+ * Reads an array of statistic names (or a single name), appending the index of
+ * each one in kd_stats to "indices".
+ */
+bool
+KstatDiff::stats(Handle<Value> arg, vector<size_t> *indices)
+{
+	Local<Array> array;
+	Local<Value> elt;
+	uint32_t ii;
+	size_t jj;
+
+	if (arg->IsString()) {
+		array = Array::New(1);
+		array->Set(0, arg);
+	} else if (arg->IsArray()) {
+		array = Local<Array>::Cast(arg);
+	} else {
+		return (false);
+	}
+
+	if (array->Length() == 0)
+		return (false);
+
+	for (ii = 0; ii < array->Length(); ii++) {
+		elt = array->Get(ii);
+		if (!elt->IsString())
+			return (false);
+
+		String::Utf8Value name(elt);
+
+		for (jj = 0; jj < kd_stats.size(); jj++) {
+			if (kd_stats[jj] == *name)
+				break;
+		}
+
+		if (jj == kd_stats.size())
+			kd_stats.push_back(*name);
+
+		indices->push_back(jj);
+	}
+
+	return (true);
+}
+
+const char *
+KstatDiff::init(Handle<Array> fields, Handle<Object> value)
+{
+	vector<string> discrete, numeric, names;
+	vector<vector<string> > constants;
+	Local<Object> desc, statmap;
+	Local<Array> values;
+	Local<Value> member;
+	ca_kstat_field field;
+	uint32_t ii, jj;
+
+	for (ii = 0; ii < fields->Length(); ii++) {
+		if (!fields->Get(ii)->IsObject())
+			return ("expected field description");
+
+		desc = fields->Get(ii)->ToObject();
+		String::Utf8Value name(desc->Get(String::NewSymbol("name")));
+		String::Utf8Value type(desc->Get(String::NewSymbol("type")));
+
+		field = ca_kstat_field();
+		names.push_back(*name);
+		constants.push_back(vector<string>());
+
+		if (strcmp(*type, "ident") == 0 || strcmp(*type, "stat") == 0) {
+			field.kf_type = strcmp(*type, "ident") == 0 ?
+			    CA_KSTAT_IDENT : CA_KSTAT_STAT;
+			member = desc->Get(String::NewSymbol(
+			    field.kf_type == CA_KSTAT_IDENT ? "member" :
+			    "stat"));
+
+			if (!member->IsString())
+				return ("expected member or stat");
+
+			String::Utf8Value mname(member);
+			field.kf_member = *mname;
+
+			for (jj = 0; field.kf_type == CA_KSTAT_IDENT &&
+			    jj < sizeof (ca_kstat_members) /
+			    sizeof (ca_kstat_members[0]); jj++) {
+				if (field.kf_member == ca_kstat_members[jj])
+					break;
+			}
+
+			if (jj == sizeof (ca_kstat_members) /
+			    sizeof (ca_kstat_members[0]))
+				return ("unsupported kstat member");
+
+			kd_dynamic.push_back(kd_fields.size());
+			discrete.push_back(*name);
+		} else if (strcmp(*type, "constant") == 0) {
+			field.kf_type = CA_KSTAT_CONSTANT;
+
+			if (!desc->Get(String::NewSymbol("values"))->IsArray())
+				return ("expected array of values");
+
+			values = Local<Array>::Cast(desc->Get(
+			    String::NewSymbol("values")));
+
+			if (values->Length() == 0)
+				return ("expected array of values");
+
+			for (jj = 0; jj < values->Length(); jj++) {
+				String::Utf8Value vname(values->Get(jj));
+				constants.back().push_back(*vname);
+			}
+
+			discrete.push_back(*name);
+		} else if (strcmp(*type, "delta") == 0 ||
+		    strcmp(*type, "percent") == 0) {
+			field.kf_type = strcmp(*type, "delta") == 0 ?
+			    CA_KSTAT_DELTA : CA_KSTAT_PERCENT;
+
+			if (!stats(desc->Get(String::NewSymbol("stats")),
+			    &field.kf_stats))
+				return ("expected array of statistics");
+
+			numeric.push_back(*name);
+		} else {
+			return ("unsupported field type");
+		}
+
+		kd_fields.push_back(field);
+	}
+
+	kd_batch = Persistent<Object>::New(ca_points_new(discrete, numeric));
+	kd_points = ca_points_unwrap(kd_batch);
+
+	/*
+	 * Each kstat yields a point for each combination of constant values,
+	 * enumerated with the last constant field varying fastest.
+	 */
+	kd_ncombos = 1;
+
+	for (ii = kd_fields.size(); ii-- > 0; ) {
+		ca_kstat_field &kf = kd_fields[ii];
+
+		(void) kd_points->field(names[ii], &kf.kf_column);
+
+		for (jj = 0; jj < constants[ii].size(); jj++)
+			kf.kf_keys.push_back(kd_points->intern(
+			    constants[ii][jj]));
+
+		kf.kf_stride = kd_ncombos;
+
+		if (kf.kf_type == CA_KSTAT_CONSTANT)
+			kd_ncombos *= kf.kf_keys.size();
+	}
+
+	String::Utf8Value vtype(value->Get(String::NewSymbol("type")));
+	kd_vfield = kd_fields.size();
+
+	if (strcmp(*vtype, "constant") == 0) {
+		kd_vtype = CA_KSTAT_CONSTANT;
+		kd_vconst = value->Get(String::NewSymbol("value"))->
+		    NumberValue();
+		return (NULL);
+	}
+
+	if (strcmp(*vtype, "delta") != 0)
+		return ("unsupported value type");
+
+	kd_vtype = CA_KSTAT_DELTA;
+	member = value->Get(String::NewSymbol("field"));
+
+	if (member->IsUndefined()) {
+		if (!stats(value->Get(String::NewSymbol("stats")), &kd_vstats))
+			return ("expected array of statistics for value");
+
+		return (NULL);
+	}
+
+	String::Utf8Value vfield(member);
+
+	for (ii = 0; ii < names.size(); ii++) {
+		if (names[ii] == *vfield &&
+		    kd_fields[ii].kf_type == CA_KSTAT_CONSTANT)
+			break;
+	}
+
+	if (ii == names.size())
+		return ("value field must be a constant field");
+
+	if (!value->Get(String::NewSymbol("stats"))->IsObject())
+		return ("expected statistic for each value of field");
+
+	kd_vfield = ii;
+	statmap = value->Get(String::NewSymbol("stats"))->ToObject();
+
+	for (jj = 0; jj < constants[ii].size(); jj++) {
+		if (!stats(statmap->Get(String::New(
+		    constants[ii][jj].c_str())), &kd_vstats) ||
+		    kd_vstats.size() != jj + 1)
+			return ("expected statistic for each value of field");
+	}
+
+	return (NULL);
+}
+
+/*
+ * Returns the slot for "kstat", creating it (and interning the keys of its
+ * dynamic fields) if it's not already present.
+ */
+uint32_t
+KstatDiff::slot(Handle<Object> kstat, Handle<Value> data)
+{
+	HandleScope scope;
+	Local<Value> value;
+	string ident;
+	uint32_t slot;
+	size_t ii;
+
+	for (ii = 0; ii < sizeof (ca_kstat_members) /
+	    sizeof (ca_kstat_members[0]); ii++) {
+		String::Utf8Value member(kstat->Get(
+		    String::NewSymbol(ca_kstat_members[ii])));
+
+		if (ii > 0)
+			ident += ':';
+
+		ident.append(*member, member.length());
+	}
+
+	if (kd_idents.lookup(ident, &slot))
+		return (slot);
+
+	slot = kd_idents.intern(ident);
+	kd_idents.hold(slot);
+
+	if (slot >= kd_seen.size()) {
+		kd_seen.resize(slot + 1);
+		kd_keys.resize((slot + 1) * kd_dynamic.size());
+		kd_last.resize((slot + 1) * kd_stats.size());
+		kd_lasttime.resize(slot + 1);
+	}
+
+	kd_seen[slot] = 0;
+
+	for (ii = 0; ii < kd_dynamic.size(); ii++) {
+		const ca_kstat_field &kf = kd_fields[kd_dynamic[ii]];
+
+		if (kf.kf_type == CA_KSTAT_IDENT)
+			value = kstat->Get(String::New(kf.kf_member.c_str()));
+		else if (data->IsObject())
+			value = data->ToObject()->Get(
+			    String::New(kf.kf_member.c_str()));
+		else
+			value = Local<Value>::New(Undefined());
+
+		String::Utf8Value key(value);
+		kd_keys[slot * kd_dynamic.size() + ii] = kd_points->intern(
+		    string(*key, key.length()));
+	}
+
+	return (slot);
+}
+
+/*
+ * Appends the data points for a snapshot whose kstats are in slots "slots",
+ * with statistics in rows of "cur" and snaptimes in "times", to the batch.
+ * Only kstats for which "paired" is set were present in the previous snapshot.
+ */
+void
+KstatDiff::diff(const vector<uint32_t> &slots, const vector<bool> &paired,
+    const vector<double> &cur, const vector<double> &times)
+{
+	vector<double> prev, numbers, values, point;
+	size_t nstats, nrows, row, ii, cc, ff;
+	double newsum, oldsum, interval;
+
+	nstats = kd_stats.size();
+	nrows = slots.size();
+
+	/*
+	 * Gather each kstat's previous statistics into a table parallel to
+	 * "cur", then compute each numeric field and value for every kstat.
+	 */
+	prev.resize(nrows * nstats);
+
+	for (row = 0; row < nrows; row++) {
+		if (!paired[row])
+			continue;
+
+		for (ii = 0; ii < nstats; ii++)
+			prev[row * nstats + ii] =
+			    kd_last[slots[row] * nstats + ii];
+	}
+
+	numbers.resize(nrows * kd_fields.size());
+	values.resize(nrows * (kd_vfield < kd_fields.size() ?
+	    kd_vstats.size() : 1));
+
+	for (ff = 0; ff < kd_fields.size(); ff++) {
+		const ca_kstat_field &kf = kd_fields[ff];
+
+		if (kf.kf_type != CA_KSTAT_DELTA &&
+		    kf.kf_type != CA_KSTAT_PERCENT)
+			continue;
+
+		for (row = 0; row < nrows; row++) {
+			newsum = oldsum = 0;
+
+			for (ii = 0; ii < kf.kf_stats.size(); ii++) {
+				newsum += cur[row * nstats + kf.kf_stats[ii]];
+				oldsum += prev[row * nstats + kf.kf_stats[ii]];
+			}
+
+			numbers[row * kd_fields.size() + ff] = newsum - oldsum;
+		}
+
+		if (kf.kf_type != CA_KSTAT_PERCENT)
+			continue;
+
+		for (row = 0; row < nrows; row++) {
+			if (!paired[row])
+				continue;
+
+			interval = times[row] - kd_lasttime[slots[row]];
+			numbers[row * kd_fields.size() + ff] = floor(100 *
+			    numbers[row * kd_fields.size() + ff] / interval);
+		}
+	}
+
+	if (kd_vtype == CA_KSTAT_CONSTANT) {
+		for (row = 0; row < nrows; row++)
+			values[row] = kd_vconst;
+	} else if (kd_vfield < kd_fields.size()) {
+		for (row = 0; row < nrows; row++) {
+			for (ii = 0; ii < kd_vstats.size(); ii++)
+				values[row * kd_vstats.size() + ii] =
+				    cur[row * nstats + kd_vstats[ii]] -
+				    prev[row * nstats + kd_vstats[ii]];
+		}
+	} else {
+		for (row = 0; row < nrows; row++) {
+			newsum = oldsum = 0;
+
+			for (ii = 0; ii < kd_vstats.size(); ii++) {
+				newsum += cur[row * nstats + kd_vstats[ii]];
+				oldsum += prev[row * nstats + kd_vstats[ii]];
+			}
+
+			values[row] = newsum - oldsum;
+		}
+	}
+
+	/*
+	 * Now emit the points for each kstat, one per combination of constant
+	 * values.
+	 */
+	point.resize(kd_points->nfields());
+
+	for (row = 0; row < nrows; row++) {
+		if (!paired[row])
+			continue;
+
+		for (ii = 0; ii < kd_dynamic.size(); ii++)
+			point[kd_fields[kd_dynamic[ii]].kf_column] =
+			    kd_keys[slots[row] * kd_dynamic.size() + ii];
+
+		for (ff = 0; ff < kd_fields.size(); ff++) {
+			if (kd_fields[ff].kf_type == CA_KSTAT_DELTA ||
+			    kd_fields[ff].kf_type == CA_KSTAT_PERCENT)
+				point[kd_fields[ff].kf_column] =
+				    numbers[row * kd_fields.size() + ff];
+		}
+
+		for (cc = 0; cc < kd_ncombos; cc++) {
+			for (ff = 0; ff < kd_fields.size(); ff++) {
+				const ca_kstat_field &kf = kd_fields[ff];
+
+				if (kf.kf_type != CA_KSTAT_CONSTANT)
+					continue;
+
+				point[kf.kf_column] = kf.kf_keys[
+				    cc / kf.kf_stride % kf.kf_keys.size()];
+			}
+
+			if (kd_vfield < kd_fields.size())
+				kd_points->append(&point[0], values[
+				    row * kd_vstats.size() +
+				    cc / kd_fields[kd_vfield].kf_stride %
+				    kd_vstats.size()]);
+			else
+				kd_points->append(&point[0], values[row]);
+		}
+	}
+}
+
+void
+KstatDiff::Initialize(Handle<Object> target)
+{
+	HandleScope scope;
+	Local<FunctionTemplate> templ = FunctionTemplate::New(KstatDiff::New);
+
+	templ->InstanceTemplate()->SetInternalFieldCount(1);
+	templ->SetClassName(String::NewSymbol("KstatDiff"));
+
+	NODE_SET_PROTOTYPE_METHOD(templ, "update", KstatDiff::Update);
+
+	target->Set(String::NewSymbol("KstatDiff"), templ->GetFunction());
+}
+
+Handle<Value>
+KstatDiff::New(const Arguments& args)
+{
+	HandleScope scope;
+	KstatDiff *kdp;
+	const char *err;
+
+	if (args.Length() < 2 || !args[0]->IsArray() || !args[1]->IsObject())
+		return (ca_throw("expected array of fields and value"));
+
+	kdp = new KstatDiff();
+
+	if ((err = kdp->init(Local<Array>::Cast(args[0]),
+	    args[1]->ToObject())) != NULL) {
+		delete (kdp);
+		return (ca_throw(err));
+	}
+
+	kdp->Wrap(args.Holder());
+	return (args.This());
+}
+
+Handle<Value>
+KstatDiff::Update(const Arguments& args)
+{
+	HandleScope scope;
+	KstatDiff *kdp = ObjectWrap::Unwrap<KstatDiff>(args.Holder());
+	vector<Local<String> > statnames;
+	Local<String> dataname, errorname, timename;
+	Local<Object> kstats, kstat;
+	Local<Array> keys;
+	Local<Value> elt, data;
+	vector<uint32_t> slots, rows;
+	vector<bool> paired;
+	vector<double> cur, times;
+	uint32_t slot, nkstats, ii;
+	size_t nstats, row, jj;
+	uint64_t gen;
+
+	if (args.Length() < 1 || !args[0]->IsObject())
+		return (ca_throw("expected kstats"));
+
+	kstats = args[0]->ToObject();
+
+	if (args[0]->IsArray()) {
+		nkstats = Local<Array>::Cast(args[0])->Length();
+	} else {
+		keys = kstats->GetPropertyNames();
+		nkstats = keys->Length();
+	}
+
+	nstats = kdp->kd_stats.size();
+	gen = ++kdp->kd_gen;
+
+	for (jj = 0; jj < nstats; jj++)
+		statnames.push_back(String::New(kdp->kd_stats[jj].c_str()));
+
+	dataname = String::NewSymbol("data");
+	errorname = String::NewSymbol("error");
+	timename = String::NewSymbol("snaptime");
+
+	/*
+	 * If a kstat appears more than once, the last one wins, as it would
+	 * when kstats are indexed by identity.
+	 */
+	for (ii = 0; ii < nkstats; ii++) {
+		elt = keys.IsEmpty() ? kstats->Get(ii) :
+		    kstats->Get(keys->Get(ii));
+
+		if (!elt->IsObject())
+			continue;
+
+		kstat = elt->ToObject();
+		if (kstat->Has(errorname))
+			continue;
+
+		data = kstat->Get(dataname);
+		slot = kdp->slot(kstat, data);
+
+		if (slot >= rows.size())
+			rows.resize(slot + 1);
+
+		if (kdp->kd_seen[slot] == gen) {
+			row = rows[slot];
+		} else {
+			row = slots.size();
+			rows[slot] = row;
+			slots.push_back(slot);
+			paired.push_back(kdp->kd_seen[slot] == gen - 1 &&
+			    gen > 1);
+			cur.resize(cur.size() + nstats);
+			times.push_back(0);
+			kdp->kd_seen[slot] = gen;
+		}
+
+		times[row] = kstat->Get(timename)->NumberValue();
+
+		for (jj = 0; jj < nstats; jj++) {
+			cur[row * nstats + jj] = !data->IsObject() ? NAN :
+			    data->ToObject()->Get(statnames[jj])->NumberValue();
+		}
+	}
+
+	caPhaseTimer timer(ca_phase_kstat, slots.size());
+
+	kdp->kd_points->clear();
+	kdp->diff(slots, paired, cur, times);
+
+	for (row = 0; row < slots.size(); row++) {
+		for (jj = 0; jj < nstats; jj++)
+			kdp->kd_last[slots[row] * nstats + jj] =
+			    cur[row * nstats + jj];
+
+		kdp->kd_lasttime[slots[row]] = times[row];
+	}
+
+	/* Forget the kstats that have gone away. */
+	for (slot = 0; slot < kdp->kd_seen.size(); slot++) {
+		if (kdp->kd_seen[slot] == 0 || kdp->kd_seen[slot] == gen)
+			continue;
+
+		kdp->kd_seen[slot] = 0;
+		kdp->kd_idents.release(slot);
+	}
+
+	if (gen == 1)
+		return (Undefined());
+
+	return (scope.Close(kdp->kd_batch));
+}
+
+void
+ca_kstat_init(Handle<Object> target)
+{
+	KstatDiff::Initialize(target);
+}
@@ -13,6 +13,8 @@
 #include <zone.h>
 #include <errno.h>
 
+#include "ca-native.h"
+
 using namespace v8;
 
 Handle<Value> call_zonenamebyid(const Arguments& args)
@@ -31,12 +33,80 @@ Handle<Value> call_zonenamebyid(const Arguments& args)
 	return (scope.Close(String::New(buf)));
 }
 
+Handle<Value>
+ca_throw(const char *msg)
+{
+	return (ThrowException(Exception::Error(String::New(msg))));
+}
+
+uint32_t
+caInternTable::intern(const std::string &str)
+{
+	std::map<std::string, uint32_t>::iterator it;
+	uint32_t id;
+
+	if ((it = it_ids.find(str)) != it_ids.end())
+		return (it->second);
+
+	if (!it_free.empty()) {
+		id = it_free.back();
+		it_free.pop_back();
+		it_names[id] = str;
+		it_refs[id] = 0;
+	} else {
+		id = it_names.size();
+		it_names.push_back(str);
+		it_refs.push_back(0);
+	}
+
+	it_ids[str] = id;
+	return (id);
+}
+
+bool
+caInternTable::lookup(const std::string &str, uint32_t *idp) const
+{
+	std::map<std::string, uint32_t>::const_iterator it;
+
+	if ((it = it_ids.find(str)) == it_ids.end())
+		return (false);
+
+	*idp = it->second;
+	return (true);
+}
+
+void
+caInternTable::release(uint32_t id)
+{
+	if (--it_refs[id] > 0)
+		return;
+
+	it_ids.erase(it_names[id]);
+	it_names[id].clear();
+	it_free.push_back(id);
+}
+
 extern "C" void
-init (Handle<Object> target) 
+init (Handle<Object> target)
 {
 	HandleScope scope;
 	Local<FunctionTemplate> templ =
 	    FunctionTemplate::New(call_zonenamebyid);
 
 	target->Set(String::NewSymbol("zoneNameById"), templ->GetFunction());
+
+	ca_bench_init(target);
+	ca_compute_init(target);
+	ca_dist_init(target);
+	ca_heatmap_init(target);
+	ca_ingest_init(target);
+	ca_kstat_init(target);
+	ca_phase_init(target);
+	ca_png_init(target);
+	ca_points_init(target);
+	ca_pred_init(target);
+	ca_proc_init(target);
+	ca_reporting_init(target);
+	ca_stash_init(target);
+	ca_timeseries_init(target);
 }
@@ -0,0 +1,77 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright (c) 2014, Joyent, Inc.
+ */
+
+/*
+ * ca-native.h: definitions shared by the ca-native addon's components
+ */
+
+#ifndef _CA_NATIVE_H
+#define	_CA_NATIVE_H
+
+#include <v8.h>
+#include <node.h>
+
+#include <stdint.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+/*
+ * Each component of the addon exposes an initializer that's invoked from the
+ * module's init() entry point to register its classes and functions.
+ */
+extern void ca_bench_init(v8::Handle<v8::Object>);
+extern void ca_compute_init(v8::Handle<v8::Object>);
+extern void ca_dist_init(v8::Handle<v8::Object>);
+extern void ca_heatmap_init(v8::Handle<v8::Object>);
+extern void ca_ingest_init(v8::Handle<v8::Object>);
+extern void ca_kstat_init(v8::Handle<v8::Object>);
+extern void ca_phase_init(v8::Handle<v8::Object>);
+extern void ca_png_init(v8::Handle<v8::Object>);
+extern void ca_points_init(v8::Handle<v8::Object>);
+extern void ca_pred_init(v8::Handle<v8::Object>);
+extern void ca_proc_init(v8::Handle<v8::Object>);
+extern void ca_reporting_init(v8::Handle<v8::Object>);
+extern void ca_stash_init(v8::Handle<v8::Object>);
+extern void ca_timeseries_init(v8::Handle<v8::Object>);
+
+/*
+ * Throws a JavaScript Error with the given message and returns the result of
+ * ThrowException() so that callers can simply "return (ca_throw(...))".
+ */
+extern v8::Handle<v8::Value> ca_throw(const char *);
+
+/*
+ * Interns strings (e.g., decomposition keys) as small integer identifiers so
+ * that per-slot data can be stored as dense (id, value) pairs rather than
+ * string-keyed objects.  Identifiers are reference-counted: callers hold() an
+ * identifier for each place it's stored and release() it when that place is
+ * cleared.  When the last reference is released, the identifier is recycled.
+ */
+class caInternTable {
+public:
+	caInternTable() {}
+
+	uint32_t intern(const std::string &);
+	bool lookup(const std::string &, uint32_t *) const;
+	const std::string &name(uint32_t id) const { return (it_names[id]); }
+	void hold(uint32_t id) { it_refs[id]++; }
+	void release(uint32_t);
+	size_t size() const { return (it_ids.size()); }
+
+private:
+	std::map<std::string, uint32_t>	it_ids;
+	std::vector<std::string>	it_names;
+	std::vector<uint32_t>		it_refs;
+	std::vector<uint32_t>		it_free;
+};
+
+#endif	/* _CA_NATIVE_H */
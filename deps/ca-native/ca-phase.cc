@@ -0,0 +1,267 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright (c) 2014, Joyent, Inc.
+ */
+
+/*
+ * ca-phase.cc: latency histograms for named phases of work (see ca-phase.h)
+ *
+ * The JavaScript interface is:
+ *
+ *	hrtime()			Returns the current time in nanoseconds
+ *					relative to some arbitrary time in the
+ *					past.  Unlike Date, this is monotonic.
+ *
+ *	phaseRecord(name, start[, count])
+ *
+ *					Records the time since "start" (a value
+ *					returned by hrtime()) against phase
+ *					"name", as "count" items (default 1).
+ *					Returns the elapsed time.
+ *
+ *	phaseStats()			Returns an object describing each phase
+ *					that's been recorded, keyed by name.
+ *					Each has "count" (items recorded),
+ *					"total", "max", "p50", "p90", and "p99"
+ *					(all in nanoseconds; percentiles are
+ *					upper bounds), and "histogram", an
+ *					array of [ [ min, max ], count ] entries
+ *					for each non-empty bucket.
+ *
+ * Phases recorded natively are created when the addon is loaded, so they're
+ * reported (with zero counts) even before they're first recorded.
+ */
+
+#include <v8.h>
+#include <node.h>
+
+#include <map>
+#include <vector>
+
+#include "ca-native.h"
+#include "ca-phase.h"
+
+using namespace v8;
+using std::string;
+
+caPhase *ca_phase_parse;
+caPhase *ca_phase_update;
+caPhase *ca_phase_bucketize;
+caPhase *ca_phase_render;
+caPhase *ca_phase_png;
+caPhase *ca_phase_stash;
+caPhase *ca_phase_compute;
+caPhase *ca_phase_procscan;
+caPhase *ca_phase_kstat;
+
+static std::map<string, caPhase *> ca_phases;
+static std::vector<caPhase *> ca_phase_list;	/* in creation order */
+static hrtime_t ca_phase_origin;
+
+caPhase::caPhase(const string &name) :
+    ph_name(name), ph_count(0), ph_total(0), ph_max(0)
+{
+	size_t ii;
+
+	for (ii = 0; ii < CA_PHASE_NBUCKETS; ii++)
+		ph_buckets[ii] = 0;
+}
+
+caPhase *
+caPhase::lookup(const string &name)
+{
+	std::map<string, caPhase *>::iterator it;
+	caPhase *pp;
+
+	if ((it = ca_phases.find(name)) != ca_phases.end())
+		return (it->second);
+
+	pp = new caPhase(name);
+	ca_phases[name] = pp;
+	ca_phase_list.push_back(pp);
+	return (pp);
+}
+
+void
+caPhase::record(hrtime_t nsec, uint64_t count)
+{
+	uint64_t per, max;
+	size_t bucket;
+
+	if (count == 0)
+		return;
+
+	per = (uint64_t)nsec / count;
+
+	for (bucket = 0; bucket < CA_PHASE_NBUCKETS - 1 &&
+	    bucketMin(bucket + 1) <= (hrtime_t)per; bucket++)
+		continue;
+
+	atomic_add_64(&ph_buckets[bucket], count);
+	atomic_add_64(&ph_count, count);
+	atomic_add_64(&ph_total, nsec);
+
+	while ((max = ph_max) < per) {
+		if (atomic_cas_64(&ph_max, max, per) == max)
+			break;
+	}
+}
+
+static hrtime_t
+ca_phase_now()
+{
+	return (gethrtime() - ca_phase_origin);
+}
+
+/*
+ * Returns an upper bound on the "pct"th percentile of the items recorded for
+ * "pp".
+ */
+static uint64_t
+ca_phase_percentile(const caPhase *pp, uint64_t count, double pct)
+{
+	uint64_t sum, max;
+	size_t ii;
+
+	sum = 0;
+	max = pp->max();
+
+	for (ii = 0; ii < CA_PHASE_NBUCKETS - 1; ii++) {
+		sum += pp->bucket(ii);
+
+		if (sum >= pct * count)
+			break;
+	}
+
+	if (ii == CA_PHASE_NBUCKETS - 1 ||
+	    (uint64_t)caPhase::bucketMin(ii + 1) > max)
+		return (max);
+
+	return (caPhase::bucketMin(ii + 1));
+}
+
+static Local<Object>
+ca_phase_describe(const caPhase *pp)
+{
+	Local<Object> rv;
+	Local<Array> histogram, entry, range;
+	uint64_t count, nitems;
+	uint32_t nentries;
+	size_t ii;
+
+	count = pp->count();
+	histogram = Array::New();
+	nentries = 0;
+
+	for (ii = 0; ii < CA_PHASE_NBUCKETS; ii++) {
+		if ((nitems = pp->bucket(ii)) == 0)
+			continue;
+
+		range = Array::New(2);
+		range->Set(0, Number::New((double)caPhase::bucketMin(ii)));
+		range->Set(1, Number::New(ii == CA_PHASE_NBUCKETS - 1 ?
+		    (double)pp->max() :
+		    (double)caPhase::bucketMin(ii + 1) - 1));
+
+		entry = Array::New(2);
+		entry->Set(0, range);
+		entry->Set(1, Number::New((double)nitems));
+		histogram->Set(nentries++, entry);
+	}
+
+	rv = Object::New();
+	rv->Set(String::New("count"), Number::New((double)count));
+	rv->Set(String::New("total"), Number::New((double)pp->total()));
+	rv->Set(String::New("max"), Number::New((double)pp->max()));
+	rv->Set(String::New("p50"), Number::New(
+	    (double)ca_phase_percentile(pp, count, 0.5)));
+	rv->Set(String::New("p90"), Number::New(
+	    (double)ca_phase_percentile(pp, count, 0.9)));
+	rv->Set(String::New("p99"), Number::New(
+	    (double)ca_phase_percentile(pp, count, 0.99)));
+	rv->Set(String::New("histogram"), histogram);
+	return (rv);
+}
+
+static Handle<Value>
+ca_hrtime(const Arguments& args)
+{
+	HandleScope scope;
+
+	return (scope.Close(Number::New((double)ca_phase_now())));
+}
+
+static Handle<Value>
+ca_phase_record(const Arguments& args)
+{
+	HandleScope scope;
+	hrtime_t now, start;
+	uint32_t count;
+
+	if (args.Length() < 2 || !args[0]->IsString() || !args[1]->IsNumber())
+		return (ca_throw("expected phase name and start time"));
+
+	count = 1;
+
+	if (args.Length() > 2 && !args[2]->IsUndefined()) {
+		if (!args[2]->IsNumber())
+			return (ca_throw("expected count to be a number"));
+
+		count = args[2]->Uint32Value();
+	}
+
+	now = ca_phase_now();
+	start = (hrtime_t)args[1]->NumberValue();
+
+	if (start > now || start < 0)
+		return (ca_throw("invalid start time"));
+
+	String::Utf8Value name(args[0]);
+	caPhase::lookup(string(*name, name.length()))->record(now - start,
+	    count);
+	return (scope.Close(Number::New((double)(now - start))));
+}
+
+static Handle<Value>
+ca_phase_stats(const Arguments& args)
+{
+	HandleScope scope;
+	Local<Object> rv;
+	size_t ii;
+
+	rv = Object::New();
+
+	for (ii = 0; ii < ca_phase_list.size(); ii++)
+		rv->Set(String::New(ca_phase_list[ii]->name().c_str()),
+		    ca_phase_describe(ca_phase_list[ii]));
+
+	return (scope.Close(rv));
+}
+
+void
+ca_phase_init(Handle<Object> target)
+{
+	ca_phase_origin = gethrtime();
+
+	ca_phase_parse = caPhase::lookup("ingest.parse");
+	ca_phase_update = caPhase::lookup("dataset.update");
+	ca_phase_bucketize = caPhase::lookup("heatmap.bucketize");
+	ca_phase_render = caPhase::lookup("heatmap.render");
+	ca_phase_png = caPhase::lookup("png.encode");
+	ca_phase_stash = caPhase::lookup("stash.encode");
+	ca_phase_compute = caPhase::lookup("instr.compute");
+	ca_phase_procscan = caPhase::lookup("proc.scan");
+	ca_phase_kstat = caPhase::lookup("kstat.diff");
+
+	target->Set(String::NewSymbol("hrtime"),
+	    FunctionTemplate::New(ca_hrtime)->GetFunction());
+	target->Set(String::NewSymbol("phaseRecord"),
+	    FunctionTemplate::New(ca_phase_record)->GetFunction());
+	target->Set(String::NewSymbol("phaseStats"),
+	    FunctionTemplate::New(ca_phase_stats)->GetFunction());
+}
@@ -0,0 +1,105 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright (c) 2014, Joyent, Inc.
+ */
+
+/*
+ * ca-phase.h: latency histograms for named phases of work
+ *
+ * A caPhase records how long each occurrence of some phase of work (e.g.,
+ * parsing a data message or encoding a PNG) took, in nanoseconds, in a
+ * histogram with power-of-two buckets.  Phases are cheap enough to leave
+ * enabled all the time: recording an occurrence takes two calls to gethrtime()
+ * and a few atomic adds, and doesn't take any locks, so phases may be recorded
+ * from any thread (including shards; see ca-shard.h).  When a phase covers a
+ * batch of similar items, the caller may record the whole batch at once with
+ * the number of items, in which case each item is counted as taking the mean
+ * time.
+ *
+ * Phases are identified by name and created on first lookup.  They're never
+ * destroyed, so components look up the phases they use when they're
+ * initialized and keep the pointers.  lookup() may only be called on the main
+ * thread.  See ca-phase.cc for the JavaScript interface.
+ */
+
+#ifndef _CA_PHASE_H
+#define	_CA_PHASE_H
+
+#include <atomic.h>
+#include <stdint.h>
+#include <sys/time.h>
+
+#include <string>
+
+#define	CA_PHASE_NBUCKETS	64	/* bucket i counts [2^(i-1), 2^i) ns */
+
+class caPhase {
+public:
+	static caPhase *lookup(const std::string &);
+
+	const std::string &name() const { return (ph_name); }
+	void record(hrtime_t, uint64_t = 1);
+
+	uint64_t count() const { return (load(&ph_count)); }
+	uint64_t total() const { return (load(&ph_total)); }
+	uint64_t max() const { return (load(&ph_max)); }
+	uint64_t bucket(size_t ii) const { return (load(&ph_buckets[ii])); }
+
+	static hrtime_t bucketMin(size_t ii) {
+		return (ii == 0 ? 0 : (hrtime_t)1 << (ii - 1));
+	}
+
+private:
+	caPhase(const std::string &);
+	caPhase(const caPhase &);
+	caPhase &operator=(const caPhase &);
+
+	/* 64-bit loads aren't necessarily atomic on 32-bit systems. */
+	static uint64_t load(volatile const uint64_t *valp) {
+		return (atomic_add_64_nv((volatile uint64_t *)valp, 0));
+	}
+
+	std::string		ph_name;
+	volatile uint64_t	ph_count;	/* items recorded */
+	volatile uint64_t	ph_total;	/* total nanoseconds */
+	volatile uint64_t	ph_max;		/* max nanoseconds per item */
+	volatile uint64_t	ph_buckets[CA_PHASE_NBUCKETS];
+};
+
+/*
+ * Records the time from construction to destruction against a phase.
+ */
+class caPhaseTimer {
+public:
+	caPhaseTimer(caPhase *phase, uint64_t count = 1) :
+	    pt_phase(phase), pt_count(count), pt_start(gethrtime()) {}
+
+	~caPhaseTimer() {
+		pt_phase->record(gethrtime() - pt_start, pt_count);
+	}
+
+private:
+	caPhase		*pt_phase;
+	uint64_t	pt_count;
+	hrtime_t	pt_start;
+};
+
+/*
+ * Phases recorded by the addon itself, created by ca_phase_init().
+ */
+extern caPhase *ca_phase_parse;		/* parsing an ingested message */
+extern caPhase *ca_phase_update;	/* adding an ingested message's value */
+extern caPhase *ca_phase_bucketize;	/* bucketizing a heatmap's columns */
+extern caPhase *ca_phase_render;	/* painting a heatmap's pixels */
+extern caPhase *ca_phase_png;		/* encoding a PNG */
+extern caPhase *ca_phase_stash;		/* encoding a stash */
+extern caPhase *ca_phase_compute;	/* computing a data point's value */
+extern caPhase *ca_phase_procscan;	/* scanning the process table */
+extern caPhase *ca_phase_kstat;		/* diffing a snapshot of kstats */
+
+#endif	/* _CA_PHASE_H */
@@ -0,0 +1,450 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright (c) 2014, Joyent, Inc.
+ */
+
+/*
+ * ca-png.cc: PNG encoding for heatmap images
+ *
+ * Heatmaps are returned to clients as base64-encoded PNGs.  This encoder takes
+ * the RGB pixels produced by the heatmap renderer and returns the base64 text
+ * directly.  The JavaScript interface is:
+ *
+ *	pngEncodeBase64(pixels, width, height[, options])
+ *
+ * where "pixels" is a Buffer of RGB pixels, row by row from the top, and
+ * "options" may specify:
+ *
+ *	level	zlib compression level, 0 (none) through 9 (best).  The
+ *		default is 6, zlib's own default.
+ *
+ *	filter	"none" to write every row unfiltered, or "adaptive" to choose
+ *		a filter for each row.  The default is "none" for indexed
+ *		images and "adaptive" for truecolor images, as the PNG
+ *		specification recommends.
+ *
+ * Heatmaps usually have few distinct colors, so whenever there are at most 256
+ * we write an indexed-color image: one byte per pixel plus a palette, which is
+ * a third of the data to compress and usually compresses better, too.
+ * Otherwise we fall back to 8-bit truecolor.  For adaptive filtering we use the
+ * "minimum sum of absolute differences" heuristic from the PNG specification:
+ * for each row, try all five filters and keep the one whose output bytes (as
+ * signed values) have the smallest absolute sum.
+ */
+
+#include <v8.h>
+#include <node.h>
+#include <node_buffer.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "ca-native.h"
+#include "ca-phase.h"
+#include "ca-png.h"
+
+using namespace v8;
+using std::vector;
+
+#define	CA_PNG_NFILTERS	5
+
+enum ca_png_filter {
+	CA_PNG_FILTER_NONE = 0,
+	CA_PNG_FILTER_SUB,
+	CA_PNG_FILTER_UP,
+	CA_PNG_FILTER_AVG,
+	CA_PNG_FILTER_PAETH
+};
+
+static const uint8_t ca_png_signature[] = {
+	0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'
+};
+
+static const char ca_base64[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static void
+ca_png_put32(vector<uint8_t> *out, uint32_t value)
+{
+	out->push_back((value >> 24) & 0xff);
+	out->push_back((value >> 16) & 0xff);
+	out->push_back((value >> 8) & 0xff);
+	out->push_back(value & 0xff);
+}
+
+/*
+ * Appends a chunk with the given type and contents.
+ */
+static void
+ca_png_chunk(vector<uint8_t> *out, const char *type, const uint8_t *data,
+    size_t len)
+{
+	size_t start;
+	uLong crc;
+
+	ca_png_put32(out, len);
+	start = out->size();
+	out->insert(out->end(), type, type + 4);
+	out->insert(out->end(), data, data + len);
+	crc = crc32(0L, Z_NULL, 0);
+	crc = crc32(crc, &(*out)[start], out->size() - start);
+	ca_png_put32(out, crc);
+}
+
+static uint8_t
+ca_png_paeth(uint8_t a, uint8_t b, uint8_t c)
+{
+	int p, pa, pb, pc;
+
+	p = (int)a + b - c;
+	pa = abs(p - a);
+	pb = abs(p - b);
+	pc = abs(p - c);
+
+	if (pa <= pb && pa <= pc)
+		return (a);
+
+	return (pb <= pc ? b : c);
+}
+
+/*
+ * Stores into "out" the given row filtered with filter "type".  "prev" is the
+ * previous (unfiltered) row, or all zeroes for the first row, and "bpp" is the
+ * number of bytes per pixel.
+ */
+static void
+ca_png_filter(int type, const uint8_t *row, const uint8_t *prev, size_t len,
+    size_t bpp, uint8_t *out)
+{
+	size_t ii;
+	uint8_t left, upleft;
+
+	for (ii = 0; ii < len; ii++) {
+		left = ii >= bpp ? row[ii - bpp] : 0;
+		upleft = ii >= bpp ? prev[ii - bpp] : 0;
+
+		switch (type) {
+		case CA_PNG_FILTER_NONE:
+			out[ii] = row[ii];
+			break;
+		case CA_PNG_FILTER_SUB:
+			out[ii] = row[ii] - left;
+			break;
+		case CA_PNG_FILTER_UP:
+			out[ii] = row[ii] - prev[ii];
+			break;
+		case CA_PNG_FILTER_AVG:
+			out[ii] = row[ii] - (((int)left + prev[ii]) >> 1);
+			break;
+		default:
+			out[ii] = row[ii] - ca_png_paeth(left, prev[ii],
+			    upleft);
+			break;
+		}
+	}
+}
+
+static uint64_t
+ca_png_cost(const uint8_t *data, size_t len)
+{
+	uint64_t sum = 0;
+	size_t ii;
+
+	for (ii = 0; ii < len; ii++)
+		sum += data[ii] < 128 ? data[ii] : 256 - data[ii];
+
+	return (sum);
+}
+
+/*
+ * Converts the RGB "pixels" into rows of palette indexes in "indexes" and the
+ * corresponding palette in "palette".  Returns false if there are more than
+ * 256 distinct colors.
+ */
+static bool
+ca_png_palettize(const uint8_t *pixels, size_t npixels,
+    vector<uint8_t> *indexes, vector<uint8_t> *palette)
+{
+	std::map<uint32_t, uint8_t> colors;
+	std::map<uint32_t, uint8_t>::iterator it;
+	uint32_t color, last;
+	uint8_t index;
+	size_t ii;
+
+	indexes->resize(npixels);
+	last = UINT32_MAX;
+	index = 0;
+
+	for (ii = 0; ii < npixels; ii++) {
+		color = (pixels[ii * 3] << 16) | (pixels[ii * 3 + 1] << 8) |
+		    pixels[ii * 3 + 2];
+
+		/* Runs of identical pixels are very common. */
+		if (color != last) {
+			if ((it = colors.find(color)) != colors.end()) {
+				index = it->second;
+			} else {
+				if (colors.size() == 256)
+					return (false);
+
+				index = colors.size();
+				colors[color] = index;
+				palette->push_back(pixels[ii * 3]);
+				palette->push_back(pixels[ii * 3 + 1]);
+				palette->push_back(pixels[ii * 3 + 2]);
+			}
+
+			last = color;
+		}
+
+		(*indexes)[ii] = index;
+	}
+
+	return (true);
+}
+
+/*
+ * Filters the image data (rows of "rowlen" bytes) and compresses it with zlib
+ * at the given level, storing the result in "out".
+ */
+static bool
+ca_png_compress(const uint8_t *data, size_t height, size_t rowlen, size_t bpp,
+    bool adaptive, int level, vector<uint8_t> *out)
+{
+	vector<uint8_t> filtered, candidate, zero;
+	const uint8_t *row, *prev;
+	uint8_t *dst;
+	uint64_t cost, best;
+	size_t yy;
+	z_stream zs;
+	int ff, bestf, err;
+
+	filtered.resize(height * (rowlen + 1));
+	candidate.resize(rowlen);
+	zero.resize(rowlen, 0);
+
+	for (yy = 0; yy < height; yy++) {
+		row = &data[yy * rowlen];
+		prev = yy > 0 ? &data[(yy - 1) * rowlen] : &zero[0];
+		dst = &filtered[yy * (rowlen + 1)];
+
+		if (!adaptive) {
+			dst[0] = CA_PNG_FILTER_NONE;
+			memcpy(dst + 1, row, rowlen);
+			continue;
+		}
+
+		bestf = CA_PNG_FILTER_NONE;
+		best = ca_png_cost(row, rowlen);
+
+		for (ff = CA_PNG_FILTER_SUB; ff < CA_PNG_NFILTERS; ff++) {
+			ca_png_filter(ff, row, prev, rowlen, bpp,
+			    &candidate[0]);
+			if ((cost = ca_png_cost(&candidate[0], rowlen)) <
+			    best) {
+				best = cost;
+				bestf = ff;
+			}
+		}
+
+		dst[0] = bestf;
+		ca_png_filter(bestf, row, prev, rowlen, bpp, dst + 1);
+	}
+
+	memset(&zs, 0, sizeof (zs));
+	if (deflateInit(&zs, level) != Z_OK)
+		return (false);
+
+	out->resize(deflateBound(&zs, filtered.size()));
+	zs.next_in = &filtered[0];
+	zs.avail_in = filtered.size();
+	zs.next_out = &(*out)[0];
+	zs.avail_out = out->size();
+	err = deflate(&zs, Z_FINISH);
+	out->resize(zs.total_out);
+	deflateEnd(&zs);
+	return (err == Z_STREAM_END);
+}
+
+/*
+ * Encodes "len" bytes of "data" as base64 into "out", which must have room for
+ * 4 * ceil(len / 3) bytes.
+ */
+static void
+ca_base64_encode(const uint8_t *data, size_t len, char *out)
+{
+	size_t ii;
+	uint32_t word;
+
+	for (ii = 0; ii + 2 < len; ii += 3) {
+		word = (data[ii] << 16) | (data[ii + 1] << 8) | data[ii + 2];
+		*out++ = ca_base64[(word >> 18) & 0x3f];
+		*out++ = ca_base64[(word >> 12) & 0x3f];
+		*out++ = ca_base64[(word >> 6) & 0x3f];
+		*out++ = ca_base64[word & 0x3f];
+	}
+
+	if (ii == len)
+		return;
+
+	word = data[ii] << 16;
+	if (ii + 1 < len)
+		word |= data[ii + 1] << 8;
+
+	*out++ = ca_base64[(word >> 18) & 0x3f];
+	*out++ = ca_base64[(word >> 12) & 0x3f];
+	*out++ = ii + 1 < len ? ca_base64[(word >> 6) & 0x3f] : '=';
+	*out++ = '=';
+}
+
+/*
+ * Parses the "options" argument described above.  Missing options keep their
+ * current values in "op".
+ */
+bool
+ca_png_options(Handle<Value> arg, caPngOptions *op, const char **errp)
+{
+	Local<Object> options;
+	Local<Value> val;
+
+	if (!arg->IsObject())
+		return (true);
+
+	options = arg->ToObject();
+
+	val = options->Get(String::New("level"));
+	if (!val->IsUndefined()) {
+		op->po_level = val->Int32Value();
+		if (op->po_level < 0 || op->po_level > 9) {
+			*errp = "invalid compression level";
+			return (false);
+		}
+	}
+
+	val = options->Get(String::New("filter"));
+	if (!val->IsUndefined()) {
+		String::Utf8Value filter(val);
+
+		if (strcmp(*filter, "none") == 0) {
+			op->po_filtering = CA_PNG_FILTERING_NONE;
+		} else if (strcmp(*filter, "adaptive") == 0) {
+			op->po_filtering = CA_PNG_FILTERING_ADAPTIVE;
+		} else {
+			*errp = "invalid filter";
+			return (false);
+		}
+	}
+
+	return (true);
+}
+
+bool
+ca_png_encode(const uint8_t *pixels, uint32_t width, uint32_t height,
+    const caPngOptions *op, std::string *out)
+{
+	caPhaseTimer timer(ca_phase_png);
+	vector<uint8_t> indexes, palette, idat, png;
+	const uint8_t *data;
+	uint8_t ihdr[13];
+	size_t npixels, bpp;
+	bool indexed, adaptive;
+	int level;
+
+	npixels = (size_t)width * height;
+	indexed = ca_png_palettize(pixels, npixels, &indexes, &palette);
+
+	if (op->po_filtering == CA_PNG_FILTERING_DEFAULT)
+		adaptive = !indexed;
+	else
+		adaptive = op->po_filtering == CA_PNG_FILTERING_ADAPTIVE;
+
+	level = op->po_level == -1 ? Z_DEFAULT_COMPRESSION : op->po_level;
+	data = indexed ? &indexes[0] : pixels;
+	bpp = indexed ? 1 : 3;
+
+	if (!ca_png_compress(data, height, width * bpp, bpp, adaptive, level,
+	    &idat))
+		return (false);
+
+	ihdr[0] = (width >> 24) & 0xff;
+	ihdr[1] = (width >> 16) & 0xff;
+	ihdr[2] = (width >> 8) & 0xff;
+	ihdr[3] = width & 0xff;
+	ihdr[4] = (height >> 24) & 0xff;
+	ihdr[5] = (height >> 16) & 0xff;
+	ihdr[6] = (height >> 8) & 0xff;
+	ihdr[7] = height & 0xff;
+	ihdr[8] = 8;			/* bit depth */
+	ihdr[9] = indexed ? 3 : 2;	/* color type: indexed or RGB */
+	ihdr[10] = 0;			/* compression method */
+	ihdr[11] = 0;			/* filter method */
+	ihdr[12] = 0;			/* interlace method */
+
+	png.reserve(sizeof (ca_png_signature) + 3 * 12 + sizeof (ihdr) +
+	    palette.size() + idat.size() + (indexed ? 12 : 0));
+	png.insert(png.end(), ca_png_signature,
+	    ca_png_signature + sizeof (ca_png_signature));
+	ca_png_chunk(&png, "IHDR", ihdr, sizeof (ihdr));
+
+	if (indexed)
+		ca_png_chunk(&png, "PLTE", &palette[0], palette.size());
+
+	ca_png_chunk(&png, "IDAT", &idat[0], idat.size());
+	ca_png_chunk(&png, "IEND", NULL, 0);
+
+	out->resize(4 * ((png.size() + 2) / 3));
+	ca_base64_encode(&png[0], png.size(), &(*out)[0]);
+	return (true);
+}
+
+static Handle<Value>
+ca_png_encode_base64(const Arguments& args)
+{
+	HandleScope scope;
+	caPngOptions options;
+	uint32_t width, height;
+	const char *err;
+	std::string text;
+
+	if (args.Length() < 3 || !node::Buffer::HasInstance(args[0]) ||
+	    !args[1]->IsNumber() || !args[2]->IsNumber())
+		return (ca_throw("expected pixels, width, and height"));
+
+	width = args[1]->Uint32Value();
+	height = args[2]->Uint32Value();
+
+	if (width == 0 || height == 0 ||
+	    node::Buffer::Length(args[0]->ToObject()) !=
+	    (size_t)width * height * 3)
+		return (ca_throw("pixels don't match dimensions"));
+
+	if (args.Length() > 3 && !ca_png_options(args[3], &options, &err))
+		return (ca_throw(err));
+
+	if (!ca_png_encode(
+	    (const uint8_t *)node::Buffer::Data(args[0]->ToObject()),
+	    width, height, &options, &text))
+		return (ca_throw("failed to compress image"));
+
+	return (scope.Close(String::New(text.data(), text.size())));
+}
+
+void
+ca_png_init(Handle<Object> target)
+{
+	Local<FunctionTemplate> templ =
+	    FunctionTemplate::New(ca_png_encode_base64);
+
+	target->Set(String::NewSymbol("pngEncodeBase64"),
+	    templ->GetFunction());
+}
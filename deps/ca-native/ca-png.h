@@ -0,0 +1,47 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright (c) 2014, Joyent, Inc.
+ */
+
+/*
+ * ca-png.h: PNG encoding for heatmap images (see ca-png.cc)
+ */
+
+#ifndef _CA_PNG_H
+#define	_CA_PNG_H
+
+#include <v8.h>
+
+#include <stdint.h>
+
+#include <string>
+
+enum ca_png_filtering {
+	CA_PNG_FILTERING_DEFAULT,	/* depends on the color type */
+	CA_PNG_FILTERING_NONE,
+	CA_PNG_FILTERING_ADAPTIVE
+};
+
+struct caPngOptions {
+	caPngOptions() : po_level(-1), po_filtering(CA_PNG_FILTERING_DEFAULT) {}
+
+	int			po_level;	/* zlib level, -1 for default */
+	ca_png_filtering	po_filtering;
+};
+
+extern bool ca_png_options(v8::Handle<v8::Value>, caPngOptions *,
+    const char **);
+
+/*
+ * Encodes RGB pixels as a base64 PNG.  This doesn't use V8, so it may be
+ * invoked from any thread.
+ */
+extern bool ca_png_encode(const uint8_t *, uint32_t, uint32_t,
+    const caPngOptions *, std::string *);
+
+#endif	/* _CA_PNG_H */
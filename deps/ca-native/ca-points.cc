@@ -0,0 +1,431 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright (c) 2014, Joyent, Inc.
+ */
+
+/*
+ * ca-points.cc: columnar batches of instrumenter data points (see ca-points.h)
+ *
+ * The JavaScript interface is:
+ *
+ *	new DataPoints(discrete[, numeric])
+ *
+ *					Creates an empty batch storing the
+ *					fields named in array "discrete" as
+ *					interned keys and those named in array
+ *					"numeric" as numbers
+ *
+ *	load(points)			Appends "points", an array of data
+ *					points, each an object with "fields"
+ *					and "value" as described in ca-instr.js
+ *
+ *	length()			Returns the number of points in the
+ *					batch
+ *
+ *	fields()			Returns an object with arrays
+ *					"discrete" and "numeric" naming the
+ *					batch's fields
+ *
+ *	filter(bits)			Removes the points whose bits aren't set
+ *					in Buffer "bits" (bit ii % 8 of byte
+ *					ii / 8 for point ii), as returned by a
+ *					Predicate's select()
+ *
+ *	toArray()			Returns the points as an array of data
+ *					points, with discrete fields as strings
+ */
+
+#include <v8.h>
+#include <node.h>
+#include <node_buffer.h>
+
+#include <string>
+#include <vector>
+
+#include "ca-native.h"
+#include "ca-points.h"
+
+using namespace v8;
+using std::string;
+using std::vector;
+
+caPoints::caPoints(const vector<string> &discrete,
+    const vector<string> &numeric)
+{
+	size_t ii;
+
+	for (ii = 0; ii < discrete.size() + numeric.size(); ii++) {
+		const string &name = ii < discrete.size() ? discrete[ii] :
+		    numeric[ii - discrete.size()];
+
+		pt_fields.push_back(name);
+		pt_numeric.push_back(ii >= discrete.size());
+	}
+
+	pt_columns.resize(pt_fields.size());
+}
+
+bool
+caPoints::field(const string &name, size_t *fieldp) const
+{
+	size_t ii;
+
+	for (ii = 0; ii < pt_fields.size(); ii++) {
+		if (pt_fields[ii] == name) {
+			*fieldp = ii;
+			return (true);
+		}
+	}
+
+	return (false);
+}
+
+/*
+ * Appends a point whose field values are given in the order of the batch's
+ * fields: key identifiers (see intern()) for discrete fields and numbers for
+ * numeric ones.
+ */
+void
+caPoints::append(const double *fields, double value)
+{
+	size_t ii;
+
+	for (ii = 0; ii < pt_columns.size(); ii++)
+		pt_columns[ii].push_back(fields[ii]);
+
+	pt_values.push_back(value);
+}
+
+/*
+ * Appends an array of data points described by JavaScript objects.  Discrete
+ * fields are interned by their string values, just as they'd be used as keys
+ * of a decomposition.  Returns false (having appended only the points before
+ * it) if some element of "points" isn't a data point.
+ */
+bool
+caPoints::load(Handle<Array> points)
+{
+	HandleScope scope;
+	vector<Local<String> > names;
+	Local<String> fieldsname, valuename;
+	Local<Object> obj, fields;
+	Local<Value> point, value;
+	uint32_t pp;
+	size_t ii;
+
+	for (ii = 0; ii < pt_fields.size(); ii++)
+		names.push_back(String::New(pt_fields[ii].c_str(),
+		    pt_fields[ii].size()));
+
+	fieldsname = String::NewSymbol("fields");
+	valuename = String::NewSymbol("value");
+
+	for (pp = 0; pp < points->Length(); pp++) {
+		point = points->Get(pp);
+		if (!point->IsObject())
+			return (false);
+
+		obj = point->ToObject();
+		value = obj->Get(fieldsname);
+		if (!value->IsObject())
+			return (false);
+
+		fields = value->ToObject();
+
+		for (ii = 0; ii < pt_columns.size(); ii++) {
+			value = fields->Get(names[ii]);
+
+			if (pt_numeric[ii]) {
+				pt_columns[ii].push_back(value->NumberValue());
+				continue;
+			}
+
+			String::Utf8Value key(value);
+			pt_columns[ii].push_back(pt_keys.intern(
+			    string(*key, key.length())));
+		}
+
+		pt_values.push_back(obj->Get(valuename)->NumberValue());
+	}
+
+	return (true);
+}
+
+/*
+ * Removes the points whose bits aren't set in "bits", preserving the order of
+ * the rest.
+ */
+void
+caPoints::filter(const uint8_t *bits)
+{
+	size_t ii, jj, ff;
+
+	for (ii = 0, jj = 0; ii < pt_values.size(); ii++) {
+		if (!(bits[ii / 8] & (1 << (ii % 8))))
+			continue;
+
+		for (ff = 0; ff < pt_columns.size(); ff++)
+			pt_columns[ff][jj] = pt_columns[ff][ii];
+
+		pt_values[jj++] = pt_values[ii];
+	}
+
+	for (ff = 0; ff < pt_columns.size(); ff++)
+		pt_columns[ff].resize(jj);
+
+	pt_values.resize(jj);
+}
+
+/*
+ * Removes all points.  The interned keys are kept, so identifiers obtained from
+ * intern() remain valid for subsequent points.
+ */
+void
+caPoints::clear()
+{
+	size_t ff;
+
+	for (ff = 0; ff < pt_columns.size(); ff++)
+		pt_columns[ff].clear();
+
+	pt_values.clear();
+}
+
+class DataPoints : public node::ObjectWrap {
+public:
+	static void Initialize(Handle<Object>);
+	static Persistent<FunctionTemplate> dp_templ;
+
+	caPoints *points() { return (&dp_points); }
+
+protected:
+	static Handle<Value> New(const Arguments&);
+	static Handle<Value> Load(const Arguments&);
+	static Handle<Value> Length(const Arguments&);
+	static Handle<Value> Fields(const Arguments&);
+	static Handle<Value> Filter(const Arguments&);
+	static Handle<Value> ToArray(const Arguments&);
+
+private:
+	DataPoints(const vector<string> &discrete,
+	    const vector<string> &numeric) : dp_points(discrete, numeric) {}
+
+	caPoints	dp_points;
+};
+
+Persistent<FunctionTemplate> DataPoints::dp_templ;
+
+void
+DataPoints::Initialize(Handle<Object> target)
+{
+	HandleScope scope;
+	Local<FunctionTemplate> templ = FunctionTemplate::New(DataPoints::New);
+
+	dp_templ = Persistent<FunctionTemplate>::New(templ);
+	dp_templ->InstanceTemplate()->SetInternalFieldCount(1);
+	dp_templ->SetClassName(String::NewSymbol("DataPoints"));
+
+	NODE_SET_PROTOTYPE_METHOD(dp_templ, "load", DataPoints::Load);
+	NODE_SET_PROTOTYPE_METHOD(dp_templ, "length", DataPoints::Length);
+	NODE_SET_PROTOTYPE_METHOD(dp_templ, "fields", DataPoints::Fields);
+	NODE_SET_PROTOTYPE_METHOD(dp_templ, "filter", DataPoints::Filter);
+	NODE_SET_PROTOTYPE_METHOD(dp_templ, "toArray", DataPoints::ToArray);
+
+	target->Set(String::NewSymbol("DataPoints"), dp_templ->GetFunction());
+}
+
+/*
+ * Reads an array of field names into "names".
+ */
+static bool
+ca_points_names(Handle<Value> arg, vector<string> *names)
+{
+	Local<Array> array;
+	uint32_t ii;
+
+	if (!arg->IsArray())
+		return (false);
+
+	array = Local<Array>::Cast(arg);
+
+	for (ii = 0; ii < array->Length(); ii++) {
+		if (!array->Get(ii)->IsString())
+			return (false);
+
+		String::Utf8Value name(array->Get(ii));
+		names->push_back(string(*name, name.length()));
+	}
+
+	return (true);
+}
+
+Handle<Value>
+DataPoints::New(const Arguments& args)
+{
+	HandleScope scope;
+	vector<string> discrete, numeric;
+
+	if (args.Length() < 1 || !ca_points_names(args[0], &discrete))
+		return (ca_throw("expected array of discrete fields"));
+
+	if (args.Length() > 1 && !args[1]->IsUndefined() &&
+	    !ca_points_names(args[1], &numeric))
+		return (ca_throw("expected array of numeric fields"));
+
+	(new DataPoints(discrete, numeric))->Wrap(args.Holder());
+	return (args.This());
+}
+
+Handle<Value>
+DataPoints::Load(const Arguments& args)
+{
+	HandleScope scope;
+	DataPoints *dp = ObjectWrap::Unwrap<DataPoints>(args.Holder());
+
+	if (args.Length() < 1 || !args[0]->IsArray() ||
+	    !dp->dp_points.load(Local<Array>::Cast(args[0])))
+		return (ca_throw("expected array of data points"));
+
+	return (Undefined());
+}
+
+Handle<Value>
+DataPoints::Length(const Arguments& args)
+{
+	HandleScope scope;
+	DataPoints *dp = ObjectWrap::Unwrap<DataPoints>(args.Holder());
+
+	return (scope.Close(Number::New(dp->dp_points.size())));
+}
+
+Handle<Value>
+DataPoints::Fields(const Arguments& args)
+{
+	HandleScope scope;
+	DataPoints *dp = ObjectWrap::Unwrap<DataPoints>(args.Holder());
+	Local<Object> rv = Object::New();
+	Local<Array> discrete = Array::New();
+	Local<Array> numeric = Array::New();
+	Local<Array> which;
+	size_t ii;
+
+	for (ii = 0; ii < dp->dp_points.nfields(); ii++) {
+		const string &name = dp->dp_points.fieldName(ii);
+		which = dp->dp_points.numeric(ii) ? numeric : discrete;
+		which->Set(which->Length(), String::New(name.c_str(),
+		    name.size()));
+	}
+
+	rv->Set(String::NewSymbol("discrete"), discrete);
+	rv->Set(String::NewSymbol("numeric"), numeric);
+	return (scope.Close(rv));
+}
+
+Handle<Value>
+DataPoints::Filter(const Arguments& args)
+{
+	HandleScope scope;
+	DataPoints *dp = ObjectWrap::Unwrap<DataPoints>(args.Holder());
+
+	if (args.Length() < 1 || !node::Buffer::HasInstance(args[0]) ||
+	    node::Buffer::Length(args[0]->ToObject()) <
+	    (dp->dp_points.size() + 7) / 8)
+		return (ca_throw("expected Buffer with a bit for each point"));
+
+	dp->dp_points.filter((const uint8_t *)node::Buffer::Data(
+	    args[0]->ToObject()));
+	return (Undefined());
+}
+
+Handle<Value>
+DataPoints::ToArray(const Arguments& args)
+{
+	HandleScope scope;
+	DataPoints *dp = ObjectWrap::Unwrap<DataPoints>(args.Holder());
+	const caPoints &points = dp->dp_points;
+	vector<Local<String> > names;
+	Local<String> fieldsname, valuename;
+	Local<Array> rv;
+	Local<Object> point, fields;
+	size_t ii, ff;
+
+	for (ff = 0; ff < points.nfields(); ff++)
+		names.push_back(String::New(points.fieldName(ff).c_str(),
+		    points.fieldName(ff).size()));
+
+	fieldsname = String::NewSymbol("fields");
+	valuename = String::NewSymbol("value");
+	rv = Array::New(points.size());
+
+	for (ii = 0; ii < points.size(); ii++) {
+		fields = Object::New();
+
+		for (ff = 0; ff < points.nfields(); ff++) {
+			if (points.numeric(ff)) {
+				fields->Set(names[ff],
+				    Number::New(points.number(ff, ii)));
+				continue;
+			}
+
+			const string &key = points.keyName(points.key(ff, ii));
+			fields->Set(names[ff], String::New(key.c_str(),
+			    key.size()));
+		}
+
+		point = Object::New();
+		point->Set(fieldsname, fields);
+		point->Set(valuename, Number::New(points.value(ii)));
+		rv->Set(ii, point);
+	}
+
+	return (scope.Close(rv));
+}
+
+caPoints *
+ca_points_unwrap(Handle<Value> value)
+{
+	if (!value->IsObject() || !DataPoints::dp_templ->HasInstance(value))
+		return (NULL);
+
+	return (node::ObjectWrap::Unwrap<DataPoints>(
+	    value->ToObject())->points());
+}
+
+/*
+ * Creates a new, empty DataPoints batch.
+ */
+Local<Object>
+ca_points_new(const vector<string> &discrete, const vector<string> &numeric)
+{
+	HandleScope scope;
+	Local<Array> names[2];
+	Handle<Value> argv[2];
+	size_t ii;
+
+	names[0] = Array::New(discrete.size());
+	names[1] = Array::New(numeric.size());
+
+	for (ii = 0; ii < discrete.size(); ii++)
+		names[0]->Set(ii, String::New(discrete[ii].c_str(),
+		    discrete[ii].size()));
+
+	for (ii = 0; ii < numeric.size(); ii++)
+		names[1]->Set(ii, String::New(numeric[ii].c_str(),
+		    numeric[ii].size()));
+
+	argv[0] = names[0];
+	argv[1] = names[1];
+	return (scope.Close(DataPoints::dp_templ->GetFunction()->NewInstance(
+	    2, argv)));
+}
+
+void
+ca_points_init(Handle<Object> target)
+{
+	DataPoints::Initialize(target);
+}
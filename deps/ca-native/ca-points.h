@@ -0,0 +1,97 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright (c) 2014, Joyent, Inc.
+ */
+
+/*
+ * ca-points.h: columnar batches of instrumenter data points
+ *
+ * Instrumenter backends describe the data for each tick as a list of data
+ * points, each with a value and a set of fields (see lib/ca/ca-instr.js).  A
+ * caPoints stores a batch of data points by column instead: for each field, an
+ * array with that field's value for every point, plus an array of the points'
+ * values.  Values of discrete fields are interned, so a discrete column is an
+ * array of small integer identifiers that can be compared and grouped without
+ * looking at strings.  Numeric fields are stored as numbers.  Fields that
+ * aren't part of the batch aren't stored at all, so a batch need only include
+ * the fields that are actually used to compute a value.
+ *
+ * See ca-points.cc for the JavaScript interface.
+ */
+
+#ifndef _CA_POINTS_H
+#define	_CA_POINTS_H
+
+#include <v8.h>
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "ca-native.h"
+
+class caPoints {
+public:
+	caPoints(const std::vector<std::string> &,
+	    const std::vector<std::string> &);
+
+	size_t size() const { return (pt_values.size()); }
+	size_t nfields() const { return (pt_fields.size()); }
+	const std::string &fieldName(size_t ff) const {
+		return (pt_fields[ff]);
+	}
+	bool numeric(size_t ff) const { return (pt_numeric[ff]); }
+	bool field(const std::string &, size_t *) const;
+
+	/* discrete fields */
+	uint32_t key(size_t ff, size_t pp) const {
+		return ((uint32_t)pt_columns[ff][pp]);
+	}
+	const std::string &keyName(uint32_t id) const {
+		return (pt_keys.name(id));
+	}
+	bool lookup(const std::string &name, uint32_t *idp) const {
+		return (pt_keys.lookup(name, idp));
+	}
+	uint32_t intern(const std::string &name) {
+		return (pt_keys.intern(name));
+	}
+	size_t nkeys() const { return (pt_keys.size()); }
+
+	/* numeric fields */
+	double number(size_t ff, size_t pp) const {
+		return (pt_columns[ff][pp]);
+	}
+	const double *numbers(size_t ff) const {
+		return (pt_columns[ff].empty() ? NULL : &pt_columns[ff][0]);
+	}
+
+	double value(size_t pp) const { return (pt_values[pp]); }
+
+	void append(const double *, double);
+	bool load(v8::Handle<v8::Array>);
+	void filter(const uint8_t *);
+	void clear();
+
+private:
+	caPoints(const caPoints &);
+	caPoints &operator=(const caPoints &);
+
+	std::vector<std::string>		pt_fields;
+	std::vector<bool>			pt_numeric;
+	caInternTable				pt_keys;
+	std::vector<std::vector<double> >	pt_columns;
+	std::vector<double>			pt_values;
+};
+
+extern caPoints *ca_points_unwrap(v8::Handle<v8::Value>);
+extern v8::Local<v8::Object> ca_points_new(const std::vector<std::string> &,
+    const std::vector<std::string> &);
+
+#endif	/* _CA_POINTS_H */
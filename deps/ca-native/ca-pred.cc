@@ -0,0 +1,530 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright (c) 2014, Joyent, Inc.
+ */
+
+/*
+ * ca-pred.cc: compiled predicates
+ *
+ * The JavaScript interface is:
+ *
+ *	new Predicate(pred)		Compiles "pred", a predicate as
+ *					described in ca-pred.js.  The predicate
+ *					should already have been validated.
+ *
+ *	fields()			Returns an object with arrays
+ *					"discrete" and "numeric" naming the
+ *					fields the predicate uses, suitable for
+ *					constructing a DataPoints batch.
+ *
+ *	select(points)			Evaluates the predicate for each point
+ *					in "points" (a DataPoints batch; see
+ *					ca-points.h) and returns a Buffer with
+ *					one bit per point (bit ii % 8 of byte
+ *					ii / 8), set if the point satisfies the
+ *					predicate.
+ *
+ * caPredEval() copies and interprets the whole predicate for each data point.
+ * Here, the predicate is instead compiled once into a flat program in postfix
+ * order: each comparison computes a bitmap over the whole batch by scanning a
+ * single column, and each "and" or "or" combines the bitmaps of its operands a
+ * word at a time.  Comparisons of discrete fields compare interned key
+ * identifiers rather than strings, and an "or" of several "eq" comparisons of
+ * the same discrete field (as used to select a list of zones) is compiled into
+ * a single set membership test.
+ *
+ * Comparisons with numbers treat the field as numeric and comparisons with
+ * strings treat it as discrete, so a field may not be used both ways.
+ */
+
+#include <v8.h>
+#include <node.h>
+#include <node_buffer.h>
+
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "ca-native.h"
+#include "ca-points.h"
+
+using namespace v8;
+using std::string;
+using std::vector;
+
+enum ca_pred_op {
+	CA_PRED_LT,
+	CA_PRED_LE,
+	CA_PRED_GT,
+	CA_PRED_GE,
+	CA_PRED_EQ,
+	CA_PRED_NE,
+	CA_PRED_IN,
+	CA_PRED_AND,
+	CA_PRED_OR
+};
+
+struct ca_pred_insn {
+	ca_pred_op	pi_op;
+	size_t		pi_field;	/* index into pr_fields */
+	double		pi_number;	/* numeric constant */
+	vector<string>	pi_strings;	/* discrete constant(s) */
+	size_t		pi_nargs;	/* operands of "and" and "or" */
+};
+
+typedef vector<uint64_t> ca_bitmap_t;
+
+class caPredicate {
+public:
+	caPredicate() {}
+
+	bool compile(Handle<Value>, const char **);
+	const char *select(const caPoints *, ca_bitmap_t *) const;
+
+	size_t nfields() const { return (pr_fields.size()); }
+	const string &fieldName(size_t ff) const { return (pr_fields[ff]); }
+	bool numeric(size_t ff) const { return (pr_numeric[ff]); }
+
+private:
+	bool compileOr(Local<Array>, const char **);
+	bool field(Handle<Value>, bool, size_t *, const char **);
+
+	vector<string>		pr_fields;
+	vector<bool>		pr_numeric;
+	vector<ca_pred_insn>	pr_insns;
+};
+
+/*
+ * Returns the index of the named field, adding it if it's not already used.
+ */
+bool
+caPredicate::field(Handle<Value> name, bool numeric, size_t *fieldp,
+    const char **errp)
+{
+	size_t ii;
+
+	if (!name->IsString()) {
+		*errp = "predicate field is not a string";
+		return (false);
+	}
+
+	String::Utf8Value str(name);
+	string fieldname(*str, str.length());
+
+	for (ii = 0; ii < pr_fields.size(); ii++) {
+		if (pr_fields[ii] != fieldname)
+			continue;
+
+		if (pr_numeric[ii] != numeric) {
+			*errp = "predicate field compared with both numbers "
+			    "and strings";
+			return (false);
+		}
+
+		*fieldp = ii;
+		return (true);
+	}
+
+	pr_fields.push_back(fieldname);
+	pr_numeric.push_back(numeric);
+	*fieldp = ii;
+	return (true);
+}
+
+/*
+ * Compiles an "or" whose operands are all "eq" comparisons of the same discrete
+ * field into a single "in" instruction.  Returns false, having done nothing, if
+ * the operands don't have that form.
+ */
+bool
+caPredicate::compileOr(Local<Array> args, const char **errp)
+{
+	HandleScope scope;
+	ca_pred_insn insn;
+	Local<Object> obj;
+	Local<Array> props, rel;
+	Local<Value> name;
+	uint32_t ii;
+
+	insn.pi_op = CA_PRED_IN;
+	insn.pi_nargs = 0;
+	insn.pi_number = 0;
+
+	for (ii = 0; ii < args->Length(); ii++) {
+		if (!args->Get(ii)->IsObject())
+			return (false);
+
+		obj = args->Get(ii)->ToObject();
+		props = obj->GetPropertyNames();
+
+		if (props->Length() != 1 || !obj->Get(props->Get(0))->IsArray())
+			return (false);
+
+		String::Utf8Value key(props->Get(0));
+		rel = Local<Array>::Cast(obj->Get(props->Get(0)));
+
+		if (strcmp(*key, "eq") != 0 || rel->Length() != 2 ||
+		    !rel->Get(0)->IsString() || !rel->Get(1)->IsString())
+			return (false);
+
+		String::Utf8Value fieldname(rel->Get(0));
+
+		if (ii == 0)
+			name = rel->Get(0);
+		else if (strcmp(*fieldname, *String::Utf8Value(name)) != 0)
+			return (false);
+
+		String::Utf8Value str(rel->Get(1));
+		insn.pi_strings.push_back(string(*str, str.length()));
+	}
+
+	if (!field(name, false, &insn.pi_field, errp))
+		return (false);
+
+	pr_insns.push_back(insn);
+	return (true);
+}
+
+/*
+ * Appends the instructions for "pred" to the program.
+ */
+bool
+caPredicate::compile(Handle<Value> pred, const char **errp)
+{
+	HandleScope scope;
+	ca_pred_insn insn;
+	Local<Object> obj;
+	Local<Array> props, args;
+	Local<Value> constant;
+	const char *err;
+	uint32_t ii;
+
+	if (!pred->IsObject()) {
+		*errp = "predicate must be an object";
+		return (false);
+	}
+
+	obj = pred->ToObject();
+	props = obj->GetPropertyNames();
+
+	if (props->Length() == 0) {
+		/* The trivial predicate matches everything. */
+		insn.pi_op = CA_PRED_AND;
+		insn.pi_nargs = 0;
+		pr_insns.push_back(insn);
+		return (true);
+	}
+
+	if (props->Length() != 1 || !obj->Get(props->Get(0))->IsArray()) {
+		*errp = "predicate must have a single key";
+		return (false);
+	}
+
+	String::Utf8Value key(props->Get(0));
+	args = Local<Array>::Cast(obj->Get(props->Get(0)));
+	insn.pi_nargs = 0;
+	insn.pi_number = 0;
+
+	if (strcmp(*key, "and") == 0 || strcmp(*key, "or") == 0) {
+		insn.pi_op = strcmp(*key, "and") == 0 ? CA_PRED_AND :
+		    CA_PRED_OR;
+		insn.pi_nargs = args->Length();
+
+		if (insn.pi_nargs < 1) {
+			*errp = "logical expression has no operands";
+			return (false);
+		}
+
+		err = NULL;
+		if (insn.pi_op == CA_PRED_OR && insn.pi_nargs > 1 &&
+		    compileOr(args, &err))
+			return (true);
+
+		if (err != NULL) {
+			*errp = err;
+			return (false);
+		}
+
+		for (ii = 0; ii < args->Length(); ii++) {
+			if (!compile(args->Get(ii), errp))
+				return (false);
+		}
+
+		pr_insns.push_back(insn);
+		return (true);
+	}
+
+	if (strcmp(*key, "lt") == 0)
+		insn.pi_op = CA_PRED_LT;
+	else if (strcmp(*key, "le") == 0)
+		insn.pi_op = CA_PRED_LE;
+	else if (strcmp(*key, "gt") == 0)
+		insn.pi_op = CA_PRED_GT;
+	else if (strcmp(*key, "ge") == 0)
+		insn.pi_op = CA_PRED_GE;
+	else if (strcmp(*key, "eq") == 0)
+		insn.pi_op = CA_PRED_EQ;
+	else if (strcmp(*key, "ne") == 0)
+		insn.pi_op = CA_PRED_NE;
+	else {
+		*errp = "invalid predicate key";
+		return (false);
+	}
+
+	if (args->Length() != 2) {
+		*errp = "predicate key does not point to an array of two "
+		    "elements";
+		return (false);
+	}
+
+	constant = args->Get(1);
+
+	if (constant->IsNumber()) {
+		insn.pi_number = constant->NumberValue();
+	} else if (constant->IsString() &&
+	    (insn.pi_op == CA_PRED_EQ || insn.pi_op == CA_PRED_NE)) {
+		String::Utf8Value str(constant);
+		insn.pi_strings.push_back(string(*str, str.length()));
+	} else {
+		*errp = "predicate constant has the wrong type";
+		return (false);
+	}
+
+	if (!field(args->Get(0), constant->IsNumber(), &insn.pi_field, errp))
+		return (false);
+
+	pr_insns.push_back(insn);
+	return (true);
+}
+
+/*
+ * Evaluates the predicate for each point of "pp", storing a bitmap of the
+ * points that satisfy it into "out".  Returns an error message if the batch
+ * doesn't contain the fields the predicate uses.
+ */
+const char *
+caPredicate::select(const caPoints *pp, ca_bitmap_t *out) const
+{
+	vector<ca_bitmap_t> stack;
+	vector<size_t> columns;
+	vector<bool> member;
+	uint32_t id;
+	size_t nwords, column, ii, jj, kk;
+	double number;
+
+	for (ii = 0; ii < pr_fields.size(); ii++) {
+		if (!pp->field(pr_fields[ii], &column))
+			return ("predicate field is not part of the batch");
+
+		if (pp->numeric(column) != pr_numeric[ii])
+			return ("predicate field has the wrong arity");
+
+		columns.push_back(column);
+	}
+
+	nwords = (pp->size() + 63) / 64;
+
+	for (ii = 0; ii < pr_insns.size(); ii++) {
+		const ca_pred_insn &insn = pr_insns[ii];
+
+		if (insn.pi_op == CA_PRED_AND || insn.pi_op == CA_PRED_OR) {
+			if (insn.pi_nargs == 0) {
+				stack.push_back(ca_bitmap_t(nwords, ~0ULL));
+				continue;
+			}
+
+			ca_bitmap_t &first =
+			    stack[stack.size() - insn.pi_nargs];
+
+			for (jj = stack.size() - insn.pi_nargs + 1;
+			    jj < stack.size(); jj++) {
+				for (kk = 0; kk < nwords; kk++) {
+					if (insn.pi_op == CA_PRED_AND)
+						first[kk] &= stack[jj][kk];
+					else
+						first[kk] |= stack[jj][kk];
+				}
+			}
+
+			stack.resize(stack.size() - insn.pi_nargs + 1);
+			continue;
+		}
+
+		stack.push_back(ca_bitmap_t(nwords, 0));
+		ca_bitmap_t &bits = stack.back();
+		column = columns[insn.pi_field];
+
+		if (pr_numeric[insn.pi_field]) {
+			for (jj = 0; jj < pp->size(); jj++) {
+				number = pp->number(column, jj);
+
+				switch (insn.pi_op) {
+				case CA_PRED_LT:
+					if (!(number < insn.pi_number))
+						continue;
+					break;
+				case CA_PRED_LE:
+					if (!(number <= insn.pi_number))
+						continue;
+					break;
+				case CA_PRED_GT:
+					if (!(number > insn.pi_number))
+						continue;
+					break;
+				case CA_PRED_GE:
+					if (!(number >= insn.pi_number))
+						continue;
+					break;
+				case CA_PRED_EQ:
+					if (!(number == insn.pi_number))
+						continue;
+					break;
+				default:
+					if (!(number != insn.pi_number))
+						continue;
+					break;
+				}
+
+				bits[jj / 64] |= 1ULL << (jj % 64);
+			}
+
+			continue;
+		}
+
+		/*
+		 * Discrete comparisons: a constant that isn't among the
+		 * batch's keys doesn't match any point.
+		 */
+		member.assign(pp->nkeys(), false);
+
+		for (jj = 0; jj < insn.pi_strings.size(); jj++) {
+			if (pp->lookup(insn.pi_strings[jj], &id))
+				member[id] = true;
+		}
+
+		for (jj = 0; jj < pp->size(); jj++) {
+			if (member[pp->key(column, jj)] ==
+			    (insn.pi_op != CA_PRED_NE))
+				bits[jj / 64] |= 1ULL << (jj % 64);
+		}
+	}
+
+	out->swap(stack.back());
+	return (NULL);
+}
+
+class Predicate : public node::ObjectWrap {
+public:
+	static void Initialize(Handle<Object>);
+
+protected:
+	static Handle<Value> New(const Arguments&);
+	static Handle<Value> Fields(const Arguments&);
+	static Handle<Value> Select(const Arguments&);
+
+private:
+	static Persistent<FunctionTemplate> pr_templ;
+
+	caPredicate	pr_pred;
+};
+
+Persistent<FunctionTemplate> Predicate::pr_templ;
+
+void
+Predicate::Initialize(Handle<Object> target)
+{
+	HandleScope scope;
+	Local<FunctionTemplate> templ = FunctionTemplate::New(Predicate::New);
+
+	pr_templ = Persistent<FunctionTemplate>::New(templ);
+	pr_templ->InstanceTemplate()->SetInternalFieldCount(1);
+	pr_templ->SetClassName(String::NewSymbol("Predicate"));
+
+	NODE_SET_PROTOTYPE_METHOD(pr_templ, "fields", Predicate::Fields);
+	NODE_SET_PROTOTYPE_METHOD(pr_templ, "select", Predicate::Select);
+
+	target->Set(String::NewSymbol("Predicate"), pr_templ->GetFunction());
+}
+
+Handle<Value>
+Predicate::New(const Arguments& args)
+{
+	HandleScope scope;
+	Predicate *pp;
+	const char *err;
+
+	if (args.Length() < 1)
+		return (ca_throw("expected predicate"));
+
+	pp = new Predicate();
+
+	if (!pp->pr_pred.compile(args[0], &err)) {
+		delete (pp);
+		return (ca_throw(err));
+	}
+
+	pp->Wrap(args.Holder());
+	return (args.This());
+}
+
+Handle<Value>
+Predicate::Fields(const Arguments& args)
+{
+	HandleScope scope;
+	Predicate *pp = ObjectWrap::Unwrap<Predicate>(args.Holder());
+	const caPredicate &pred = pp->pr_pred;
+	Local<Object> rv = Object::New();
+	Local<Array> discrete = Array::New();
+	Local<Array> numeric = Array::New();
+	Local<Array> which;
+	size_t ii;
+
+	for (ii = 0; ii < pred.nfields(); ii++) {
+		which = pred.numeric(ii) ? numeric : discrete;
+		which->Set(which->Length(), String::New(
+		    pred.fieldName(ii).c_str(), pred.fieldName(ii).size()));
+	}
+
+	rv->Set(String::NewSymbol("discrete"), discrete);
+	rv->Set(String::NewSymbol("numeric"), numeric);
+	return (scope.Close(rv));
+}
+
+Handle<Value>
+Predicate::Select(const Arguments& args)
+{
+	HandleScope scope;
+	Predicate *pp = ObjectWrap::Unwrap<Predicate>(args.Holder());
+	caPoints *points;
+	ca_bitmap_t bits;
+	node::Buffer *buffer;
+	uint8_t *bytes;
+	const char *err;
+	size_t ii;
+
+	if (args.Length() < 1 || (points = ca_points_unwrap(args[0])) == NULL)
+		return (ca_throw("expected DataPoints"));
+
+	if ((err = pp->pr_pred.select(points, &bits)) != NULL)
+		return (ca_throw(err));
+
+	buffer = node::Buffer::New((points->size() + 7) / 8);
+	bytes = (uint8_t *)node::Buffer::Data(buffer->handle_);
+
+	for (ii = 0; ii < (points->size() + 7) / 8; ii++)
+		bytes[ii] = (uint8_t)(bits[ii / 8] >> (8 * (ii % 8)));
+
+	return (scope.Close(buffer->handle_));
+}
+
+void
+ca_pred_init(Handle<Object> target)
+{
+	Predicate::Initialize(target);
+}
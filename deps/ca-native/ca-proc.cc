@@ -0,0 +1,492 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright (c) 2014, Joyent, Inc.
+ */
+
+/*
+ * ca-proc.cc: batched scans of the process table
+ *
+ * The JavaScript interface is:
+ *
+ *	procScan(options, callback)
+ *
+ *		Reads every process in the process table on the thread pool and
+ *		invokes "callback" with an error or a snapshot of the table.
+ *		"options" may specify:
+ *
+ *		source	"psinfo" (the default) to read /proc/<pid>/psinfo, or
+ *			"linux" to read the Linux /proc/<pid>/stat, status, and
+ *			cmdline files
+ *
+ *		root	the directory to scan (default "/proc")
+ *
+ *		The snapshot is an object with "length", the number of
+ *		processes, and one array of that length for each column:
+ *		"pid", "ppid", "zoneid", "zonename", "contract", "rssize" (in
+ *		kilobytes), "nlwp", "dmodel" (a PR_MODEL_* value), "fname",
+ *		"psargs", "timesec", and "timensec".
+ *
+ * As with reading the table from JavaScript, this is a best effort: processes
+ * may come and go during the scan, so those whose files can't be read are
+ * skipped.  The scan only fails if the directory itself can't be read or if no
+ * process can be.  Each process is decoded into a fixed-size ca_proc_entry on
+ * the thread pool, including its zone name (looked up once per zone), so the
+ * main thread only has to copy the columns into JavaScript.
+ */
+
+#include <v8.h>
+#include <node.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <procfs.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <zone.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "ca-native.h"
+#include "ca-phase.h"
+
+using namespace v8;
+using std::string;
+using std::vector;
+
+/*
+ * A process as read by a caProcSource.  "pe_zone" is filled in by the scan.
+ */
+struct ca_proc_entry {
+	int32_t		pe_pid;
+	int32_t		pe_ppid;
+	int32_t		pe_zoneid;
+	int32_t		pe_contract;
+	uint32_t	pe_nlwp;
+	uint32_t	pe_zone;		/* index of zone name */
+	uint64_t	pe_rssize;		/* kilobytes */
+	int64_t		pe_timesec;
+	int32_t		pe_timensec;
+	uint8_t		pe_dmodel;
+	char		pe_fname[PRFNSZ];
+	char		pe_psargs[PRARGSZ];
+};
+
+/*
+ * A backend from which to read processes.  read() is given the process's
+ * directory (e.g., "/proc/123") and returns 0 or an errno value.  zonename()
+ * returns the name of a zone.  Both are invoked on the thread pool.
+ */
+class caProcSource {
+public:
+	virtual ~caProcSource() {}
+	virtual int read(const string &, int32_t, ca_proc_entry *) = 0;
+	virtual string zonename(int32_t);
+};
+
+/*
+ * A zone may be shutting down by the time we look up its name, in which case
+ * we get EINVAL and label it as such.
+ */
+string
+caProcSource::zonename(int32_t zoneid)
+{
+	char buf[ZONENAME_MAX];
+
+	if (getzonenamebyid(zoneid, buf, sizeof (buf)) < 0)
+		return ("shutting-down");
+
+	return (buf);
+}
+
+/*
+ * Reads up to "size" bytes of file "path" into "buf", returning the number of
+ * bytes read or -1 (with errno set).
+ */
+static ssize_t
+ca_proc_readfile(const string &path, char *buf, size_t size)
+{
+	ssize_t rv;
+	int fd, err;
+
+	if ((fd = open(path.c_str(), O_RDONLY)) < 0)
+		return (-1);
+
+	do {
+		rv = ::read(fd, buf, size);
+	} while (rv < 0 && errno == EINTR);
+
+	err = errno;
+	(void) close(fd);
+	errno = err;
+	return (rv);
+}
+
+/*
+ * Reads illumos's /proc/<pid>/psinfo.
+ */
+class caProcPsinfo : public caProcSource {
+public:
+	virtual int read(const string &, int32_t, ca_proc_entry *);
+};
+
+int
+caProcPsinfo::read(const string &dir, int32_t pid, ca_proc_entry *pep)
+{
+	psinfo_t info;
+	ssize_t rv;
+
+	if ((rv = ca_proc_readfile(dir + "/psinfo", (char *)&info,
+	    sizeof (info))) < 0)
+		return (errno);
+
+	if (rv != sizeof (info))
+		return (EIO);
+
+	pep->pe_pid = info.pr_pid;
+	pep->pe_ppid = info.pr_ppid;
+	pep->pe_zoneid = info.pr_zoneid;
+	pep->pe_contract = info.pr_contract;
+	pep->pe_nlwp = info.pr_nlwp;
+	pep->pe_rssize = info.pr_rssize;
+	pep->pe_timesec = info.pr_time.tv_sec;
+	pep->pe_timensec = info.pr_time.tv_nsec;
+	pep->pe_dmodel = info.pr_dmodel;
+	(void) snprintf(pep->pe_fname, sizeof (pep->pe_fname), "%s",
+	    info.pr_fname);
+	(void) snprintf(pep->pe_psargs, sizeof (pep->pe_psargs), "%s",
+	    info.pr_psargs);
+	return (0);
+}
+
+/*
+ * Reads Linux's /proc/<pid>/stat, status, and cmdline.  Linux has neither
+ * zones nor contracts, so every process is in the global zone with contract 0,
+ * and every process is assumed to have our own data model.  As with psinfo,
+ * the arguments are truncated to PRARGSZ - 1 characters.
+ */
+class caProcLinux : public caProcSource {
+public:
+	caProcLinux() : pl_ticks(sysconf(_SC_CLK_TCK)) {}
+	virtual int read(const string &, int32_t, ca_proc_entry *);
+	virtual string zonename(int32_t) { return ("global"); }
+
+private:
+	long	pl_ticks;	/* clock ticks per second */
+};
+
+int
+caProcLinux::read(const string &dir, int32_t pid, ca_proc_entry *pep)
+{
+	char buf[4096];
+	char *start, *end, *line;
+	unsigned long long utime, stime, ticks;
+	unsigned int nlwp;
+	ssize_t rv, ii;
+	size_t len;
+	char state;
+	int ppid;
+
+	/*
+	 * The command name is in parentheses and may itself contain spaces or
+	 * parentheses, so the remaining fields start after the last ')'.
+	 */
+	if ((rv = ca_proc_readfile(dir + "/stat", buf, sizeof (buf) - 1)) < 0)
+		return (errno);
+
+	buf[rv] = '\0';
+
+	if ((start = strchr(buf, '(')) == NULL ||
+	    (end = strrchr(buf, ')')) == NULL || end < start)
+		return (EIO);
+
+	if (sscanf(end + 1, " %c %d %*d %*d %*d %*d %*u %*u %*u %*u %*u "
+	    "%llu %llu %*d %*d %*d %*d %u", &state, &ppid, &utime, &stime,
+	    &nlwp) != 5)
+		return (EIO);
+
+	len = end - start - 1;
+	if (len >= sizeof (pep->pe_fname))
+		len = sizeof (pep->pe_fname) - 1;
+	(void) memcpy(pep->pe_fname, start + 1, len);
+	pep->pe_fname[len] = '\0';
+
+	ticks = pl_ticks > 0 ? pl_ticks : 100;
+	pep->pe_pid = pid;
+	pep->pe_ppid = ppid;
+	pep->pe_zoneid = 0;
+	pep->pe_contract = 0;
+	pep->pe_nlwp = nlwp;
+	pep->pe_timesec = (utime + stime) / ticks;
+	pep->pe_timensec = (utime + stime) % ticks * 1000000000ULL / ticks;
+	pep->pe_dmodel = sizeof (void *) == 8 ? PR_MODEL_LP64 : PR_MODEL_ILP32;
+
+	/* Kernel threads have no VmRSS. */
+	pep->pe_rssize = 0;
+	if ((rv = ca_proc_readfile(dir + "/status", buf,
+	    sizeof (buf) - 1)) < 0)
+		return (errno);
+
+	buf[rv] = '\0';
+
+	for (line = buf; line != NULL; line = strchr(line, '\n')) {
+		if (*line == '\n')
+			line++;
+
+		if (strncmp(line, "VmRSS:", sizeof ("VmRSS:") - 1) == 0) {
+			pep->pe_rssize = strtoull(line + sizeof ("VmRSS:") - 1,
+			    NULL, 10);
+			break;
+		}
+	}
+
+	/*
+	 * The arguments are separated by NULs.  Kernel threads have none, in
+	 * which case we use the command name as psinfo does.
+	 */
+	if ((rv = ca_proc_readfile(dir + "/cmdline", pep->pe_psargs,
+	    sizeof (pep->pe_psargs) - 1)) < 0)
+		return (errno);
+
+	for (ii = 0; ii < rv; ii++) {
+		if (pep->pe_psargs[ii] == '\0')
+			pep->pe_psargs[ii] = ' ';
+	}
+
+	while (rv > 0 && pep->pe_psargs[rv - 1] == ' ')
+		rv--;
+
+	pep->pe_psargs[rv] = '\0';
+
+	if (rv == 0)
+		(void) snprintf(pep->pe_psargs, sizeof (pep->pe_psargs), "%s",
+		    pep->pe_fname);
+
+	return (0);
+}
+
+/*
+ * State for scanning the process table on the thread pool.
+ */
+struct ca_proc_work {
+	uv_work_t		pw_req;
+	caProcSource		*pw_source;
+	string			pw_root;
+	vector<ca_proc_entry>	pw_entries;
+	vector<string>		pw_zones;
+	int			pw_errno;
+	const char		*pw_syscall;
+	Persistent<Function>	pw_callback;
+};
+
+static void
+ca_proc_scan_work(uv_work_t *req)
+{
+	ca_proc_work *pwp = (ca_proc_work *)req->data;
+	std::map<int32_t, uint32_t> zones;
+	std::map<int32_t, uint32_t>::iterator it;
+	ca_proc_entry entry;
+	struct dirent *dep;
+	size_t nerrors;
+	DIR *dirp;
+	char *end;
+	long pid;
+	int err;
+
+	caPhaseTimer timer(ca_phase_procscan);
+
+	if ((dirp = opendir(pwp->pw_root.c_str())) == NULL) {
+		pwp->pw_errno = errno;
+		pwp->pw_syscall = "opendir";
+		return;
+	}
+
+	nerrors = 0;
+
+	while ((dep = readdir(dirp)) != NULL) {
+		pid = strtol(dep->d_name, &end, 10);
+		if (*end != '\0' || end == dep->d_name || pid < 0)
+			continue;
+
+		(void) memset(&entry, 0, sizeof (entry));
+
+		if ((err = pwp->pw_source->read(pwp->pw_root + "/" +
+		    dep->d_name, pid, &entry)) != 0) {
+			pwp->pw_errno = err;
+			nerrors++;
+			continue;
+		}
+
+		if ((it = zones.find(entry.pe_zoneid)) == zones.end()) {
+			it = zones.insert(std::make_pair(entry.pe_zoneid,
+			    (uint32_t)pwp->pw_zones.size())).first;
+			pwp->pw_zones.push_back(
+			    pwp->pw_source->zonename(entry.pe_zoneid));
+		}
+
+		entry.pe_zone = it->second;
+		pwp->pw_entries.push_back(entry);
+	}
+
+	(void) closedir(dirp);
+
+	if (nerrors > 0 && pwp->pw_entries.empty())
+		pwp->pw_syscall = "open";
+	else
+		pwp->pw_errno = 0;
+}
+
+static void
+ca_proc_scan_done(uv_work_t *req)
+{
+	HandleScope scope;
+	ca_proc_work *pwp = (ca_proc_work *)req->data;
+	vector<Local<String> > zones;
+	Local<Array> pid, ppid, zoneid, zonename, contract, rssize, nlwp;
+	Local<Array> dmodel, fname, psargs, timesec, timensec;
+	Local<Object> snapshot;
+	Local<Value> argv[2];
+	uint32_t ii;
+
+	if (pwp->pw_errno != 0) {
+		argv[0] = node::ErrnoException(pwp->pw_errno, pwp->pw_syscall,
+		    NULL, pwp->pw_root.c_str());
+		argv[1] = Local<Value>::New(Undefined());
+	} else {
+		for (ii = 0; ii < pwp->pw_zones.size(); ii++)
+			zones.push_back(String::New(pwp->pw_zones[ii].c_str()));
+
+		pid = Array::New(pwp->pw_entries.size());
+		ppid = Array::New(pwp->pw_entries.size());
+		zoneid = Array::New(pwp->pw_entries.size());
+		zonename = Array::New(pwp->pw_entries.size());
+		contract = Array::New(pwp->pw_entries.size());
+		rssize = Array::New(pwp->pw_entries.size());
+		nlwp = Array::New(pwp->pw_entries.size());
+		dmodel = Array::New(pwp->pw_entries.size());
+		fname = Array::New(pwp->pw_entries.size());
+		psargs = Array::New(pwp->pw_entries.size());
+		timesec = Array::New(pwp->pw_entries.size());
+		timensec = Array::New(pwp->pw_entries.size());
+
+		for (ii = 0; ii < pwp->pw_entries.size(); ii++) {
+			const ca_proc_entry &entry = pwp->pw_entries[ii];
+
+			pid->Set(ii, Integer::New(entry.pe_pid));
+			ppid->Set(ii, Integer::New(entry.pe_ppid));
+			zoneid->Set(ii, Integer::New(entry.pe_zoneid));
+			zonename->Set(ii, zones[entry.pe_zone]);
+			contract->Set(ii, Integer::New(entry.pe_contract));
+			rssize->Set(ii, Number::New((double)entry.pe_rssize));
+			nlwp->Set(ii, Integer::NewFromUnsigned(entry.pe_nlwp));
+			dmodel->Set(ii, Integer::New(entry.pe_dmodel));
+			fname->Set(ii, String::New(entry.pe_fname));
+			psargs->Set(ii, String::New(entry.pe_psargs));
+			timesec->Set(ii, Number::New((double)entry.pe_timesec));
+			timensec->Set(ii, Integer::New(entry.pe_timensec));
+		}
+
+		snapshot = Object::New();
+		snapshot->Set(String::NewSymbol("length"),
+		    Integer::NewFromUnsigned(pwp->pw_entries.size()));
+		snapshot->Set(String::NewSymbol("pid"), pid);
+		snapshot->Set(String::NewSymbol("ppid"), ppid);
+		snapshot->Set(String::NewSymbol("zoneid"), zoneid);
+		snapshot->Set(String::NewSymbol("zonename"), zonename);
+		snapshot->Set(String::NewSymbol("contract"), contract);
+		snapshot->Set(String::NewSymbol("rssize"), rssize);
+		snapshot->Set(String::NewSymbol("nlwp"), nlwp);
+		snapshot->Set(String::NewSymbol("dmodel"), dmodel);
+		snapshot->Set(String::NewSymbol("fname"), fname);
+		snapshot->Set(String::NewSymbol("psargs"), psargs);
+		snapshot->Set(String::NewSymbol("timesec"), timesec);
+		snapshot->Set(String::NewSymbol("timensec"), timensec);
+
+		argv[0] = Local<Value>::New(Null());
+		argv[1] = snapshot;
+	}
+
+	TryCatch trycatch;
+	pwp->pw_callback->Call(Context::GetCurrent()->Global(), 2, argv);
+
+	pwp->pw_callback.Dispose();
+	delete (pwp->pw_source);
+	delete (pwp);
+
+	if (trycatch.HasCaught())
+		node::FatalException(trycatch);
+}
+
+static Handle<Value>
+ca_proc_scan(const Arguments& args)
+{
+	HandleScope scope;
+	Local<Object> options;
+	Local<Value> value;
+	ca_proc_work *pwp;
+	caProcSource *source;
+	string root;
+
+	if (args.Length() < 2 || !args[0]->IsObject() ||
+	    !args[1]->IsFunction())
+		return (ca_throw("expected options and callback"));
+
+	options = args[0]->ToObject();
+	value = options->Get(String::NewSymbol("source"));
+
+	if (value->IsUndefined()) {
+		source = new caProcPsinfo();
+	} else {
+		String::Utf8Value name(value);
+
+		if (!value->IsString())
+			return (ca_throw("expected source to be a string"));
+
+		if (strcmp(*name, "psinfo") == 0)
+			source = new caProcPsinfo();
+		else if (strcmp(*name, "linux") == 0)
+			source = new caProcLinux();
+		else
+			return (ca_throw("unsupported source"));
+	}
+
+	value = options->Get(String::NewSymbol("root"));
+
+	if (value->IsUndefined()) {
+		root = "/proc";
+	} else if (!value->IsString()) {
+		delete (source);
+		return (ca_throw("expected root to be a string"));
+	} else {
+		String::Utf8Value path(value);
+		root = string(*path, path.length());
+	}
+
+	pwp = new ca_proc_work();
+	pwp->pw_source = source;
+	pwp->pw_root = root;
+	pwp->pw_errno = 0;
+	pwp->pw_syscall = NULL;
+	pwp->pw_callback = Persistent<Function>::New(
+	    Local<Function>::Cast(args[1]));
+	pwp->pw_req.data = pwp;
+
+	(void) uv_queue_work(uv_default_loop(), &pwp->pw_req,
+	    ca_proc_scan_work, ca_proc_scan_done);
+	return (Undefined());
+}
+
+void
+ca_proc_init(Handle<Object> target)
+{
+	target->Set(String::NewSymbol("procScan"),
+	    FunctionTemplate::New(ca_proc_scan)->GetFunction());
+}
@@ -0,0 +1,721 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright (c) 2014, Joyent, Inc.
+ */
+
+/*
+ * ca-render.cc: native heatmap rendering (see ca-render.h)
+ *
+ * Every step here mirrors the corresponding node-heatmap function, including
+ * the order of floating-point operations, because the result must be
+ * pixel-for-pixel identical to what caAggrValueHeatmapImage() used to
+ * produce.  Rather than computing a color for each pixel, we compute one for
+ * each (column, bucket) cell and copy it to the pixels that cell covers.
+ */
+
+#include <v8.h>
+#include <node.h>
+#include <node_buffer.h>
+#include <uv.h>
+
+#include <math.h>
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+
+#include "ca-native.h"
+#include "ca-phase.h"
+#include "ca-png.h"
+#include "ca-render.h"
+
+using namespace v8;
+using std::string;
+using std::vector;
+
+/*
+ * The cache keeps columns for at most this many sets of parameters, and once a
+ * set holds more than twice as many columns as the current request used, it
+ * drops the columns that haven't been used in this many renders.
+ */
+#define	CA_HC_MAXSETS	8
+#define	CA_HC_KEEP	4
+
+static double
+ca_get_number(Handle<Object> obj, const char *name, double dflt)
+{
+	Local<Value> val = obj->Get(String::New(name));
+
+	if (val->IsUndefined() || val->IsNull())
+		return (dflt);
+
+	return (val->NumberValue());
+}
+
+static bool
+ca_get_bool(Handle<Object> obj, const char *name)
+{
+	return (obj->Get(String::New(name))->BooleanValue());
+}
+
+bool
+ca_heatmap_conf(Handle<Value> arg, caHeatmapConf *hcp, const char **errp)
+{
+	Local<Object> conf;
+	Local<Value> val;
+	Local<Array> array;
+	double base, nsamples, step, ii;
+
+	if (!arg->IsObject()) {
+		*errp = "expected heatmap configuration";
+		return (false);
+	}
+
+	conf = arg->ToObject();
+	base = ca_get_number(conf, "base", 0);
+	nsamples = ca_get_number(conf, "nsamples", 0);
+	step = ca_get_number(conf, "step", 1);
+	hcp->hc_width = (uint32_t)ca_get_number(conf, "width", 0);
+	hcp->hc_height = (uint32_t)ca_get_number(conf, "height", 0);
+	hcp->hc_nbuckets = (uint32_t)ca_get_number(conf, "nbuckets", 0);
+	hcp->hc_min = ca_get_number(conf, "min", 0);
+	hcp->hc_max = ca_get_number(conf, "max", 0);
+	hcp->hc_hasmax = !conf->Get(String::New("max"))->IsUndefined();
+	hcp->hc_weighbyrange = ca_get_bool(conf, "weighbyrange");
+	hcp->hc_linear = ca_get_bool(conf, "linear");
+	hcp->hc_isolate = ca_get_bool(conf, "isolate");
+	hcp->hc_exclude = ca_get_bool(conf, "exclude");
+	hcp->hc_value = ca_get_number(conf, "value", 0);
+
+	if (hcp->hc_width == 0 || hcp->hc_height == 0 ||
+	    hcp->hc_nbuckets == 0 || !(step > 0) || !(nsamples > 0)) {
+		*errp = "invalid heatmap dimensions";
+		return (false);
+	}
+
+	hcp->hc_times.clear();
+	for (ii = 0; ii < nsamples; ii += step)
+		hcp->hc_times.push_back(base + ii);
+
+	val = conf->Get(String::New("hue"));
+	hcp->hc_hue.clear();
+	if (val->IsArray()) {
+		array = Local<Array>::Cast(val);
+		for (ii = 0; ii < array->Length(); ii++)
+			hcp->hc_hue.push_back(array->Get(ii)->NumberValue());
+	}
+
+	val = conf->Get(String::New("saturation"));
+	if (!val->IsArray()) {
+		*errp = "expected \"saturation\"";
+		return (false);
+	}
+
+	array = Local<Array>::Cast(val);
+	hcp->hc_saturation[0] = array->Get(0)->NumberValue();
+	hcp->hc_saturation[1] = array->Get(1)->NumberValue();
+	return (true);
+}
+
+/*
+ * Returns the highest value present in the given column, plus one.  The
+ * heatmap's maximum is autoscaled from the highest of these.
+ */
+static double
+ca_heatmap_colmax(const caDist *dist)
+{
+	vector<ca_bucket_t> buckets;
+	double max, low, high;
+	size_t jj;
+
+	max = 0;
+	dist->buckets(&buckets);
+
+	for (jj = 0; jj < buckets.size(); jj++) {
+		dist->layout()->range(buckets[jj].first, &low, &high);
+		if (high + 1 > max)
+			max = high + 1;
+	}
+
+	return (max);
+}
+
+/*
+ * Picks the maximum value for the heatmap based on the data when the user
+ * hasn't specified one: a bit more than the highest value present.
+ */
+static double
+ca_heatmap_autoscale(const caHeatmapConf *hcp, const ca_columns_t &columns,
+    caHeatmapCache *cache)
+{
+	double max;
+	size_t ii;
+
+	max = 0;
+
+	for (ii = 0; ii < columns.size(); ii++) {
+		if (columns[ii] != NULL)
+			max = std::max(max, cache->colmax(columns[ii]));
+	}
+
+	if (max == 0)
+		max = hcp->hc_nbuckets;
+
+	return (floor(max * (1 + 1 / (double)hcp->hc_nbuckets)));
+}
+
+/*
+ * Stores into "column" the amount of data from "dist" in each bucket.  Each
+ * range's count is apportioned to the buckets it overlaps.
+ */
+static void
+ca_heatmap_bucketize(const ca_hc_params *params, const caDist *dist,
+    double *column)
+{
+	vector<ca_bucket_t> buckets;
+	double min, size, low, high, value, olow, ohigh, first;
+	uint32_t nbuckets, bb;
+	size_t jj;
+
+	min = params->hcp_min;
+	nbuckets = params->hcp_nbuckets;
+	size = (params->hcp_max - min) / nbuckets;
+	dist->buckets(&buckets);
+
+	for (jj = 0; jj < buckets.size(); jj++) {
+		dist->layout()->range(buckets[jj].first, &low, &high);
+		high = high + 1;
+		value = buckets[jj].second;
+
+		if (params->hcp_weighbyrange)
+			value = value * (low + high - 1) / 2;
+
+		first = std::max(0.0, floor((low - min) / size));
+		if (first >= nbuckets)
+			continue;
+
+		for (bb = (uint32_t)first; bb < nbuckets; bb++) {
+			olow = std::max(low, min + bb * size);
+			ohigh = std::min(high, min + (bb + 1) * size);
+
+			if (ohigh <= olow) {
+				if (min + bb * size >= high)
+					break;
+				continue;
+			}
+
+			column[bb] += value * (ohigh - olow) / (high - low);
+		}
+	}
+}
+
+bool
+ca_hc_params::operator<(const ca_hc_params &rhs) const
+{
+	if (hcp_min != rhs.hcp_min)
+		return (hcp_min < rhs.hcp_min);
+
+	if (hcp_max != rhs.hcp_max)
+		return (hcp_max < rhs.hcp_max);
+
+	if (hcp_nbuckets != rhs.hcp_nbuckets)
+		return (hcp_nbuckets < rhs.hcp_nbuckets);
+
+	return (hcp_weighbyrange < rhs.hcp_weighbyrange);
+}
+
+/*
+ * Starts a new render.
+ */
+void
+caHeatmapCache::begin()
+{
+	hc_tick++;
+	hc_ncolumns = 0;
+	hc_nmaxes = 0;
+	hc_set = NULL;
+}
+
+/*
+ * Returns ca_heatmap_colmax() for "dist", which doesn't depend on the
+ * parameters, so these are cached separately from the columns.
+ */
+double
+caHeatmapCache::colmax(const caDist *dist)
+{
+	ca_hc_maxes_t::iterator it;
+	ca_hc_entry<double> entry;
+
+	hc_nmaxes++;
+
+	if ((it = hc_maxes.find(dist->version())) != hc_maxes.end()) {
+		it->second.hce_used = hc_tick;
+		return (it->second.hce_value);
+	}
+
+	entry.hce_used = hc_tick;
+	entry.hce_value = ca_heatmap_colmax(dist);
+	hc_maxes[dist->version()] = entry;
+	return (entry.hce_value);
+}
+
+/*
+ * Selects the set of cached columns for the given parameters, which must
+ * include the final "max".  If there are already too many sets, the least
+ * recently used one is discarded.
+ */
+void
+caHeatmapCache::params(const caHeatmapConf *hcp)
+{
+	ca_hc_sets_t::iterator it, lru;
+
+	hc_params.hcp_min = hcp->hc_min;
+	hc_params.hcp_max = hcp->hc_max;
+	hc_params.hcp_nbuckets = hcp->hc_nbuckets;
+	hc_params.hcp_weighbyrange = hcp->hc_weighbyrange;
+
+	if (hc_sets.find(hc_params) == hc_sets.end() &&
+	    hc_sets.size() >= CA_HC_MAXSETS) {
+		lru = hc_sets.begin();
+		for (it = hc_sets.begin(); it != hc_sets.end(); it++) {
+			if (it->second.hcs_used < lru->second.hcs_used)
+				lru = it;
+		}
+
+		hc_sets.erase(lru);
+	}
+
+	hc_set = &hc_sets[hc_params];
+	hc_set->hcs_used = hc_tick;
+}
+
+/*
+ * Returns the bucketized column for "dist" using the current parameters.
+ */
+const double *
+caHeatmapCache::column(const caDist *dist)
+{
+	ca_hc_columns_t::iterator it;
+	ca_hc_entry<vector<double> > *entry;
+
+	hc_ncolumns++;
+	it = hc_set->hcs_columns.find(dist->version());
+
+	if (it != hc_set->hcs_columns.end()) {
+		hc_hits++;
+		it->second.hce_used = hc_tick;
+		return (&it->second.hce_value[0]);
+	}
+
+	hc_misses++;
+	entry = &hc_set->hcs_columns[dist->version()];
+	entry->hce_used = hc_tick;
+	entry->hce_value.assign(hc_params.hcp_nbuckets, 0);
+	ca_heatmap_bucketize(&hc_params, dist, &entry->hce_value[0]);
+	return (&entry->hce_value[0]);
+}
+
+template <typename T> static void
+ca_hc_sweep(std::map<uint64_t, ca_hc_entry<T> > *entries, size_t nused,
+    uint64_t tick)
+{
+	typename std::map<uint64_t, ca_hc_entry<T> >::iterator it;
+
+	if (entries->size() <= 2 * nused)
+		return;
+
+	for (it = entries->begin(); it != entries->end(); ) {
+		if (it->second.hce_used + CA_HC_KEEP <= tick)
+			entries->erase(it++);
+		else
+			it++;
+	}
+}
+
+/*
+ * Finishes a render, discarding entries that are no longer being used.  Data
+ * that has changed or expired is never requested again, so without this the
+ * cache would grow without bound.
+ */
+void
+caHeatmapCache::end()
+{
+	if (hc_set != NULL)
+		ca_hc_sweep(&hc_set->hcs_columns, hc_ncolumns, hc_tick);
+
+	ca_hc_sweep(&hc_maxes, hc_nmaxes, hc_tick);
+}
+
+Local<Object>
+caHeatmapCache::stats() const
+{
+	HandleScope scope;
+	ca_hc_sets_t::const_iterator it;
+	Local<Object> rv;
+	size_t ncolumns;
+
+	ncolumns = 0;
+	for (it = hc_sets.begin(); it != hc_sets.end(); it++)
+		ncolumns += it->second.hcs_columns.size();
+
+	rv = Object::New();
+	rv->Set(String::New("renders"), Number::New((double)hc_tick));
+	rv->Set(String::New("hits"), Number::New((double)hc_hits));
+	rv->Set(String::New("misses"), Number::New((double)hc_misses));
+	rv->Set(String::New("nsets"), Number::New((double)hc_sets.size()));
+	rv->Set(String::New("ncolumns"), Number::New((double)ncolumns));
+	return (scope.Close(rv));
+}
+
+/*
+ * Maps each non-zero value to either its fraction of the maximum value
+ * ("linear") or its rank among all non-zero values, in (0, 1].
+ */
+static void
+ca_heatmap_normalize(const caHeatmapConf *hcp, vector<double *> &datasets,
+    size_t ncells)
+{
+	vector<double> values;
+	double max, *cells;
+	size_t ii, jj, rank;
+
+	max = 0;
+
+	for (ii = 0; ii < datasets.size(); ii++) {
+		cells = datasets[ii];
+		for (jj = 0; jj < ncells; jj++) {
+			if (cells[jj] > max)
+				max = cells[jj];
+			if (cells[jj] > 0)
+				values.push_back(cells[jj]);
+		}
+	}
+
+	std::sort(values.begin(), values.end());
+
+	for (ii = 0; ii < datasets.size(); ii++) {
+		cells = datasets[ii];
+		for (jj = 0; jj < ncells; jj++) {
+			if (cells[jj] == 0)
+				continue;
+
+			if (hcp->hc_linear) {
+				cells[jj] = cells[jj] / max;
+				continue;
+			}
+
+			/* Equal values all get the rank of the last one. */
+			rank = std::upper_bound(values.begin(), values.end(),
+			    cells[jj]) - values.begin();
+			cells[jj] = (double)rank / values.size();
+		}
+	}
+}
+
+/*
+ * Rounds like JavaScript's Math.round(), which rounds halves up.
+ */
+static uint8_t
+ca_round(double value)
+{
+	double rv = floor(value);
+
+	if (value - rv >= 0.5)
+		rv++;
+
+	return ((uint8_t)rv);
+}
+
+static void
+ca_hsv2rgb(double hue, double sat, double value, uint8_t *rgb)
+{
+	double c, hp, x, r, g, b, m;
+
+	c = value * sat;
+	hp = hue / 60;
+	x = c * (1 - fabs(fmod(hp, 2) - 1));
+
+	if (hp < 1) {
+		r = c; g = x; b = 0;
+	} else if (hp < 2) {
+		r = x; g = c; b = 0;
+	} else if (hp < 3) {
+		r = 0; g = c; b = x;
+	} else if (hp < 4) {
+		r = 0; g = x; b = c;
+	} else if (hp < 5) {
+		r = x; g = 0; b = c;
+	} else {
+		r = c; g = 0; b = x;
+	}
+
+	m = value - c;
+	rgb[0] = ca_round((r + m) * 255);
+	rgb[1] = ca_round((g + m) * 255);
+	rgb[2] = ca_round((b + m) * 255);
+}
+
+/*
+ * Collects the bucketized columns of the given datasets (the first is the
+ * total, and the rest are the selected keys) into "cells", taking them from
+ * "cache" where possible.  If the heatmap is to be autoscaled, the chosen
+ * maximum is stored back into "conf" as "max", just as node-heatmap does.
+ * This is the only part of rendering that looks at the datasets' storage, so
+ * afterwards the datasets may change without affecting the heatmap.
+ */
+void
+ca_heatmap_gather(Handle<Value> conf, caHeatmapConf *hcp,
+    const vector<ca_columns_t> &sources, caHeatmapCache *cache,
+    vector<double> *cells)
+{
+	caPhaseTimer timer(ca_phase_bucketize);
+	size_t ncolumns, nbuckets, ncells, ii, kk;
+	const caDist *dist;
+
+	ncolumns = hcp->hc_times.size();
+	nbuckets = hcp->hc_nbuckets;
+	ncells = ncolumns * nbuckets;
+
+	cache->begin();
+
+	if (!hcp->hc_hasmax) {
+		hcp->hc_max = ca_heatmap_autoscale(hcp, sources[0], cache);
+		hcp->hc_hasmax = true;
+		conf->ToObject()->Set(String::New("max"),
+		    Number::New(hcp->hc_max));
+	}
+
+	cells->assign(ncells * std::max(sources.size(), (size_t)1), 0);
+
+	cache->params(hcp);
+
+	for (kk = 0; kk < sources.size(); kk++) {
+		for (ii = 0; ii < ncolumns; ii++) {
+			if ((dist = sources[kk][ii]) != NULL)
+				memcpy(&(*cells)[kk * ncells + ii * nbuckets],
+				    cache->column(dist),
+				    nbuckets * sizeof (double));
+		}
+	}
+
+	cache->end();
+}
+
+/*
+ * Computes the RGB pixels, row by row from the top, for the cells collected by
+ * ca_heatmap_gather() from "nsources" datasets.  "cells" is modified in the
+ * process.  Returns NULL on success or an error message.  This doesn't use V8,
+ * so it may be invoked from any thread.
+ */
+const char *
+ca_heatmap_paint(const caHeatmapConf *hcp, size_t nsources,
+    vector<double> *cells, uint8_t *pixels)
+{
+	caPhaseTimer timer(ca_phase_render);
+	vector<double *> datasets;
+	vector<double> hues;
+	vector<uint8_t> colors;
+	uint8_t *color;
+	size_t ncolumns, nbuckets, ncells, ii, jj, kk;
+	uint32_t xx, yy, width, height;
+	double best, hue, *total, *base;
+
+	ncolumns = hcp->hc_times.size();
+	nbuckets = hcp->hc_nbuckets;
+	ncells = ncolumns * nbuckets;
+	width = hcp->hc_width;
+	height = hcp->hc_height;
+	base = &(*cells)[0];
+
+	/*
+	 * Select the datasets to display and their hues.  With "isolate", we
+	 * show only the selected keys (or an empty heatmap if there are none).
+	 * Otherwise, we show the total minus the selected keys, followed by
+	 * the keys themselves unless they're being excluded.
+	 */
+	hues = hcp->hc_hue;
+	total = base;
+
+	if (hcp->hc_isolate) {
+		for (ii = 1; ii < nsources; ii++)
+			datasets.push_back(&base[ii * ncells]);
+
+		if (datasets.empty()) {
+			memset(total, 0, ncells * sizeof (double));
+			datasets.push_back(total);
+			hues.assign(1, 0);
+		}
+	} else {
+		datasets.push_back(total);
+
+		for (ii = 1; ii < nsources; ii++) {
+			for (jj = 0; jj < ncells; jj++)
+				total[jj] = std::max(0.0,
+				    total[jj] - base[ii * ncells + jj]);
+
+			if (!hcp->hc_exclude)
+				datasets.push_back(&base[ii * ncells]);
+		}
+	}
+
+	if (hues.size() < datasets.size())
+		return ("not enough hues");
+
+	ca_heatmap_normalize(hcp, datasets, ncells);
+
+	/*
+	 * Each cell takes the hue of the dataset with the highest value there
+	 * (the first one, in case of a tie) and a saturation and value based on
+	 * that value.
+	 */
+	colors.resize(ncells * 3);
+
+	for (ii = 0; ii < ncells; ii++) {
+		best = 0;
+		hue = 0;
+
+		for (kk = 0; kk < datasets.size(); kk++) {
+			if (datasets[kk][ii] > best) {
+				best = datasets[kk][ii];
+				hue = hues[kk];
+			}
+		}
+
+		ca_hsv2rgb(hue, hcp->hc_saturation[0] + best *
+		    (hcp->hc_saturation[1] - hcp->hc_saturation[0]),
+		    hcp->hc_value - (best > 0 ? best * 0.3 : 0),
+		    &colors[ii * 3]);
+	}
+
+	for (yy = 0; yy < height; yy++) {
+		jj = (size_t)floor((double)(height - 1 - yy) * nbuckets /
+		    height);
+
+		for (xx = 0; xx < width; xx++) {
+			ii = (size_t)floor((double)xx * ncolumns / width);
+			color = &colors[(ii * nbuckets + jj) * 3];
+			memcpy(&pixels[((size_t)yy * width + xx) * 3],
+			    color, 3);
+		}
+	}
+
+	return (NULL);
+}
+
+/*
+ * Renders the heatmap described by "hcp" for the given datasets and returns a
+ * Buffer of RGB pixels.
+ */
+Handle<Value>
+ca_heatmap_render(Handle<Value> conf, caHeatmapConf *hcp,
+    const vector<ca_columns_t> &sources, caHeatmapCache *cache)
+{
+	HandleScope scope;
+	vector<double> cells;
+	node::Buffer *buffer;
+	const char *err;
+
+	ca_heatmap_gather(conf, hcp, sources, cache, &cells);
+
+	buffer = node::Buffer::New((size_t)hcp->hc_width * hcp->hc_height * 3);
+
+	if ((err = ca_heatmap_paint(hcp, sources.size(), &cells,
+	    (uint8_t *)node::Buffer::Data(buffer->handle_))) != NULL)
+		return (ca_throw(err));
+
+	return (scope.Close(buffer->handle_));
+}
+
+/*
+ * State for rendering a heatmap on the thread pool.  Everything the work needs
+ * is copied here first, so the work never touches the dataset or V8.
+ */
+struct ca_render_work {
+	uv_work_t		rw_req;
+	caHeatmapConf		rw_conf;
+	size_t			rw_nsources;
+	vector<double>		rw_cells;
+	caPngOptions		rw_png;
+	const char		*rw_err;
+	string			rw_image;
+	Persistent<Function>	rw_callback;
+};
+
+static void
+ca_heatmap_render_work(uv_work_t *req)
+{
+	ca_render_work *rwp = (ca_render_work *)req->data;
+	vector<uint8_t> pixels;
+
+	pixels.resize((size_t)rwp->rw_conf.hc_width *
+	    rwp->rw_conf.hc_height * 3);
+
+	if ((rwp->rw_err = ca_heatmap_paint(&rwp->rw_conf, rwp->rw_nsources,
+	    &rwp->rw_cells, &pixels[0])) != NULL)
+		return;
+
+	if (!ca_png_encode(&pixels[0], rwp->rw_conf.hc_width,
+	    rwp->rw_conf.hc_height, &rwp->rw_png, &rwp->rw_image))
+		rwp->rw_err = "failed to compress image";
+}
+
+static void
+ca_heatmap_render_done(uv_work_t *req)
+{
+	HandleScope scope;
+	ca_render_work *rwp = (ca_render_work *)req->data;
+	Local<Value> argv[2];
+
+	if (rwp->rw_err != NULL) {
+		argv[0] = Exception::Error(String::New(rwp->rw_err));
+		argv[1] = Local<Value>::New(Undefined());
+	} else {
+		argv[0] = Local<Value>::New(Null());
+		argv[1] = String::New(rwp->rw_image.data(),
+		    rwp->rw_image.size());
+	}
+
+	TryCatch trycatch;
+	rwp->rw_callback->Call(Context::GetCurrent()->Global(), 2, argv);
+
+	rwp->rw_callback.Dispose();
+	delete (rwp);
+
+	if (trycatch.HasCaught())
+		node::FatalException(trycatch);
+}
+
+/*
+ * Like ca_heatmap_render(), but only the columns are collected right away.
+ * The rest of the rendering and the PNG encoding happen on the thread pool,
+ * after which "callback" is invoked with an error or the base64 image.
+ */
+Handle<Value>
+ca_heatmap_render_async(Handle<Value> conf, caHeatmapConf *hcp,
+    const vector<ca_columns_t> &sources, caHeatmapCache *cache,
+    const caPngOptions *pngopts, Handle<Value> callback)
+{
+	ca_render_work *rwp;
+
+	if (!callback->IsFunction())
+		return (ca_throw("expected callback"));
+
+	rwp = new ca_render_work();
+	ca_heatmap_gather(conf, hcp, sources, cache, &rwp->rw_cells);
+	rwp->rw_conf = *hcp;
+	rwp->rw_nsources = sources.size();
+	rwp->rw_png = *pngopts;
+	rwp->rw_err = NULL;
+	rwp->rw_callback = Persistent<Function>::New(
+	    Local<Function>::Cast(callback));
+	rwp->rw_req.data = rwp;
+
+	(void) uv_queue_work(uv_default_loop(), &rwp->rw_req,
+	    ca_heatmap_render_work, ca_heatmap_render_done);
+	return (Undefined());
+}
@@ -0,0 +1,147 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright (c) 2014, Joyent, Inc.
+ */
+
+/*
+ * ca-render.h: native heatmap rendering
+ *
+ * caAggrValueHeatmapImage() used to render heatmaps with node-heatmap: it
+ * bucketized the total and each selected key into a separate array of
+ * columns, deducted the keys from the total (or dropped the total for
+ * "isolate"), normalized all values, and finally generated the image.  The
+ * renderer here does all of that natively, straight from the distributions
+ * stored by a TimeSeries or HeatmapDecomp, and produces exactly the same RGB
+ * pixels.  Storage classes gather one caDist (or NULL) per heatmap column for
+ * the total and each selected key and hand them to ca_heatmap_render().
+ *
+ * Most heatmap requests come from dashboards polling the same heatmap every
+ * second or so, and between two polls only the newest column or two has
+ * changed.  So each storage object keeps a caHeatmapCache of bucketized
+ * columns.  Bucketizing a column depends only on the column's distribution and
+ * on the vertical parameters (min, max, nbuckets, and weighbyrange), so cached
+ * columns are grouped by those parameters and looked up by the distribution's
+ * version (see ca-dist.h).  A column whose data hasn't changed since the last
+ * request is found no matter where it now falls in the heatmap, and a column
+ * whose data has changed simply misses the cache.  Only the remaining steps
+ * (which depend on all columns at once) are recomputed for each request.
+ *
+ * Rendering a large heatmap (especially one decomposed by many keys) can take
+ * long enough to hold up everything else the aggregator does, like ingesting
+ * data.  So rendering is split in two: ca_heatmap_gather() copies the
+ * bucketized columns out of the cache (which is the only step that looks at
+ * the dataset), and ca_heatmap_paint() does everything else without V8.
+ * ca_heatmap_render_async() runs the second step and the PNG encoding on the
+ * libuv thread pool, so the event loop keeps running in the meantime.
+ */
+
+#ifndef _CA_RENDER_H
+#define	_CA_RENDER_H
+
+#include <v8.h>
+
+#include <stdint.h>
+
+#include <map>
+#include <vector>
+
+#include "ca-dist.h"
+#include "ca-png.h"
+
+/*
+ * Heatmap parameters, as constructed by caAggrHeatmapConf().  "times" holds
+ * the time of each column: base, base + step, ... up to base + nsamples.
+ */
+struct caHeatmapConf {
+	std::vector<double>	hc_times;
+	uint32_t		hc_width;
+	uint32_t		hc_height;
+	uint32_t		hc_nbuckets;
+	double			hc_min;
+	double			hc_max;
+	bool			hc_hasmax;	/* false to autoscale */
+	bool			hc_weighbyrange;
+	bool			hc_linear;	/* linear (not rank) coloring */
+	bool			hc_isolate;
+	bool			hc_exclude;
+	std::vector<double>	hc_hue;
+	double			hc_saturation[2];
+	double			hc_value;
+};
+
+/* One distribution per column, NULL where there's no data. */
+typedef std::vector<const caDist *> ca_columns_t;
+
+/* Vertical parameters that determine how a column is bucketized. */
+struct ca_hc_params {
+	bool operator<(const ca_hc_params &rhs) const;
+
+	double		hcp_min;
+	double		hcp_max;
+	uint32_t	hcp_nbuckets;
+	bool		hcp_weighbyrange;
+};
+
+/* A cached value, with the render in which it was last used. */
+template <typename T> struct ca_hc_entry {
+	uint64_t	hce_used;
+	T		hce_value;
+};
+
+typedef std::map<uint64_t, ca_hc_entry<std::vector<double> > >
+    ca_hc_columns_t;
+typedef std::map<uint64_t, ca_hc_entry<double> > ca_hc_maxes_t;
+
+/* Cached columns for one set of parameters. */
+struct ca_hc_set {
+	uint64_t	hcs_used;
+	ca_hc_columns_t	hcs_columns;
+};
+
+typedef std::map<ca_hc_params, ca_hc_set> ca_hc_sets_t;
+
+class caHeatmapCache {
+public:
+	caHeatmapCache() :
+	    hc_tick(0), hc_hits(0), hc_misses(0), hc_ncolumns(0),
+	    hc_nmaxes(0), hc_set(NULL) {}
+
+	void begin();
+	double colmax(const caDist *);
+	void params(const caHeatmapConf *);
+	const double *column(const caDist *);
+	void end();
+
+	v8::Local<v8::Object> stats() const;
+
+private:
+	uint64_t	hc_tick;	/* number of renders */
+	uint64_t	hc_hits;
+	uint64_t	hc_misses;
+	size_t		hc_ncolumns;	/* columns used by this render */
+	size_t		hc_nmaxes;	/* maxes used by this render */
+	ca_hc_maxes_t	hc_maxes;	/* by version */
+	ca_hc_sets_t	hc_sets;
+	ca_hc_params	hc_params;	/* current parameters */
+	ca_hc_set	*hc_set;	/* current set */
+};
+
+extern bool ca_heatmap_conf(v8::Handle<v8::Value>, caHeatmapConf *,
+    const char **);
+extern void ca_heatmap_gather(v8::Handle<v8::Value>, caHeatmapConf *,
+    const std::vector<ca_columns_t> &, caHeatmapCache *,
+    std::vector<double> *);
+extern const char *ca_heatmap_paint(const caHeatmapConf *, size_t,
+    std::vector<double> *, uint8_t *);
+extern v8::Handle<v8::Value> ca_heatmap_render(v8::Handle<v8::Value>,
+    caHeatmapConf *, const std::vector<ca_columns_t> &, caHeatmapCache *);
+extern v8::Handle<v8::Value> ca_heatmap_render_async(v8::Handle<v8::Value>,
+    caHeatmapConf *, const std::vector<ca_columns_t> &, caHeatmapCache *,
+    const caPngOptions *, v8::Handle<v8::Value>);
+
+#endif	/* _CA_RENDER_H */
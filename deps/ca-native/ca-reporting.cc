@@ -0,0 +1,449 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright (c) 2014, Joyent, Inc.
+ */
+
+/*
+ * ca-reporting.cc: tracking which sources reported data at each time (see
+ * ca-reporting.h)
+ *
+ * The JavaScript interface is:
+ *
+ *	new Reporting(granularity, nslots)
+ *
+ *	report(time, source)		Records that "source" reported data for
+ *					"time".  Returns true unless it had
+ *					already reported for that time.
+ *
+ *	count(time)			Returns the number of sources reporting
+ *					for "time"
+ *
+ *	min(start, duration)		Returns the minimum number of sources
+ *					reporting at any time in the interval
+ *					[start, start + duration)
+ *
+ *	max(start, duration)		Returns the maximum number of sources
+ *					reporting at any time in the interval
+ *
+ *	byTime([start, duration])	Returns an object mapping each time in
+ *					the given interval (or all time) for
+ *					which any source reported to an object
+ *					whose keys are the sources reporting
+ *
+ *	expire(exptime)			Removes data for times before exptime
+ *
+ *	times()				Returns the sorted list of times for
+ *					which any source reported
+ */
+
+#include <v8.h>
+#include <node.h>
+
+#include <algorithm>
+
+#include "ca-native.h"
+#include "ca-reporting.h"
+
+using namespace v8;
+using std::string;
+using std::vector;
+
+caReporting::caReporting(int64_t granularity, size_t nslots) :
+    rp_granularity(granularity), rp_ring(nslots)
+{
+}
+
+/*
+ * Records that "source" reported for "time".  Returns false if it had already
+ * reported for that time, or if the time is too old to be recorded (see
+ * ca-ring.h).
+ */
+bool
+caReporting::report(int64_t time, const string &source)
+{
+	ca_rp_slot *sp;
+	int64_t index;
+	uint32_t id;
+	uint64_t bit;
+	size_t word;
+
+	index = time / rp_granularity;
+
+	if (rp_ring.evicts(index))
+		expireIndex(rp_ring.horizon(index));
+
+	if ((sp = rp_ring.claim(index)) == NULL)
+		return (false);
+
+	id = rp_sources.intern(source);
+	word = id / 64;
+	bit = (uint64_t)1 << (id % 64);
+
+	if (word >= sp->rps_bits.size())
+		sp->rps_bits.resize(word + 1, 0);
+	else if (sp->rps_bits[word] & bit)
+		return (false);
+
+	sp->rps_bits[word] |= bit;
+	sp->rps_count++;
+	rp_sources.hold(id);
+	return (true);
+}
+
+/*
+ * Returns the number of sources that reported for "time".
+ */
+uint32_t
+caReporting::count(int64_t time)
+{
+	ca_rp_slot *sp;
+
+	sp = rp_ring.slot(time / rp_granularity);
+	return (sp == NULL ? 0 : sp->rps_count);
+}
+
+/*
+ * Stores into *minp and *maxp the minimum and maximum number of sources that
+ * reported at any time index in the interval [start, start + duration).  Time
+ * indexes for which no source reported count as zero.
+ */
+void
+caReporting::range(int64_t start, int64_t duration, uint32_t *minp,
+    uint32_t *maxp)
+{
+	vector<ca_rp_slot *> slots;
+	int64_t first, last;
+	uint32_t minval, maxval;
+	size_t ii;
+
+	first = start / rp_granularity;
+	last = (start + duration + rp_granularity - 1) / rp_granularity;
+	rp_ring.slots(first, last, &slots);
+
+	minval = slots.empty() ? 0 : UINT32_MAX;
+	maxval = 0;
+
+	for (ii = 0; ii < slots.size(); ii++) {
+		minval = std::min(minval, slots[ii]->rps_count);
+		maxval = std::max(maxval, slots[ii]->rps_count);
+	}
+
+	if ((int64_t)slots.size() < last - first)
+		minval = 0;
+
+	*minp = minval;
+	*maxp = maxval;
+}
+
+/*
+ * Stores into "out" the sorted list of times for which any source reported.
+ */
+void
+caReporting::times(vector<int64_t> *out) const
+{
+	size_t ii;
+
+	rp_ring.indexes(out);
+
+	for (ii = 0; ii < out->size(); ii++)
+		(*out)[ii] *= rp_granularity;
+}
+
+/*
+ * Stores into "out" the names of the sources that reported for "time".
+ */
+void
+caReporting::sources(int64_t time, vector<const string *> *out)
+{
+	ca_rp_slot *sp;
+	size_t ii, jj;
+
+	out->clear();
+
+	if ((sp = rp_ring.slot(time / rp_granularity)) == NULL)
+		return;
+
+	for (ii = 0; ii < sp->rps_bits.size(); ii++) {
+		if (sp->rps_bits[ii] == 0)
+			continue;
+
+		for (jj = 0; jj < 64; jj++) {
+			if (!(sp->rps_bits[ii] & ((uint64_t)1 << jj)))
+				continue;
+
+			out->push_back(&rp_sources.name(ii * 64 + jj));
+		}
+	}
+}
+
+/*
+ * Removes data for times before "exptime", releasing the identifiers of the
+ * sources that reported at those times.
+ */
+void
+caReporting::expire(int64_t exptime)
+{
+	if (exptime <= 0)
+		return;
+
+	expireIndex((exptime + rp_granularity - 1) / rp_granularity);
+}
+
+/*
+ * Removes data for all time indexes before "first".
+ */
+void
+caReporting::expireIndex(int64_t first)
+{
+	vector<ca_rp_slot> expired;
+	size_t ii, jj, kk;
+
+	rp_ring.expire(first, &expired);
+
+	for (ii = 0; ii < expired.size(); ii++) {
+		const vector<uint64_t> &bits = expired[ii].rps_bits;
+
+		for (jj = 0; jj < bits.size(); jj++) {
+			if (bits[jj] == 0)
+				continue;
+
+			for (kk = 0; kk < 64; kk++) {
+				if (bits[jj] & ((uint64_t)1 << kk))
+					rp_sources.release(jj * 64 + kk);
+			}
+		}
+	}
+}
+
+class Reporting : public node::ObjectWrap {
+public:
+	static void Initialize(Handle<Object>);
+	static Persistent<FunctionTemplate> rp_templ;
+
+	caReporting		rp_set;
+
+protected:
+	static Handle<Value> New(const Arguments&);
+	static Handle<Value> Report(const Arguments&);
+	static Handle<Value> Count(const Arguments&);
+	static Handle<Value> Min(const Arguments&);
+	static Handle<Value> Max(const Arguments&);
+	static Handle<Value> ByTime(const Arguments&);
+	static Handle<Value> Expire(const Arguments&);
+	static Handle<Value> Times(const Arguments&);
+
+private:
+	Reporting(int64_t granularity, size_t nslots) :
+	    node::ObjectWrap(), rp_set(granularity, nslots) {}
+
+	static Handle<Value> Range(const Arguments&, bool);
+};
+
+Persistent<FunctionTemplate> Reporting::rp_templ;
+
+void
+Reporting::Initialize(Handle<Object> target)
+{
+	HandleScope scope;
+	Local<FunctionTemplate> templ = FunctionTemplate::New(Reporting::New);
+
+	rp_templ = Persistent<FunctionTemplate>::New(templ);
+	rp_templ->InstanceTemplate()->SetInternalFieldCount(1);
+	rp_templ->SetClassName(String::NewSymbol("Reporting"));
+
+	NODE_SET_PROTOTYPE_METHOD(rp_templ, "report", Reporting::Report);
+	NODE_SET_PROTOTYPE_METHOD(rp_templ, "count", Reporting::Count);
+	NODE_SET_PROTOTYPE_METHOD(rp_templ, "min", Reporting::Min);
+	NODE_SET_PROTOTYPE_METHOD(rp_templ, "max", Reporting::Max);
+	NODE_SET_PROTOTYPE_METHOD(rp_templ, "byTime", Reporting::ByTime);
+	NODE_SET_PROTOTYPE_METHOD(rp_templ, "expire", Reporting::Expire);
+	NODE_SET_PROTOTYPE_METHOD(rp_templ, "times", Reporting::Times);
+
+	target->Set(String::NewSymbol("Reporting"), rp_templ->GetFunction());
+}
+
+Handle<Value>
+Reporting::New(const Arguments& args)
+{
+	HandleScope scope;
+	Reporting *rp;
+
+	if (args.Length() < 2 || !args[0]->IsNumber() || !args[1]->IsNumber())
+		return (ca_throw("expected granularity and nslots"));
+
+	if (args[0]->IntegerValue() < 1)
+		return (ca_throw("granularity must be positive"));
+
+	if (args[1]->IntegerValue() < 1)
+		return (ca_throw("nslots must be positive"));
+
+	rp = new Reporting(args[0]->IntegerValue(),
+	    (size_t)args[1]->IntegerValue());
+	rp->Wrap(args.Holder());
+	return (args.This());
+}
+
+Handle<Value>
+Reporting::Report(const Arguments& args)
+{
+	HandleScope scope;
+	Reporting *rp = ObjectWrap::Unwrap<Reporting>(args.Holder());
+
+	if (args.Length() < 2 || !args[0]->IsNumber() || !args[1]->IsString())
+		return (ca_throw("expected time and source"));
+
+	if (args[0]->IntegerValue() < 0)
+		return (ca_throw("time must be non-negative"));
+
+	String::Utf8Value source(args[1]);
+	return (scope.Close(Boolean::New(rp->rp_set.report(
+	    args[0]->IntegerValue(), string(*source, source.length())))));
+}
+
+Handle<Value>
+Reporting::Count(const Arguments& args)
+{
+	HandleScope scope;
+	Reporting *rp = ObjectWrap::Unwrap<Reporting>(args.Holder());
+
+	if (args.Length() < 1 || !args[0]->IsNumber())
+		return (ca_throw("expected time"));
+
+	if (args[0]->IntegerValue() < 0)
+		return (scope.Close(Number::New(0)));
+
+	return (scope.Close(Number::New(
+	    rp->rp_set.count(args[0]->IntegerValue()))));
+}
+
+/*
+ * Implements min() and max().  Since each time index's data covers the whole
+ * "granularity"-sized interval starting at that time, the interval must start
+ * at such a time.
+ */
+Handle<Value>
+Reporting::Range(const Arguments& args, bool wantmax)
+{
+	HandleScope scope;
+	Reporting *rp = ObjectWrap::Unwrap<Reporting>(args.Holder());
+	int64_t start, duration;
+	uint32_t minval, maxval;
+
+	if (args.Length() < 2 || !args[0]->IsNumber() || !args[1]->IsNumber())
+		return (ca_throw("expected start and duration"));
+
+	start = args[0]->IntegerValue();
+	duration = args[1]->IntegerValue();
+
+	if (start < 0 || start % rp->rp_set.granularity() != 0)
+		return (ca_throw("start must be aligned to granularity"));
+
+	if (duration <= 0)
+		return (scope.Close(Number::New(0)));
+
+	rp->rp_set.range(start, duration, &minval, &maxval);
+	return (scope.Close(Number::New(wantmax ? maxval : minval)));
+}
+
+Handle<Value>
+Reporting::Min(const Arguments& args)
+{
+	return (Range(args, false));
+}
+
+Handle<Value>
+Reporting::Max(const Arguments& args)
+{
+	return (Range(args, true));
+}
+
+Handle<Value>
+Reporting::ByTime(const Arguments& args)
+{
+	HandleScope scope;
+	Reporting *rp = ObjectWrap::Unwrap<Reporting>(args.Holder());
+	vector<const string *> sources;
+	vector<int64_t> times;
+	int64_t start, end;
+	Local<Object> rv, treporting;
+	size_t ii, jj;
+
+	if (args.Length() >= 2) {
+		start = args[0]->IntegerValue();
+		end = start + args[1]->IntegerValue();
+	} else {
+		start = 0;
+		end = INT64_MAX;
+	}
+
+	rp->rp_set.times(&times);
+	rv = Object::New();
+
+	for (ii = 0; ii < times.size(); ii++) {
+		if (times[ii] + rp->rp_set.granularity() <= start ||
+		    times[ii] >= end)
+			continue;
+
+		rp->rp_set.sources(times[ii], &sources);
+		treporting = Object::New();
+
+		for (jj = 0; jj < sources.size(); jj++)
+			treporting->Set(String::New(sources[jj]->data(),
+			    sources[jj]->size()), True());
+
+		rv->Set(Number::New((double)times[ii]), treporting);
+	}
+
+	return (scope.Close(rv));
+}
+
+Handle<Value>
+Reporting::Expire(const Arguments& args)
+{
+	HandleScope scope;
+	Reporting *rp = ObjectWrap::Unwrap<Reporting>(args.Holder());
+
+	if (args.Length() < 1 || !args[0]->IsNumber())
+		return (ca_throw("expected expiration time"));
+
+	rp->rp_set.expire(args[0]->IntegerValue());
+	return (Undefined());
+}
+
+Handle<Value>
+Reporting::Times(const Arguments& args)
+{
+	HandleScope scope;
+	Reporting *rp = ObjectWrap::Unwrap<Reporting>(args.Holder());
+	vector<int64_t> times;
+	Local<Array> rv;
+	size_t ii;
+
+	rp->rp_set.times(&times);
+	rv = Array::New(times.size());
+	for (ii = 0; ii < times.size(); ii++)
+		rv->Set(ii, Number::New((double)times[ii]));
+
+	return (scope.Close(rv));
+}
+
+caReporting *
+ca_reporting_unwrap(Handle<Value> value)
+{
+	if (!value->IsObject() || !Reporting::rp_templ->HasInstance(value))
+		return (NULL);
+
+	return (&node::ObjectWrap::Unwrap<Reporting>(
+	    value->ToObject())->rp_set);
+}
+
+void
+ca_reporting_init(Handle<Object> target)
+{
+	Reporting::Initialize(target);
+}
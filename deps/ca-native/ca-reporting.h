@@ -0,0 +1,77 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright (c) 2014, Joyent, Inc.
+ */
+
+/*
+ * ca-reporting.h: tracking which sources reported data at each time
+ *
+ * The aggregator records which sources (hostnames) reported data for each time
+ * index so that it can tell whether a data point may be missing data.  It asks
+ * for the minimum and maximum number of sources reporting over an interval
+ * every time a data message arrives, so that has to be cheap even when an
+ * instrumentation spans thousands of hosts.
+ *
+ * A caReporting interns hostnames as small integer identifiers (see
+ * caInternTable) and stores, for each time index, a bitset of the sources that
+ * reported at that time along with the number of bits set.  The count is kept
+ * up to date as bits are set, so counting the sources reporting at a time
+ * index is O(1) and the minimum or maximum over an interval is O(number of
+ * time indexes) regardless of the number of sources.  Identifiers are recycled
+ * when no slot references them any more, so bitsets stay as small as the
+ * number of distinct sources reporting within the retention time.
+ */
+
+#ifndef _CA_REPORTING_H
+#define	_CA_REPORTING_H
+
+#include <v8.h>
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "ca-native.h"
+#include "ca-ring.h"
+
+struct ca_rp_slot {
+	ca_rp_slot() : rps_count(0) {}
+
+	void swap(ca_rp_slot &other) {
+		rps_bits.swap(other.rps_bits);
+		std::swap(rps_count, other.rps_count);
+	}
+
+	std::vector<uint64_t>	rps_bits;	/* bit N: source N reported */
+	uint32_t		rps_count;	/* number of bits set */
+};
+
+class caReporting {
+public:
+	caReporting(int64_t, size_t);
+
+	int64_t granularity() const { return (rp_granularity); }
+	bool report(int64_t, const std::string &);
+	uint32_t count(int64_t);
+	void range(int64_t, int64_t, uint32_t *, uint32_t *);
+	void times(std::vector<int64_t> *) const;
+	void sources(int64_t, std::vector<const std::string *> *);
+	void expire(int64_t);
+
+private:
+	void expireIndex(int64_t);
+
+	int64_t			rp_granularity;
+	caTimeRing<ca_rp_slot>	rp_ring;
+	caInternTable		rp_sources;
+};
+
+extern caReporting *ca_reporting_unwrap(v8::Handle<v8::Value>);
+
+#endif	/* _CA_REPORTING_H */
@@ -0,0 +1,293 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright (c) 2014, Joyent, Inc.
+ */
+
+/*
+ * ca-ring.h: ring of time-indexed slots
+ *
+ * A caTimeRing stores one T for each time index (i.e., time / granularity) in
+ * a ring of slots.  The slot for index I is I mod capacity, so updates,
+ * lookups, and expiration of a single index are O(1).  The ring is sized by the
+ * caller to cover the instrumentation's retention time.  If we're asked to
+ * store data that doesn't fit because expiration hasn't caught up yet, the ring
+ * grows to cover the whole range of stored data, but only up to CA_RING_GROWTH
+ * times its original size, and it shrinks back once expiration catches up.
+ * Data for indexes too far behind the newest data to fit is refused: claim()
+ * returns NULL.  Storing an index too far ahead of the oldest data first
+ * requires expiring everything before horizon(index), which the caller does so
+ * that it can release the expired data (see evicts()).
+ *
+ * T must be default-constructible and must provide swap().  A default-
+ * constructed T represents "no data".  The ring never copies a T that holds
+ * data, so T may contain pointers to memory it owns, but the ring doesn't free
+ * anything: expire() hands the expired data back to the caller, and the
+ * caller is responsible for whatever's left when the ring is destroyed.
+ */
+
+#ifndef _CA_RING_H
+#define	_CA_RING_H
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <vector>
+
+#define	CA_RING_GROWTH	4
+
+template <class T> class caTimeRing {
+public:
+	caTimeRing(size_t);
+
+	size_t capacity() const { return (tr_data.size()); }
+	size_t count() const { return (tr_count); }
+	int64_t index(const T *sp) const {
+		return (tr_index[sp - &tr_data[0]]);
+	}
+	int64_t horizon(int64_t index) const {
+		return (index - (int64_t)(tr_base * CA_RING_GROWTH) + 1);
+	}
+
+	bool admits(int64_t) const;
+	bool evicts(int64_t) const;
+	T *slot(int64_t);
+	T *claim(int64_t);
+	void slots(int64_t, int64_t, std::vector<T *> *);
+	void indexes(std::vector<int64_t> *) const;
+	void expire(int64_t, std::vector<T> *);
+
+private:
+	void resize(int64_t);
+	void remove(size_t, std::vector<T> *);
+
+	std::vector<int64_t>	tr_index;	/* index in each slot, or -1 */
+	std::vector<T>		tr_data;
+	size_t			tr_base;	/* original capacity */
+	size_t			tr_count;	/* number of slots in use */
+	int64_t			tr_low;		/* lower bound on indexes */
+	int64_t			tr_high;	/* upper bound on indexes */
+};
+
+template <class T>
+caTimeRing<T>::caTimeRing(size_t nslots) :
+    tr_count(0), tr_low(-1), tr_high(-1)
+{
+	for (tr_base = 1; tr_base < nslots; tr_base <<= 1)
+		continue;
+
+	tr_index.resize(tr_base, -1);
+	tr_data.resize(tr_base);
+}
+
+/*
+ * Returns whether data for the given time index may be stored: it must be
+ * close enough to the newest data that the ring can hold both.
+ */
+template <class T> bool
+caTimeRing<T>::admits(int64_t index) const
+{
+	if (index < 0)
+		return (false);
+
+	return (tr_count == 0 || index >= horizon(tr_high));
+}
+
+/*
+ * Returns whether storing data for the given time index requires first
+ * expiring the data before horizon(index).
+ */
+template <class T> bool
+caTimeRing<T>::evicts(int64_t index) const
+{
+	return (tr_count > 0 && tr_low < horizon(index));
+}
+
+/*
+ * Returns the slot holding data for the given time index, or NULL if there's
+ * no data for that index.
+ */
+template <class T> T *
+caTimeRing<T>::slot(int64_t index)
+{
+	size_t ii;
+
+	if (index < 0)
+		return (NULL);
+
+	ii = index & (tr_data.size() - 1);
+	return (tr_index[ii] == index ? &tr_data[ii] : NULL);
+}
+
+/*
+ * Returns the slot for the given time index, claiming it (and growing the ring)
+ * if necessary, or NULL if the index isn't admitted or would evict older data.
+ */
+template <class T> T *
+caTimeRing<T>::claim(int64_t index)
+{
+	size_t ii;
+
+	if (!admits(index) || evicts(index))
+		return (NULL);
+
+	ii = index & (tr_data.size() - 1);
+
+	if (tr_index[ii] == index)
+		return (&tr_data[ii]);
+
+	if (tr_index[ii] != -1) {
+		resize(std::max(tr_high, index) - std::min(tr_low, index));
+		ii = index & (tr_data.size() - 1);
+	}
+
+	tr_index[ii] = index;
+
+	if (tr_count++ == 0) {
+		tr_low = tr_high = index;
+	} else {
+		tr_low = std::min(tr_low, index);
+		tr_high = std::max(tr_high, index);
+	}
+
+	return (&tr_data[ii]);
+}
+
+/*
+ * Resizes the ring to the smallest capacity, no smaller than the original, for
+ * which indexes up to "span" apart map to distinct slots.
+ */
+template <class T> void
+caTimeRing<T>::resize(int64_t span)
+{
+	std::vector<int64_t> oldindex;
+	std::vector<T> olddata;
+	size_t cap, ii, jj;
+
+	for (cap = tr_base; (int64_t)cap <= span; cap <<= 1)
+		continue;
+
+	if (cap == tr_data.size())
+		return;
+
+	oldindex.resize(cap, -1);
+	olddata.resize(cap);
+	oldindex.swap(tr_index);
+	olddata.swap(tr_data);
+
+	for (ii = 0; ii < olddata.size(); ii++) {
+		if (oldindex[ii] == -1)
+			continue;
+
+		jj = oldindex[ii] & (cap - 1);
+		tr_index[jj] = oldindex[ii];
+		tr_data[jj].swap(olddata[ii]);
+	}
+}
+
+/*
+ * Stores into "out" the slots holding data for time indexes in [first, last).
+ * If the interval is larger than the ring, it's cheaper to scan the ring, but
+ * then the slots are not in time order.
+ */
+template <class T> void
+caTimeRing<T>::slots(int64_t first, int64_t last, std::vector<T *> *out)
+{
+	int64_t index;
+	size_t ii;
+	T *sp;
+
+	out->clear();
+
+	if (tr_count == 0)
+		return;
+
+	first = std::max(first, tr_low);
+	last = std::min(last, tr_high + 1);
+
+	if (last - first > (int64_t)tr_data.size()) {
+		for (ii = 0; ii < tr_data.size(); ii++) {
+			if (tr_index[ii] >= first && tr_index[ii] < last)
+				out->push_back(&tr_data[ii]);
+		}
+
+		return;
+	}
+
+	for (index = first; index < last; index++) {
+		if ((sp = slot(index)) != NULL)
+			out->push_back(sp);
+	}
+}
+
+/*
+ * Stores into "out" the sorted list of time indexes for which there's data.
+ */
+template <class T> void
+caTimeRing<T>::indexes(std::vector<int64_t> *out) const
+{
+	size_t ii;
+
+	out->clear();
+
+	for (ii = 0; ii < tr_index.size(); ii++) {
+		if (tr_index[ii] != -1)
+			out->push_back(tr_index[ii]);
+	}
+
+	std::sort(out->begin(), out->end());
+}
+
+/*
+ * Removes data for all time indexes before "first", appending the removed data
+ * to "out" so that the caller can release whatever it references.  If the
+ * range to expire is larger than the ring, we just scan the ring instead.
+ * Either way the cost is bounded by the number of slots we actually expire plus
+ * the number of indexes elapsed since the last expiration.  If the ring had
+ * grown and the remaining data fits in a smaller one, the ring shrinks.
+ */
+template <class T> void
+caTimeRing<T>::expire(int64_t first, std::vector<T> *out)
+{
+	int64_t index;
+	size_t ii;
+
+	if (tr_count == 0 || first <= tr_low)
+		return;
+
+	if (first - tr_low >= (int64_t)tr_data.size()) {
+		for (ii = 0; ii < tr_data.size() && tr_count > 0; ii++) {
+			if (tr_index[ii] != -1 && tr_index[ii] < first)
+				remove(ii, out);
+		}
+	} else {
+		for (index = tr_low; index < first && tr_count > 0; index++) {
+			ii = index & (tr_data.size() - 1);
+			if (tr_index[ii] == index)
+				remove(ii, out);
+		}
+	}
+
+	if (tr_count == 0)
+		tr_low = tr_high = -1;
+	else
+		tr_low = first;
+
+	if (tr_data.size() > tr_base)
+		resize(tr_count == 0 ? 0 : tr_high - tr_low);
+}
+
+template <class T> void
+caTimeRing<T>::remove(size_t ii, std::vector<T> *out)
+{
+	out->push_back(T());
+	out->back().swap(tr_data[ii]);
+	tr_index[ii] = -1;
+	tr_count--;
+}
+
+#endif	/* _CA_RING_H */
@@ -0,0 +1,171 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright (c) 2014, Joyent, Inc.
+ */
+
+/*
+ * ca-shard.cc: pool of worker threads for CPU-bound work (see ca-shard.h)
+ */
+
+#include <uv.h>
+
+#include <errno.h>
+
+#include "ca-shard.h"
+
+caShardPool::caShardPool(size_t nshards, size_t depth) :
+    sp_depth(depth), sp_async(new uv_async_t), sp_stopping(false),
+    sp_pending(0), sp_ncompleted(0)
+{
+	shard *sh;
+	size_t ii;
+
+	sp_async->data = this;
+	(void) uv_async_init(uv_default_loop(), sp_async, wakeup);
+
+	/* An idle pool shouldn't keep the process running. */
+	uv_unref(uv_default_loop());
+
+	for (ii = 0; ii < nshards; ii++) {
+		sh = new shard(this, depth);
+
+		if (sem_init(&sh->sh_wakeup, 0, 0) != 0) {
+			delete (sh);
+			break;
+		}
+
+		if (pthread_create(&sh->sh_thread, NULL, worker, sh) != 0) {
+			(void) sem_destroy(&sh->sh_wakeup);
+			delete (sh);
+			break;
+		}
+
+		sp_shards.push_back(sh);
+	}
+}
+
+/*
+ * Stops the shards, waiting for each one to finish whatever it's doing.  Tasks
+ * that haven't run are neither run nor done(), so the pool's owner must not
+ * destroy it while it has tasks pending.
+ */
+caShardPool::~caShardPool()
+{
+	size_t ii;
+
+	sp_stopping = true;
+	membar_producer();
+
+	for (ii = 0; ii < sp_shards.size(); ii++)
+		(void) sem_post(&sp_shards[ii]->sh_wakeup);
+
+	for (ii = 0; ii < sp_shards.size(); ii++) {
+		(void) pthread_join(sp_shards[ii]->sh_thread, NULL);
+		(void) sem_destroy(&sp_shards[ii]->sh_wakeup);
+		delete (sp_shards[ii]);
+	}
+
+	if (sp_pending == 0)
+		uv_ref(uv_default_loop());
+
+	sp_async->data = NULL;
+	uv_close((uv_handle_t *)sp_async, closed);
+}
+
+void
+caShardPool::closed(uv_handle_t *handle)
+{
+	delete ((uv_async_t *)handle);
+}
+
+/*
+ * Submits "task" to shard "which" (modulo the number of shards).  Returns false
+ * if that shard already has as many tasks outstanding as it can take.
+ */
+bool
+caShardPool::submit(size_t which, caShardTask *task)
+{
+	shard *sh;
+
+	if (sp_shards.empty())
+		return (false);
+
+	sh = sp_shards[which % sp_shards.size()];
+
+	if (sh->sh_outstanding >= sp_depth || !sh->sh_in.push(task))
+		return (false);
+
+	sh->sh_outstanding++;
+
+	if (sp_pending++ == 0)
+		uv_ref(uv_default_loop());
+
+	(void) sem_post(&sh->sh_wakeup);
+	return (true);
+}
+
+void *
+caShardPool::worker(void *arg)
+{
+	shard *sh = (shard *)arg;
+	caShardTask *task;
+
+	for (;;) {
+		while (sem_wait(&sh->sh_wakeup) != 0 && errno == EINTR)
+			continue;
+
+		if (!sh->sh_in.pop(&task)) {
+			membar_consumer();
+
+			if (sh->sh_pool->sp_stopping)
+				break;
+
+			continue;
+		}
+
+		task->run();
+
+		/* There's always room, since sh_outstanding <= sp_depth. */
+		(void) sh->sh_out.push(task);
+		(void) uv_async_send(sh->sh_pool->sp_async);
+	}
+
+	return (NULL);
+}
+
+void
+caShardPool::wakeup(uv_async_t *handle, int status)
+{
+	caShardPool *pool = (caShardPool *)handle->data;
+
+	if (pool != NULL)
+		pool->drain();
+}
+
+/*
+ * Invokes done() for each completed task.  A task's done() may submit more
+ * tasks, so we don't hold onto any state about the shards across calls.
+ */
+void
+caShardPool::drain()
+{
+	caShardTask *task;
+	size_t ii;
+
+	for (ii = 0; ii < sp_shards.size(); ii++) {
+		while (sp_shards[ii]->sh_out.pop(&task)) {
+			sp_shards[ii]->sh_outstanding--;
+			sp_ncompleted++;
+
+			if (--sp_pending == 0)
+				uv_unref(uv_default_loop());
+
+			task->done();
+		}
+	}
+}
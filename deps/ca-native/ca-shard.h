@@ -0,0 +1,149 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright (c) 2014, Joyent, Inc.
+ */
+
+/*
+ * ca-shard.h: pool of worker threads for CPU-bound work
+ *
+ * Node runs all JavaScript (and all of this addon's entry points) on a single
+ * thread, so by default a CA service uses only one CPU no matter how busy it
+ * is.  A caShardPool runs a fixed number of worker threads ("shards"), each
+ * of which executes caShardTasks submitted to it in order.  Each task's run()
+ * method is invoked on the shard's thread, and its done() method is invoked
+ * later on the main thread, where it may touch JavaScript objects again.
+ *
+ * Tasks are handed to each shard through a single-producer single-consumer
+ * queue (the main thread is the only producer and the shard the only consumer)
+ * and handed back through another one in the other direction, so neither side
+ * ever takes a lock to pass a task.  An idle shard sleeps on a semaphore that's
+ * posted once for each task submitted.  Shards wake up the main thread with a
+ * libuv async handle, and the main thread drains all of the completed tasks
+ * each time it wakes up.
+ *
+ * Each shard has at most "depth" tasks outstanding (submitted but not yet
+ * done()).  submit() fails when a shard is full, in which case the caller
+ * should just do the work itself.  Nothing running on a shard may use V8.
+ */
+
+#ifndef _CA_SHARD_H
+#define	_CA_SHARD_H
+
+#include <uv.h>
+
+#include <atomic.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdint.h>
+
+#include <vector>
+
+/*
+ * A fixed-size single-producer single-consumer queue.  push() may only be
+ * called from one thread and pop() from one (possibly different) thread.
+ */
+template <class T> class caSpscQueue {
+public:
+	caSpscQueue(size_t capacity) :
+	    q_slots(capacity + 1), q_head(0), q_tail(0) {}
+
+	bool push(const T &);
+	bool pop(T *);
+
+private:
+	std::vector<T>	q_slots;
+	volatile size_t	q_head;		/* next slot to pop (consumer) */
+	volatile size_t	q_tail;		/* next slot to push (producer) */
+};
+
+template <class T> bool
+caSpscQueue<T>::push(const T &value)
+{
+	size_t tail, next;
+
+	tail = q_tail;
+	next = (tail + 1) % q_slots.size();
+
+	if (next == q_head)
+		return (false);
+
+	/* Don't overwrite the slot until the consumer is done reading it. */
+	membar_enter();
+	q_slots[tail] = value;
+	membar_producer();
+	q_tail = next;
+	return (true);
+}
+
+template <class T> bool
+caSpscQueue<T>::pop(T *valuep)
+{
+	size_t head;
+
+	head = q_head;
+
+	if (head == q_tail)
+		return (false);
+
+	membar_consumer();
+	*valuep = q_slots[head];
+	membar_exit();
+	q_head = (head + 1) % q_slots.size();
+	return (true);
+}
+
+class caShardTask {
+public:
+	virtual ~caShardTask() {}
+
+	virtual void run() = 0;		/* invoked on a shard */
+	virtual void done() = 0;	/* invoked on the main thread */
+};
+
+class caShardPool {
+public:
+	caShardPool(size_t, size_t);
+	~caShardPool();
+
+	size_t nshards() const { return (sp_shards.size()); }
+	size_t pending() const { return (sp_pending); }
+	uint64_t ncompleted() const { return (sp_ncompleted); }
+	bool submit(size_t, caShardTask *);
+
+private:
+	/* sh_outstanding is only accessed on the main thread. */
+	struct shard {
+		shard(caShardPool *pool, size_t depth) :
+		    sh_pool(pool), sh_in(depth), sh_out(depth),
+		    sh_outstanding(0) {}
+
+		caShardPool			*sh_pool;
+		pthread_t			sh_thread;
+		sem_t				sh_wakeup;
+		caSpscQueue<caShardTask *>	sh_in;
+		caSpscQueue<caShardTask *>	sh_out;
+		size_t				sh_outstanding;
+	};
+
+	caShardPool(const caShardPool &);
+	caShardPool &operator=(const caShardPool &);
+
+	static void *worker(void *);
+	static void wakeup(uv_async_t *, int);
+	static void closed(uv_handle_t *);
+	void drain();
+
+	std::vector<shard *>	sp_shards;
+	size_t			sp_depth;
+	uv_async_t		*sp_async;
+	volatile bool		sp_stopping;
+	size_t			sp_pending;	/* tasks not yet done() */
+	uint64_t		sp_ncompleted;	/* tasks done() */
+};
+
+#endif	/* _CA_SHARD_H */
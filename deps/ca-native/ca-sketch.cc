@@ -0,0 +1,351 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright (c) 2014, Joyent, Inc.
+ */
+
+/*
+ * ca-sketch.cc: mergeable quantile sketches (see ca-sketch.h)
+ */
+
+#include <v8.h>
+#include <node.h>
+
+#include <float.h>
+#include <math.h>
+
+#include <algorithm>
+
+#include "ca-native.h"
+#include "ca-sketch.h"
+#include "ca-stash.h"
+
+using namespace v8;
+using std::vector;
+
+caSketch::caSketch(double alpha) :
+    sk_alpha(alpha), sk_gamma((1 + alpha) / (1 - alpha)),
+    sk_lngamma(log(sk_gamma)), sk_zero(0), sk_offset(0)
+{
+}
+
+/*
+ * Returns the index of the bin containing "value", which must be at least 1.
+ * Values too large for any bin (i.e., infinity) go in the last bin.
+ */
+int32_t
+caSketch::index(double value) const
+{
+	if (!(value <= DBL_MAX))
+		value = DBL_MAX;
+
+	return ((int32_t)ceil(log(value) / sk_lngamma));
+}
+
+/*
+ * Returns the upper bound of bin "ii", gamma^ii.
+ */
+double
+caSketch::bound(int32_t ii) const
+{
+	return (exp(ii * sk_lngamma));
+}
+
+void
+caSketch::add(int32_t ii, double count)
+{
+	if (sk_counts.empty()) {
+		sk_offset = ii;
+		sk_counts.push_back(count);
+		return;
+	}
+
+	if (ii < sk_offset) {
+		sk_counts.insert(sk_counts.begin(), sk_offset - ii, 0);
+		sk_offset = ii;
+	} else if (ii - sk_offset >= (int32_t)sk_counts.size()) {
+		sk_counts.resize(ii - sk_offset + 1, 0);
+	}
+
+	sk_counts[ii - sk_offset] += count;
+}
+
+void
+caSketch::insert(double value, double count)
+{
+	if (!(value >= 1))
+		sk_zero += count;
+	else
+		add(index(value), count);
+}
+
+/*
+ * Adds "count" values spread uniformly over the range [low, high].  A range
+ * with low == high is a single exact value.  Returns false without adding
+ * anything if the bounds aren't finite, low > high, or the count is negative or
+ * not finite.
+ */
+bool
+caSketch::insertRange(double low, double high, double count)
+{
+	double width, lo, blo, bhi;
+	int32_t ii, last;
+
+	if (!isfinite(low) || !isfinite(high) || low > high ||
+	    !isfinite(count) || count < 0)
+		return (false);
+
+	width = high - low;
+
+	if (width == 0) {
+		insert(low, count);
+		return (true);
+	}
+
+	if (low < 1)
+		sk_zero += count * (std::min(high, 1.0) - low) / width;
+
+	if (high <= 1)
+		return (true);
+
+	lo = std::max(low, 1.0);
+	last = index(high);
+
+	for (ii = index(lo); ii <= last; ii++) {
+		blo = std::max(lo, bound(ii - 1));
+		bhi = std::min(high, bound(ii));
+
+		if (bhi > blo)
+			add(ii, count * (bhi - blo) / width);
+	}
+
+	return (true);
+}
+
+/*
+ * Adds "rhs", which must have the same accuracy, into this sketch.
+ */
+void
+caSketch::merge(const caSketch &rhs)
+{
+	size_t ii;
+
+	sk_zero += rhs.sk_zero;
+
+	if (rhs.sk_counts.empty())
+		return;
+
+	/* Make room for the whole range up front. */
+	add(rhs.sk_offset, 0);
+	add(rhs.sk_offset + rhs.sk_counts.size() - 1, 0);
+
+	for (ii = 0; ii < rhs.sk_counts.size(); ii++)
+		sk_counts[rhs.sk_offset + ii - sk_offset] += rhs.sk_counts[ii];
+}
+
+double
+caSketch::count() const
+{
+	double sum = sk_zero;
+	size_t ii;
+
+	for (ii = 0; ii < sk_counts.size(); ii++)
+		sum += sk_counts[ii];
+
+	return (sum);
+}
+
+/*
+ * Returns the estimated value at quantile "qq" (between 0 and 1), or 0 if the
+ * sketch is empty.
+ */
+double
+caSketch::quantile(double qq) const
+{
+	double target, sum;
+	size_t ii;
+
+	target = qq * count();
+	sum = sk_zero;
+
+	if (sk_zero > 0 && target <= sum)
+		return (0);
+
+	for (ii = 0; ii < sk_counts.size(); ii++) {
+		sum += sk_counts[ii];
+
+		if (sk_counts[ii] > 0 && sum >= target)
+			return (2 * bound(sk_offset + ii) / (sk_gamma + 1));
+	}
+
+	for (ii = sk_counts.size(); ii > 0; ii--) {
+		if (sk_counts[ii - 1] > 0)
+			return (2 * bound(sk_offset + ii - 1) /
+			    (sk_gamma + 1));
+	}
+
+	return (0);
+}
+
+size_t
+caSketch::memsize() const
+{
+	return (sizeof (*this) + sk_counts.capacity() * sizeof (double));
+}
+
+/*
+ * Adds "value", which is either a distribution in the wire format or another
+ * sketch's JavaScript representation, to this sketch.  On failure, returns
+ * false and sets *errp to an error message.
+ */
+bool
+caSketch::addjs(Handle<Value> value, const char **errp)
+{
+	Local<Array> array, entry, range;
+	Local<Object> obj;
+	double zero, count;
+	int32_t offset;
+	uint32_t ii;
+
+	if (value->IsArray()) {
+		array = Local<Array>::Cast(value);
+
+		for (ii = 0; ii < array->Length(); ii++) {
+			if (!array->Get(ii)->IsArray()) {
+				*errp = "distribution entry must be an array";
+				return (false);
+			}
+
+			entry = Local<Array>::Cast(array->Get(ii));
+			if (!entry->Get(0)->IsArray()) {
+				*errp = "distribution range must be an array";
+				return (false);
+			}
+
+			range = Local<Array>::Cast(entry->Get(0));
+			if (!range->Get(0)->IsNumber() ||
+			    !range->Get(1)->IsNumber() ||
+			    !entry->Get(1)->IsNumber() ||
+			    !insertRange(range->Get(0)->NumberValue(),
+			    range->Get(1)->NumberValue(),
+			    entry->Get(1)->NumberValue())) {
+				*errp = "invalid distribution entry";
+				return (false);
+			}
+		}
+
+		return (true);
+	}
+
+	if (!value->IsObject()) {
+		*errp = "expected distribution or sketch";
+		return (false);
+	}
+
+	obj = value->ToObject();
+
+	if (fabs(obj->Get(String::New("alpha"))->NumberValue() - sk_alpha) >
+	    1e-12) {
+		*errp = "sketch accuracy doesn't match";
+		return (false);
+	}
+
+	if (!obj->Get(String::New("counts"))->IsArray()) {
+		*errp = "expected sketch counts";
+		return (false);
+	}
+
+	zero = obj->Get(String::New("zero"))->NumberValue();
+	offset = obj->Get(String::New("offset"))->Int32Value();
+	array = Local<Array>::Cast(obj->Get(String::New("counts")));
+
+	/* Bins are never below 1 or above the largest finite value. */
+	if (!isfinite(zero) || zero < 0 || offset < 0 ||
+	    (int64_t)offset + array->Length() > (int64_t)index(DBL_MAX) + 1) {
+		*errp = "invalid sketch";
+		return (false);
+	}
+
+	for (ii = 0; ii < array->Length(); ii++) {
+		count = array->Get(ii)->NumberValue();
+
+		if (!isfinite(count) || count < 0) {
+			*errp = "invalid sketch";
+			return (false);
+		}
+	}
+
+	sk_zero += zero;
+	for (ii = 0; ii < array->Length(); ii++)
+		add(offset + ii, array->Get(ii)->NumberValue());
+
+	return (true);
+}
+
+Local<Object>
+caSketch::tojs() const
+{
+	HandleScope scope;
+	Local<Object> rv;
+	Local<Array> counts;
+	size_t ii;
+
+	counts = Array::New(sk_counts.size());
+	for (ii = 0; ii < sk_counts.size(); ii++)
+		counts->Set(ii, Number::New(sk_counts[ii]));
+
+	rv = Object::New();
+	rv->Set(String::New("alpha"), Number::New(sk_alpha));
+	rv->Set(String::New("zero"), Number::New(sk_zero));
+	rv->Set(String::New("offset"), Number::New(sk_offset));
+	rv->Set(String::New("counts"), counts);
+	return (scope.Close(rv));
+}
+
+/*
+ * Encodes this sketch's zero count, offset, and counts (see ca-stash.h).  The
+ * accuracy is not included: callers only load sketches into sketches with the
+ * same accuracy.
+ */
+void
+caSketch::stash(caStashWriter *wp) const
+{
+	size_t ii;
+
+	wp->putNumber(sk_zero);
+	wp->putNumber(sk_offset);
+	wp->putVarint(sk_counts.size());
+
+	for (ii = 0; ii < sk_counts.size(); ii++)
+		wp->putNumber(sk_counts[ii]);
+}
+
+/*
+ * Adds a sketch encoded by stash() to this one.
+ */
+bool
+caSketch::unstash(caStashReader *rp)
+{
+	double zero, offset, count;
+	uint64_t ncounts, ii;
+
+	if (!rp->getNumber(&zero) || !rp->getNumber(&offset) ||
+	    !rp->getVarint(&ncounts) || !(offset >= INT32_MIN &&
+	    offset + ncounts <= INT32_MAX) || offset != floor(offset))
+		return (false);
+
+	sk_zero += zero;
+
+	for (ii = 0; ii < ncounts; ii++) {
+		if (!rp->getNumber(&count))
+			return (false);
+
+		add((int32_t)offset + (int32_t)ii, count);
+	}
+
+	return (true);
+}
@@ -0,0 +1,80 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright (c) 2014, Joyent, Inc.
+ */
+
+/*
+ * ca-sketch.h: mergeable quantile sketches
+ *
+ * A caSketch summarizes a distribution of non-negative values so that any
+ * quantile can be estimated with bounded relative error.  This is the
+ * "DDSketch" construction: for relative accuracy "alpha", let
+ * gamma = (1 + alpha) / (1 - alpha).  Bin i counts the values in
+ * (gamma^(i-1), gamma^i], and we report a value from that bin as
+ * 2 * gamma^i / (gamma + 1), which is within a factor of alpha of every value
+ * in the bin.  Values below 1 (CA's values are integers) are counted
+ * separately and reported as 0.
+ *
+ * Sketches with the same accuracy merge by adding counts, so per-second
+ * sketches from many sources can be combined into a sketch for any interval
+ * with no further loss of accuracy.  The number of bins depends only on the
+ * range of values, not the number of values: with alpha = 0.01, values from 1
+ * to 10^12 need at most about 1400 bins, and typical latency distributions need
+ * far fewer.
+ *
+ * Instrumenters report distributions in the wire format ([ [ low, high ],
+ * count ] entries).  Each entry's count is spread uniformly over the range it
+ * covers, so quantiles are as accurate as the instrumenter's own buckets allow
+ * and never worse than alpha beyond that.  The JavaScript representation of a
+ * sketch is an object with properties "alpha", "zero" (the count of values
+ * below 1), "offset" (the index of the first bin), and "counts".
+ */
+
+#ifndef _CA_SKETCH_H
+#define	_CA_SKETCH_H
+
+#include <v8.h>
+
+#include <stdint.h>
+
+#include <vector>
+
+class caStashReader;
+class caStashWriter;
+
+class caSketch {
+public:
+	caSketch(double);
+
+	double alpha() const { return (sk_alpha); }
+	void insert(double, double);
+	bool insertRange(double, double, double);
+	void merge(const caSketch &);
+	double count() const;
+	double quantile(double) const;
+	size_t memsize() const;
+
+	bool addjs(v8::Handle<v8::Value>, const char **);
+	v8::Local<v8::Object> tojs() const;
+	void stash(caStashWriter *) const;
+	bool unstash(caStashReader *);
+
+private:
+	int32_t index(double) const;
+	double bound(int32_t) const;
+	void add(int32_t, double);
+
+	double			sk_alpha;
+	double			sk_gamma;
+	double			sk_lngamma;
+	double			sk_zero;	/* count of values below 1 */
+	int32_t			sk_offset;	/* index of sk_counts[0] */
+	std::vector<double>	sk_counts;
+};
+
+#endif	/* _CA_SKETCH_H */
@@ -0,0 +1,667 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright (c) 2014, Joyent, Inc.
+ */
+
+/*
+ * ca-stash.cc: compact binary encoding of aggregated data (see ca-stash.h)
+ *
+ * The JavaScript interface is:
+ *
+ *	stashEncode(granularity, nsources, sources, tiers)
+ *
+ *		Returns a Buffer encoding a dataset with the given base
+ *		granularity and number of sources.  "sources" maps each
+ *		hostname to an object with "s_last", and "tiers" is an array
+ *		of objects with "granularity", "reporting" (a Reporting, which
+ *		records the sources reporting at each time), and "data" (a
+ *		TimeSeries or HeatmapDecomp).
+ *
+ *	stashHeader(buffer)
+ *
+ *		Returns an object describing an encoded dataset with
+ *		"version", "granularity", "nsources", "sources" (as for
+ *		stashEncode()), and "tiers", an array of objects with
+ *		"granularity".
+ *
+ *	stashLoad(buffer, which, granularity, doadd, reporting, data)
+ *
+ *		Loads tier "which" of an encoded dataset into "reporting" and
+ *		"data" (as for stashEncode()), which store data at the given
+ *		granularity.  Each time's data is added to the data for the
+ *		aligned time at that granularity, unless "doadd" is false, in
+ *		which case data for unaligned times is skipped.
+ */
+
+#include <v8.h>
+#include <node.h>
+#include <node_buffer.h>
+
+#include <math.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "ca-native.h"
+#include "ca-phase.h"
+#include "ca-reporting.h"
+#include "ca-stash.h"
+
+using namespace v8;
+using std::string;
+using std::vector;
+
+static const uint8_t ca_stash_magic[] = { 'C', 'A', 's', 't' };
+static const uint64_t ca_stash_version = 1;
+
+/*
+ * Numbers with magnitude less than this are encoded as integers if they are
+ * integers.
+ */
+static const double ca_stash_maxint = 9007199254740992.0;	/* 2^53 */
+
+void
+caStashWriter::putVarint(uint64_t value)
+{
+	while (value >= 0x80) {
+		putByte((value & 0x7f) | 0x80);
+		value >>= 7;
+	}
+
+	putByte(value);
+}
+
+void
+caStashWriter::putNumber(double value)
+{
+	uint64_t bits;
+	int64_t ival;
+	int ii;
+
+	if (value > -ca_stash_maxint && value < ca_stash_maxint) {
+		ival = (int64_t)value;
+
+		if ((double)ival == value) {
+			putVarint((((uint64_t)ival << 1) ^
+			    (uint64_t)(ival >> 63)) << 1);
+			return;
+		}
+	}
+
+	putVarint(1);
+	memcpy(&bits, &value, sizeof (bits));
+
+	for (ii = 0; ii < 8; ii++)
+		putByte((bits >> (ii * 8)) & 0xff);
+}
+
+void
+caStashWriter::putString(const string &str)
+{
+	std::map<string, uint32_t>::iterator it;
+
+	if ((it = sw_stringids.find(str)) == sw_stringids.end()) {
+		it = sw_stringids.insert(std::make_pair(str,
+		    (uint32_t)sw_strings.size())).first;
+		sw_strings.push_back(&it->first);
+	}
+
+	putVarint(it->second);
+}
+
+void
+caStashWriter::putRange(double low, double high)
+{
+	std::map<range_t, uint32_t>::iterator it;
+	range_t range(low, high);
+
+	if ((it = sw_rangeids.find(range)) == sw_rangeids.end()) {
+		it = sw_rangeids.insert(std::make_pair(range,
+		    (uint32_t)sw_ranges.size())).first;
+		sw_ranges.push_back(range);
+	}
+
+	putVarint(it->second);
+}
+
+/*
+ * Writes out the strings and ranges used so far.
+ */
+void
+caStashWriter::putTables()
+{
+	size_t ii;
+
+	putVarint(sw_strings.size());
+	for (ii = 0; ii < sw_strings.size(); ii++) {
+		putVarint(sw_strings[ii]->size());
+		sw_out->insert(sw_out->end(), sw_strings[ii]->begin(),
+		    sw_strings[ii]->end());
+	}
+
+	putVarint(sw_ranges.size());
+	for (ii = 0; ii < sw_ranges.size(); ii++) {
+		putNumber(sw_ranges[ii].first);
+		putNumber(sw_ranges[ii].second);
+	}
+}
+
+bool
+caStashReader::getByte(uint8_t *bytep)
+{
+	if (sr_off >= sr_len)
+		return (false);
+
+	*bytep = sr_data[sr_off++];
+	return (true);
+}
+
+bool
+caStashReader::getVarint(uint64_t *valuep)
+{
+	uint64_t value;
+	unsigned int shift;
+	uint8_t byte;
+
+	for (value = 0, shift = 0; shift < 64; shift += 7) {
+		if (!getByte(&byte))
+			return (false);
+
+		value |= (uint64_t)(byte & 0x7f) << shift;
+
+		if ((byte & 0x80) == 0) {
+			*valuep = value;
+			return (true);
+		}
+	}
+
+	return (false);
+}
+
+bool
+caStashReader::getNumber(double *valuep)
+{
+	uint64_t value, bits;
+	int ii;
+
+	if (!getVarint(&value))
+		return (false);
+
+	if ((value & 1) == 0) {
+		value >>= 1;
+		*valuep = (double)(int64_t)((value >> 1) ^ (0 - (value & 1)));
+		return (true);
+	}
+
+	if (value != 1 || sr_len - sr_off < 8)
+		return (false);
+
+	for (bits = 0, ii = 0; ii < 8; ii++)
+		bits |= (uint64_t)sr_data[sr_off++] << (ii * 8);
+
+	memcpy(valuep, &bits, sizeof (bits));
+	return (true);
+}
+
+bool
+caStashReader::getString(const string **strp)
+{
+	uint64_t id;
+
+	if (!getVarint(&id) || id >= sr_strings.size())
+		return (false);
+
+	*strp = &sr_strings[id];
+	return (true);
+}
+
+bool
+caStashReader::getRange(double *lowp, double *highp)
+{
+	uint64_t id;
+
+	if (!getVarint(&id) || id >= sr_ranges.size())
+		return (false);
+
+	*lowp = sr_ranges[id].first;
+	*highp = sr_ranges[id].second;
+	return (true);
+}
+
+/*
+ * Reads the tables written by caStashWriter::putTables().
+ */
+bool
+caStashReader::getTables()
+{
+	uint64_t count, len, ii;
+	double low, high;
+
+	if (!getVarint(&count))
+		return (false);
+
+	for (ii = 0; ii < count; ii++) {
+		if (!getVarint(&len) || len > sr_len - sr_off)
+			return (false);
+
+		sr_strings.push_back(string((const char *)sr_data + sr_off,
+		    len));
+		sr_off += len;
+	}
+
+	if (!getVarint(&count))
+		return (false);
+
+	for (ii = 0; ii < count; ii++) {
+		if (!getNumber(&low) || !getNumber(&high))
+			return (false);
+
+		sr_ranges.push_back(std::make_pair(low, high));
+	}
+
+	return (true);
+}
+
+static caStashable *
+ca_stashable(Handle<Value> value)
+{
+	caStashable *sp;
+
+	if ((sp = ca_timeseries_stashable(value)) != NULL)
+		return (sp);
+
+	return (ca_heatmap_stashable(value));
+}
+
+struct ca_stash_tier {
+	uint64_t	st_granularity;
+	uint64_t	st_kind;
+	double		st_param;
+	size_t		st_offset;	/* offset of tier data */
+	size_t		st_length;	/* length of tier data */
+};
+
+struct ca_stash_header {
+	uint64_t				sh_version;
+	uint64_t				sh_granularity;
+	uint64_t				sh_nsources;
+	vector<std::pair<const string *, double> >	sh_hosts;
+	vector<ca_stash_tier>			sh_tiers;
+};
+
+/*
+ * Reads everything that precedes the tiers' data.
+ */
+static const char *
+ca_stash_header_read(caStashReader *rp, ca_stash_header *hp)
+{
+	uint64_t count, len, ii;
+	ca_stash_tier tier;
+	const string *host;
+	double last;
+	size_t offset;
+	uint8_t byte;
+
+	for (ii = 0; ii < sizeof (ca_stash_magic); ii++) {
+		if (!rp->getByte(&byte) || byte != ca_stash_magic[ii])
+			return ("not a stash");
+	}
+
+	if (!rp->getVarint(&hp->sh_version))
+		return ("stash is truncated");
+
+	if (hp->sh_version > ca_stash_version)
+		return ("unsupported stash version");
+
+	if (!rp->getVarint(&hp->sh_granularity) ||
+	    !rp->getVarint(&hp->sh_nsources) || !rp->getTables() ||
+	    !rp->getVarint(&count))
+		return ("stash is truncated");
+
+	for (ii = 0; ii < count; ii++) {
+		if (!rp->getString(&host) || !rp->getNumber(&last))
+			return ("stash has invalid source");
+
+		hp->sh_hosts.push_back(std::make_pair(host, last));
+	}
+
+	if (!rp->getVarint(&count))
+		return ("stash is truncated");
+
+	for (ii = 0; ii < count; ii++) {
+		if (!rp->getVarint(&tier.st_granularity) ||
+		    !rp->getVarint(&tier.st_kind) ||
+		    !rp->getNumber(&tier.st_param) ||
+		    !rp->getVarint(&len) || tier.st_granularity == 0)
+			return ("stash has invalid tier");
+
+		tier.st_length = len;
+		hp->sh_tiers.push_back(tier);
+	}
+
+	offset = rp->offset();
+
+	for (ii = 0; ii < hp->sh_tiers.size(); ii++) {
+		hp->sh_tiers[ii].st_offset = offset;
+		offset += hp->sh_tiers[ii].st_length;
+	}
+
+	if (!rp->seek(offset))
+		return ("stash is truncated");
+
+	return (NULL);
+}
+
+/*
+ * Encodes one tier's data for times at or after "since" into "out".
+ */
+static void
+ca_stash_tier_encode(caStashWriter *wp, caReporting *rp, caStashable *sp,
+    int64_t since, vector<uint8_t> *out)
+{
+	vector<uint8_t> value;
+	vector<int64_t> times;
+	vector<const string *> hosts;
+	int64_t prev;
+	size_t ii, jj;
+
+	rp->times(&times);
+	times.erase(times.begin(), std::lower_bound(times.begin(),
+	    times.end(), since));
+
+	wp->begin(out);
+	wp->putVarint(times.size());
+
+	for (prev = 0, ii = 0; ii < times.size(); ii++) {
+		wp->putVarint(times[ii] - prev);
+		prev = times[ii];
+
+		rp->sources(times[ii], &hosts);
+		wp->putVarint(hosts.size());
+		for (jj = 0; jj < hosts.size(); jj++)
+			wp->putString(*hosts[jj]);
+
+		value.clear();
+		wp->begin(&value);
+		sp->stashSlot(wp, times[ii]);
+		wp->begin(out);
+		wp->putVarint(value.size());
+		out->insert(out->end(), value.begin(), value.end());
+	}
+}
+
+static Handle<Value>
+ca_stash_encode(const Arguments& args)
+{
+	HandleScope scope;
+	caPhaseTimer timer(ca_phase_stash);
+	vector<uint8_t> header, hostdata, data;
+	vector<vector<uint8_t> > tierdata;
+	Local<Object> sources, tier;
+	Local<Array> tiers, hosts;
+	node::Buffer *buffer;
+	caStashWriter writer;
+	caReporting *rp;
+	caStashable *sp;
+	double param;
+	int64_t since, granularity;
+	uint32_t ii;
+
+	if (args.Length() < 4 || !args[0]->IsNumber() ||
+	    !args[1]->IsNumber() || !args[2]->IsObject() ||
+	    !args[3]->IsArray())
+		return (ca_throw("expected granularity, nsources, sources, "
+		    "and tiers"));
+
+	if (args.Length() > 4 && !args[4]->IsUndefined() &&
+	    !args[4]->IsNumber())
+		return (ca_throw("expected \"since\" to be a number"));
+
+	since = args.Length() > 4 && args[4]->IsNumber() ?
+	    args[4]->IntegerValue() : 0;
+	sources = args[2]->ToObject();
+	tiers = Local<Array>::Cast(args[3]);
+	tierdata.resize(tiers->Length());
+	writer.begin(&header);
+
+	for (ii = 0; ii < sizeof (ca_stash_magic); ii++)
+		writer.putByte(ca_stash_magic[ii]);
+
+	writer.putVarint(ca_stash_version);
+	writer.putVarint(args[0]->IntegerValue());
+	writer.putVarint(args[1]->IntegerValue());
+
+	for (ii = 0; ii < tiers->Length(); ii++) {
+		if (!tiers->Get(ii)->IsObject())
+			return (ca_throw("expected array of tiers"));
+
+		tier = tiers->Get(ii)->ToObject();
+		granularity = tier->Get(
+		    String::New("granularity"))->IntegerValue();
+
+		if ((rp = ca_reporting_unwrap(tier->Get(
+		    String::New("reporting")))) == NULL)
+			return (ca_throw("expected Reporting"));
+
+		if (granularity < 1)
+			return (ca_throw("granularity must be positive"));
+
+		if ((sp = ca_stashable(tier->Get(String::New("data")))) ==
+		    NULL)
+			return (ca_throw("expected TimeSeries or "
+			    "HeatmapDecomp"));
+
+		/*
+		 * Each slot covers "granularity" seconds, so the first slot
+		 * that may have changed since "since" is the one containing it.
+		 */
+		ca_stash_tier_encode(&writer, rp, sp,
+		    since - since % granularity, &tierdata[ii]);
+
+		writer.begin(&data);
+		writer.putVarint(granularity);
+		writer.putVarint(sp->stashKind(&param));
+		writer.putNumber(param);
+		writer.putVarint(tierdata[ii].size());
+	}
+
+	writer.begin(&hostdata);
+	hosts = sources->GetPropertyNames();
+	writer.putVarint(hosts->Length());
+
+	for (ii = 0; ii < hosts->Length(); ii++) {
+		String::Utf8Value host(hosts->Get(ii));
+		writer.putString(string(*host, host.length()));
+		writer.putNumber(sources->Get(hosts->Get(ii))->ToObject()->Get(
+		    String::New("s_last"))->NumberValue());
+	}
+
+	writer.begin(&header);
+	writer.putTables();
+	header.insert(header.end(), hostdata.begin(), hostdata.end());
+	writer.putVarint(tiers->Length());
+	header.insert(header.end(), data.begin(), data.end());
+
+	for (ii = 0; ii < tierdata.size(); ii++)
+		header.insert(header.end(), tierdata[ii].begin(),
+		    tierdata[ii].end());
+
+	buffer = node::Buffer::New(header.size());
+	memcpy(node::Buffer::Data(buffer->handle_), &header[0], header.size());
+	return (scope.Close(buffer->handle_));
+}
+
+static Handle<Value>
+ca_stash_header_js(const Arguments& args)
+{
+	HandleScope scope;
+	ca_stash_header header;
+	Local<Object> rv, sources, source, tier;
+	Local<Array> tiers;
+	const char *err;
+	size_t ii;
+
+	if (args.Length() < 1 || !node::Buffer::HasInstance(args[0]))
+		return (ca_throw("expected Buffer"));
+
+	caStashReader reader(
+	    (const uint8_t *)node::Buffer::Data(args[0]->ToObject()),
+	    node::Buffer::Length(args[0]->ToObject()));
+
+	if ((err = ca_stash_header_read(&reader, &header)) != NULL)
+		return (ca_throw(err));
+
+	sources = Object::New();
+	for (ii = 0; ii < header.sh_hosts.size(); ii++) {
+		const string &host = *header.sh_hosts[ii].first;
+		source = Object::New();
+		source->Set(String::New("s_last"),
+		    Number::New(header.sh_hosts[ii].second));
+		sources->Set(String::New(host.data(), host.size()), source);
+	}
+
+	tiers = Array::New(header.sh_tiers.size());
+	for (ii = 0; ii < header.sh_tiers.size(); ii++) {
+		tier = Object::New();
+		tier->Set(String::New("granularity"), Number::New(
+		    (double)header.sh_tiers[ii].st_granularity));
+		tiers->Set(ii, tier);
+	}
+
+	rv = Object::New();
+	rv->Set(String::New("version"),
+	    Number::New((double)header.sh_version));
+	rv->Set(String::New("granularity"),
+	    Number::New((double)header.sh_granularity));
+	rv->Set(String::New("nsources"),
+	    Number::New((double)header.sh_nsources));
+	rv->Set(String::New("sources"), sources);
+	rv->Set(String::New("tiers"), tiers);
+	return (scope.Close(rv));
+}
+
+static Handle<Value>
+ca_stash_load(const Arguments& args)
+{
+	HandleScope scope;
+	ca_stash_header header;
+	vector<const string *> hosts;
+	const string *host;
+	caReporting *rp;
+	caStashable *sp;
+	const char *err;
+	uint64_t ntimes, delta, nhosts, len, ii, jj;
+	int64_t granularity, time, ttime, before;
+	double param;
+	uint32_t which;
+	bool doadd;
+	size_t end;
+
+	if (args.Length() < 6 || !node::Buffer::HasInstance(args[0]) ||
+	    !args[1]->IsNumber() || !args[2]->IsNumber())
+		return (ca_throw("expected buffer, tier, granularity, doadd, "
+		    "reporting, and data"));
+
+	if (args.Length() > 6 && !args[6]->IsUndefined() &&
+	    !args[6]->IsNumber())
+		return (ca_throw("expected \"before\" to be a number"));
+
+	if ((rp = ca_reporting_unwrap(args[4])) == NULL)
+		return (ca_throw("expected Reporting"));
+
+	if ((sp = ca_stashable(args[5])) == NULL)
+		return (ca_throw("expected TimeSeries or HeatmapDecomp"));
+
+	which = args[1]->Uint32Value();
+	granularity = args[2]->IntegerValue();
+	doadd = args[3]->BooleanValue();
+
+	if (granularity < 1)
+		return (ca_throw("granularity must be positive"));
+
+	caStashReader reader(
+	    (const uint8_t *)node::Buffer::Data(args[0]->ToObject()),
+	    node::Buffer::Length(args[0]->ToObject()));
+
+	if ((err = ca_stash_header_read(&reader, &header)) != NULL)
+		return (ca_throw(err));
+
+	if (which >= header.sh_tiers.size())
+		return (ca_throw("no such tier"));
+
+	const ca_stash_tier &tier = header.sh_tiers[which];
+
+	if (tier.st_kind != sp->stashKind(&param) ||
+	    fabs(tier.st_param - param) > 1e-12)
+		return (ca_throw("stashed data doesn't match dataset"));
+
+	/*
+	 * Slots starting at or after the one containing "before" are skipped,
+	 * since they're superseded by a later stash (see stashEncode()).
+	 */
+	if (args.Length() > 6 && args[6]->IsNumber()) {
+		before = args[6]->IntegerValue();
+		before -= before % (int64_t)tier.st_granularity;
+	} else {
+		before = (int64_t)ca_stash_maxint;
+	}
+
+	(void) reader.seek(tier.st_offset);
+
+	if (!reader.getVarint(&ntimes))
+		return (ca_throw("stash is truncated"));
+
+	for (time = 0, ii = 0; ii < ntimes; ii++) {
+		if (!reader.getVarint(&delta) || !reader.getVarint(&nhosts))
+			return (ca_throw("stash is truncated"));
+
+		time += delta;
+		hosts.clear();
+
+		for (jj = 0; jj < nhosts; jj++) {
+			if (!reader.getString(&host))
+				return (ca_throw("stash has invalid source"));
+
+			hosts.push_back(host);
+		}
+
+		if (!reader.getVarint(&len) ||
+		    len > tier.st_offset + tier.st_length - reader.offset())
+			return (ca_throw("stash is truncated"));
+
+		end = reader.offset() + len;
+		ttime = time - (time % granularity);
+
+		if (time >= before)
+			break;
+
+		if (!doadd && ttime != time) {
+			(void) reader.seek(end);
+			continue;
+		}
+
+		for (jj = 0; jj < hosts.size(); jj++)
+			(void) rp->report(ttime, *hosts[jj]);
+
+		if (!sp->unstashSlot(&reader, time) || reader.offset() != end)
+			return (ca_throw("stash has invalid value"));
+	}
+
+	return (Undefined());
+}
+
+void
+ca_stash_init(Handle<Object> target)
+{
+	target->Set(String::NewSymbol("stashEncode"),
+	    FunctionTemplate::New(ca_stash_encode)->GetFunction());
+	target->Set(String::NewSymbol("stashHeader"),
+	    FunctionTemplate::New(ca_stash_header_js)->GetFunction());
+	target->Set(String::NewSymbol("stashLoad"),
+	    FunctionTemplate::New(ca_stash_load)->GetFunction());
+}
@@ -0,0 +1,160 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright (c) 2014, Joyent, Inc.
+ */
+
+/*
+ * ca-stash.h: compact binary encoding of aggregated data
+ *
+ * The aggregator periodically saves each instrumentation's data to the stash so
+ * that it survives restarts.  Serializing a dataset as JSON means building an
+ * object for every time index (with the sources reporting and the datum) and
+ * then stringifying the whole thing, which for heatmaps can mean tens of
+ * megabytes of text and hundreds of milliseconds with the event loop blocked.
+ * Instead, stashEncode() serializes the native datasets directly into a Buffer:
+ *
+ *	magic		"CAst"
+ *	version		varint (currently 1)
+ *	granularity	varint
+ *	nsources	varint
+ *	strings		varint count, then each string as a varint length
+ *			and UTF-8 bytes.  Hostnames and decomposition keys are
+ *			stored once here and referred to elsewhere by index.
+ *	ranges		varint count, then each distribution bucket's low and
+ *			high bounds as numbers.  Distributions refer to buckets
+ *			by index.
+ *	hosts		varint count, then each source's string index and the
+ *			last time it reported, as a number
+ *	tiers		varint count, then each tier's granularity (varint),
+ *			kind (varint), kind-specific parameter (number), and
+ *			length in bytes of the tier's data (varint)
+ *
+ * followed by each tier's data:
+ *
+ *	ntimes		varint
+ *	times		for each time with data, in increasing order: the
+ *			difference from the previous time (varint), the
+ *			number of sources reporting and their string indexes
+ *			(varints), and the length (varint) and contents of
+ *			the value, encoded by the dataset (see caStashable).
+ *
+ * Varints are unsigned LEB128.  Numbers are varints too: integers of magnitude
+ * less than 2^53 are zigzag-encoded and shifted left by one bit, and anything
+ * else is a varint 1 followed by the eight bytes of the IEEE 754 double, least
+ * significant byte first.  Since counts are almost always integers, most
+ * numbers take one or two bytes.
+ *
+ * Each value is prefixed with its length so that a reader can skip values it
+ * doesn't want without decoding them.
+ *
+ * A stash may be saved incrementally as a complete stash followed by segments
+ * containing only the slots that changed.  stashEncode() takes an optional
+ * "since" time, in which case each tier includes only the slots at or after the
+ * one containing that time.  A segment's slots replace the same slots in
+ * everything saved before it, so stashLoad() takes an optional "before" time
+ * (the earliest "since" of the later segments) and skips the slots it would
+ * encode.
+ */
+
+#ifndef _CA_STASH_H
+#define	_CA_STASH_H
+
+#include <v8.h>
+
+#include <stdint.h>
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+enum ca_stash_kind {
+	CA_ST_SCALAR,
+	CA_ST_DECOMP,
+	CA_ST_DIST,
+	CA_ST_SKETCH,
+	CA_ST_HEATMAP
+};
+
+/*
+ * Encodes values into a byte array, interning strings and distribution bucket
+ * ranges in tables that are written out separately.
+ */
+class caStashWriter {
+public:
+	caStashWriter() : sw_out(NULL) {}
+
+	void begin(std::vector<uint8_t> *out) { sw_out = out; }
+	void putByte(uint8_t byte) { sw_out->push_back(byte); }
+	void putVarint(uint64_t);
+	void putNumber(double);
+	void putString(const std::string &);
+	void putRange(double, double);
+	void putTables();
+
+private:
+	typedef std::pair<double, double> range_t;
+
+	std::vector<uint8_t>			*sw_out;
+	std::map<std::string, uint32_t>		sw_stringids;
+	std::vector<const std::string *>	sw_strings;
+	std::map<range_t, uint32_t>		sw_rangeids;
+	std::vector<range_t>			sw_ranges;
+};
+
+/*
+ * Decodes values written by a caStashWriter.  Each method returns false if the
+ * encoded data is truncated or invalid.
+ */
+class caStashReader {
+public:
+	caStashReader(const uint8_t *data, size_t len) :
+	    sr_data(data), sr_len(len), sr_off(0) {}
+
+	size_t offset() const { return (sr_off); }
+	bool seek(size_t off) {
+		if (off > sr_len)
+			return (false);
+		sr_off = off;
+		return (true);
+	}
+	bool getByte(uint8_t *);
+	bool getVarint(uint64_t *);
+	bool getNumber(double *);
+	bool getString(const std::string **);
+	bool getRange(double *, double *);
+	bool getTables();
+
+private:
+	const uint8_t				*sr_data;
+	size_t					sr_len;
+	size_t					sr_off;
+	std::vector<std::string>		sr_strings;
+	std::vector<std::pair<double, double> >	sr_ranges;
+};
+
+/*
+ * Datasets that can be stashed implement caStashable.  stashSlot() encodes the
+ * value for the given time (which may be empty), and unstashSlot() decodes such
+ * a value and adds it to the data for the given time.  A value is only ever
+ * loaded into a dataset of the same kind and parameter (e.g., sketch accuracy)
+ * as the one that encoded it.
+ */
+class caStashable {
+public:
+	virtual ~caStashable() {}
+
+	virtual ca_stash_kind stashKind(double *) const = 0;
+	virtual void stashSlot(caStashWriter *, int64_t) = 0;
+	virtual bool unstashSlot(caStashReader *, int64_t) = 0;
+};
+
+extern caStashable *ca_timeseries_stashable(v8::Handle<v8::Value>);
+extern caStashable *ca_heatmap_stashable(v8::Handle<v8::Value>);
+
+#endif	/* _CA_STASH_H */
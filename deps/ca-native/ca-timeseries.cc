@@ -0,0 +1,1250 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright (c) 2014, Joyent, Inc.
+ */
+
+/*
+ * ca-timeseries.cc: native time-indexed storage for aggregated data
+ *
+ * A TimeSeries stores one value for each "granularity"-aligned time index in a
+ * caTimeRing (see ca-ring.h), so updates, lookups, and expiration of a single
+ * time index are O(1) and the structure never allocates per-update JavaScript
+ * objects.
+ *
+ * Three kinds of values are supported:
+ *
+ *	"scalar"	values are numbers and are combined by adding them
+ *
+ *	"decomp"	values are objects mapping keys to numbers (i.e., simple
+ *			discrete decompositions).  Values are combined by
+ *			adding the values for corresponding keys.  Keys are
+ *			interned so that each slot stores just a sorted array
+ *			of (key id, value) pairs.
+ *
+ *			For both "scalar" and "decomp" series, we also keep
+ *			sliding-window sums for the few widest intervals
+ *			that have been requested recently (see window()), so
+ *			that repeatedly summing the last N seconds takes
+ *			constant time per second elapsed rather than time
+ *			proportional to N.
+ *
+ *	"dist"		values are distributions, exchanged with JavaScript in
+ *			the wire format and stored as native caDists (see
+ *			ca-dist.h).  All slots share one layout, which may be
+ *			passed to the constructor as a DistLayout.  We also
+ *			keep running totals (a caDistPrefix), so summing a
+ *			"dist" series over any interval takes constant time.
+ *
+ *	"sketch"	values are quantile sketches (see ca-sketch.h) with
+ *			relative accuracy "alpha", which may be passed to the
+ *			constructor (default: 0.01).  Values may be added as
+ *			distributions in the wire format or as sketches, and
+ *			they're returned as sketches.
+ *
+ * The JavaScript interface is:
+ *
+ *	new TimeSeries(kind, granularity, nslots[, layout | alpha])
+ *
+ *	add(time, datum)		Adds "datum" to the value for "time",
+ *					unless the data for "time" is refused
+ *					(see ca-ring.h)
+ *
+ *	value(start, duration)		Returns the sum of values in the
+ *					interval [start, start + duration)
+ *
+ *	byTime([start, duration])	Returns an object mapping each time in
+ *					the given interval (or all time) for
+ *					which there's data to its value
+ *
+ *	expire(exptime)			Removes values for times before exptime
+ *
+ *	times()				Returns the sorted list of times for
+ *					which this series has data
+ *
+ *	capacity()			Returns the current number of slots
+ *
+ *	quantiles(start, duration, qs)	For a "sketch" series, returns the
+ *					estimated value at each quantile in "qs"
+ *					over the interval
+ *
+ *	render(conf, selected)		Renders a heatmap of a "dist" series
+ *					(see ca-render.h).  The keys in
+ *					"selected" are rendered without data,
+ *					since a series has no decomposition.
+ *
+ *	renderAsync(conf, selected,	Like render(), but finishes rendering
+ *	    options, callback)		and encodes the image as a base64 PNG
+ *					on the thread pool (see
+ *					HeatmapDecomp)
+ *
+ *	renderStats()			Returns statistics about the cache of
+ *					bucketized heatmap columns
+ */
+
+#include <v8.h>
+#include <node.h>
+
+#include <string.h>
+
+#include <algorithm>
+
+#include "ca-native.h"
+#include "ca-dist.h"
+#include "ca-ingest.h"
+#include "ca-render.h"
+#include "ca-ring.h"
+#include "ca-sketch.h"
+#include "ca-stash.h"
+
+using namespace v8;
+using std::string;
+using std::vector;
+
+typedef std::pair<uint32_t, double> ca_keyval_t;
+typedef vector<ca_keyval_t> ca_decomp_t;
+
+enum ca_ts_kind {
+	CA_TS_SCALAR,
+	CA_TS_DECOMP,
+	CA_TS_DIST,
+	CA_TS_SKETCH
+};
+
+/*
+ * Each slot stores the value for one time index.  Only the field corresponding
+ * to the series's kind is used.
+ */
+struct ca_ts_slot {
+	ca_ts_slot() : tss_scalar(0), tss_dist(NULL), tss_sketch(NULL) {}
+
+	void swap(ca_ts_slot &other) {
+		std::swap(tss_scalar, other.tss_scalar);
+		tss_decomp.swap(other.tss_decomp);
+		std::swap(tss_dist, other.tss_dist);
+		std::swap(tss_sketch, other.tss_sketch);
+	}
+
+	double		tss_scalar;
+	ca_decomp_t	tss_decomp;
+	caDist		*tss_dist;
+	caSketch	*tss_sketch;
+};
+
+/*
+ * Sliding-window sums are kept only for intervals of at least CA_TS_WINDOW_MIN
+ * time indexes, since narrower ones are cheap to sum directly, and for at most
+ * CA_TS_MAXWINDOWS different widths per series.
+ */
+#define	CA_TS_WINDOW_MIN	16
+#define	CA_TS_MAXWINDOWS	4
+
+/*
+ * A window's running total for one key of a "decomp" series.  The key is
+ * present in the sum as long as any slot in the window has it, even if the
+ * total is zero, just as if the slots were summed directly.
+ */
+struct ca_ts_wkey {
+	ca_ts_wkey() : tswk_value(0), tswk_nslots(0) {}
+
+	double		tswk_value;
+	uint32_t	tswk_nslots;	/* slots in the window with this key */
+};
+
+/*
+ * The running sum of slots [tsw_first, tsw_last).  Moving a window forward
+ * subtracts the slots that leave it and adds the slots that enter it.  To keep
+ * floating-point error from accumulating, a window is recomputed from scratch
+ * once it has moved by its own width, which keeps the cost per time index
+ * elapsed constant.
+ */
+struct ca_ts_window {
+	int64_t			tsw_first;
+	int64_t			tsw_last;
+	int64_t			tsw_moved;	/* moved since rebuilt */
+	uint64_t		tsw_used;	/* when last used */
+	double			tsw_scalar;
+	vector<ca_ts_wkey>	tsw_keys;	/* "decomp" sums by key id */
+};
+
+static bool
+ca_keyval_lt(const ca_keyval_t &lhs, const ca_keyval_t &rhs)
+{
+	return (lhs.first < rhs.first);
+}
+
+class TimeSeries : public node::ObjectWrap, public caIngestTarget,
+    public caStashable {
+public:
+	static void Initialize(Handle<Object>);
+	static Persistent<FunctionTemplate> ts_templ;
+
+	bool ingest(int64_t, const caIngestDatum &);
+	ca_stash_kind stashKind(double *) const;
+	void stashSlot(caStashWriter *, int64_t);
+	bool unstashSlot(caStashReader *, int64_t);
+
+protected:
+	static Handle<Value> New(const Arguments&);
+	static Handle<Value> Add(const Arguments&);
+	static Handle<Value> Sum(const Arguments&);
+	static Handle<Value> ByTime(const Arguments&);
+	static Handle<Value> Expire(const Arguments&);
+	static Handle<Value> Times(const Arguments&);
+	static Handle<Value> Capacity(const Arguments&);
+	static Handle<Value> Quantiles(const Arguments&);
+	static Handle<Value> Render(const Arguments&);
+	static Handle<Value> RenderAsync(const Arguments&);
+	static Handle<Value> RenderStats(const Arguments&);
+
+private:
+	TimeSeries(ca_ts_kind, int64_t, size_t, caDistLayout *, double);
+	bool interval(const Arguments&, int64_t *, int64_t *);
+	~TimeSeries();
+
+	void clear(ca_ts_slot *);
+	ca_ts_slot *claim(int64_t);
+	void expire(int64_t);
+	void addScalar(int64_t, double);
+	void addDecomp(int64_t, Handle<Object>);
+	void addDecompKey(int64_t, const string &, double);
+	void sumDecomp(ca_decomp_t *, const ca_decomp_t &);
+	ca_ts_window *window(int64_t, int64_t);
+	void windowRebuild(ca_ts_window *, int64_t, int64_t);
+	void windowUpdate(ca_ts_window *, int64_t, int64_t, double);
+	Local<Value> toValue(double, const ca_decomp_t &, const caDist *,
+	    const caSketch *);
+	void columns(const caHeatmapConf &, Handle<Value>,
+	    vector<ca_columns_t> *);
+
+	ca_ts_kind		ts_kind;
+	int64_t			ts_granularity;
+	caTimeRing<ca_ts_slot>	ts_ring;
+	caInternTable		ts_keys;
+	caDistLayout		*ts_layout;	/* "dist" series only */
+	caDistPrefix		*ts_prefix;	/* "dist" series only */
+	double			ts_alpha;	/* "sketch" series only */
+	caHeatmapCache		ts_cache;	/* for render() */
+	vector<ca_ts_window>	ts_windows;	/* "scalar" and "decomp" only */
+	uint64_t		ts_nsums;	/* calls to value() */
+};
+
+Persistent<FunctionTemplate> TimeSeries::ts_templ;
+
+TimeSeries::TimeSeries(ca_ts_kind kind, int64_t granularity, size_t nslots,
+    caDistLayout *layout, double alpha) :
+    node::ObjectWrap(), ts_kind(kind), ts_granularity(granularity),
+    ts_ring(nslots), ts_layout(layout), ts_prefix(NULL), ts_alpha(alpha),
+    ts_nsums(0)
+{
+	if (ts_layout != NULL) {
+		ts_layout->hold();
+		ts_prefix = new caDistPrefix(ts_layout);
+	}
+}
+
+TimeSeries::~TimeSeries()
+{
+	expire(INT64_MAX);
+	delete (ts_prefix);
+
+	if (ts_layout != NULL)
+		ts_layout->rele();
+}
+
+/*
+ * Releases the resources referenced by an expired slot.
+ */
+void
+TimeSeries::clear(ca_ts_slot *sp)
+{
+	size_t ii;
+
+	for (ii = 0; ii < sp->tss_decomp.size(); ii++)
+		ts_keys.release(sp->tss_decomp[ii].first);
+
+	delete (sp->tss_dist);
+	sp->tss_dist = NULL;
+	delete (sp->tss_sketch);
+	sp->tss_sketch = NULL;
+}
+
+/*
+ * Reads the interval [start, start + duration) from the first two arguments as
+ * the range of time indexes [*firstp, *lastp).
+ */
+bool
+TimeSeries::interval(const Arguments& args, int64_t *firstp, int64_t *lastp)
+{
+	if (args.Length() < 2 || !args[1]->IsNumber())
+		return (false);
+
+	*firstp = args[0]->IntegerValue() / ts_granularity;
+	*lastp = (args[0]->IntegerValue() + args[1]->IntegerValue() +
+	    ts_granularity - 1) / ts_granularity;
+	return (true);
+}
+
+/*
+ * Returns the slot for time index "index", first expiring whatever data is too
+ * old to be kept alongside it, or NULL if the ring refuses the index (see
+ * ca-ring.h).  Data for refused indexes is dropped.
+ */
+ca_ts_slot *
+TimeSeries::claim(int64_t index)
+{
+	if (!ts_ring.admits(index))
+		return (NULL);
+
+	if (ts_ring.evicts(index))
+		expire(ts_ring.horizon(index));
+
+	return (ts_ring.claim(index));
+}
+
+void
+TimeSeries::expire(int64_t first)
+{
+	vector<ca_ts_slot> expired;
+	size_t ii;
+
+	/* Windows that include expired data would have to be rebuilt anyway. */
+	for (ii = ts_windows.size(); ii > 0; ii--) {
+		if (ts_windows[ii - 1].tsw_first < first)
+			ts_windows.erase(ts_windows.begin() + ii - 1);
+	}
+
+	ts_ring.expire(first, &expired);
+
+	for (ii = 0; ii < expired.size(); ii++)
+		clear(&expired[ii]);
+
+	if (ts_prefix != NULL)
+		ts_prefix->expire(first);
+}
+
+/*
+ * Adds "value" to the scalar value for time index "index".
+ */
+void
+TimeSeries::addScalar(int64_t index, double value)
+{
+	ca_ts_slot *sp;
+	size_t ii;
+
+	if ((sp = claim(index)) == NULL)
+		return;
+
+	sp->tss_scalar += value;
+
+	for (ii = 0; ii < ts_windows.size(); ii++) {
+		if (index >= ts_windows[ii].tsw_first &&
+		    index < ts_windows[ii].tsw_last)
+			ts_windows[ii].tsw_scalar += value;
+	}
+}
+
+/*
+ * Adds the decomposition described by JavaScript object "datum" into the value
+ * for time index "index".
+ */
+void
+TimeSeries::addDecomp(int64_t index, Handle<Object> datum)
+{
+	Local<Array> keys;
+	Local<Value> key;
+	uint32_t ii;
+
+	keys = datum->GetPropertyNames();
+
+	for (ii = 0; ii < keys->Length(); ii++) {
+		key = keys->Get(ii);
+		String::Utf8Value name(key);
+		addDecompKey(index, string(*name, name.length()),
+		    datum->Get(key)->NumberValue());
+	}
+}
+
+/*
+ * Adds "value" to the value of key "name" for time index "index".
+ */
+void
+TimeSeries::addDecompKey(int64_t index, const string &name, double value)
+{
+	ca_decomp_t *decomp;
+	ca_decomp_t::iterator it;
+	ca_keyval_t kv;
+	ca_ts_wkey *wkp;
+	ca_ts_slot *sp;
+	bool added;
+	size_t ii;
+
+	if ((sp = claim(index)) == NULL)
+		return;
+
+	decomp = &sp->tss_decomp;
+
+	kv.first = ts_keys.intern(name);
+	kv.second = value;
+
+	it = std::lower_bound(decomp->begin(), decomp->end(), kv,
+	    ca_keyval_lt);
+
+	if (it != decomp->end() && it->first == kv.first) {
+		it->second += kv.second;
+		added = false;
+	} else {
+		ts_keys.hold(kv.first);
+		decomp->insert(it, kv);
+		added = true;
+	}
+
+	for (ii = 0; ii < ts_windows.size(); ii++) {
+		if (index < ts_windows[ii].tsw_first ||
+		    index >= ts_windows[ii].tsw_last)
+			continue;
+
+		if (ts_windows[ii].tsw_keys.size() <= kv.first)
+			ts_windows[ii].tsw_keys.resize(kv.first + 1);
+
+		wkp = &ts_windows[ii].tsw_keys[kv.first];
+		wkp->tswk_value += value;
+
+		if (added)
+			wkp->tswk_nslots++;
+	}
+}
+
+/*
+ * Adds "rhs" into "lhs", both of which are sorted by key id.
+ */
+void
+TimeSeries::sumDecomp(ca_decomp_t *lhs, const ca_decomp_t &rhs)
+{
+	ca_decomp_t sum;
+	size_t ll, rr;
+
+	if (lhs->empty()) {
+		*lhs = rhs;
+		return;
+	}
+
+	sum.reserve(lhs->size() + rhs.size());
+
+	for (ll = 0, rr = 0; ll < lhs->size() || rr < rhs.size(); ) {
+		if (rr == rhs.size() ||
+		    (ll < lhs->size() && (*lhs)[ll].first < rhs[rr].first)) {
+			sum.push_back((*lhs)[ll++]);
+		} else if (ll == lhs->size() ||
+		    rhs[rr].first < (*lhs)[ll].first) {
+			sum.push_back(rhs[rr++]);
+		} else {
+			sum.push_back(ca_keyval_t((*lhs)[ll].first,
+			    (*lhs)[ll].second + rhs[rr].second));
+			ll++;
+			rr++;
+		}
+	}
+
+	lhs->swap(sum);
+}
+
+/*
+ * Returns a window covering time indexes [first, last), creating it or moving
+ * an existing window of the same width if necessary.  When we're already
+ * keeping as many windows as we're willing to, the least recently used one is
+ * replaced.
+ */
+ca_ts_window *
+TimeSeries::window(int64_t first, int64_t last)
+{
+	ca_ts_window *wp = NULL;
+	size_t ii;
+
+	for (ii = 0; ii < ts_windows.size(); ii++) {
+		if (ts_windows[ii].tsw_last - ts_windows[ii].tsw_first ==
+		    last - first) {
+			wp = &ts_windows[ii];
+			break;
+		}
+
+		if (wp == NULL || ts_windows[ii].tsw_used < wp->tsw_used)
+			wp = &ts_windows[ii];
+	}
+
+	if (ii == ts_windows.size()) {
+		if (ts_windows.size() < CA_TS_MAXWINDOWS) {
+			ts_windows.push_back(ca_ts_window());
+			wp = &ts_windows.back();
+		}
+
+		windowRebuild(wp, first, last);
+	} else if (first < wp->tsw_first || first >= wp->tsw_last ||
+	    wp->tsw_moved + (first - wp->tsw_first) >= last - first) {
+		windowRebuild(wp, first, last);
+	} else if (first > wp->tsw_first) {
+		wp->tsw_moved += first - wp->tsw_first;
+		windowUpdate(wp, wp->tsw_first, first, -1);
+		windowUpdate(wp, wp->tsw_last, last, 1);
+		wp->tsw_first = first;
+		wp->tsw_last = last;
+	}
+
+	wp->tsw_used = ts_nsums;
+	return (wp);
+}
+
+/*
+ * Recomputes window "wp" to cover time indexes [first, last).
+ */
+void
+TimeSeries::windowRebuild(ca_ts_window *wp, int64_t first, int64_t last)
+{
+	wp->tsw_first = first;
+	wp->tsw_last = last;
+	wp->tsw_moved = 0;
+	wp->tsw_scalar = 0;
+	wp->tsw_keys.clear();
+	windowUpdate(wp, first, last, 1);
+}
+
+/*
+ * Adds (if "sign" is 1) or subtracts (if it's -1) the values for time indexes
+ * [first, last) to window "wp".
+ */
+void
+TimeSeries::windowUpdate(ca_ts_window *wp, int64_t first, int64_t last,
+    double sign)
+{
+	vector<ca_ts_slot *> slots;
+	ca_ts_wkey *wkp;
+	size_t ii, jj;
+
+	ts_ring.slots(first, last, &slots);
+
+	for (ii = 0; ii < slots.size(); ii++) {
+		wp->tsw_scalar += sign * slots[ii]->tss_scalar;
+
+		for (jj = 0; jj < slots[ii]->tss_decomp.size(); jj++) {
+			const ca_keyval_t &kv = slots[ii]->tss_decomp[jj];
+
+			if (wp->tsw_keys.size() <= kv.first)
+				wp->tsw_keys.resize(kv.first + 1);
+
+			wkp = &wp->tsw_keys[kv.first];
+			wkp->tswk_nslots += (int)sign;
+			wkp->tswk_value += sign * kv.second;
+
+			if (wkp->tswk_nslots == 0)
+				wkp->tswk_value = 0;
+		}
+	}
+}
+
+/*
+ * Returns the JavaScript representation of the given value.  Only the part
+ * corresponding to this series's kind is used.
+ */
+Local<Value>
+TimeSeries::toValue(double scalar, const ca_decomp_t &decomp,
+    const caDist *dist, const caSketch *sketch)
+{
+	HandleScope scope;
+	Local<Object> rv;
+	size_t ii;
+
+	if (ts_kind == CA_TS_SCALAR)
+		return (scope.Close(Number::New(scalar)));
+
+	if (ts_kind == CA_TS_DIST) {
+		if (dist == NULL)
+			return (scope.Close(Array::New(0)));
+
+		return (scope.Close(dist->tojs()));
+	}
+
+	if (ts_kind == CA_TS_SKETCH) {
+		if (sketch == NULL)
+			return (scope.Close(caSketch(ts_alpha).tojs()));
+
+		return (scope.Close(sketch->tojs()));
+	}
+
+	rv = Object::New();
+	for (ii = 0; ii < decomp.size(); ii++) {
+		const string &name = ts_keys.name(decomp[ii].first);
+		rv->Set(String::New(name.c_str(), name.size()),
+		    Number::New(decomp[ii].second));
+	}
+
+	return (scope.Close(rv));
+}
+
+void
+TimeSeries::Initialize(Handle<Object> target)
+{
+	HandleScope scope;
+	Local<FunctionTemplate> templ = FunctionTemplate::New(TimeSeries::New);
+
+	ts_templ = Persistent<FunctionTemplate>::New(templ);
+	ts_templ->InstanceTemplate()->SetInternalFieldCount(1);
+	ts_templ->SetClassName(String::NewSymbol("TimeSeries"));
+
+	NODE_SET_PROTOTYPE_METHOD(ts_templ, "add", TimeSeries::Add);
+	NODE_SET_PROTOTYPE_METHOD(ts_templ, "value", TimeSeries::Sum);
+	NODE_SET_PROTOTYPE_METHOD(ts_templ, "byTime", TimeSeries::ByTime);
+	NODE_SET_PROTOTYPE_METHOD(ts_templ, "expire", TimeSeries::Expire);
+	NODE_SET_PROTOTYPE_METHOD(ts_templ, "times", TimeSeries::Times);
+	NODE_SET_PROTOTYPE_METHOD(ts_templ, "capacity", TimeSeries::Capacity);
+	NODE_SET_PROTOTYPE_METHOD(ts_templ, "quantiles", TimeSeries::Quantiles);
+	NODE_SET_PROTOTYPE_METHOD(ts_templ, "render", TimeSeries::Render);
+	NODE_SET_PROTOTYPE_METHOD(ts_templ, "renderAsync",
+	    TimeSeries::RenderAsync);
+	NODE_SET_PROTOTYPE_METHOD(ts_templ, "renderStats",
+	    TimeSeries::RenderStats);
+
+	target->Set(String::NewSymbol("TimeSeries"), ts_templ->GetFunction());
+}
+
+Handle<Value>
+TimeSeries::New(const Arguments& args)
+{
+	HandleScope scope;
+	caDistLayout *layout = NULL;
+	double alpha = 0.01;
+	ca_ts_kind kind;
+	TimeSeries *ts;
+
+	if (args.Length() < 3 || !args[0]->IsString() ||
+	    !args[1]->IsNumber() || !args[2]->IsNumber())
+		return (ca_throw("expected kind, granularity, and nslots"));
+
+	String::Utf8Value kstr(args[0]);
+
+	if (strcmp(*kstr, "scalar") == 0)
+		kind = CA_TS_SCALAR;
+	else if (strcmp(*kstr, "decomp") == 0)
+		kind = CA_TS_DECOMP;
+	else if (strcmp(*kstr, "dist") == 0)
+		kind = CA_TS_DIST;
+	else if (strcmp(*kstr, "sketch") == 0)
+		kind = CA_TS_SKETCH;
+	else
+		return (ca_throw("unsupported kind"));
+
+	if (args[1]->IntegerValue() < 1)
+		return (ca_throw("granularity must be positive"));
+
+	if (args[2]->IntegerValue() < 1)
+		return (ca_throw("nslots must be positive"));
+
+	if (kind == CA_TS_DIST) {
+		if (args.Length() > 3 && !args[3]->IsUndefined()) {
+			if ((layout = ca_dist_layout(args[3])) == NULL)
+				return (ca_throw("expected DistLayout"));
+
+			layout->hold();
+		} else {
+			layout = caDistLayout::ranges();
+		}
+	}
+
+	if (kind == CA_TS_SKETCH && args.Length() > 3 &&
+	    !args[3]->IsUndefined()) {
+		alpha = args[3]->NumberValue();
+
+		if (!(alpha > 0 && alpha < 1))
+			return (ca_throw("alpha must be between 0 and 1"));
+	}
+
+	ts = new TimeSeries(kind, args[1]->IntegerValue(),
+	    (size_t)args[2]->IntegerValue(), layout, alpha);
+	ts->Wrap(args.Holder());
+
+	if (layout != NULL)
+		layout->rele();
+
+	return (args.This());
+}
+
+Handle<Value>
+TimeSeries::Add(const Arguments& args)
+{
+	HandleScope scope;
+	TimeSeries *ts = ObjectWrap::Unwrap<TimeSeries>(args.Holder());
+	ca_ts_slot *sp;
+	int64_t time, index;
+
+	if (args.Length() < 1 ||
+	    (!args[0]->IsNumber() && !args[0]->IsString()))
+		return (ca_throw("expected time"));
+
+	if ((time = args[0]->IntegerValue()) < 0)
+		return (ca_throw("time must be non-negative"));
+
+	/*
+	 * Claiming a slot may expire older ones, so we validate the datum
+	 * before claiming its slot.  An undefined datum just claims the slot.
+	 */
+	index = time / ts->ts_granularity;
+
+	if (args[1]->IsUndefined()) {
+		(void) ts->claim(index);
+		return (Undefined());
+	}
+
+	if (ts->ts_kind == CA_TS_SCALAR) {
+		ts->addScalar(index, args[1]->NumberValue());
+		return (Undefined());
+	}
+
+	if (ts->ts_kind == CA_TS_DIST) {
+		caDist delta(ts->ts_layout);
+		const char *err;
+
+		if (!delta.addjs(args[1], &err))
+			return (ca_throw(err));
+
+		if ((sp = ts->claim(index)) == NULL)
+			return (Undefined());
+
+		if (sp->tss_dist == NULL)
+			sp->tss_dist = new caDist(ts->ts_layout);
+
+		sp->tss_dist->merge(delta);
+		ts->ts_prefix->add(index, delta);
+		return (Undefined());
+	}
+
+	if (ts->ts_kind == CA_TS_SKETCH) {
+		caSketch delta(ts->ts_alpha);
+		const char *err;
+
+		if (!delta.addjs(args[1], &err))
+			return (ca_throw(err));
+
+		if ((sp = ts->claim(index)) == NULL)
+			return (Undefined());
+
+		if (sp->tss_sketch == NULL)
+			sp->tss_sketch = new caSketch(ts->ts_alpha);
+
+		sp->tss_sketch->merge(delta);
+		return (Undefined());
+	}
+
+	if (!args[1]->IsObject())
+		return (ca_throw("expected decomposition object"));
+
+	if (ts->claim(index) == NULL)
+		return (Undefined());
+
+	ts->addDecomp(index, args[1]->ToObject());
+	return (Undefined());
+}
+
+/*
+ * Adds a value parsed by an Ingest (see ca-ingest.h).  This is equivalent to
+ * Add() but creates no JavaScript objects.
+ */
+bool
+TimeSeries::ingest(int64_t time, const caIngestDatum &datum)
+{
+	int64_t index = time / ts_granularity;
+	ca_ts_slot *sp;
+	uint32_t bucket;
+	size_t ii;
+
+	switch (ts_kind) {
+	case CA_TS_SCALAR:
+		if (datum.id_kind != CA_IN_SCALAR)
+			return (false);
+
+		addScalar(index, datum.id_scalar);
+		return (true);
+
+	case CA_TS_DECOMP:
+		if (datum.id_kind != CA_IN_DECOMP)
+			return (false);
+
+		(void) claim(index);
+		for (ii = 0; ii < datum.id_entries.size(); ii++)
+			addDecompKey(index,
+			    datum.id_keys[datum.id_entries[ii].ie_key],
+			    datum.id_entries[ii].ie_value);
+		return (true);
+
+	case CA_TS_DIST: {
+		caDist delta(ts_layout);
+
+		if (datum.id_kind != CA_IN_DIST)
+			return (false);
+
+		for (ii = 0; ii < datum.id_entries.size(); ii++) {
+			const ca_ingest_entry &entry = datum.id_entries[ii];
+
+			if (!ts_layout->index(entry.ie_low, entry.ie_high,
+			    &bucket))
+				return (false);
+
+			delta.add(bucket, entry.ie_value);
+		}
+
+		if ((sp = claim(index)) == NULL)
+			return (true);
+
+		if (sp->tss_dist == NULL)
+			sp->tss_dist = new caDist(ts_layout);
+
+		sp->tss_dist->merge(delta);
+		ts_prefix->add(index, delta);
+		return (true);
+	}
+
+	case CA_TS_SKETCH: {
+		caSketch delta(ts_alpha);
+
+		if (datum.id_kind != CA_IN_DIST)
+			return (false);
+
+		for (ii = 0; ii < datum.id_entries.size(); ii++) {
+			if (!delta.insertRange(datum.id_entries[ii].ie_low,
+			    datum.id_entries[ii].ie_high,
+			    datum.id_entries[ii].ie_value))
+				return (false);
+		}
+
+		if ((sp = claim(index)) == NULL)
+			return (true);
+
+		if (sp->tss_sketch == NULL)
+			sp->tss_sketch = new caSketch(ts_alpha);
+
+		sp->tss_sketch->merge(delta);
+		return (true);
+	}
+	}
+
+	return (false);
+}
+
+caIngestTarget *
+ca_timeseries_target(Handle<Value> value)
+{
+	if (!value->IsObject() || !TimeSeries::ts_templ->HasInstance(value))
+		return (NULL);
+
+	return (node::ObjectWrap::Unwrap<TimeSeries>(value->ToObject()));
+}
+
+ca_stash_kind
+TimeSeries::stashKind(double *paramp) const
+{
+	*paramp = ts_kind == CA_TS_SKETCH ? ts_alpha : 0;
+
+	switch (ts_kind) {
+	case CA_TS_SCALAR:
+		return (CA_ST_SCALAR);
+	case CA_TS_DECOMP:
+		return (CA_ST_DECOMP);
+	case CA_TS_DIST:
+		return (CA_ST_DIST);
+	default:
+		return (CA_ST_SKETCH);
+	}
+}
+
+/*
+ * Encodes the value for "time" for a stash (see ca-stash.h).
+ */
+void
+TimeSeries::stashSlot(caStashWriter *wp, int64_t time)
+{
+	ca_ts_slot *sp = ts_ring.slot(time / ts_granularity);
+	size_t ii;
+
+	switch (ts_kind) {
+	case CA_TS_SCALAR:
+		wp->putNumber(sp != NULL ? sp->tss_scalar : 0);
+		break;
+
+	case CA_TS_DECOMP:
+		if (sp == NULL) {
+			wp->putVarint(0);
+			break;
+		}
+
+		wp->putVarint(sp->tss_decomp.size());
+		for (ii = 0; ii < sp->tss_decomp.size(); ii++) {
+			wp->putString(ts_keys.name(sp->tss_decomp[ii].first));
+			wp->putNumber(sp->tss_decomp[ii].second);
+		}
+		break;
+
+	case CA_TS_DIST:
+		if (sp == NULL || sp->tss_dist == NULL)
+			caDist(ts_layout).stash(wp);
+		else
+			sp->tss_dist->stash(wp);
+		break;
+
+	case CA_TS_SKETCH:
+		if (sp == NULL || sp->tss_sketch == NULL)
+			caSketch(ts_alpha).stash(wp);
+		else
+			sp->tss_sketch->stash(wp);
+		break;
+	}
+}
+
+/*
+ * Adds a value encoded by stashSlot() to the value for "time".
+ */
+bool
+TimeSeries::unstashSlot(caStashReader *rp, int64_t time)
+{
+	int64_t index = time / ts_granularity;
+	const string *name;
+	uint64_t nkeys, ii;
+	ca_ts_slot *sp;
+	double value;
+
+	switch (ts_kind) {
+	case CA_TS_SCALAR:
+		if (!rp->getNumber(&value))
+			return (false);
+
+		addScalar(index, value);
+		return (true);
+
+	case CA_TS_DECOMP:
+		if (!rp->getVarint(&nkeys))
+			return (false);
+
+		/* A decomposition with no keys still claims its slot. */
+		(void) claim(index);
+		for (ii = 0; ii < nkeys; ii++) {
+			if (!rp->getString(&name) || !rp->getNumber(&value))
+				return (false);
+
+			addDecompKey(index, *name, value);
+		}
+		return (true);
+
+	case CA_TS_DIST: {
+		caDist delta(ts_layout);
+
+		if (!delta.unstash(rp))
+			return (false);
+
+		if ((sp = claim(index)) == NULL)
+			return (true);
+
+		if (sp->tss_dist == NULL)
+			sp->tss_dist = new caDist(ts_layout);
+
+		sp->tss_dist->merge(delta);
+		ts_prefix->add(index, delta);
+		return (true);
+	}
+
+	case CA_TS_SKETCH: {
+		caSketch delta(ts_alpha);
+
+		if (!delta.unstash(rp))
+			return (false);
+
+		if ((sp = claim(index)) == NULL)
+			return (true);
+
+		if (sp->tss_sketch == NULL)
+			sp->tss_sketch = new caSketch(ts_alpha);
+
+		sp->tss_sketch->merge(delta);
+		return (true);
+	}
+	}
+
+	return (false);
+}
+
+caStashable *
+ca_timeseries_stashable(Handle<Value> value)
+{
+	if (!value->IsObject() || !TimeSeries::ts_templ->HasInstance(value))
+		return (NULL);
+
+	return (node::ObjectWrap::Unwrap<TimeSeries>(value->ToObject()));
+}
+
+Handle<Value>
+TimeSeries::Sum(const Arguments& args)
+{
+	HandleScope scope;
+	TimeSeries *ts = ObjectWrap::Unwrap<TimeSeries>(args.Holder());
+	vector<ca_ts_slot *> slots;
+	ca_ts_window *wp;
+	int64_t first, last;
+	double scalar;
+	ca_decomp_t decomp;
+	caSketch sketch(ts->ts_alpha);
+	size_t ii;
+
+	if (!ts->interval(args, &first, &last))
+		return (ca_throw("expected start and duration"));
+
+	scalar = 0;
+	ts->ts_nsums++;
+
+	if ((ts->ts_kind == CA_TS_SCALAR || ts->ts_kind == CA_TS_DECOMP) &&
+	    last - first >= CA_TS_WINDOW_MIN) {
+		wp = ts->window(first, last);
+
+		for (ii = 0; ii < wp->tsw_keys.size(); ii++) {
+			if (wp->tsw_keys[ii].tswk_nslots > 0)
+				decomp.push_back(ca_keyval_t(ii,
+				    wp->tsw_keys[ii].tswk_value));
+		}
+
+		return (scope.Close(ts->toValue(wp->tsw_scalar, decomp, NULL,
+		    NULL)));
+	}
+
+	if (ts->ts_kind == CA_TS_DIST) {
+		caDist dist(ts->ts_layout);
+
+		ts->ts_prefix->sum(first, last, &dist);
+		return (scope.Close(ts->toValue(scalar, decomp, &dist, NULL)));
+	}
+
+	ts->ts_ring.slots(first, last, &slots);
+
+	for (ii = 0; ii < slots.size(); ii++) {
+		scalar += slots[ii]->tss_scalar;
+		ts->sumDecomp(&decomp, slots[ii]->tss_decomp);
+
+		if (slots[ii]->tss_sketch != NULL)
+			sketch.merge(*slots[ii]->tss_sketch);
+	}
+
+	return (scope.Close(ts->toValue(scalar, decomp, NULL, &sketch)));
+}
+
+Handle<Value>
+TimeSeries::ByTime(const Arguments& args)
+{
+	HandleScope scope;
+	TimeSeries *ts = ObjectWrap::Unwrap<TimeSeries>(args.Holder());
+	vector<ca_ts_slot *> slots;
+	int64_t first, last;
+	Local<Object> rv;
+	size_t ii;
+
+	if (args.Length() >= 2) {
+		first = args[0]->IntegerValue() / ts->ts_granularity;
+		last = (args[0]->IntegerValue() + args[1]->IntegerValue() +
+		    ts->ts_granularity - 1) / ts->ts_granularity;
+	} else {
+		first = 0;
+		last = INT64_MAX;
+	}
+
+	ts->ts_ring.slots(first, last, &slots);
+	rv = Object::New();
+
+	for (ii = 0; ii < slots.size(); ii++) {
+		rv->Set(Number::New((double)(ts->ts_ring.index(slots[ii]) *
+		    ts->ts_granularity)),
+		    ts->toValue(slots[ii]->tss_scalar, slots[ii]->tss_decomp,
+		    slots[ii]->tss_dist, slots[ii]->tss_sketch));
+	}
+
+	return (scope.Close(rv));
+}
+
+Handle<Value>
+TimeSeries::Expire(const Arguments& args)
+{
+	HandleScope scope;
+	TimeSeries *ts = ObjectWrap::Unwrap<TimeSeries>(args.Holder());
+	int64_t exptime;
+
+	if (args.Length() < 1 || !args[0]->IsNumber())
+		return (ca_throw("expected expiration time"));
+
+	exptime = args[0]->IntegerValue();
+	if (exptime <= 0)
+		return (Undefined());
+
+	ts->expire((exptime + ts->ts_granularity - 1) / ts->ts_granularity);
+	return (Undefined());
+}
+
+Handle<Value>
+TimeSeries::Times(const Arguments& args)
+{
+	HandleScope scope;
+	TimeSeries *ts = ObjectWrap::Unwrap<TimeSeries>(args.Holder());
+	vector<int64_t> indexes;
+	Local<Array> rv;
+	size_t ii;
+
+	ts->ts_ring.indexes(&indexes);
+	rv = Array::New(indexes.size());
+	for (ii = 0; ii < indexes.size(); ii++)
+		rv->Set(ii, Number::New(
+		    (double)(indexes[ii] * ts->ts_granularity)));
+
+	return (scope.Close(rv));
+}
+
+Handle<Value>
+TimeSeries::Capacity(const Arguments& args)
+{
+	HandleScope scope;
+	TimeSeries *ts = ObjectWrap::Unwrap<TimeSeries>(args.Holder());
+
+	return (scope.Close(Number::New((double)ts->ts_ring.capacity())));
+}
+
+Handle<Value>
+TimeSeries::Quantiles(const Arguments& args)
+{
+	HandleScope scope;
+	TimeSeries *ts = ObjectWrap::Unwrap<TimeSeries>(args.Holder());
+	vector<ca_ts_slot *> slots;
+	caSketch sketch(ts->ts_alpha);
+	int64_t first, last;
+	Local<Array> qs, rv;
+	double qq;
+	uint32_t ii;
+
+	if (ts->ts_kind != CA_TS_SKETCH)
+		return (ca_throw("only sketches support quantiles"));
+
+	if (!ts->interval(args, &first, &last))
+		return (ca_throw("expected start and duration"));
+
+	if (args.Length() < 3 || !args[2]->IsArray())
+		return (ca_throw("expected array of quantiles"));
+
+	qs = Local<Array>::Cast(args[2]);
+
+	for (ii = 0; ii < qs->Length(); ii++) {
+		qq = qs->Get(ii)->NumberValue();
+		if (!(qq >= 0 && qq <= 1))
+			return (ca_throw("quantiles must be between 0 and 1"));
+	}
+
+	ts->ts_ring.slots(first, last, &slots);
+
+	for (ii = 0; ii < slots.size(); ii++) {
+		if (slots[ii]->tss_sketch != NULL)
+			sketch.merge(*slots[ii]->tss_sketch);
+	}
+
+	rv = Array::New(qs->Length());
+	for (ii = 0; ii < qs->Length(); ii++)
+		rv->Set(ii, Number::New(sketch.quantile(
+		    qs->Get(ii)->NumberValue())));
+
+	return (scope.Close(rv));
+}
+
+/*
+ * Collects the distributions for each column of the heatmap described by
+ * "conf".  The selected keys have no data.
+ */
+void
+TimeSeries::columns(const caHeatmapConf &conf, Handle<Value> selected,
+    vector<ca_columns_t> *sources)
+{
+	ca_ts_slot *sp;
+	int64_t time;
+	size_t ii, nselected;
+
+	nselected = 0;
+	if (selected->IsArray())
+		nselected = Local<Array>::Cast(selected)->Length();
+
+	sources->resize(1 + nselected);
+
+	for (ii = 0; ii < sources->size(); ii++)
+		(*sources)[ii].resize(conf.hc_times.size(), NULL);
+
+	for (ii = 0; ii < conf.hc_times.size(); ii++) {
+		time = (int64_t)conf.hc_times[ii];
+
+		if (time != conf.hc_times[ii] || time < 0 ||
+		    time % ts_granularity != 0)
+			continue;
+
+		if ((sp = ts_ring.slot(time / ts_granularity)) != NULL)
+			(*sources)[0][ii] = sp->tss_dist;
+	}
+}
+
+Handle<Value>
+TimeSeries::Render(const Arguments& args)
+{
+	HandleScope scope;
+	TimeSeries *ts = ObjectWrap::Unwrap<TimeSeries>(args.Holder());
+	vector<ca_columns_t> sources;
+	caHeatmapConf conf;
+	const char *err;
+
+	if (ts->ts_kind != CA_TS_DIST)
+		return (ca_throw("only distributions can be rendered"));
+
+	if (!ca_heatmap_conf(args[0], &conf, &err))
+		return (ca_throw(err));
+
+	ts->columns(conf, args[1], &sources);
+	return (scope.Close(ca_heatmap_render(args[0], &conf, sources,
+	    &ts->ts_cache)));
+}
+
+Handle<Value>
+TimeSeries::RenderAsync(const Arguments& args)
+{
+	HandleScope scope;
+	TimeSeries *ts = ObjectWrap::Unwrap<TimeSeries>(args.Holder());
+	vector<ca_columns_t> sources;
+	caHeatmapConf conf;
+	caPngOptions pngopts;
+	const char *err;
+
+	if (ts->ts_kind != CA_TS_DIST)
+		return (ca_throw("only distributions can be rendered"));
+
+	if (args.Length() < 4)
+		return (ca_throw("expected conf, selected, options, and "
+		    "callback"));
+
+	if (!ca_heatmap_conf(args[0], &conf, &err) ||
+	    !ca_png_options(args[2], &pngopts, &err))
+		return (ca_throw(err));
+
+	ts->columns(conf, args[1], &sources);
+	return (scope.Close(ca_heatmap_render_async(args[0], &conf, sources,
+	    &ts->ts_cache, &pngopts, args[3])));
+}
+
+Handle<Value>
+TimeSeries::RenderStats(const Arguments& args)
+{
+	HandleScope scope;
+	TimeSeries *ts = ObjectWrap::Unwrap<TimeSeries>(args.Holder());
+
+	return (scope.Close(ts->ts_cache.stats()));
+}
+
+void
+ca_timeseries_init(Handle<Object> target)
+{
+	TimeSeries::Initialize(target);
+}
@@ -17,18 +17,51 @@ var mod_assert = require('assert');
 var ASSERT = mod_assert.ok;
 
 var mod_ca = require('./ca-common');
+var mod_native = require('ca-native');
 var mod_heatmap;
 
+/*
+ * Datasets backed by a native TimeSeries preallocate enough slots to cover the
+ * instrumentation's retention time.  Instrumentations without a retention time
+ * (which should be rare outside of tests) start with enough slots to cover
+ * this many seconds.  A series grows to at most four times its initial size to
+ * accommodate more data, dropping the oldest data beyond that (see ca-ring.h),
+ * so a datum with a stale timestamp can't make it grow without bound.
+ */
+var caDatasetDefaultRetention = 600;
+
+/*
+ * zlib compression level for heatmap PNGs, from 0 (none) to 9 (best).  Higher
+ * levels trade aggregator CPU time for smaller responses.
+ */
+var caAggrPngLevel = 6;
+
+/*
+ * Relative accuracy of quantile sketches for "value-sketch" instrumentations:
+ * each reported quantile is within this fraction of the true value (beyond the
+ * resolution of the instrumenter's own buckets).  Smaller values use more
+ * memory per second of data.
+ */
+var caDatasetSketchAccuracy = 0.01;
+
+/*
+ * Stashes with this minor version or later are encoded in the compact binary
+ * format implemented by ca-native's stashEncode().  Earlier stashes are JSON.
+ */
+var caDatasetStashBinary = 3;
+exports.caDatasetStashBinary = caDatasetStashBinary;
+
 /*
  * Given an instrumentation, returns an instance of caDataset for handling that
  * instrumentation's data.  See caDataset below for details.
  */
 function caDatasetForInstrumentation(inst)
 {
-	var nsources, granularity, doadd, cons;
+	var nsources, granularity, doadd, retention, cons;
 
 	nsources = inst['nsources'];
 	granularity = inst['granularity'];
+	retention = inst['retention-time'];
 	ASSERT(granularity > 0);
 
 	ASSERT(inst['value-dimension'] > 0);
@@ -38,6 +71,10 @@ function caDatasetForInstrumentation(inst)
 
 	if (inst['value-dimension'] == 1) {
 		cons = caDatasetScalar;
+	} else if (inst['value-sketch']) {
+		ASSERT(inst['value-dimension'] == 2);
+		ASSERT(inst['value-arity'] == mod_ca.ca_arity_numeric);
+		cons = caDatasetSketch;
 	} else if (inst['value-dimension'] == 3) {
 		ASSERT(inst['value-arity'] == mod_ca.ca_arity_numeric);
 		cons = caDatasetHeatmapDecomp;
@@ -47,7 +84,7 @@ function caDatasetForInstrumentation(inst)
 		cons = caDatasetDecomp;
 	}
 
-	return (new cons(granularity, nsources, doadd));
+	return (new cons(granularity, nsources, doadd, retention));
 }
 
 exports.caDatasetForInstrumentation = caDatasetForInstrumentation;
@@ -58,7 +95,7 @@ exports.caDatasetForInstrumentation = caDatasetForInstrumentation;
  * instrumentation over a specified period of time.  The base class caDataset
  * implements common functions like tracking the number of sources reporting for
  * this instrumentation, but caDataset itself is an abstract class and doesn't
- * manage the actual data.  That's handled by four subclasses:
+ * manage the actual data.  That's handled by five subclasses:
  *
  *	caDatasetScalar		scalar values
  *
@@ -68,15 +105,41 @@ exports.caDatasetForInstrumentation = caDatasetForInstrumentation;
  *
  *	caDatasetHeatmapDecomp	heatmap values with an additional decomposition
  *
- * Additionally, the caDatasetSimple class is used as a parent class of the
- * first three of these to provide functionality common to these
- * implementations.
+ *	caDatasetSketch		numeric values summarized as quantile sketches
+ *				(for instrumentations with "value-sketch" set)
+ *
+ * Additionally, the caDatasetSeries class is used as a parent class of all of
+ * these except caDatasetHeatmapDecomp to store their data in a native
+ * TimeSeries.
+ *
+ * Data is stored in one or more tiers, as described by caDataTiers(): the
+ * first at the instrumentation's granularity, and for instrumentations with
+ * long retention times, additional tiers at coarser granularities that each
+ * keep data for longer.  Every tier stores all data added for the time it
+ * spans, so rolling data up doesn't require a separate pass over older data,
+ * and queries are answered from the coarsest tier that satisfies them (see
+ * tier()).  Subclasses create the native storage for each tier (ct_data),
+ * which must provide add(), value(), and expire().  As a result, memory used
+ * for long retention times grows only with the number of tiers rather than
+ * with the retention time.
  *
  * The methods provided by caDataset itself (and thus available for all
  * datasets) include:
  *
  *	update(source, time, datum)	Add new data to this dataset.
  *
+ *	report(source, time)		Records that "source" reported data for
+ *					"time" without adding any data.  This is
+ *					used when the data itself was added
+ *					directly to the native datasets returned
+ *					by ingestTargets().
+ *
+ *	ingestTargets()			Returns the native objects (TimeSeries
+ *					or HeatmapDecomps) to which a native
+ *					Ingest can add this dataset's data
+ *					directly, or undefined if data must be
+ *					added with update().
+ *
  *	expireBefore(exptime)		Throws out data older than 'exptime'.
  *
  *	dataForTime(start, duration)	Returns the raw data representation for
@@ -98,19 +161,34 @@ exports.caDatasetForInstrumentation = caDatasetForInstrumentation;
  *
  *	normalizeInterval(start,	Returns an interval described with
  *	    duration			'start_time' and 'duration' properties
- *					that's aligned with this dataset's
- *					granularity.
+ *					that's aligned with the granularity of
+ *					the finest tier that still has data for
+ *					'start'.
+ *
+ *	step(start, duration, width)	Returns the granularity of the tier to
+ *					use for displaying the specified
+ *					interval "width" data points wide.
  *
- *	stash()				Returns a serialized representation of
+ *	stash([since])			Returns a serialized representation of
  *					the dataset's data for passing to
- *					unstash().
+ *					unstash(): "metadata" and "data", a
+ *					Buffer in the binary stash format.  If
+ *					"since" is specified, only data for
+ *					times at or after "since" is included,
+ *					and the result is a segment that
+ *					supersedes that data in earlier stashes.
  *
- *	unstash(data)			Given a serialized representation as
- *					returned by a previous call to stash(),
+ *	unstash(metadata, data		Given a serialized representation as
+ *	    [, segments])		returned by a previous call to stash(),
  *					load the specified data into this
- *					dataset.  This data will be combined
- *					with other data already stored in the
- *					dataset.
+ *					dataset, followed by the segments (each
+ *					an object with "metadata" and "data")
+ *					stashed after it.  This data will be
+ *					combined with other data already stored
+ *					in the dataset.  Binary data may also be
+ *					passed as a base64 string, and data
+ *					stashed in JSON by older versions may be
+ *					passed as the parsed object.
  *
  * Heatmap datasets provide additional methods to retrieve data that's stored
  * more efficiently for the heatmap generator:
@@ -120,27 +198,79 @@ exports.caDatasetForInstrumentation = caDatasetForInstrumentation;
  *					non-zero values during the specified
  *					interval.
  *
- *	total()				Returns the data for all keys.  That is,
+ *	total([start, duration])	Returns the data for all keys.  That is,
  *					the data at each time index is the sum
  *					of data over all keys at that time.
  *
- *	dataForKey(key)			Returns the data for a specific key.
+ *	dataForKey(key[, start,		Returns the data for a specific key.
+ *	    duration])
+ *
+ *	totalValue(start, duration)	Returns a single distribution: the sum
+ *					of the data for all keys over the whole
+ *					interval.  This takes constant time
+ *					regardless of the interval's length.
+ *
+ *	render(conf, selected)		Renders a heatmap image of the total
+ *					and the keys in "selected" as described
+ *					by "conf" and returns the RGB pixels.
+ *					See caAggrValueHeatmapImage.
+ *
+ *	renderAsync(conf, selected,	Like render(), but the rendering is
+ *	    options, callback)		finished and the image is encoded as a
+ *					base64 PNG (see ca-native's
+ *					pngEncodeBase64 for "options") on
+ *					another thread.  "callback" is invoked
+ *					with an error or the image.
+ *
+ *	renderStats()			Returns statistics about the cache of
+ *					bucketized columns used by render().
+ *					Repeated requests for the same heatmap
+ *					only bucketize columns whose data has
+ *					changed since the previous request.
+ *
+ * Sketch datasets instead provide:
  *
- * Note that the data accessors for the heatmap objects do not reference a
- * particular time.  They return data for all time.  This avoids having to
- * create a new object for each request for the specific time interval in the
- * request.  This works because node-heatmap can consume much more data than it
- * actually needs as long as the caller specifies which data to look at.
+ *	quantiles(start, duration, qs)	Returns an array of the estimated values
+ *					at each quantile in "qs" over the whole
+ *					interval.
+ *
+ * The heatmap methods return objects mapping time to distribution, suitable
+ * for passing to node-heatmap.  Distributions are stored natively (see
+ * ca-native), so these objects are created on demand.  Callers should pass the
+ * interval they're interested in so that we only convert the data they'll
+ * actually look at.  Without an interval, data for all time is returned.
  */
-function caDataset(granularity, nsources, doadd)
+function caDataset(granularity, nsources, doadd, retention)
 {
+	var tiers, gran, span, ii;
+
 	this.cd_granularity = granularity;
 	this.cd_nsources = nsources;
 	this.cd_sources = {};
-	this.cd_reporting = {};
 	this.cd_vers_major = 0;
-	this.cd_vers_minor = 1;
+	this.cd_vers_minor = 3;
 	this.cd_doadd = doadd;
+	this.cd_retention = retention;
+	this.cd_tiers = [];
+
+	/* subclass prototypes are created without arguments */
+	if (granularity === undefined)
+		return;
+
+	tiers = mod_ca.caDataTiers(granularity, retention);
+
+	for (ii = 0; ii < tiers.length; ii++) {
+		gran = tiers[ii]['granularity'];
+		span = tiers[ii]['span'];
+		this.cd_tiers.push({
+		    ct_granularity: gran,
+		    ct_span: span,
+		    ct_expired: 0,	/* data before this time is gone */
+		    ct_reporting: new mod_native.Reporting(gran,
+			caDatasetSlots(gran, span)),	/* sources reporting */
+		    ct_data: undefined	/* native storage */
+		});
+	}
 }
 
 /*
@@ -150,12 +280,28 @@ function caDataset(granularity, nsources, doadd)
  *
  * This base class implementation updates our state about which sources are
  * reporting data for this instrumentation and then delegates the actual data
- * handling to subclasses via aggregateValue().
+ * handling to aggregateValue().
  */
 caDataset.prototype.update = function (source, rawtime, datum)
 {
 	var time;
 
+	if ((time = this.report(source, rawtime)) === undefined)
+		return;
+
+	this.aggregateValue(time, datum);
+};
+
+/*
+ * report(source, time): Updates our state about which sources are reporting
+ * data.  Returns the aligned time index for the data, or undefined if the data
+ * should be ignored because this source has already reported data for this time
+ * index and we're not supposed to add multiple data points.
+ */
+caDataset.prototype.report = function (source, rawtime)
+{
+	var time, tier, ttime, ii;
+
 	if (!(source in this.cd_sources)) {
 		this.cd_sources[source] = { s_last: rawtime };
 	} else {
@@ -171,21 +317,73 @@ caDataset.prototype.update = function (source, rawtime, datum)
 	 */
 	time = this.ptime(rawtime);
 
-	if (!(time in this.cd_reporting))
-		this.cd_reporting[time] = {};
-
 	/*
 	 * If this source has already reported data for this time period and
 	 * we're not supposed to add multiple data points, then we just ignore
 	 * the new data point.
 	 */
-	if (this.cd_reporting[time][source] && !this.cd_doadd)
-		return;
+	if (!this.cd_tiers[0].ct_reporting.report(time, source) &&
+	    !this.cd_doadd)
+		return (undefined);
 
-	this.cd_reporting[time][source] = true;
+	for (ii = 1; ii < this.cd_tiers.length; ii++) {
+		tier = this.cd_tiers[ii];
+		ttime = time - (time % tier.ct_granularity);
 
-	ASSERT(this.aggregateValue, 'caDataset is abstract');
-	this.aggregateValue(time, datum);
+		if (!this.cd_doadd && ttime != time)
+			continue;
+
+		tier.ct_reporting.report(ttime, source);
+	}
+
+	return (time);
+};
+
+/*
+ * [private] aggregateValue(time, datum[, tiers]): Adds "datum" to the data for
+ * "time" in each of "tiers" (default: all tiers).  For datasets that don't add
+ * multiple data points, a coarser tier's data point is the same as the data
+ * point at the start of its interval, so other data points are not stored in
+ * coarser tiers at all.
+ */
+caDataset.prototype.aggregateValue = function (time, datum, tiers)
+{
+	var tier, ii;
+
+	ASSERT(time % this.cd_granularity === 0);
+	ASSERT(this.cd_tiers[0].ct_data, 'caDataset is abstract');
+
+	if (tiers === undefined)
+		tiers = this.cd_tiers;
+
+	for (ii = 0; ii < tiers.length; ii++) {
+		tier = tiers[ii];
+
+		if (!this.cd_doadd && time % tier.ct_granularity !== 0)
+			continue;
+
+		tier.ct_data.add(time, datum);
+	}
+};
+
+/*
+ * ingestTargets(): Returns the native objects to which new data can be added
+ * directly, one for each tier.  Since a native Ingest adds every data point it
+ * receives, this is only possible for datasets that add multiple data points
+ * for the same time.
+ */
+caDataset.prototype.ingestTargets = function ()
+{
+	var targets, ii;
+
+	if (!this.cd_doadd)
+		return (undefined);
+
+	targets = [];
+	for (ii = 0; ii < this.cd_tiers.length; ii++)
+		targets.push(this.cd_tiers[ii].ct_data);
+
+	return (targets);
 };
 
 /*
@@ -197,31 +395,93 @@ caDataset.prototype.updateSources = function (nsources)
 };
 
 /*
- * expireBefore(exptime): Removes data older than "exptime".  This base class
- * removes source-specific information but delegates to the subclass for
- * expiring the actual data.
+ * expireBefore(exptime): Removes data older than "exptime".  Tiers that don't
+ * span the whole retention time expire their data correspondingly sooner.
  */
 caDataset.prototype.expireBefore = function (exptime)
 {
-	var time;
+	var tier, texp, ii;
 
-	for (time in this.cd_reporting) {
-		if (time >= exptime)
+	for (ii = 0; ii < this.cd_tiers.length; ii++) {
+		tier = this.cd_tiers[ii];
+		texp = exptime;
+
+		if (tier.ct_span < this.cd_retention)
+			texp += this.cd_retention - tier.ct_span;
+
+		tier.ct_reporting.expire(texp);
+		tier.ct_data.expire(texp);
+		tier.ct_expired = Math.max(tier.ct_expired, texp);
+	}
+};
+
+/*
+ * [private] tier(start, duration[, width]): Returns the tier from which to
+ * retrieve data for the interval [start, start + duration).  Of the tiers that
+ * still have data for the whole interval and whose granularity the interval is
+ * aligned to, this picks the coarsest one that has at least "width" (default:
+ * 1) data points in the interval, or if none has that many, the finest one.
+ * If no tier has data for the interval, this returns the first tier.
+ */
+caDataset.prototype.tier = function (start, duration, width)
+{
+	var finest, coarsest, tier, gran, ii;
+
+	if (width === undefined)
+		width = 1;
+
+	for (ii = 0; ii < this.cd_tiers.length; ii++) {
+		tier = this.cd_tiers[ii];
+		gran = tier.ct_granularity;
+
+		if (start % gran !== 0 || duration % gran !== 0 ||
+		    start < tier.ct_expired)
 			continue;
 
-		delete (this.cd_reporting[time]);
+		if (finest === undefined)
+			finest = tier;
+
+		if (duration / gran >= width)
+			coarsest = tier;
 	}
 
-	this.expireDataBefore(exptime);
+	if (coarsest !== undefined)
+		return (coarsest);
+
+	if (finest !== undefined)
+		return (finest);
+
+	return (this.cd_tiers[0]);
+};
+
+/*
+ * step(start, duration, width): Returns the granularity of the data used to
+ * display the specified interval as "width" data points.  See tier().
+ */
+caDataset.prototype.step = function (start, duration, width)
+{
+	return (this.tier(start, duration, width).ct_granularity);
 };
 
 /*
  * dataForTime(start, duration): Returns the raw data for the specified
- * interval.  The implementation is entirely subclass-specific.
+ * interval.  For datasets that don't add multiple data points, this is the data
+ * point at "start".
  */
 caDataset.prototype.dataForTime = function (start, duration)
 {
-	ASSERT(false, 'caDataset is abstract');
+	var tier;
+
+	mod_assert.equal(start % this.cd_granularity, 0);
+	mod_assert.equal(duration % this.cd_granularity, 0);
+	ASSERT(duration > 0);
+
+	tier = this.tier(start, duration);
+
+	if (!this.cd_doadd)
+		duration = tier.ct_granularity;
+
+	return (tier.ct_data.value(start, duration));
 };
 
 /*
@@ -247,10 +507,19 @@ caDataset.prototype.nsources = function ()
  * we're trying to convey is whether a given data point may be missing data
  * because some sources weren't reporting.  We're not trying to convey anything
  * about the overall health of the system.
+ *
+ * For data that's only available from a coarser tier, "every second" above
+ * becomes every data point of that tier, and a source counts as reporting for
+ * a data point if it reported at any time during it.
+ *
+ * Each tier tracks the sources reporting at each time in a native Reporting
+ * (see ca-native), which keeps a running count per data point, so this takes
+ * time proportional to the number of data points in the interval no matter how
+ * many sources there are.  The aggregator calls this for every data message.
  */
 caDataset.prototype.nreporting = function (start, duration)
 {
-	var minval, value, time;
+	var tier;
 
 	if (!duration)
 		duration = this.cd_granularity;
@@ -258,19 +527,8 @@ caDataset.prototype.nreporting = function (start, duration)
 	ASSERT(start % this.cd_granularity === 0);
 	ASSERT(duration % this.cd_granularity === 0);
 
-	for (time = start; time < start + duration;
-	    time += this.cd_granularity) {
-		value = this.nReportingAt(time);
-
-		if (minval == undefined) {
-			minval = value;
-			continue;
-		}
-
-		minval = Math.min(minval, value);
-	}
-
-	return (minval ? minval : 0);
+	tier = this.tier(start, duration, duration / this.cd_granularity);
+	return (tier.ct_reporting.min(start, duration));
 };
 
 /*
@@ -282,7 +540,7 @@ caDataset.prototype.nreporting = function (start, duration)
  */
 caDataset.prototype.maxreporting = function (start, duration)
 {
-	var maxval, value, time;
+	var tier;
 
 	if (!duration)
 		duration = 1;
@@ -290,27 +548,10 @@ caDataset.prototype.maxreporting = function (start, duration)
 	ASSERT(start % this.cd_granularity === 0);
 	ASSERT(duration == 1 || duration % this.cd_granularity === 0);
 
-	maxval = 0;
-	for (time = start; time < start + duration;
-	    time += this.cd_granularity) {
-		value = this.nReportingAt(time);
-		maxval = Math.max(maxval, value);
-	}
+	tier = this.tier(start, Math.max(duration, this.cd_granularity),
+	    duration / this.cd_granularity);
 
-	return (maxval);
-};
-
-/*
- * [private] Returns the number of sources reporting at this time
- */
-caDataset.prototype.nReportingAt = function (time)
-{
-	ASSERT(time % this.cd_granularity === 0);
-
-	if (!(time in this.cd_reporting))
-		return (0);
-
-	return (caNumProps(this.cd_reporting[time]));
+	return (tier.ct_reporting.max(start, duration));
 };
 
 /*
@@ -338,56 +579,165 @@ caDataset.prototype.ntime = function (rawtime)
 	return (this.ptime(rawtime) + this.cd_granularity);
 };
 
+/*
+ * Data older than what the first tier keeps is only available at a coarser
+ * granularity, so intervals starting then are aligned to the granularity of
+ * the finest tier that still has data for the start of the interval.
+ */
 caDataset.prototype.normalizeInterval = function (rawstart, rawduration)
 {
+	var gran, start, ii;
+
+	for (ii = 0; ii < this.cd_tiers.length; ii++) {
+		gran = this.cd_tiers[ii].ct_granularity;
+		start = rawstart - (rawstart % gran);
+
+		if (start >= this.cd_tiers[ii].ct_expired)
+			break;
+	}
+
+	if (ii == this.cd_tiers.length) {
+		gran = this.cd_granularity;
+		start = this.ptime(rawstart);
+	}
+
 	return ({
-		start_time: this.ptime(rawstart),
-		duration: this.ntime(rawduration)
+		start_time: start,
+		duration: rawduration % gran === 0 ? rawduration :
+		    rawduration - (rawduration % gran) + gran
 	});
 };
 
-caDataset.prototype.stash = function ()
+caDataset.prototype.stash = function (since)
 {
-	var metadata, data, time;
+	var metadata, tiers;
 
 	metadata = {
 	    ca_agg_stash_vers_major: this.cd_vers_major,
 	    ca_agg_stash_vers_minor: this.cd_vers_minor
 	};
 
-	data = {
-	    cs_granularity: this.cd_granularity,
-	    cs_nsources: this.cd_nsources,
-	    cs_sources: this.cd_sources,
-	    cs_data: {}
-	};
+	if (since !== undefined)
+		metadata.ca_agg_stash_since = since;
 
-	for (time in this.cd_reporting) {
-		data.cs_data[time] = {
-		    reporting: this.cd_reporting[time],
-		    datum: this.dataForTime(time, this.cd_granularity)
-		};
-	}
+	tiers = this.cd_tiers.map(function (tier) {
+		return ({
+		    granularity: tier.ct_granularity,
+		    reporting: tier.ct_reporting,
+		    data: tier.ct_data
+		});
+	});
 
-	return ({ metadata: metadata, data: data });
+	return ({
+	    metadata: metadata,
+	    data: mod_native.stashEncode(this.cd_granularity,
+		this.cd_nsources || 0, this.cd_sources, tiers, since)
+	});
 };
 
-caDataset.prototype.unstash = function (metadata, data)
+/*
+ * Each segment replaces the slots it contains in everything stashed before it,
+ * so each stash is loaded only for times before the earliest "since" of the
+ * segments that follow it.
+ */
+caDataset.prototype.unstash = function (metadata, data, segments)
 {
-	var host, source, time;
+	var records, before, since, ii;
 
 	if (metadata.ca_agg_stash_vers_major != this.cd_vers_major)
 		throw (new caError(ECA_INCOMPAT));
 
-	if (data.cs_granularity != this.cd_granularity)
+	if (metadata.ca_agg_stash_vers_minor < caDatasetStashBinary) {
+		this.unstashJson(data);
+		return;
+	}
+
+	records = [ { metadata: metadata, data: data } ];
+	if (segments)
+		records = records.concat(segments);
+
+	for (ii = records.length - 1; ii >= 0; ii--) {
+		metadata = records[ii]['metadata'];
+
+		if (metadata.ca_agg_stash_vers_major != this.cd_vers_major ||
+		    metadata.ca_agg_stash_vers_minor < caDatasetStashBinary)
+			throw (new caError(ECA_INCOMPAT));
+
+		this.unstashBinary(records[ii]['data'], before);
+
+		since = metadata.ca_agg_stash_since;
+		if (since !== undefined && (before === undefined ||
+		    since < before))
+			before = since;
+	}
+};
+
+/*
+ * [private] Loads data in the binary stash format, skipping slots at or after
+ * "before", if specified.
+ */
+caDataset.prototype.unstashBinary = function (data, before)
+{
+	var dataset, header;
+
+	if (typeof (data) == 'string')
+		data = new Buffer(data, 'base64');
+
+	dataset = this;
+	header = mod_native.stashHeader(data);
+	this.unstashHeader(header, function (which, ltier) {
+		mod_native.stashLoad(data, which, ltier.ct_granularity,
+		    dataset.cd_doadd, ltier.ct_reporting, ltier.ct_data,
+		    before);
+	});
+};
+
+/*
+ * [private] Loads data stashed in JSON by older versions.
+ */
+caDataset.prototype.unstashJson = function (data)
+{
+	var dataset, stashed;
+
+	dataset = this;
+	stashed = [ {
+	    granularity: this.cd_granularity,
+	    data: data.cs_data
+	} ];
+
+	if (data.cs_tiers)
+		stashed = stashed.concat(data.cs_tiers);
+
+	this.unstashHeader({
+	    granularity: data.cs_granularity,
+	    nsources: data.cs_nsources,
+	    sources: data.cs_sources,
+	    tiers: stashed
+	}, function (which, ltier) {
+		dataset.unstashTier(ltier, stashed[which]['data']);
+	});
+};
+
+/*
+ * [private] Merges the sources described by a stash header into this dataset's
+ * and invokes load(which, tier) for each tier.  Each tier is loaded from the
+ * coarsest stashed tier whose granularity divides its own, which is the stashed
+ * tier with the same granularity unless the tiers have changed (as for stashes
+ * from before tiers existed, or when the retention time changes).
+ */
+caDataset.prototype.unstashHeader = function (header, load)
+{
+	var stashed, host, source, tier, best, ii, jj;
+
+	if (header['granularity'] != this.cd_granularity)
 		throw (new caError(ECA_INVAL, null,
 		    'expected granularity %s, but found %s',
-		    this.cd_granularity, data.cs_granularity));
+		    this.cd_granularity, header['granularity']));
 
-	this.cd_nsources = Math.max(this.cd_nsources, data.cs_nsources);
+	this.cd_nsources = Math.max(this.cd_nsources, header['nsources']);
 
-	for (host in data.cs_sources) {
-		source = data.cs_sources[host];
+	for (host in header['sources']) {
+		source = header['sources'][host];
 
 		if (!(host in this.cd_sources)) {
 			this.cd_sources[host] = source;
@@ -398,132 +748,157 @@ caDataset.prototype.unstash = function (metadata, data)
 		    this.cd_sources[host].s_last, source.s_last);
 	}
 
-	for (time in data.cs_data) {
-		ASSERT(time % this.cd_granularity === 0);
+	stashed = header['tiers'];
 
-		if (!(time in this.cd_reporting))
-			this.cd_reporting[time] = {};
+	for (ii = 0; ii < this.cd_tiers.length; ii++) {
+		tier = this.cd_tiers[ii];
+		best = 0;
 
-		for (host in data.cs_data[time]['reporting'])
-			this.cd_reporting[time][host] = true;
+		for (jj = 1; jj < stashed.length; jj++) {
+			if (tier.ct_granularity %
+			    stashed[jj]['granularity'] === 0 &&
+			    stashed[jj]['granularity'] >
+			    stashed[best]['granularity'])
+				best = jj;
+		}
 
-		this.aggregateValue(time, data.cs_data[time]['datum']);
+		load(best, tier);
 	}
 };
 
 /*
- * Implements common functions for datasets whose data can be represented with
- * just an object mapping time-index to value.  This implementation is used for
- * scalars, simple discrete decompositions, and simple numeric decompositions.
+ * [private] Loads one tier's data as stashed in JSON by older versions into
+ * "tier".  The data maps each time to an object with "reporting" (the sources
+ * reporting) and "datum".
  */
-function caDatasetSimple(granularity, nsources, doadd, zero, add)
+caDataset.prototype.unstashTier = function (tier, data)
 {
-	caDataset.apply(this, [ granularity, nsources, doadd ]);
-	this.cds_data = {};
-	this.cds_zero = zero;
-	this.cds_add = add;
-}
+	var host, time, ttime;
 
-caDatasetSimple.prototype = new caDataset();
-mod_sys.inherits(caDatasetSimple, caDataset);
-
-caDatasetSimple.prototype.expireDataBefore = function (exptime)
-{
-	var time;
+	for (time in data) {
+		ASSERT(time % this.cd_granularity === 0);
+		ttime = time - (time % tier.ct_granularity);
 
-	for (time in this.cds_data) {
-		if (time >= exptime)
+		if (!this.cd_doadd && ttime != time)
 			continue;
 
-		delete (this.cds_data[time]);
+		for (host in data[time]['reporting'])
+			tier.ct_reporting.report(ttime, host);
+
+		this.aggregateValue(time, data[time]['datum'], [ tier ]);
 	}
 };
 
-caDatasetSimple.prototype.dataForTime = function (start, duration)
+/*
+ * Implements datasets whose data is stored in a native TimeSeries (see
+ * ca-native), which is a ring of slots indexed by time.  "kind" is the kind of
+ * value stored ("scalar", "decomp", "dist", or "sketch"), and "arg" is the
+ * distribution layout or sketch accuracy, if any.  Updates and expiration are
+ * O(1) per time index and don't create any JavaScript objects, which matters
+ * because long-retention instrumentations would otherwise keep one object per
+ * second on the heap for hours.
+ */
+function caDatasetSeries(granularity, nsources, doadd, retention, kind,
+    arg)
 {
-	var time, value;
-
-	mod_assert.equal(start % this.cd_granularity, 0);
-	mod_assert.equal(duration % this.cd_granularity, 0);
-	ASSERT(duration > 0);
+	var tier, ii;
 
-	if (!this.cd_doadd)
-		duration = this.cd_granularity;
-
-	value = caDeepCopy(this.cds_zero);
+	caDataset.apply(this, [ granularity, nsources, doadd, retention ]);
 
-	for (time = start; time < start + duration;
-	    time += this.cd_granularity) {
-		if (!(time in this.cds_data))
-			continue;
+	if (kind === undefined)
+		return;
 
-		value = this.cds_add(value, this.cds_data[time]);
+	for (ii = 0; ii < this.cd_tiers.length; ii++) {
+		tier = this.cd_tiers[ii];
+		tier.ct_data = new mod_native.TimeSeries(kind,
+		    tier.ct_granularity,
+		    caDatasetSlots(tier.ct_granularity, tier.ct_span), arg);
 	}
+}
 
-	return (value);
-};
-
-caDatasetSimple.prototype.aggregateValue = function (time, datum)
+/*
+ * Returns the number of time slots a native TimeSeries needs to hold data for
+ * the given retention time without growing.
+ */
+function caDatasetSlots(granularity, retention)
 {
-	ASSERT(time % this.cd_granularity === 0);
+	if (!retention)
+		retention = caDatasetDefaultRetention;
 
-	if (datum === undefined)
-		datum = this.cds_zero;
-
-	if (!(time in this.cds_data)) {
-		this.cds_data[time] = datum;
-		return;
-	}
+	return (Math.ceil(retention / granularity) + 1);
+}
 
-	this.cds_data[time] = this.cds_add(this.cds_data[time], datum);
-};
+caDatasetSeries.prototype = new caDataset();
+mod_sys.inherits(caDatasetSeries, caDataset);
 
 
 /*
  * Implements datasets for scalar values.
  */
-function caDatasetScalar(granularity, nsources, doadd)
+function caDatasetScalar(granularity, nsources, doadd, retention)
 {
-	caDatasetSimple.apply(this, [ granularity, nsources, doadd,
-	    0, caAddScalars ]);
+	caDatasetSeries.apply(this, [ granularity, nsources, doadd,
+	    retention, 'scalar' ]);
 }
 
-caDatasetScalar.prototype = new caDatasetSimple();
-mod_sys.inherits(caDatasetScalar, caDatasetSimple);
+caDatasetScalar.prototype = new caDatasetSeries();
+mod_sys.inherits(caDatasetScalar, caDatasetSeries);
 
 
 /*
  * Implements datasets for simple discrete decompositions.
  */
-function caDatasetDecomp(granularity, nsources, doadd)
+function caDatasetDecomp(granularity, nsources, doadd, retention)
 {
-	caDatasetSimple.apply(this, [ granularity, nsources, doadd,
-	    {}, caAddDecompositions ]);
+	caDatasetSeries.apply(this, [ granularity, nsources, doadd,
+	    retention, 'decomp' ]);
 }
 
-caDatasetDecomp.prototype = new caDatasetSimple();
-mod_sys.inherits(caDatasetDecomp, caDatasetSimple);
+caDatasetDecomp.prototype = new caDatasetSeries();
+mod_sys.inherits(caDatasetDecomp, caDatasetSeries);
 
 
 /*
  * Implements datasets for heatmaps with no additional decompositions.
  */
-function caDatasetHeatmapScalar(granularity, nsources, doadd)
+function caDatasetHeatmapScalar(granularity, nsources, doadd, retention)
 {
-	caDatasetSimple.apply(this, [ granularity, nsources, doadd,
-	    [], caAddDistributions ]);
+	caDatasetSeries.apply(this, [ granularity, nsources, doadd,
+	    retention, 'dist' ]);
 }
 
-caDatasetHeatmapScalar.prototype = new caDatasetSimple();
-mod_sys.inherits(caDatasetHeatmapScalar, caDatasetSimple);
+caDatasetHeatmapScalar.prototype = new caDatasetSeries();
+mod_sys.inherits(caDatasetHeatmapScalar, caDatasetSeries);
 
-caDatasetHeatmapScalar.prototype.total = function ()
+caDatasetHeatmapScalar.prototype.total = function (start, duration)
 {
-	/*
-	 * Yes, it's a little dirty to reach into our parent class here, but
-	 * anything short of a major restructuring would be equally hokey.
-	 */
-	return (this.cds_data);
+	if (start === undefined)
+		return (this.cd_tiers[0].ct_data.byTime());
+
+	return (this.tier(start, duration).ct_data.byTime(start, duration));
+};
+
+caDatasetHeatmapScalar.prototype.totalValue = function (start, duration)
+{
+	return (this.tier(start, duration).ct_data.value(start, duration));
+};
+
+caDatasetHeatmapScalar.prototype.render = function (conf, selected)
+{
+	return (this.tier(conf.base, conf.step).ct_data.render(conf,
+	    selected));
+};
+
+caDatasetHeatmapScalar.prototype.renderAsync = function (conf, selected,
+    options, callback)
+{
+	this.tier(conf.base, conf.step).ct_data.renderAsync(conf, selected,
+	    options, callback);
+};
+
+caDatasetHeatmapScalar.prototype.renderStats = function ()
+{
+	return (this.cd_tiers[0].ct_data.renderStats());
 };
 
 caDatasetHeatmapScalar.prototype.keysForTime = function (time)
@@ -538,160 +913,116 @@ caDatasetHeatmapScalar.prototype.dataForKey = function (key)
 
 
 /*
- * Implements a heatmap dataset with an additional discrete decomposition.  For
- * efficiency, we maintain three data structures:
- *
- *	distbykey	mapping of key -> time -> distribution
- *			This is the actual data for all time for each key.
- *
- *	totalsbytime	mapping of time -> distribution
- *			This is the actual data for all time summed over all
- *			keys.
- *
- *	keysbytime:	mapping of time -> list of keys with non-zero values
- *			This is used to quickly identify which elements of
- *			distbykey to look at for a particular time.
- *
- * This structure is more complicated than the Simple implementation above but
- * allows us to retrieve the input data for heatmap generation much more quickly
- * than the more straightforward representation would.
+ * Implements datasets for numeric values summarized as quantile sketches.
+ * Unlike heatmap datasets, these keep no per-bucket distributions: each second
+ * of data costs a few hundred bytes at most regardless of how the instrumenter
+ * bucketizes values, and sketches for any interval merge without losing
+ * accuracy.  The tradeoff is that they can't be rendered as heatmaps.
  */
-function caDatasetHeatmapDecomp(granularity, nsources, doadd)
+function caDatasetSketch(granularity, nsources, doadd, retention)
 {
-	caDataset.apply(this, [ granularity, nsources, doadd ]);
-	this.cdh_distbykey = {};
-	this.cdh_totalsbytime = {};
-	this.cdh_keysbytime = {};
+	caDatasetSeries.apply(this, [ granularity, nsources, doadd,
+	    retention, 'sketch', caDatasetSketchAccuracy ]);
 }
 
-caDatasetHeatmapDecomp.prototype = new caDataset();
-mod_sys.inherits(caDatasetHeatmapDecomp, caDataset);
+caDatasetSketch.prototype = new caDatasetSeries();
+mod_sys.inherits(caDatasetSketch, caDatasetSeries);
 
-caDatasetHeatmapDecomp.prototype.expireDataBefore = function (exptime)
+caDatasetSketch.prototype.quantiles = function (start, duration, qs)
 {
-	var time, key;
-
-	for (time in this.cdh_keysbytime) {
-		if (time >= exptime)
-			continue;
+	var tier = this.tier(start, duration);
 
-		for (key in this.cdh_keysbytime[time]) {
-			delete (this.cdh_distbykey[key][time]);
-
-			if (caIsEmpty(this.cdh_distbykey[key]))
-				delete (this.cdh_distbykey[key]);
-		}
+	if (!this.cd_doadd)
+		duration = tier.ct_granularity;
 
-		delete (this.cdh_totalsbytime[time]);
-		delete (this.cdh_keysbytime[time]);
-	}
+	return (tier.ct_data.quantiles(start, duration, qs));
 };
 
-caDatasetHeatmapDecomp.prototype.dataForTime = function (start, duration)
-{
-	var key, time, value;
-
-	ASSERT(start % this.cd_granularity === 0);
-	ASSERT(duration % this.cd_granularity === 0);
-
-	if (!this.cd_doadd)
-		duration = this.cd_granularity;
 
-	value = {};
+/*
+ * Implements a heatmap dataset with an additional discrete decomposition.  The
+ * data is stored in a native HeatmapDecomp (see ca-native), which interns keys
+ * and keeps per-key and total distributions by time along with the set of keys
+ * present at each time.  Decompositions by fields like remote address can have
+ * tens of thousands of keys, and storing those as nested JavaScript objects
+ * made garbage collection prohibitively expensive.
+ */
+function caDatasetHeatmapDecomp(granularity, nsources, doadd, retention)
+{
+	var tier, ii;
 
-	for (time = start; time < start + duration;
-	    time += this.cd_granularity) {
-		if (!(time in this.cdh_keysbytime))
-			continue;
+	caDataset.apply(this, [ granularity, nsources, doadd, retention ]);
 
-		for (key in this.cdh_keysbytime[time]) {
-			if (!(key in value))
-				value[key] = [];
+	if (granularity === undefined)
+		return;
 
-			value[key] = caAddDistributions(value[key],
-			    this.cdh_distbykey[key][time]);
-		}
+	for (ii = 0; ii < this.cd_tiers.length; ii++) {
+		tier = this.cd_tiers[ii];
+		tier.ct_data = new mod_native.HeatmapDecomp(tier.ct_granularity,
+		    caDatasetSlots(tier.ct_granularity, tier.ct_span));
 	}
+}
 
-	return (value);
-};
+caDatasetHeatmapDecomp.prototype = new caDataset();
+mod_sys.inherits(caDatasetHeatmapDecomp, caDataset);
 
-caDatasetHeatmapDecomp.prototype.aggregateValue = function (time, datum)
+caDatasetHeatmapDecomp.prototype.aggregateValue = function (time, datum,
+    tiers)
 {
-	var key;
-
-	ASSERT(time % this.cd_granularity === 0);
-
 	if (datum === undefined)
 		return;
 
 	ASSERT(datum.constructor == Object);
-
-	/*
-	 * If we've never seen anything at this time before, initialize the
-	 * by-time mappings.  They must be consistent with respect to keys.
-	 */
-	if (!(time in this.cdh_keysbytime)) {
-		this.cdh_keysbytime[time] = {};
-		ASSERT(!(time in this.cdh_totalsbytime));
-		this.cdh_totalsbytime[time] = [];
-	}
-
-	/*
-	 * Update the per-key distributions and totals for this time period.
-	 */
-	for (key in datum) {
-		ASSERT(datum[key].constructor == Array);
-
-		this.cdh_keysbytime[time][key] = true;
-
-		if (!(key in this.cdh_distbykey))
-			this.cdh_distbykey[key] = {};
-
-		if (!(time in this.cdh_distbykey[key])) {
-			this.cdh_distbykey[key][time] = datum[key];
-		} else {
-			this.cdh_distbykey[key][time] = caAddDistributions(
-			    this.cdh_distbykey[key][time], datum[key]);
-		}
-
-		this.cdh_totalsbytime[time] = caAddDistributions(
-		    this.cdh_totalsbytime[time], datum[key]);
-	}
+	caDataset.prototype.aggregateValue.call(this, time, datum, tiers);
 };
 
 caDatasetHeatmapDecomp.prototype.keysForTime = function (start, duration)
 {
-	var time, key, keys;
-
 	ASSERT(start % this.cd_granularity === 0);
 	ASSERT(duration % this.cd_granularity === 0);
 
-	keys = {};
+	return (this.tier(start, duration).ct_data.keys(start, duration));
+};
 
-	for (time = start; time < start + duration;
-	    time += this.cd_granularity) {
-		if (!(time in this.cdh_keysbytime))
-			continue;
+caDatasetHeatmapDecomp.prototype.dataForKey = function (key, start, duration)
+{
+	if (start === undefined)
+		return (this.cd_tiers[0].ct_data.byKey(key));
 
-		for (key in this.cdh_keysbytime[time])
-			keys[key] = true;
-	}
+	return (this.tier(start, duration).ct_data.byKey(key, start,
+	    duration));
+};
 
-	return (Object.keys(keys));
+caDatasetHeatmapDecomp.prototype.totalValue = function (start, duration)
+{
+	return (this.tier(start, duration).ct_data.totalValue(start,
+	    duration));
 };
 
-caDatasetHeatmapDecomp.prototype.dataForKey = function (key)
+caDatasetHeatmapDecomp.prototype.render = function (conf, selected)
 {
-	if (!(key in this.cdh_distbykey))
-		return ({});
+	return (this.tier(conf.base, conf.step).ct_data.render(conf,
+	    selected));
+};
 
-	return (this.cdh_distbykey[key]);
+caDatasetHeatmapDecomp.prototype.renderAsync = function (conf, selected,
+    options, callback)
+{
+	this.tier(conf.base, conf.step).ct_data.renderAsync(conf, selected,
+	    options, callback);
 };
 
-caDatasetHeatmapDecomp.prototype.total = function ()
+caDatasetHeatmapDecomp.prototype.renderStats = function ()
 {
-	return (this.cdh_totalsbytime);
+	return (this.cd_tiers[0].ct_data.renderStats());
+};
+
+caDatasetHeatmapDecomp.prototype.total = function (start, duration)
+{
+	if (start === undefined)
+		return (this.cd_tiers[0].ct_data.total());
+
+	return (this.tier(start, duration).ct_data.total(start, duration));
 };
 
 
@@ -875,6 +1206,13 @@ exports.caAggrInterval = caAggrInterval;
  *	    representing the value of this data point.  The form of this value
  *	    is entirely implementation-specific.  "xform" may be used to
  *	    transform objects as appropriate.
+ *
+ * Implementations whose work is expensive enough to hold up the event loop may
+ * also provide an asynchronous form (exported as "ai_value_async"):
+ *
+ *	func(dataset, start_time, duration, xform, request, callback)
+ *
+ *	    Like the above, but invokes "callback" with an error or the value.
  */
 
 /*
@@ -895,17 +1233,13 @@ function caAggrValueRaw(dataset, start, duration, xform)
 }
 
 /*
- * Generates a heatmap image for the specified data points.
+ * Validates the parameters for a heatmap image and returns the configuration
+ * for rendering it: "conf" and "selected" for the dataset's render method, and
+ * "present", the keys present in the interval.
  */
-function caAggrValueHeatmapImage(dataset, start, duration, xform, request)
+function caAggrHeatmapImageConf(dataset, start, duration, request)
 {
-	var param, conf, selected, isolate, exclude, rainbow, count;
-	var ret, ii, present, datasets, buffer, png, tk;
-
-	if (!mod_heatmap)
-		mod_heatmap = require('heatmap');
-
-	tk = new mod_ca.caTimeKeeper();
+	var param, conf, selected, isolate, exclude, rainbow, count, present;
 
 	/*
 	 * Retrieve and validate parameters.
@@ -918,7 +1252,7 @@ function caAggrValueHeatmapImage(dataset, start, duration, xform, request)
 	rainbow = param('decompose_all');
 	conf = caAggrHeatmapConf(request, start, duration, isolate,
 	    selected.length);
-	conf.step = dataset.normalizeInterval(0, 0.1)['duration'];
+	conf.step = dataset.step(start, duration, conf.width);
 
 	count = 0;
 	if (isolate)
@@ -934,76 +1268,95 @@ function caAggrValueHeatmapImage(dataset, start, duration, xform, request)
 		    '"decompose_all" may be specified'));
 
 	/*
-	 * Extract data from the dataset, bucketize it, and generate a heatmap.
+	 * The heatmap is rendered natively straight from the dataset's storage.
+	 * This does what node-heatmap's bucketize(), deduct(), normalize(),
+	 * and generate() would do, in a single pass and without creating
+	 * intermediate JavaScript arrays.
 	 */
 	present = dataset.keysForTime(start, duration);
 
 	if (rainbow)
 		selected = present.sort();
 
-	datasets = [];
-	datasets.push(dataset.total());
-
-	for (ii = 0; ii < selected.length; ii++)
-		datasets.push(dataset.dataForKey(selected[ii]));
-
-	for (ii = 0; ii < datasets.length; ii++)
-		datasets[ii] = mod_heatmap.bucketize(datasets[ii], conf);
-
 	if (!conf.hue)
-		conf.hue = caAggrHeatmapHues(datasets.length - 1, isolate);
-
-	if (isolate) {
-		datasets.shift();
-
-		if (datasets.length === 0) {
-			datasets = [ mod_heatmap.bucketize({}, conf) ];
-			conf.hue = [ 0 ];
-		}
-	} else {
-		for (ii = 1; ii < datasets.length; ii++)
-			mod_heatmap.deduct(datasets[0], datasets[ii]);
-
-		if (exclude)
-			datasets = [ datasets[0] ];
-	}
-
-	tk.step('up to bucketize + deduction');
-
-	/*
-	 * We can have more than the expected number of hues here because we
-	 * won't always have entries for an empty dataset or because the user
-	 * simply provided more hues than were necessary.
-	 */
-	ASSERT(conf.hue.length >= datasets.length);
-	conf.hue = conf.hue.slice(0, datasets.length);
-	mod_heatmap.normalize(datasets, conf);
-	tk.step('normalize');
+		conf.hue = caAggrHeatmapHues(selected.length, isolate);
 
-	conf.base = 0;
+	conf.isolate = isolate;
+	conf.exclude = exclude;
 	conf.saturation = [ 0, 0.9 ];
 	conf.value = 0.95;
-	png = mod_heatmap.generate(datasets, conf);
-	tk.step('generate');
 
-	buffer = png.encodeSync();
-	tk.step('png encoding');
+	return ({ conf: conf, selected: selected, present: present });
+}
+
+/*
+ * Returns the value for a heatmap image, given the result of
+ * caAggrHeatmapImageConf() after rendering and the encoded image.
+ */
+function caAggrHeatmapImageValue(hmconf, xform, image)
+{
+	var ret, conf;
 
+	conf = hmconf['conf'];
 	ret = {};
 	caAggrValueHeatmapCommon(ret, conf);
 	ret['ymin'] = conf.min;
 	ret['ymax'] = conf.max;
-	ret['present'] = present;
+	ret['present'] = hmconf['present'];
 	ret['transformations'] = xform(ret['present']);
-	ret['image'] = buffer.toString('base64');
+	ret['image'] = image;
+	return (ret);
+}
+
+/*
+ * Generates a heatmap image for the specified data points.
+ */
+function caAggrValueHeatmapImage(dataset, start, duration, xform, request)
+{
+	var hmconf, conf, pixels, image, ret, tk;
+
+	tk = new mod_ca.caTimeKeeper();
+
+	hmconf = caAggrHeatmapImageConf(dataset, start, duration, request);
+	conf = hmconf['conf'];
+	pixels = dataset.render(conf, hmconf['selected']);
+	tk.step('render');
+
+	image = mod_native.pngEncodeBase64(pixels, conf.width, conf.height,
+	    { 'level': caAggrPngLevel });
+	tk.step('png encoding');
+
+	ret = caAggrHeatmapImageValue(hmconf, xform, image);
 	tk.step('value generation');
 
 	return (ret);
 }
 
+/*
+ * Like caAggrValueHeatmapImage, but renders and encodes the image on another
+ * thread and invokes "callback" with an error or the value.  Only collecting
+ * the data happens synchronously, so a large heatmap doesn't hold up everything
+ * else while it's being drawn.  Invalid parameters are still thrown.
+ */
+function caAggrValueHeatmapImageAsync(dataset, start, duration, xform, request,
+    callback)
+{
+	var hmconf;
+
+	hmconf = caAggrHeatmapImageConf(dataset, start, duration, request);
+	dataset.renderAsync(hmconf['conf'], hmconf['selected'],
+	    { 'level': caAggrPngLevel }, function (err, image) {
+		if (err)
+			return (callback(err));
+
+		return (callback(null,
+		    caAggrHeatmapImageValue(hmconf, xform, image)));
+	    });
+}
+
 function caAggrValueHeatmapDetails(dataset, start, duration, xform, request)
 {
-	var conf, detconf, xx, yy, param;
+	var conf, detconf, xx, yy, param, step;
 	var range, present, ii, ret, value;
 
 	if (!mod_heatmap)
@@ -1013,6 +1366,7 @@ function caAggrValueHeatmapDetails(dataset, start, duration, xform, request)
 	    caAggrHeatmapParams, request.ca_params);
 
 	conf = caAggrHeatmapConf(request, start, duration, false, 0);
+	conf.step = dataset.step(start, duration, conf.width);
 	xx = param('x');
 	yy = param('y');
 
@@ -1026,7 +1380,8 @@ function caAggrValueHeatmapDetails(dataset, start, duration, xform, request)
 		throw (new caValidationError('"y" must be less than "height"'));
 
 	range = mod_heatmap.samplerange(xx, yy, conf);
-	range[0] = dataset.normalizeInterval(range[0], duration)['start_time'];
+	step = conf.step;
+	range[0] -= (range[0] - start) % step;
 
 	ret = {};
 	caAggrValueHeatmapCommon(ret, conf);
@@ -1063,7 +1418,7 @@ function caAggrValueHeatmapDetails(dataset, start, duration, xform, request)
 	 * decomposition; in those where we don't, we apply the same rounded-
 	 * but-at-least-one rule to derive the total directly from the data.
 	 */
-	present = dataset.keysForTime(range[0], duration);
+	present = dataset.keysForTime(range[0], step);
 	ret.present = {};
 
 	if (present.length === 0) {
@@ -1071,7 +1426,8 @@ function caAggrValueHeatmapDetails(dataset, start, duration, xform, request)
 		 * Maybe there's no data here, or maybe there's just no
 		 * decomposition.  Either way, calculate the total separately.
 		 */
-		value = mod_heatmap.bucketize(dataset.total(), detconf)[0][0];
+		value = mod_heatmap.bucketize(
+		    dataset.total(range[0], step), detconf)[0][0];
 		if (value === 0)
 			ret.total = 0;
 		else
@@ -1080,8 +1436,8 @@ function caAggrValueHeatmapDetails(dataset, start, duration, xform, request)
 		ret.total = 0;
 
 		for (ii = 0; ii < present.length; ii++) {
-			value = mod_heatmap.bucketize(
-			    dataset.dataForKey(present[ii]), detconf)[0][0];
+			value = mod_heatmap.bucketize(dataset.dataForKey(
+			    present[ii], range[0], step), detconf)[0][0];
 
 			if (!value)
 				continue;
@@ -1095,24 +1451,38 @@ function caAggrValueHeatmapDetails(dataset, start, duration, xform, request)
 	return (ret);
 }
 
-function caAggrValueHeatmapAverage(dataset, start, duration, xform, request)
+/*
+ * Returns the data for the whole interval [start, start + duration) bucketized
+ * as a single heatmap column.  The dataset computes the sum over the interval
+ * from running totals, so this costs the same whether the interval is one
+ * second or one hour long.
+ */
+function caAggrHeatmapIntervalMap(dataset, start, duration, conf)
 {
-	var conf, value, ret, map;
+	var data;
 
 	if (!mod_heatmap)
 		mod_heatmap = require('heatmap');
 
+	data = {};
+	data[start] = dataset.totalValue(start, duration);
+	conf.base = start;
+	conf.nsamples = 1;
+	return (mod_heatmap.bucketize(data, conf));
+}
+
+function caAggrValueHeatmapAverage(dataset, start, duration, xform, request)
+{
+	var conf, value, ret, map;
+
 	conf = caAggrHeatmapConf(request, start, duration, false, 0);
-	conf.step = dataset.normalizeInterval(0, 0.1)['duration'];
 
 	ret = {};
 	caAggrValueHeatmapCommon(ret, conf);
 
-	conf.base = start;
-	conf.nsamples = duration;
-	map = mod_heatmap.bucketize(dataset.total(), conf);
+	map = caAggrHeatmapIntervalMap(dataset, start, duration, conf);
 	value = mod_heatmap.average(map, conf);
-	ret['average'] = value[0][1]; /* XXX */
+	ret['average'] = value[0][1];
 
 	return (ret);
 }
@@ -1121,29 +1491,64 @@ function caAggrValueHeatmapPercentile(dataset, start, duration, xform, request)
 {
 	var conf, param, value, ret, map, pctile;
 
-	if (!mod_heatmap)
-		mod_heatmap = require('heatmap');
-
 	param = mod_ca.caHttpParam.bind(null,
 	    caAggrHeatmapParams, request.ca_params);
 	pctile = param('percentile');
 
 	conf = caAggrHeatmapConf(request, start, duration, false, 0);
-	conf.step = dataset.normalizeInterval(0, 0.1)['duration'];
 
 	ret = {};
 	caAggrValueHeatmapCommon(ret, conf);
 
-	conf.base = start;
-	conf.nsamples = duration;
-	map = mod_heatmap.bucketize(dataset.total(), conf);
+	map = caAggrHeatmapIntervalMap(dataset, start, duration, conf);
 	conf.percentile = pctile;
 	value = mod_heatmap.percentile(map, conf);
-	ret['percentile'] = value[0][1]; /* XXX */
+	ret['percentile'] = value[0][1];
+
+	return (ret);
+}
+
+/*
+ * Returns the estimated value at each of the requested quantiles of the
+ * specified interval's data, which is summarized by a quantile sketch.  Unlike
+ * heatmap percentiles, these don't depend on the resolution of an image.
+ */
+function caAggrValueQuantile(dataset, start, duration, xform, request)
+{
+	var qs, values, ret, ii;
+
+	qs = mod_ca.caHttpParam(caAggrQuantileParams, request.ca_params,
+	    'quantiles');
+	qs = qs.map(function (qq) {
+		return (mod_ca.caHttpParam(caAggrQuantileParams,
+		    { quantile: qq }, 'quantile'));
+	});
+
+	values = dataset.quantiles(start, duration, qs);
+
+	ret = { quantiles: {}, relative_error: caDatasetSketchAccuracy };
+	for (ii = 0; ii < qs.length; ii++)
+		ret['quantiles'][qs[ii]] = values[ii];
 
 	return (ret);
 }
 
+/*
+ * Describes allowable HTTP parameters for quantile resources.  "quantile"
+ * describes each element of "quantiles".
+ */
+var caAggrQuantileParams = {
+	quantiles: {
+	    type: 'array',
+	    default: [ 0.5, 0.9, 0.99 ]
+	},
+	quantile: {
+	    type: 'float',
+	    min: 0,
+	    max: 1
+	}
+};
+
 function caAggrValueHeatmapCommon(ret, conf)
 {
 	ret['nbuckets'] = conf['nbuckets'];
@@ -1318,11 +1723,27 @@ function caAggrHeatmapCheck(aggrq)
 function caAggrSupportsHeatmap(instn)
 {
 	return (instn.agi_instrumentation['value-arity'] ===
-	    mod_ca.ca_arity_numeric);
+	    mod_ca.ca_arity_numeric &&
+	    !instn.agi_instrumentation['value-sketch']);
 }
 
 exports.caAggrSupportsHeatmap = caAggrSupportsHeatmap;
 
+function caAggrQuantileCheck(aggrq)
+{
+	return (caAggrSupportsQuantiles(aggrq.instn()));
+}
+
+/*
+ * Returns true if the specified instrumentation supports quantile queries.
+ */
+function caAggrSupportsQuantiles(instn)
+{
+	return (instn.agi_instrumentation['value-sketch'] === true);
+}
+
+exports.caAggrSupportsQuantiles = caAggrSupportsQuantiles;
+
 exports.caAggrRawImpl = {
     ai_check: function () { return (true); },
     ai_value: caAggrValueRaw,
@@ -1332,6 +1753,7 @@ exports.caAggrRawImpl = {
 exports.caAggrHeatmapImageImpl = {
     ai_check: caAggrHeatmapCheck,
     ai_value: caAggrValueHeatmapImage,
+    ai_value_async: caAggrValueHeatmapImageAsync,
     ai_duration: 60
 };
 
@@ -1352,3 +1774,9 @@ exports.caAggrHeatmapPercentileImpl = {
     ai_value: caAggrValueHeatmapPercentile,
     ai_duration: 1
 };
+
+exports.caAggrQuantileImpl = {
+    ai_check: caAggrQuantileCheck,
+    ai_value: caAggrValueQuantile,
+    ai_duration: 1
+};
@@ -231,6 +231,16 @@ function capDispatch(cap, msg)
  *
  *	exchange_opts	AMQP exchange options (default: CA default)
  *
+ *	ingest		Function to which received messages are first passed
+ *			undecoded, as an array of Buffers containing the bodies
+ *			of all messages received during one turn of the event
+ *			loop, along with a callback.  The function invokes the
+ *			callback (possibly asynchronously) with an array of the
+ *			bodies it didn't handle, which are then decoded and
+ *			dispatched as usual.  This allows consumers to process
+ *			high-volume messages without decoding them into
+ *			JavaScript objects.  (default: none)
+ *
  *	keepalive	If true, automatically ping self at some interval to
  *			keep the broker connection alive.  (default: false)
  *
@@ -253,6 +263,9 @@ function capAmqpCap(args)
 	this.cap_cmds = {};
 	this.cap_cmdid = 0;
 
+	this.cap_ingest = args['ingest'];
+	this.cap_batch = [];
+
 	amqpconf = {
 	    broker: this.cap_broker,
 	    exchange: args['exchange'] || exports.ca_amqp_exchange,
@@ -267,12 +280,16 @@ function capAmqpCap(args)
 	if ('retry_limit' in args)
 		amqpconf['retry_limit'] = args['retry_limit'];
 
+	if (this.cap_ingest)
+		amqpconf['raw'] = true;
+
 	this.cap_amqp = new mod_caamqp.caAmqp(amqpconf);
 	this.cap_amqp.on('connected', this.connected.bind(this));
 	this.cap_amqp.on('disconnected', this.disconnected.bind(this));
 	this.cap_amqp.on('amqp-error', this.error.bind(this));
 	this.cap_amqp.on('amqp-fatal', this.fatal.bind(this));
 	this.cap_amqp.on('msg', this.receive.bind(this));
+	this.cap_amqp.on('msg-raw', this.receiveRaw.bind(this));
 }
 
 mod_sys.inherits(capAmqpCap, mod_events.EventEmitter);
@@ -434,6 +451,57 @@ capAmqpCap.prototype.fatal = function (err)
 	this.emit('fatal', exn);
 };
 
+/*
+ * [internal] Invoked when the underlying AMQP object receives a message in raw
+ * mode.  We batch up the bodies received during this turn of the event loop and
+ * hand them to our consumer's "ingest" function all at once.
+ */
+capAmqpCap.prototype.receiveRaw = function (body)
+{
+	this.cap_batch.push(body);
+
+	if (this.cap_batch.length == 1)
+		process.nextTick(this.flushRaw.bind(this));
+};
+
+capAmqpCap.prototype.flushRaw = function ()
+{
+	var batch;
+
+	batch = this.cap_batch;
+	this.cap_batch = [];
+
+	if (this.cap_dead)
+		return;
+
+	this.cap_ingest(batch, this.receiveRest.bind(this));
+};
+
+/*
+ * [internal] Invoked by our consumer's "ingest" function with the bodies that
+ * it didn't handle.  Batches may complete some time after they were received,
+ * by which time we may have hit a fatal error.
+ */
+capAmqpCap.prototype.receiveRest = function (rest)
+{
+	var msg, ii;
+
+	if (this.cap_dead)
+		return;
+
+	for (ii = 0; ii < rest.length; ii++) {
+		try {
+			msg = JSON.parse(rest[ii].toString('utf8'));
+		} catch (ex) {
+			this.cap_log.warn('dropped message with invalid ' +
+			    'JSON: %s', ex.message);
+			continue;
+		}
+
+		this.receive(msg);
+	}
+};
+
 /*
  * [internal] Invoked when the underlying AMQP object receives a message.
  * Validate it and emit the corresponding event for our consumer.
@@ -65,6 +65,10 @@ var amqp_retry_limit_default = -1;		/* Try forever */
  *			means to avoid retrying at all.  If this field is not
  *			specified, retry indefinitely.
  *
+ *	raw		If true, received messages are not decoded.  Instead of
+ *			"msg" events, this manager emits "msg-raw" events with
+ *			each message's body as a Buffer.
+ *
  * This manager emits the following events:
  *
  *	amqp-error	Indicates an error occured on the AMQP service.  If the
@@ -91,6 +95,9 @@ var amqp_retry_limit_default = -1;		/* Try forever */
  *			suspended while disconnected.
  *
  *	msg		A message was received.  Argument: the message.
+ *
+ *	msg-raw		A message was received in "raw" mode.  Argument: the
+ *			message body (a Buffer).
  */
 function caAmqp(conf)
 {
@@ -108,6 +115,7 @@ function caAmqp(conf)
 	this.caa_queue_name = conf['queue'];
 	this.caa_queue_opts = { exclusive: true };
 	this.caa_log = conf['log'];
+	this.caa_raw = conf['raw'] || false;
 
 	this.caa_bindings.push(this.caa_queue_name);
 
@@ -233,7 +241,10 @@ caAmqp.prototype.connSetup = function ()
 		/*
 		 * Subscribe to incoming messages on this queue.
 		 */
-		queue.subscribe(amqp.receive.bind(amqp));
+		if (amqp.caa_raw)
+			queue.subscribeRaw(amqp.receiveRaw.bind(amqp));
+		else
+			queue.subscribe(amqp.receive.bind(amqp));
 
 		/*
 		 * Listen to 'close' solely to prevent node-amqp from emitting
@@ -367,6 +378,39 @@ caAmqp.prototype.receive = function (msg)
 	this.emit('msg', msg);
 };
 
+/*
+ * [private] Invoked when we start receiving a new AMQP message in "raw" mode.
+ * The body may arrive in several chunks.
+ */
+caAmqp.prototype.receiveRaw = function (message)
+{
+	var amqp = this;
+	var chunks = [];
+	var size = 0;
+
+	message.on('data', function (chunk) {
+		chunks.push(chunk);
+		size += chunk.length;
+	});
+
+	message.on('end', function () {
+		var body, off, ii;
+
+		if (chunks.length == 1) {
+			amqp.emit('msg-raw', chunks[0]);
+			return;
+		}
+
+		body = new Buffer(size);
+		for (off = 0, ii = 0; ii < chunks.length; ii++) {
+			chunks[ii].copy(body, off);
+			off += chunks[ii].length;
+		}
+
+		amqp.emit('msg-raw', body);
+	});
+};
+
 /*
  * Flush all queued messages.
  */
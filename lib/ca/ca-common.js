@@ -42,6 +42,13 @@ exports.ca_arity_numeric		= 'numeric-decomposition';
  */
 exports.ca_granularity_min = 5;
 
+/*
+ * Instrumentations with long retention times keep older data at coarser
+ * granularities.  See caDataTiers() below.
+ */
+exports.ca_tier_granularities = [ 10, 60, 600 ];
+exports.ca_tier_slots = 60 * 60;
+
 /*
  * Like the AMQP broker, the VMAPI/CNAPI parameters are specified via
  * environment variables.
@@ -905,6 +912,50 @@ function caSubObject(obj)
 exports.caSubObject = caSubObject;
 global.caSubObject = caSubObject;
 
+/*
+ * Returns the "tiers" at which data is stored for an instrumentation with the
+ * given granularity and retention time, as an array of objects with properties
+ * "granularity" and "span" (the number of seconds of data kept at that
+ * granularity), from finest to coarsest.  The first tier has the
+ * instrumentation's own granularity.  If that tier would need more than
+ * ca_tier_slots data points to cover the whole retention time, it only keeps
+ * the most recent ca_tier_slots data points, and the next tier keeps data at
+ * the next of ca_tier_granularities that's a multiple of the previous tier's
+ * granularity, and so on.  The last tier always spans the whole retention
+ * time.  Every tier stores all data received for the time it spans, so for
+ * recent data any tier can be used, and older data is available only at
+ * coarser granularities.
+ */
+function caDataTiers(granularity, retention)
+{
+	var tiers, last, gran, span, ii;
+
+	tiers = [ { granularity: granularity, span: retention } ];
+
+	if (!retention)
+		return (tiers);
+
+	for (ii = 0; ii < exports.ca_tier_granularities.length; ii++) {
+		last = tiers[tiers.length - 1];
+		span = last.granularity * exports.ca_tier_slots;
+
+		if (retention <= span)
+			break;
+
+		gran = exports.ca_tier_granularities[ii];
+
+		if (gran <= last.granularity || gran % last.granularity !== 0)
+			continue;
+
+		last.span = span;
+		tiers.push({ granularity: gran, span: retention });
+	}
+
+	return (tiers);
+}
+
+exports.caDataTiers = caDataTiers;
+
 /*
  * This is a kludge.  ca-error invokes caSprintf indirectly from the top level,
  * so it can't be loaded before caSprintf is defined above.  However, we use
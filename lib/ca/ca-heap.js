@@ -0,0 +1,163 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright (c) 2014, Joyent, Inc.
+ */
+
+/*
+ * ca-heap.js: binary min-heap with removal
+ *
+ * A caHeap stores values ordered by a numeric key.  insert() returns a handle
+ * for the new entry that can later be passed to remove() to take that entry
+ * out of the heap, so entries can be removed from the middle of the heap (as
+ * when a request is satisfied before it times out) as cheaply as from the top.
+ * insert(), remove(), and pop() are O(log n), and peek() is O(1).
+ */
+
+var mod_assert = require('assert');
+var ASSERT = mod_assert.ok;
+
+function caHeap()
+{
+	this.ch_entries = [];
+}
+
+caHeap.prototype.size = function ()
+{
+	return (this.ch_entries.length);
+};
+
+/*
+ * Inserts "value" with the given "key" and returns a handle for the entry.
+ */
+caHeap.prototype.insert = function (key, value)
+{
+	var entry;
+
+	entry = { che_key: key, che_value: value,
+	    che_index: this.ch_entries.length };
+	this.ch_entries.push(entry);
+	this.up(entry.che_index);
+	return (entry);
+};
+
+/*
+ * Returns the key of the entry with the smallest key, or undefined if the heap
+ * is empty.
+ */
+caHeap.prototype.peekKey = function ()
+{
+	return (this.ch_entries.length > 0 ?
+	    this.ch_entries[0].che_key : undefined);
+};
+
+/*
+ * Returns the value of the entry with the smallest key, or undefined if the
+ * heap is empty.
+ */
+caHeap.prototype.peek = function ()
+{
+	return (this.ch_entries.length > 0 ?
+	    this.ch_entries[0].che_value : undefined);
+};
+
+/*
+ * Removes the entry with the smallest key and returns its value.
+ */
+caHeap.prototype.pop = function ()
+{
+	var entry;
+
+	ASSERT(this.ch_entries.length > 0);
+	entry = this.ch_entries[0];
+	this.remove(entry);
+	return (entry.che_value);
+};
+
+/*
+ * Removes the entry identified by "entry", which must have been returned by
+ * insert() and not already removed.
+ */
+caHeap.prototype.remove = function (entry)
+{
+	var last, index;
+
+	index = entry.che_index;
+	ASSERT(this.ch_entries[index] === entry);
+
+	last = this.ch_entries.pop();
+	entry.che_index = -1;
+
+	if (last === entry)
+		return;
+
+	last.che_index = index;
+	this.ch_entries[index] = last;
+	this.down(this.up(index));
+};
+
+/*
+ * [private] Moves the entry at "index" up until its parent's key is no larger
+ * than its own.  Returns the entry's new index.
+ */
+caHeap.prototype.up = function (index)
+{
+	var entries, entry, parent;
+
+	entries = this.ch_entries;
+	entry = entries[index];
+
+	while (index > 0) {
+		parent = (index - 1) >> 1;
+
+		if (entries[parent].che_key <= entry.che_key)
+			break;
+
+		entries[index] = entries[parent];
+		entries[index].che_index = index;
+		index = parent;
+	}
+
+	entries[index] = entry;
+	entry.che_index = index;
+	return (index);
+};
+
+/*
+ * [private] Moves the entry at "index" down until neither of its children has a
+ * smaller key.
+ */
+caHeap.prototype.down = function (index)
+{
+	var entries, entry, child;
+
+	entries = this.ch_entries;
+	entry = entries[index];
+
+	for (;;) {
+		child = 2 * index + 1;
+
+		if (child >= entries.length)
+			break;
+
+		if (child + 1 < entries.length &&
+		    entries[child + 1].che_key < entries[child].che_key)
+			child++;
+
+		if (entry.che_key <= entries[child].che_key)
+			break;
+
+		entries[index] = entries[child];
+		entries[index].che_index = index;
+		index = child;
+	}
+
+	entries[index] = entry;
+	entry.che_index = index;
+};
+
+exports.caHeap = caHeap;
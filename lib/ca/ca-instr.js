@@ -13,6 +13,7 @@
  */
 
 var mod_assert = require('assert');
+var mod_native = require('ca-native');
 
 var mod_ca = require('./ca-common');
 var mod_capred = require('./ca-pred');
@@ -27,26 +28,263 @@ var mod_capred = require('./ca-pred');
  *	value		value of the base metric for this data point
  *
  * This function returns the set of datapoints for which the predicate evaluates
- * to "true".
+ * to "true".  The predicate is compiled (see caInstrCompilePredicate()) rather
+ * than evaluated with caPredEval() for each point, unless some field is
+ * compared with both numbers and strings, in which case only caPredEval()'s
+ * loose comparisons will do.
  */
 function caInstrApplyPredicate(predicate, datapoints)
 {
-	return (datapoints.filter(function (point) {
-		return (mod_capred.caPredEval(predicate, point['fields']));
-	}));
+	var fieldarities;
+
+	if (!mod_capred.caPredNonTrivial(predicate))
+		return (datapoints);
+
+	fieldarities = caInstrPredicateArities(predicate);
+
+	if (fieldarities === null) {
+		return (datapoints.filter(function (point) {
+			return (mod_capred.caPredEval(predicate,
+			    point['fields']));
+		}));
+	}
+
+	return (caInstrCompilePredicate(fieldarities, predicate)(datapoints));
+}
+
+/*
+ * Infers the arities of the fields used by a predicate from the constants
+ * they're compared with.  Returns null if some field is compared with both
+ * numbers and strings.
+ */
+function caInstrPredicateArities(predicate)
+{
+	var fieldarities = {};
+	var conflict = false;
+
+	mod_capred.caPredWalk(function (pred, key) {
+		var field = pred[key][0];
+		var arity = typeof (pred[key][1]) == 'number' ?
+		    mod_ca.ca_field_arity_numeric :
+		    mod_ca.ca_field_arity_discrete;
+
+		if (field in fieldarities && fieldarities[field] != arity)
+			conflict = true;
+
+		fieldarities[field] = arity;
+	}, predicate);
+
+	return (conflict ? null : fieldarities);
+}
+
+/*
+ * Compiles a predicate for fields with the given arities (see
+ * caPredValidateSemantics()) and returns a function that, given a set of
+ * datapoints, returns those for which the predicate evaluates to "true".  The
+ * predicate is validated once here.  The returned function loads the fields the
+ * predicate uses into a batch (see ca-native's DataPoints) and evaluates the
+ * predicate for the whole batch at once with ca-native's Predicate, so it's
+ * much cheaper than caPredEval() for large sets of datapoints or predicates.
+ */
+function caInstrCompilePredicate(fieldarities, predicate)
+{
+	var compiled, fields;
+
+	mod_capred.caPredValidateSyntax(predicate);
+	mod_capred.caPredValidateSemantics(fieldarities, predicate);
+
+	compiled = new mod_native.Predicate(predicate);
+	fields = compiled.fields();
+
+	return (function (datapoints) {
+		var points, selected, rv, ii;
+
+		points = new mod_native.DataPoints(fields['discrete'],
+		    fields['numeric']);
+		points.load(datapoints);
+		selected = compiled.select(points);
+
+		rv = [];
+		for (ii = 0; ii < datapoints.length; ii++) {
+			if (selected[ii >> 3] & (1 << (ii & 7)))
+				rv.push(datapoints[ii]);
+		}
+
+		return (rv);
+	});
 }
 
 /*
  * Given a set of datapoints (described above), a list of fields representing a
  * decomposition, and an array of bucketizers for the numeric fields, compute
  * the value by adding fields which are not being decomposed.
+ *
+ * Decomposed values are computed natively in a single pass over the points
+ * (see ca-native's computeValue()) when the numeric field, if any, uses one of
+ * the bucketizers below.  Otherwise, or if the native code can't represent
+ * some point exactly, we fall back to caInstrComputeValueFrom().
  */
 function caInstrComputeValue(metadata, bucketizers, decomps, datapts)
 {
+	var value;
+
+	if (decomps.length > 0) {
+		value = caInstrComputeValueNative(metadata, bucketizers,
+		    decomps, datapts);
+
+		if (value !== undefined)
+			return (value);
+	}
+
 	return (caInstrComputeValueFrom(metadata, bucketizers, decomps,
 	    datapts, 0));
 }
 
+function caInstrComputeValueNative(metadata, bucketizers, decomps, datapts)
+{
+	var fields, points;
+
+	fields = caInstrDecompFields(metadata, bucketizers, decomps);
+	if (fields === null)
+		return (undefined);
+
+	points = new mod_native.DataPoints(fields['discrete'],
+	    fields['numeric']);
+	points.load(datapts);
+	return (mod_native.computeValue(points, decomps, fields['layout']));
+}
+
+/*
+ * Returns the "discrete" and "numeric" fields used by the given decompositions
+ * and the "layout" with which to bucketize the numeric one, if any, or null if
+ * the value can't be computed natively.
+ */
+function caInstrDecompFields(metadata, bucketizers, decomps)
+{
+	var discrete, numeric, layout, ii;
+
+	discrete = [];
+	numeric = [];
+
+	for (ii = 0; ii < decomps.length; ii++) {
+		if (metadata.fieldArity(decomps[ii]) ==
+		    mod_ca.ca_field_arity_discrete) {
+			if (decomps[ii] in bucketizers)
+				return (null);
+
+			discrete.push(decomps[ii]);
+			continue;
+		}
+
+		if (ii != decomps.length - 1 || !(decomps[ii] in bucketizers))
+			return (null);
+
+		layout = caInstrBucketizeLayout(bucketizers[decomps[ii]]);
+		if (layout === null)
+			return (null);
+
+		numeric.push(decomps[ii]);
+	}
+
+	return ({ discrete: discrete, numeric: numeric, layout: layout });
+}
+
+/*
+ * Like caInstrApplyPredicate() followed by caInstrComputeValue(), but for data
+ * points that are already in a batch (see ca-native's DataPoints) with every
+ * field that the predicate and decompositions use.  The batch is filtered in
+ * place.  The points are only converted to objects if the predicate or the
+ * value can't be evaluated natively.
+ */
+function caInstrComputeBatch(metadata, bucketizers, decomps, predicate, points)
+{
+	var fieldarities, fields, value;
+
+	if (mod_capred.caPredNonTrivial(predicate)) {
+		fieldarities = caInstrPredicateArities(predicate);
+
+		if (fieldarities === null ||
+		    !caInstrBatchHasArities(points, fieldarities))
+			return (caInstrComputeValue(metadata, bucketizers,
+			    decomps, caInstrApplyPredicate(predicate,
+			    points.toArray())));
+
+		mod_capred.caPredValidateSyntax(predicate);
+		mod_capred.caPredValidateSemantics(fieldarities, predicate);
+		points.filter(new mod_native.Predicate(predicate).select(
+		    points));
+	}
+
+	fields = caInstrDecompFields(metadata, bucketizers, decomps);
+	if (fields !== null) {
+		value = mod_native.computeValue(points, decomps,
+		    fields['layout']);
+
+		if (value !== undefined)
+			return (value);
+	}
+
+	return (caInstrComputeValueFrom(metadata, bucketizers, decomps,
+	    points.toArray(), 0));
+}
+
+/*
+ * Returns whether each field in "fieldarities" is part of the batch "points"
+ * with the given arity.
+ */
+function caInstrBatchHasArities(points, fieldarities)
+{
+	var fields, field, which;
+
+	fields = points.fields();
+
+	for (field in fieldarities) {
+		which = fieldarities[field] == mod_ca.ca_field_arity_numeric ?
+		    fields['numeric'] : fields['discrete'];
+
+		if (which.indexOf(field) == -1)
+			return (false);
+	}
+
+	return (true);
+}
+
+/*
+ * Returns the native DistLayout equivalent to the given bucketizer, or null if
+ * there isn't one.  Layouts are created on first use and cached on the
+ * bucketizer.
+ */
+function caInstrBucketizeLayout(bucketizer)
+{
+	var params = bucketizer.caLayoutParams;
+
+	if (bucketizer.caLayout !== undefined)
+		return (bucketizer.caLayout);
+
+	bucketizer.caLayout = null;
+
+	if (params === undefined)
+		return (null);
+
+	if (params['type'] == 'linear' && !(params['step'] > 0))
+		return (null);
+
+	if (params['type'] == 'loglinear' && (!(params['base'] > 1) ||
+	    !caInstrIsInteger(params['min'], 0) ||
+	    !caInstrIsInteger(params['max'], params['min']) ||
+	    !caInstrIsInteger(params['nbuckets'], 1)))
+		return (null);
+
+	bucketizer.caLayout = new mod_native.DistLayout(params);
+	return (bucketizer.caLayout);
+}
+
+function caInstrIsInteger(value, min)
+{
+	return (typeof (value) == 'number' && Math.floor(value) === value &&
+	    value >= min && value <= 0x7fffffff);
+}
+
 function caInstrComputeValueFrom(metadata, bucketizers, decomps, datapts, ii)
 {
 	var arity, rv, key, fieldvalues, subdata, jj;
@@ -99,25 +337,46 @@ function caInstrComputeValueFrom(metadata, bucketizers, decomps, datapts, ii)
 	return (rv);
 }
 
+/*
+ * Returns the index of the first entry of distribution "rv" whose range ends at
+ * or after "value", or rv.length if there's no such entry.  "value" belongs
+ * either in that entry or in a new entry inserted just before it.
+ */
+function caBucketSearch(rv, value)
+{
+	var lo, hi, mid;
+
+	lo = 0;
+	hi = rv.length;
+	while (lo < hi) {
+		mid = (lo + hi) >> 1;
+		if (rv[mid][0][1] < value)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return (lo);
+}
+
 function caInstrLinearBucketize(step)
 {
-	return (function (rv, value, card) {
+	var bucketizer = function (rv, value, card) {
 		return (caLinearBucketize(rv, value, card, step));
-	});
+	};
+
+	bucketizer.caLayoutParams = { type: 'linear', step: step };
+	return (bucketizer);
 }
 
 function caLinearBucketize(rv, value, card, step)
 {
 	var ii, ent;
 
-	for (ii = 0; ii < rv.length; ii++) {
-		if (value >= rv[ii][0][0] && value <= rv[ii][0][1]) {
-			rv[ii][1] += card;
-			return;
-		}
-
-		if (value < rv[ii][0][0])
-			break;
+	ii = caBucketSearch(rv, value);
+	if (ii < rv.length && value >= rv[ii][0][0]) {
+		rv[ii][1] += card;
+		return;
 	}
 
 	mod_assert.ok(ii == rv.length || value < rv[ii][0][0]);
@@ -132,24 +391,24 @@ function caLinearBucketize(rv, value, card, step)
 
 function caInstrLogLinearBucketize(base, min, max, nbuckets)
 {
-	return (function (rv, value, card) {
+	var bucketizer = function (rv, value, card) {
 		return (caLogLinearBucketize(rv, value, card, base, min, max,
 		    nbuckets));
-	});
+	};
+
+	bucketizer.caLayoutParams = { type: 'loglinear', base: base,
+	    min: min, max: max, nbuckets: nbuckets };
+	return (bucketizer);
 }
 
 function caLogLinearBucketize(rv, value, card, base, min, max, nbuckets)
 {
 	var ii, ent, logbase, step, offset;
 
-	for (ii = 0; ii < rv.length; ii++) {
-		if (value >= rv[ii][0][0] && value <= rv[ii][0][1]) {
-			rv[ii][1] += card;
-			return;
-		}
-
-		if (value < rv[ii][0][0])
-			break;
+	ii = caBucketSearch(rv, value);
+	if (ii < rv.length && value >= rv[ii][0][0]) {
+		rv[ii][1] += card;
+		return;
 	}
 
 	mod_assert.ok(ii == rv.length || value < rv[ii][0][0]);
@@ -191,6 +450,8 @@ function caLogFloor(base, input)
 }
 
 exports.caInstrApplyPredicate = caInstrApplyPredicate;
+exports.caInstrCompilePredicate = caInstrCompilePredicate;
+exports.caInstrComputeBatch = caInstrComputeBatch;
 exports.caInstrComputeValue = caInstrComputeValue;
 exports.caInstrLinearBucketize = caInstrLinearBucketize;
 exports.caInstrLogLinearBucketize = caInstrLogLinearBucketize;
@@ -48,7 +48,12 @@ var ASSERT = mod_assert.ok;
 var ca_stash_version_major = 1;		/* stash format major version */
 var ca_stash_version_minor = 0;		/* stash format minor version */
 var ca_bucket_version_major = 1;	/* bucket format major version */
-var ca_bucket_version_minor = 0;	/* bucket format minor version */
+var ca_bucket_version_minor = 1;	/* bucket format minor version */
+var ca_index_version_major = 1;		/* bucket index major version */
+
+var ca_index_delay = 5 * 1000;		/* delay before saving bucket index */
+var ca_index_racy = 1000;		/* see indexSave() */
+var ca_index_nchecks = 8;		/* see indexCheck() */
 
 /*
  * See the block comment at the top of this file.  This implementation of a
@@ -56,10 +61,37 @@ var ca_bucket_version_minor = 0;	/* bucket format minor version */
  *
  *    $stash_root/
  *        stash.json		Global stash metadata (version)
+ *        index.json		Cached metadata for all buckets (see below)
  *        bucket-XX/		Directory for bucket XX
  *            metadata.json	Metadata for bucket XX (version)
- *            data		Data for bucket XX
+ *            data.json		Data for bucket XX (text)
+ *            data.bin		Data for bucket XX (binary)
+ *            segment-N		Segment N appended to bucket XX
  *        ...			More buckets
+ *
+ * Bucket contents are either strings or Buffers.  Buckets filled with Buffers
+ * (as of bucket minor version 1) have "ca_bucket_encoding" set to "binary" in
+ * their metadata and store their data in data.bin instead of data.json, so
+ * they're returned as Buffers.  Older software will fail to read the data for
+ * such buckets but can still load the rest of the stash.
+ *
+ * Binary buckets may also be updated incrementally by appending segments (see
+ * bucketAppend()), which are numbered in the order they were appended.  Each
+ * segment file contains the segment's metadata as a single line of JSON
+ * followed by its data.  Filling a bucket replaces its segments along with
+ * everything else, which is how consumers compact buckets that have
+ * accumulated many segments.
+ *
+ * Reading the metadata for every bucket when the stash is loaded takes a long
+ * time for stashes with thousands of buckets, during which the stash can't
+ * serve any requests.  So shortly after buckets change, we save the metadata
+ * for all of them to index.json (see indexSave()).  When loading the stash, we
+ * only read the metadata for buckets that aren't in the index.  The stash can
+ * be used as soon as that's done, and each indexed bucket is checked the first
+ * time it's used: if its directory has changed since the index was saved,
+ * which we check by comparing the directory's inode number and change time,
+ * we read its metadata from disk then (see bucketCheck()).  Meanwhile, we
+ * check the rest of the indexed buckets in the background (see indexCheck()).
  */
 function caStash(log, sysinfo)
 {
@@ -67,6 +99,12 @@ function caStash(log, sysinfo)
 	this.cas_creator = caDeepCopy(sysinfo);
 	this.cas_busy = {};
 	this.cas_cleanup = [];
+	this.cas_segments = {};
+	this.cas_unchecked = {};
+	this.cas_check_waiters = null;
+	this.cas_index_timer = null;
+	this.cas_index_saving = false;
+	this.cas_index_dirty = false;
 }
 
 /*
@@ -94,6 +132,8 @@ caStash.prototype.init = function (directory, callback)
 	caRunStages(stages, null, function (err) {
 		if (err)
 			stash.cas_rootdir = undefined;
+		else
+			stash.indexCheck();
 		return (callback(err));
 	});
 };
@@ -135,7 +175,9 @@ caStash.prototype.loadInit = function (unused, callback)
 };
 
 /*
- * [private] Load all of the individual stash buckets' metadata.
+ * [private] Load the metadata for all of the individual stash buckets that
+ * aren't in the bucket index.  The rest are recorded in "cas_unchecked" to be
+ * checked later.
  */
 caStash.prototype.loadBuckets = function (unused, callback)
 {
@@ -181,16 +223,17 @@ caStash.prototype.loadBuckets = function (unused, callback)
 	stash = this;
 	log = stash.cas_log;
 	mod_fs.readdir(this.cas_rootdir, function (err, files) {
-		var ii, tasks;
+		var ii, buckets;
 
 		if (err)
 			return (callback(new caSystemError(err,
 			    'failed to read stash')));
 
-		tasks = [];
+		buckets = [];
 
 		for (ii = 0; ii < files.length; ii++) {
-			if (files[ii] == 'stash.json')
+			if (files[ii] == 'stash.json' ||
+			    caStartsWith(files[ii], 'index.json'))
 				continue;
 
 			if (caStartsWith(files[ii], 'newbucket-')) {
@@ -215,21 +258,67 @@ caStash.prototype.loadBuckets = function (unused, callback)
 				continue;
 			}
 
-			tasks.push(stash.loadBucket.bind(stash, files[ii]));
+			buckets.push(files[ii]);
+		}
+
+		return (stash.loadIndex(function (index) {
+			var tasks = [];
+
+			buckets.forEach(function (bucket) {
+				var name = bucket.substring('bucket-'.length);
+
+				if (index.hasOwnProperty(name)) {
+					stash.cas_unchecked[name] = index[name];
+					return;
+				}
+
+				tasks.push(stash.loadBucket.bind(stash, bucket,
+				    stash.cas_cleanup));
+			});
+
+			caRunParallel(tasks, function (rv) {
+				callback(null, rv);
+			});
+		}));
+	});
+};
+
+/*
+ * [private] Load the bucket index, if there is one.  Since the index is only
+ * an optimization, we ignore it if we fail to read it for any reason.
+ */
+caStash.prototype.loadIndex = function (callback)
+{
+	var log, path;
+
+	log = this.cas_log;
+	path = mod_path.join(this.cas_rootdir, 'index.json');
+	caReadFileJson(path, function (err, json) {
+		if (err) {
+			if (err.code() != ECA_NOENT)
+				log.warn('stash: ignoring index: %r', err);
+			return (callback({}));
+		}
+
+		if (json.ca_index_version_major != ca_index_version_major) {
+			log.warn('stash: ignoring index with version %s',
+			    json.ca_index_version_major);
+			return (callback({}));
 		}
 
-		return (caRunParallel(tasks,
-		    function (rv) { callback(null, rv); }));
+		return (callback(json.ca_index_buckets));
 	});
 };
 
 /*
- * [private] Load a particular stash bucket's metadata.
+ * [private] Load a particular stash bucket's metadata.  Functions that clean up
+ * after operations on the bucket that were interrupted are added to "cleanup".
  */
-caStash.prototype.loadBucket = function (bucket, callback)
+caStash.prototype.loadBucket = function (bucket, cleanup, callback)
 {
-	var path;
+	var stash, path;
 
+	stash = this;
 	path = mod_path.join(this.cas_rootdir, bucket, 'metadata.json');
 	caReadFileJson(path, function (err, json) {
 		if (err)
@@ -243,18 +332,97 @@ caStash.prototype.loadBucket = function (bucket, callback)
 			    ca_bucket_version_major,
 			    json.ca_bucket_version_major)));
 
-		bucket = bucket.substring('bucket-'.length);
+		return (stash.loadSegments(bucket, cleanup,
+		    function (err2, segments) {
+			if (err2)
+				return (callback(err2));
+
+			return (callback(null, {
+			    bucket: bucket.substring('bucket-'.length),
+			    metadata: json,
+			    segments: segments
+			}));
+		    }));
+	});
+};
+
+/*
+ * [private] Load the metadata for the segments appended to a stash bucket,
+ * removing any that we were still writing when we last stopped (by adding a
+ * function to do so to "cleanup").
+ */
+caStash.prototype.loadSegments = function (bucket, cleanup, callback)
+{
+	var log, dir;
+
+	log = this.cas_log;
+	dir = mod_path.join(this.cas_rootdir, bucket);
+	mod_fs.readdir(dir, function (err, files) {
+		var tasks, seqs;
+
+		if (err)
+			return (callback(new caSystemError(err,
+			    'failed to read stash bucket "%s"', bucket)));
+
+		seqs = [];
+
+		files.forEach(function (file) {
+			var path = mod_path.join(dir, file);
+
+			if (caStartsWith(file, 'newsegment-')) {
+				log.warn('stash: found "%s", will remove',
+				    path);
+				cleanup.push(function (unused, subcallback) {
+					caRemoveTree(log, path, subcallback);
+				});
+				return;
+			}
+
+			if (caStartsWith(file, 'segment-'))
+				seqs.push(parseInt(file.substring(
+				    'segment-'.length), 10));
+		});
+
+		seqs.sort(function (a, b) { return (a - b); });
+		tasks = seqs.map(function (seq) {
+			var path = mod_path.join(dir, 'segment-' + seq);
+
+			return (function (subcallback) {
+				caReadSegment(path, function (err2, segment) {
+					if (err2)
+						return (subcallback(err2));
 
-		return (callback(null, { bucket: bucket, metadata: json }));
+					return (subcallback(null, {
+					    seq: seq,
+					    umetadata: segment['metadata']
+					}));
+				});
+			});
+		});
+
+		return (caRunParallel(tasks, function (rv) {
+			var err2;
+
+			if (rv['nerrors'] > 0) {
+				err2 = rv['results'][rv['errlocs'][0]]['error'];
+				return (callback(new caError(err2.code(), err2,
+				    'failed to load segments for stash ' +
+				    'bucket "%s"', bucket)));
+			}
+
+			return (callback(null, rv['results'].map(
+			    function (elt) { return (elt['result']); })));
+		}));
 	});
 };
 
 /*
- * [private] Finish loading bucket metadata.
+ * [private] Finish loading bucket metadata.  Until they're checked, we use the
+ * metadata in the index for the buckets in it.
  */
 caStash.prototype.loadFini = function (rv, callback)
 {
-	var fatal, err, result, ii, cleanup;
+	var fatal, err, result, ii, cleanup, bucket, entry;
 
 	fatal = [];
 	for (ii = 0; ii < rv['errlocs'].length; ii++) {
@@ -294,6 +462,18 @@ caStash.prototype.loadFini = function (rv, callback)
 	for (ii = 0; ii < rv['results'].length; ii++) {
 		result = rv['results'][ii]['result'];
 		this.cas_buckets[result['bucket']] = result['metadata'];
+
+		if (result['segments'].length > 0)
+			this.cas_segments[result['bucket']] =
+			    result['segments'];
+	}
+
+	for (bucket in this.cas_unchecked) {
+		entry = this.cas_unchecked[bucket];
+		this.cas_buckets[bucket] = entry['metadata'];
+
+		if (entry['segments'].length > 0)
+			this.cas_segments[bucket] = entry['segments'];
 	}
 
 	return (caRunStages(cleanup, null, function (suberr) {
@@ -363,13 +543,139 @@ caStash.prototype.created = function ()
 	return (new Date(this.cas_stash_metadata.ca_stash_created));
 };
 
-/* [private] */
+/*
+ * [private] Invokes "callback" once no other operation is using the named
+ * bucket and the bucket has been checked (see bucketCheck()).  "callback" is
+ * passed a function to invoke when its operation completes and the error, if
+ * any, from checking the bucket.
+ */
 caStash.prototype.bucketTask = function (bucket, callback)
 {
+	var stash = this;
+
 	if (!(bucket in this.cas_busy))
 		this.cas_busy[bucket] = new mod_catask.caTaskSerializer();
 
-	this.cas_busy[bucket].task(function (taskcb) { callback(taskcb); });
+	this.cas_busy[bucket].task(function (taskcb) {
+		stash.bucketCheck(bucket, function (err) {
+			callback(taskcb, err);
+		});
+	});
+};
+
+/*
+ * [private] If the named bucket's metadata came from the bucket index and
+ * hasn't been checked yet, check whether the bucket's directory has changed
+ * since the index was saved, and if so, read the bucket's metadata from disk.
+ * If the bucket no longer exists, we forget about it.  If we fail to read it
+ * for some other reason, we return the error and leave it unchecked so that
+ * subsequent operations on it fail too.  The special ".contents" bucket
+ * describes all buckets, so it waits until all of them have been checked.
+ * Callers must prevent concurrent operations on the bucket (see bucketTask()).
+ */
+caStash.prototype.bucketCheck = function (bucket, callback)
+{
+	var stash, log, entry, dir;
+
+	if (bucket == '.contents') {
+		if (this.cas_check_waiters === null)
+			return (callback(null));
+
+		this.cas_check_waiters.push(callback);
+		return (undefined);
+	}
+
+	if (!this.cas_unchecked.hasOwnProperty(bucket))
+		return (callback(null));
+
+	stash = this;
+	log = this.cas_log;
+	entry = this.cas_unchecked[bucket];
+	dir = 'bucket-' + bucket;
+	return (mod_fs.stat(mod_path.join(this.cas_rootdir, dir),
+	    function (err, stat) {
+		var cleanup;
+
+		if (!err && stat.ino == entry['ino'] &&
+		    stat.ctime.getTime() == entry['ctime']) {
+			delete (stash.cas_unchecked[bucket]);
+			return (callback(null));
+		}
+
+		log.dbg('stash: bucket "%s" changed since index was saved',
+		    bucket);
+		cleanup = [];
+		return (stash.loadBucket(dir, cleanup, function (err2, result) {
+			if (err2 && err2.code() != ECA_NOENT) {
+				log.error('%s', err2);
+				return (callback(err2));
+			}
+
+			delete (stash.cas_unchecked[bucket]);
+			delete (stash.cas_segments[bucket]);
+
+			if (err2) {
+				log.warn('%s', err2);
+				delete (stash.cas_buckets[bucket]);
+			} else {
+				stash.cas_buckets[bucket] = result['metadata'];
+				if (result['segments'].length > 0)
+					stash.cas_segments[bucket] =
+					    result['segments'];
+			}
+
+			stash.indexChanged();
+			return (caRunStages(cleanup, null, function (suberr) {
+				if (suberr)
+					log.warn('failed to clean up stash ' +
+					    'bucket "%s": %r', bucket, suberr);
+				callback(null);
+			}));
+		}));
+	    }));
+};
+
+/*
+ * [private] Check all of the buckets whose metadata came from the bucket index
+ * (see bucketCheck()).  We only check a few at a time so that operations on
+ * other buckets, which check those buckets first, don't wait behind all of
+ * them.
+ */
+caStash.prototype.indexCheck = function ()
+{
+	var stash, log, buckets, nbuckets, nrunning, start;
+
+	stash = this;
+	log = this.cas_log;
+	buckets = Object.keys(this.cas_unchecked);
+	nbuckets = buckets.length;
+	nrunning = 0;
+	start = new Date().getTime();
+	this.cas_check_waiters = [];
+
+	function next() {
+		var waiters;
+
+		if (buckets.length === 0 && nrunning === 0) {
+			log.info('stash: checked %d indexed buckets in %sms',
+			    nbuckets, new Date().getTime() - start);
+			waiters = stash.cas_check_waiters;
+			stash.cas_check_waiters = null;
+			waiters.forEach(function (waiter) { waiter(null); });
+			return;
+		}
+
+		while (buckets.length > 0 && nrunning < ca_index_nchecks) {
+			nrunning++;
+			stash.bucketTask(buckets.shift(), function (taskcb) {
+				nrunning--;
+				taskcb();
+				next();
+			});
+		}
+	}
+
+	next();
 };
 
 /*
@@ -383,19 +689,57 @@ caStash.prototype.bucketFill = function (bucket, metadata, contents, callback)
 
 	ASSERT(this.cas_buckets, 'caStash.bucketFill() called before init()');
 
-	this.bucketTask(bucket, function (taskcb) {
-		stash.doBucketFill(bucket, metadata, contents, function (err) {
-			callback(err, err ? undefined : true);
+	this.bucketTask(bucket, function (taskcb, err) {
+		if (err) {
+			callback(err);
+			return (taskcb());
+		}
+
+		return (stash.doBucketFill(bucket, metadata, contents,
+		    function (err2) {
+			callback(err2, err2 ? undefined : true);
 			taskcb();
-		});
+		    }));
+	});
+};
+
+/*
+ * Appends a segment with "contents" and "metadata" to the bucket called "name",
+ * which must already have been filled with binary contents.  The segment is
+ * returned along with the bucket's other contents, and the bucket's metadata
+ * becomes "metadata".  Like bucketFill(), this operation is atomic.
+ */
+caStash.prototype.bucketAppend = function (bucket, metadata, contents,
+    callback)
+{
+	var stash = this;
+
+	ASSERT(this.cas_buckets, 'caStash.bucketAppend() called before init()');
+
+	this.bucketTask(bucket, function (taskcb, err) {
+		if (err) {
+			callback(err);
+			return (taskcb());
+		}
+
+		return (stash.doBucketAppend(bucket, metadata, contents,
+		    function (err2) {
+			callback(err2, err2 ? undefined : true);
+			taskcb();
+		    }));
 	});
 };
 
 /*
- * Retrieves the metadata for the named bucket.
+ * Retrieves the metadata for the named bucket.  For buckets with segments,
+ * this is the metadata of the most recently appended segment.  Until a bucket
+ * whose metadata came from the bucket index has been checked (see
+ * bucketCheck()), this returns the metadata from the index.
  */
 caStash.prototype.bucketMetadata = function (bucket)
 {
+	var segments;
+
 	/*
 	 * This operation is not synchronized with read/write because only one
 	 * "write" will be happening at a time and it will atomically update
@@ -406,12 +750,20 @@ caStash.prototype.bucketMetadata = function (bucket)
 	if (!(bucket in this.cas_buckets))
 		return (undefined);
 
+	if (bucket in this.cas_segments) {
+		segments = this.cas_segments[bucket];
+		return (segments[segments.length - 1].umetadata);
+	}
+
 	return (this.cas_buckets[bucket].ca_bucket_umetadata);
 };
 
 /*
  * Retrieves the contents of the named bucket as an object with "metadata" and
- * "data" members.
+ * "data" members.  If any segments have been appended to the bucket since it
+ * was last filled, "metadata" is the metadata it was filled with and
+ * "segments" is an array of the segments (each with "metadata" and "data"), in
+ * the order they were appended.
  */
 caStash.prototype.bucketContents = function (bucket, callback)
 {
@@ -419,11 +771,16 @@ caStash.prototype.bucketContents = function (bucket, callback)
 
 	ASSERT(this.cas_buckets, 'caStash.bucketFill() called before init()');
 
-	this.bucketTask(bucket, function (taskcb) {
-		stash.doBucketContents(bucket, function (err, result) {
-			callback(err, result);
+	this.bucketTask(bucket, function (taskcb, err) {
+		if (err) {
+			callback(err);
+			return (taskcb());
+		}
+
+		return (stash.doBucketContents(bucket, function (err2, result) {
+			callback(err2, result);
 			taskcb();
-		});
+		}));
 	});
 };
 
@@ -436,11 +793,16 @@ caStash.prototype.bucketDelete = function (bucket, callback)
 
 	ASSERT(this.cas_buckets, 'caStash.bucketDelete() called before init()');
 
-	this.bucketTask(bucket, function (taskcb) {
-		stash.doBucketDelete(bucket, function (err) {
-			callback(err, err ? undefined: true);
+	this.bucketTask(bucket, function (taskcb, err) {
+		if (err) {
+			callback(err);
+			return (taskcb());
+		}
+
+		return (stash.doBucketDelete(bucket, function (err2) {
+			callback(err2, err2 ? undefined: true);
 			taskcb();
-		});
+		}));
 	});
 };
 
@@ -476,6 +838,10 @@ caStash.prototype.doBucketFill = function (bucket, umetadata, contents,
 		return (callback(new caError(ECA_INVAL, null,
 		    'metadata must be an object')));
 
+	if (typeof (contents) != typeof ('') && !Buffer.isBuffer(contents))
+		return (callback(new caError(ECA_INVAL, null,
+		    'contents must be a string or Buffer')));
+
 	/*
 	 * Because we use a per-bucket task serializer around all read and write
 	 * operations, we know that nobody else is currently reading or writing
@@ -514,6 +880,8 @@ caStash.prototype.doBucketFill = function (bucket, umetadata, contents,
 	    ca_bucket_version_minor: ca_bucket_version_minor,
 	    ca_bucket_umetadata: umetadata
 	};
+	if (Buffer.isBuffer(contents))
+		metadata.ca_bucket_encoding = 'binary';
 	stages = [];
 	written = false;
 	log = this.cas_log;
@@ -525,7 +893,7 @@ caStash.prototype.doBucketFill = function (bucket, umetadata, contents,
 	tmpdir = mod_path.join(this.cas_rootdir,
 	    caSprintf('newbucket-%s-%s', bucket, rand));
 	mdfile = mod_path.join(tmpdir, 'metadata.json');
-	datafile = mod_path.join(tmpdir, 'data.json');
+	datafile = mod_path.join(tmpdir, caBucketDataFile(metadata));
 
 	stages.push(function (unused, subcallback) {
 		log.dbg('stash update "%s": mkdir "%s"', bucket, tmpdir);
@@ -594,6 +962,8 @@ caStash.prototype.doBucketFill = function (bucket, umetadata, contents,
 			log.info('stash update "%s" completed in %sms', bucket,
 			    new Date().getTime() - start);
 			stash.cas_buckets[bucket] = caDeepCopy(metadata);
+			delete (stash.cas_segments[bucket]);
+			stash.indexChanged();
 			return (callback(null));
 		}
 
@@ -624,14 +994,95 @@ caStash.prototype.doBucketFill = function (bucket, umetadata, contents,
 	}));
 };
 
+caStash.prototype.doBucketAppend = function (bucket, umetadata, contents,
+    callback)
+{
+	var stash, segments, seq, log, header, buffer, stages;
+	var dir, tmpfile, segfile;
+	var start = new Date().getTime();
+
+	if (!this.bucketValidate(bucket, callback))
+		return (undefined);
+
+	if (typeof (umetadata) != typeof ({}) ||
+	    umetadata.constructor !== Object)
+		return (callback(new caError(ECA_INVAL, null,
+		    'metadata must be an object')));
+
+	if (!Buffer.isBuffer(contents))
+		return (callback(new caError(ECA_INVAL, null,
+		    'contents must be a Buffer')));
+
+	if (!(bucket in this.cas_buckets))
+		return (callback(new caError(ECA_NOENT, null,
+		    'bucket "%s" does not exist', bucket)));
+
+	if (this.cas_buckets[bucket].ca_bucket_encoding != 'binary')
+		return (callback(new caError(ECA_INVAL, null,
+		    'bucket "%s" is not binary', bucket)));
+
+	/*
+	 * Segments are written the same way as whole buckets: we write the new
+	 * segment to "newsegment-<seq>" in the bucket's directory, sync it, and
+	 * then rename it to "segment-<seq>".  If we crash before the rename
+	 * completes, we'll remove the temporary file when we start up again.
+	 * Because filling the bucket replaces the whole directory, a segment
+	 * can never end up applied to data other than what it was appended to.
+	 */
+	stash = this;
+	log = this.cas_log;
+	segments = this.cas_segments[bucket] || [];
+	seq = segments.length > 0 ? segments[segments.length - 1].seq + 1 : 1;
+	dir = mod_path.join(this.cas_rootdir, caSprintf('bucket-%s', bucket));
+	tmpfile = mod_path.join(dir, 'newsegment-' + seq);
+	segfile = mod_path.join(dir, 'segment-' + seq);
+
+	header = new Buffer(JSON.stringify(umetadata) + '\n', 'utf-8');
+	buffer = new Buffer(header.length + contents.length);
+	header.copy(buffer, 0);
+	contents.copy(buffer, header.length);
+
+	stages = [];
+
+	stages.push(function (unused, subcallback) {
+		log.dbg('stash append "%s": saving "%s"', bucket, tmpfile);
+		caSaveFile(tmpfile, buffer, subcallback);
+	});
+
+	stages.push(function (unused, subcallback) {
+		log.dbg('stash append "%s": rename "%s" to "%s"',
+		    bucket, tmpfile, segfile);
+		caRename(tmpfile, segfile, subcallback);
+	});
+
+	return (caRunStages(stages, null, function (err) {
+		if (!err) {
+			log.info('stash append "%s" (segment %d, %d bytes) ' +
+			    'completed in %sms', bucket, seq, buffer.length,
+			    new Date().getTime() - start);
+			segments.push({
+			    seq: seq,
+			    umetadata: caDeepCopy(umetadata)
+			});
+			stash.cas_segments[bucket] = segments;
+			stash.indexChanged();
+			return (callback(null));
+		}
+
+		log.error('stash append "%s" failed: %r', bucket, err);
+		caRemoveTree(log, tmpfile, function () { callback(err); });
+		return (undefined);
+	}));
+};
+
 caStash.prototype.doBucketContents = function (bucket, callback)
 {
-	var key, cts, stash, log, path;
+	var key, cts, stash, log, dir, binary, tasks;
 
 	if (bucket == '.contents') {
 		cts = {};
 		for (key in this.cas_buckets)
-			cts[key] = this.cas_buckets[key].ca_bucket_umetadata;
+			cts[key] = this.bucketMetadata(key);
 
 		return (callback(null, {
 		    bucket: bucket,
@@ -645,26 +1096,62 @@ caStash.prototype.doBucketContents = function (bucket, callback)
 
 	stash = this;
 	log = this.cas_log;
-	path = mod_path.join(this.cas_rootdir, 'bucket-' + bucket, 'data.json');
+	binary = this.cas_buckets[bucket].ca_bucket_encoding == 'binary';
+	dir = mod_path.join(this.cas_rootdir, 'bucket-' + bucket);
 
 	log.dbg('reading contents of bucket "%s"', bucket);
 
-	return (mod_fs.readFile(path, function (err, data) {
-		if (err) {
-			err = new caSystemError(err,
+	tasks = [ function (subcallback) {
+		mod_fs.readFile(mod_path.join(dir,
+		    caBucketDataFile(stash.cas_buckets[bucket])),
+		    function (err, data) {
+			if (err)
+				return (subcallback(new caSystemError(err)));
+
+			return (subcallback(null, data));
+		    });
+	} ];
+
+	if (bucket in this.cas_segments) {
+		this.cas_segments[bucket].forEach(function (segment) {
+			tasks.push(caReadSegment.bind(null,
+			    mod_path.join(dir, 'segment-' + segment.seq)));
+		});
+	}
+
+	return (caRunParallel(tasks, function (rv) {
+		var err, data, nbytes, rval, ii;
+
+		if (rv['nerrors'] > 0) {
+			err = rv['results'][rv['errlocs'][0]]['error'];
+			err = new caError(err.code(), err,
 			    'failed to read data for bucket "%s"', bucket);
 			log.warn('stash read failed: %r', err);
 			return (callback(err));
 		}
 
-		log.dbg('stash read of "%s" completed (%d bytes)', bucket,
-		    data.length);
-
-		return (callback(null, {
+		data = rv['results'][0]['result'];
+		nbytes = data.length;
+		rval = {
 		    bucket: bucket,
-		    metadata: stash.bucketMetadata(bucket),
-		    data: data.toString('utf-8')
-		}));
+		    metadata: stash.cas_buckets[bucket].ca_bucket_umetadata,
+		    data: binary ? data : data.toString('utf-8')
+		};
+
+		if (rv['results'].length > 1) {
+			rval['segments'] = [];
+
+			for (ii = 1; ii < rv['results'].length; ii++) {
+				rval['segments'].push(
+				    rv['results'][ii]['result']);
+				nbytes += rv['results'][ii]['result'][
+				    'data'].length;
+			}
+		}
+
+		log.dbg('stash read of "%s" completed (%d bytes)', bucket,
+		    nbytes);
+		return (callback(null, rval));
 	}));
 };
 
@@ -756,6 +1243,8 @@ caStash.prototype.doBucketDelete = function (bucket, callback)
 		if (!err) {
 			log.info('stash bucket "%s" deleted', bucket);
 			delete (stash.cas_buckets[bucket]);
+			delete (stash.cas_segments[bucket]);
+			stash.indexChanged();
 			return (callback(null));
 		}
 
@@ -763,6 +1252,8 @@ caStash.prototype.doBucketDelete = function (bucket, callback)
 			log.warn('stash bucket "%s" delete succeeded, but ' +
 			    'remove failed: %r', bucket, err);
 			delete (stash.cas_buckets[bucket]);
+			delete (stash.cas_segments[bucket]);
+			stash.indexChanged();
 			return (callback(null));
 		}
 
@@ -771,6 +1262,171 @@ caStash.prototype.doBucketDelete = function (bucket, callback)
 	}));
 };
 
+/*
+ * [private] Schedule the bucket index to be saved soon.  We wait a few seconds
+ * so that a burst of updates results in only one save.
+ */
+caStash.prototype.indexChanged = function ()
+{
+	var stash = this;
+
+	this.cas_index_dirty = true;
+
+	if (this.cas_index_timer !== null || this.cas_index_saving)
+		return;
+
+	this.cas_index_timer = setTimeout(function () {
+		stash.cas_index_timer = null;
+		stash.indexSave(function () {});
+	}, ca_index_delay);
+};
+
+/*
+ * Saves the metadata for all buckets to the bucket index, along with each
+ * bucket directory's inode number and change time, which bucketCheck() uses
+ * to tell whether the bucket has changed since.  We omit buckets that are
+ * being updated, since their metadata in memory may not match what's on disk.
+ * We also omit buckets that changed very recently (within ca_index_racy), since
+ * the directory's change time may not change again if the bucket is updated
+ * again within the resolution of the timestamp.  Buckets that haven't been
+ * checked yet keep their existing entries.
+ */
+caStash.prototype.indexSave = function (callback)
+{
+	var stash, log, buckets, tasks, path, tmppath;
+
+	ASSERT(this.cas_buckets, 'caStash.indexSave() called before init()');
+
+	if (this.cas_index_saving) {
+		this.cas_index_dirty = true;
+		return (callback(null));
+	}
+
+	stash = this;
+	log = this.cas_log;
+	buckets = Object.keys(this.cas_buckets);
+	path = mod_path.join(this.cas_rootdir, 'index.json');
+	tmppath = path + '.tmp';
+	tasks = buckets.map(function (bucket) {
+		return (mod_fs.stat.bind(null,
+		    mod_path.join(stash.cas_rootdir, 'bucket-' + bucket)));
+	});
+
+	this.cas_index_saving = true;
+	this.cas_index_dirty = false;
+
+	return (caRunParallel(tasks, function (rv) {
+		var now, index, nindexed, retry, bucket, stat, ii;
+
+		now = new Date().getTime();
+		index = {};
+		nindexed = 0;
+		retry = false;
+
+		for (ii = 0; ii < buckets.length; ii++) {
+			bucket = buckets[ii];
+
+			if (!('result' in rv['results'][ii]) ||
+			    !(bucket in stash.cas_buckets))
+				continue;
+
+			if (stash.cas_unchecked.hasOwnProperty(bucket)) {
+				nindexed++;
+				index[bucket] = stash.cas_unchecked[bucket];
+				continue;
+			}
+
+			stat = rv['results'][ii]['result'];
+			if ((bucket in stash.cas_busy &&
+			    stash.cas_busy[bucket].busy()) ||
+			    now - stat.ctime.getTime() < ca_index_racy) {
+				retry = true;
+				continue;
+			}
+
+			nindexed++;
+
+			index[bucket] = {
+			    ino: stat.ino,
+			    ctime: stat.ctime.getTime(),
+			    metadata: stash.cas_buckets[bucket],
+			    segments: stash.cas_segments[bucket] || []
+			};
+		}
+
+		log.dbg('saving stash index (%d of %d buckets)', nindexed,
+		    buckets.length);
+
+		caRunStages([
+		    function (unused, subcallback) {
+			caSaveFile(tmppath, JSON.stringify({
+			    ca_index_version_major: ca_index_version_major,
+			    ca_index_buckets: index
+			}), subcallback);
+		    },
+		    function (unused, subcallback) {
+			caRename(tmppath, path, subcallback);
+		    }
+		], null, function (err) {
+			stash.cas_index_saving = false;
+
+			if (err)
+				log.warn('failed to save stash index: %r', err);
+
+			if (err || retry)
+				stash.cas_index_dirty = true;
+
+			if (stash.cas_index_dirty)
+				stash.indexChanged();
+
+			callback(err);
+		});
+	}));
+};
+
+/*
+ * Returns the name of the data file for a bucket with the given (internal)
+ * metadata.
+ */
+function caBucketDataFile(metadata)
+{
+	return (metadata.ca_bucket_encoding == 'binary' ? 'data.bin' :
+	    'data.json');
+}
+
+/*
+ * Reads a segment appended to a bucket (see bucketAppend()) and returns an
+ * object with "metadata" and "data" members.
+ */
+function caReadSegment(filename, callback)
+{
+	mod_fs.readFile(filename, function (err, contents) {
+		var metadata, ii;
+
+		if (err)
+			return (callback(new caSystemError(err,
+			    'failed to read file "%s"', filename)));
+
+		for (ii = 0; ii < contents.length; ii++) {
+			if (contents[ii] == 0x0a)
+				break;
+		}
+
+		try {
+			metadata = JSON.parse(
+			    contents.toString('utf-8', 0, ii));
+		} catch (ex) {
+			return (callback(new caError(ECA_INVAL, ex,
+			    'failed to parse segment "%s"', filename)));
+		}
+
+		return (callback(null, {
+		    metadata: metadata,
+		    data: contents.slice(Math.min(ii + 1, contents.length))
+		}));
+	});
+}
+
 /*
  * Recursively remove the given path.
  */
@@ -826,8 +1482,9 @@ function caRemoveDirectory(log, path, callback)
 }
 
 /*
- * Writes the specified data to the named file.  The callback will be invoked
- * only after the data has been syncked to disk.
+ * Writes the specified data (a string, written as UTF-8, or a Buffer) to the
+ * named file.  The callback will be invoked only after the data has been
+ * syncked to disk.
  */
 function caSaveFile(filename, data, callback)
 {
@@ -856,7 +1513,8 @@ function caSaveFile(filename, data, callback)
 	sync = mod_fs.fsync;
 
 	nwritten = 0;
-	data = new Buffer(data, 'utf-8');
+	if (!Buffer.isBuffer(data))
+		data = new Buffer(data, 'utf-8');
 	caRunStages([ open, write, sync ], null, function (err, result) {
 		if (fd === undefined)
 			return (callback(new caSystemError(err,
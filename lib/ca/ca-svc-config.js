@@ -77,7 +77,7 @@ var cfg_retain_min = 10;		/* min data retention time: 10 sec */
 var cfg_retain_default = 10 * 60;	/* default data retention: 10 min */
 
 var cfg_granularity_default = 1;		/* 1 second */
-var cfg_datapoints_max = 60 * 60;		/* 1 hour at per-second */
+var cfg_datapoints_max = 60 * 60;		/* per granularity tier */
 
 var cfg_idle_max_min = 0;			/* never expire */
 var cfg_idle_max_max = 60 * 60 * 24 * 7;	/* 1 week */
@@ -88,6 +88,7 @@ var cfg_http_uri_inst = '/instrumentations';
 var cfg_http_uri_raw  = '/value/raw';
 var cfg_http_uri_heatmap_image = '/value/heatmap/image';
 var cfg_http_uri_heatmap_details = '/value/heatmap/details';
+var cfg_http_uri_quantile = '/value/quantile';
 
 var cfg_name = 'configsvc';		/* component name */
 var cfg_vers = '0.0';			/* component version */
@@ -1098,7 +1099,8 @@ caConfigService.prototype.httpInstnProps = function (request)
 
 	props = {};
 	fields = [ 'module', 'stat', 'predicate', 'decomposition', 'enabled',
-	    'retention-time', 'idle-max', 'granularity', 'persist-data' ];
+	    'retention-time', 'idle-max', 'granularity', 'persist-data',
+	    'value-sketch' ];
 
 	for (ii = 0; ii < fields.length; ii++) {
 		if (fields[ii] in actuals)
@@ -1414,7 +1416,9 @@ caConfigService.prototype.httpInstnValue = function (request, response)
 
 	extraheaders = {
 	    'x-ca-instn-arity': instn.cfi_props['value-arity'],
-	    'x-ca-instn-granularity': instn.cfi_props['granularity']
+	    'x-ca-instn-granularity': instn.cfi_props['granularity'],
+	    'x-ca-instn-sketch':
+		String(instn.cfi_props['value-sketch'] === true)
 	};
 
 	return (mod_cahttp.caHttpForward(request, response, ipaddr, port,
@@ -1638,6 +1642,28 @@ caConfigService.prototype.instnValidateProps = function (props, pset, scopeid)
 	props['value-dimension'] = arity['dimension'];
 	props['value-arity'] = arity['arity'];
 
+	/*
+	 * "value-sketch" is optional and only makes sense for numeric values
+	 * with no additional decomposition.  Such instrumentations store
+	 * quantile sketches rather than heatmap data.
+	 */
+	if (!('value-sketch' in props) || props['value-sketch'] === 'false' ||
+	    props['value-sketch'] === false)
+		props['value-sketch'] = false;
+	else if (props['value-sketch'] === 'true' ||
+	    props['value-sketch'] === true)
+		props['value-sketch'] = true;
+	else
+		throw (new caInvalidFieldError('value-sketch',
+		    props['value-sketch'], 'must be a boolean'));
+
+	if (props['value-sketch'] &&
+	    (props['value-arity'] != mod_ca.ca_arity_numeric ||
+	    props['value-dimension'] != 2))
+		throw (new caInvalidFieldError('value-sketch',
+		    props['value-sketch'], 'only supported for numeric ' +
+		    'values without additional decompositions'));
+
 	props['crtime'] = new Date().getTime();
 
 	/*
@@ -2392,7 +2418,7 @@ function caInstArity(fieldarities, decomp)
  */
 function caInstValidateMutableFields(props, privileged)
 {
-	var retain, idle;
+	var retain, idle, tiers, last;
 
 	if ('enabled' in props) {
 		if (props['enabled'] !== 'true' && props['enabled'] !== true)
@@ -2414,12 +2440,20 @@ function caInstValidateMutableFields(props, privileged)
 			    props['retention-time'], 'minimum is %s',
 			    cfg_retain_min));
 
-		if (retain / props['granularity'] > cfg_datapoints_max)
+		/*
+		 * Older data is kept at coarser granularities (see
+		 * caDataTiers()), so the limit on data points applies to the
+		 * coarsest granularity at which the data will be stored.
+		 */
+		tiers = mod_ca.caDataTiers(props['granularity'], retain);
+		last = tiers[tiers.length - 1];
+
+		if (last.span / last.granularity > cfg_datapoints_max)
 			throw (new caInvalidFieldError('retention-time',
 			    props['retention-time'],
 			    'maximum for granularity "%s" is %s',
 			    props['granularity'], cfg_datapoints_max *
-			    props['granularity']));
+			    last.granularity));
 
 		props['retention-time'] = retain;
 	}
@@ -2501,11 +2535,12 @@ function caNormalizeProperties(baseuri, scopeid, instnid, props)
 	fields = [ 'module', 'stat', 'predicate', 'decomposition',
 	    'value-dimension', 'value-arity', 'enabled', 'retention-time',
 	    'idle-max', 'transformations', 'nsources', 'granularity',
-	    'persist-data', 'crtime', 'value-scope' ];
+	    'persist-data', 'crtime', 'value-scope', 'value-sketch' ];
 
 	defaults = {
 	    'crtime': 0,
 	    'persist-data': false,
+	    'value-sketch': false,
 	    'value-scope': 'interval',
 	    'nsources': 0
 	};
@@ -2534,7 +2569,12 @@ function caNormalizeProperties(baseuri, scopeid, instnid, props)
 	nprops['id'] = instnid.toString();
 
 	uris = [];
-	if (nprops['value-arity'] == mod_ca.ca_arity_numeric) {
+	if (nprops['value-sketch']) {
+		uris.push({
+		    uri: uri + cfg_http_uri_quantile,
+		    name: 'value_quantile'
+		});
+	} else if (nprops['value-arity'] == mod_ca.ca_arity_numeric) {
 		uris.push({
 		    uri: uri + cfg_http_uri_heatmap_image,
 		    name: 'value_heatmap'
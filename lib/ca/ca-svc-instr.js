@@ -23,6 +23,7 @@ var mod_capred = require('./ca-pred');
 var mod_md = require('./ca-metadata');
 var mod_metric = require('./ca-metric');
 var mod_instr = require('./ca-instr');
+var mod_native = require('ca-native');
 
 function caInstrService(argv, out, backends)
 {
@@ -226,7 +227,7 @@ caInstrService.prototype.tick = function ()
 
 	Object.keys(this.ins_instns).forEach(function (id) {
 		var instn = svc.ins_instns[id];
-		var gwhenms, gevt;
+		var gwhenms, gevt, start;
 
 		if (instn.is_impl.tick)
 			instn.is_impl.tick();
@@ -253,15 +254,22 @@ caInstrService.prototype.tick = function ()
 		    subsecond: gwhenms % 1000
 		};
 
+		/*
+		 * The time each backend takes to compute a value is also
+		 * recorded by phase (see ca-native's phaseRecord()) so that
+		 * the distribution is available from the status command.
+		 */
+		start = mod_native.hrtime();
 		instn.is_impl.value(function (value) {
+			gevt['latency'] = mod_native.phaseRecord(
+			    'value.' + instn.is_backend, start);
+
 			if (value === undefined)
 				svc.ins_log.warn(
 				    'undefined value from instn %s', id);
 
 			svc.ins_cap.sendData(instn.is_inst_key, id, value,
 			    whenms);
-			gevt['latency'] = (new Date().getTime() - gwhenms) *
-			    1000 * 1000;
 			svc.emit('instr_backend_op', { fields: gevt });
 		});
 	});
@@ -300,6 +308,7 @@ caInstrService.prototype.amqpStatus = function (msg)
 	sendmsg.s_status = {
 		instrumentations: sendmsg.s_instrumentations,
 		amqp_cap: this.ins_cap.info(),
+		phases: mod_native.phaseStats(),
 		uptime: new Date().getTime() - this.ins_start
 	};
 
@@ -702,4 +711,12 @@ insBackendInterface.prototype.computeValue = function (bucketizers, decomps,
 	    decomps, datapts));
 };
 
+insBackendInterface.prototype.computeBatch = function (bucketizers, decomps,
+    predicate, points)
+{
+	var svc = this.ibi_svc;
+	return (mod_instr.caInstrComputeBatch(svc.ins_metadata, bucketizers,
+	    decomps, predicate, points));
+};
+
 exports.caInstrService = caInstrService;
@@ -159,6 +159,12 @@ caStashService.prototype.cmdDataDelete = function (msg)
 	});
 };
 
+/*
+ * Binary bucket contents (see ca-persist.js) are exchanged in base64, with the
+ * request or result's "encoding" set to "base64".  That includes the data for
+ * each of the bucket's segments.  A "put" request with "append" set appends a
+ * segment to the bucket rather than replacing its contents.
+ */
 caStashService.prototype.cmdDataGet = function (msg)
 {
 	var svc, stash, tasks;
@@ -167,7 +173,23 @@ caStashService.prototype.cmdDataGet = function (msg)
 	stash = this.ps_stash;
 	tasks = msg.p_requests.map(function (obj) {
 		return (function (callback) {
-			stash.bucketContents(obj['bucket'], callback);
+			stash.bucketContents(obj['bucket'],
+			    function (err, result) {
+				if (!err && Buffer.isBuffer(result['data'])) {
+					result['data'] =
+					    result['data'].toString('base64');
+					result['encoding'] = 'base64';
+				}
+
+				if (!err && result['segments'])
+					result['segments'].forEach(
+					    function (segment) {
+						segment['data'] = segment[
+						    'data'].toString('base64');
+					    });
+
+				callback(err, result);
+			    });
 		});
 	});
 
@@ -185,8 +207,24 @@ caStashService.prototype.cmdDataPut = function (msg)
 	stash = this.ps_stash;
 	tasks = msg.p_requests.map(function (obj) {
 		return (function (callback) {
-			stash.bucketFill(obj['bucket'], obj['metadata'],
-			    obj['data'], callback);
+			var data;
+
+			if (obj['encoding'] === undefined)
+				data = obj['data'];
+			else if (obj['encoding'] == 'base64' &&
+			    typeof (obj['data']) == typeof (''))
+				data = new Buffer(obj['data'], 'base64');
+			else
+				return (callback(new caError(ECA_INVAL, null,
+				    'unsupported encoding for bucket "%s"',
+				    obj['bucket'])));
+
+			if (obj['append'])
+				return (stash.bucketAppend(obj['bucket'],
+				    obj['metadata'], data, callback));
+
+			return (stash.bucketFill(obj['bucket'],
+			    obj['metadata'], data, callback));
 		});
 	});
 
@@ -27,6 +27,14 @@ caTaskSerializer.prototype.task = function (callback)
 	this.start();
 };
 
+/*
+ * Returns true if a task is running or waiting to run.
+ */
+caTaskSerializer.prototype.busy = function ()
+{
+	return (this.cts_pending !== null || this.cts_waiters.length > 0);
+};
+
 /* [private] */
 caTaskSerializer.prototype.start = function ()
 {
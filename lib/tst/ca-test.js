@@ -818,3 +818,10 @@ FakeInstrBackendInterface.prototype.computeValue = function (bucketizers,
 	return (mod_cainstr.caInstrComputeValue(this.fbi_metadata, bucketizers,
 	    decomps, datapts));
 };
+
+FakeInstrBackendInterface.prototype.computeBatch = function (bucketizers,
+    decomps, predicate, points)
+{
+	return (mod_cainstr.caInstrComputeBatch(this.fbi_metadata, bucketizers,
+	    decomps, predicate, points));
+};
@@ -0,0 +1,525 @@
+#!/usr/bin/env node
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright (c) 2014, Joyent, Inc.
+ */
+
+/*
+ * cabench: aggregator benchmark
+ *
+ * Replays synthetic data for a number of hosts and instrumentations through the
+ * same pipeline the aggregator uses: each data message is encoded the way an
+ * instrumenter sends it, batches of raw messages are handed to a native Ingest
+ * (as capAmqpCap's "ingest" hook does), and data that can't be ingested
+ * natively is decoded and added to the dataset the way aggData() does.  This
+ * stands in for the AMQP transport, so no broker is needed.  Meanwhile, a
+ * number of concurrent clients issue value and heatmap requests against the
+ * same datasets using the aggregator's value implementations.
+ *
+ * Instrumentations cycle through scalar, discrete decomposition, heatmap, and
+ * decomposed heatmap data, with values generated by the caDistr generators in
+ * lib/ca/ca-dist.js much like the instrumenter's "fake" backend.  We report
+ * ingest throughput, query latency percentiles, and memory usage, followed by
+ * microbenchmarks of the native kernels (see ca-native's benchmark()).
+ */
+
+var mod_ca = require('../lib/ca/ca-common');
+var mod_agg = require('../lib/ca/ca-agg');
+var mod_dist = require('../lib/ca/ca-dist');
+var mod_instr = require('../lib/ca/ca-instr');
+var mod_native = require('ca-native');
+
+var cbUsageMessage = [
+    'usage: cabench [-j] [-b batchsize] [-h nhosts] [-i ninsts] ' +
+	'[-q nclients]',
+    '               [-s nshards] [-t seconds]',
+    '',
+    '    Measure aggregator throughput and latency with synthetic data.',
+    '',
+    '    -b batchsize    messages per ingest batch (default: 256)',
+    '    -h nhosts       number of simulated hosts (default: 50)',
+    '    -i ninsts       number of instrumentations (default: 20)',
+    '    -j              emit results as JSON',
+    '    -q nclients     number of concurrent query clients (default: 4)',
+    '    -s nshards      number of ingest shards (default: 0)',
+    '    -t seconds      seconds of data to replay (default: 60)'
+].join('\n');
+
+var cbOptions = {
+    b: [ 'batchsize', 256 ],
+    h: [ 'nhosts', 50 ],
+    i: [ 'ninsts', 20 ],
+    q: [ 'nclients', 4 ],
+    s: [ 'nshards', 0 ],
+    t: [ 'seconds', 60 ]
+};
+
+/*
+ * Iterations of each native kernel (see ca-bench.cc).
+ */
+var cbKernels = {
+    add: 100000,
+    bucketize: 1000,
+    render: 100,
+    png: 100
+};
+
+var cbKinds = [ 'scalar', 'decomp', 'heatmap', 'heatmap-decomp' ];
+
+var cbSpecs = {
+    'scalar': {
+	'value-arity': mod_ca.ca_arity_scalar,
+	'value-dimension': 1
+    },
+    'decomp': {
+	'value-arity': mod_ca.ca_arity_discrete,
+	'value-dimension': 2
+    },
+    'heatmap': {
+	'value-arity': mod_ca.ca_arity_numeric,
+	'value-dimension': 2
+    },
+    'heatmap-decomp': {
+	'value-arity': mod_ca.ca_arity_numeric,
+	'value-dimension': 3
+    }
+};
+
+var cbNkeys = 10;		/* distinct decomposition keys */
+var cbNvalues = 16;		/* distinct values per instrumentation */
+var cbQueryWindow = 60;		/* seconds of data per query */
+
+var cbBucketize = mod_instr.caInstrLogLinearBucketize(10, 0, 11, 100);
+var cbConf, cbInsts, cbIngest, cbStats, cbTime, cbDone;
+
+function main(argv)
+{
+	var ii;
+
+	cbConf = parseArgs(argv);
+	cbIngest = new mod_native.Ingest(cbConf['nshards']);
+	cbInsts = [];
+
+	for (ii = 0; ii < cbConf['ninsts']; ii++)
+		cbInsts.push(createInst(ii));
+
+	cbStats = {
+	    nmessages: 0,
+	    nnative: 0,
+	    ndecoded: 0,
+	    maxheap: 0,
+	    maxrss: 0,
+	    queries: { raw: [], heatmap: [] },
+	    nerrors: 0
+	};
+
+	cbTime = Math.floor(new Date().getTime() / 1000) - cbConf['seconds'];
+	cbDone = false;
+	cbStats['start'] = now();
+
+	for (ii = 0; ii < cbConf['nclients']; ii++)
+		query(ii);
+
+	replay(0);
+}
+
+function parseArgs(argv)
+{
+	var conf, opt, key, val, min, ii;
+
+	conf = { json: false };
+
+	for (key in cbOptions)
+		conf[cbOptions[key][0]] = cbOptions[key][1];
+
+	for (ii = 0; ii < argv.length; ii++) {
+		if (argv[ii] == '-j') {
+			conf['json'] = true;
+			continue;
+		}
+
+		opt = argv[ii].charAt(1);
+
+		if (argv[ii].charAt(0) != '-' || !(opt in cbOptions))
+			usage('unknown option: ' + argv[ii]);
+
+		if (++ii >= argv.length)
+			usage('option requires an argument: -' + opt);
+
+		val = parseInt(argv[ii], 10);
+		min = opt == 's' || opt == 'q' ? 0 : 1;
+
+		if (isNaN(val) || val < min)
+			usage('invalid value for -' + opt + ': ' + argv[ii]);
+
+		conf[cbOptions[opt][0]] = val;
+	}
+
+	return (conf);
+}
+
+function usage(err)
+{
+	var msg = '';
+
+	if (err)
+		msg += 'error: ' + err + '\n';
+
+	msg += cbUsageMessage;
+	process.stderr.write(msg + '\n');
+	process.exit(2);
+}
+
+/*
+ * Returns the current time in milliseconds, with sub-millisecond resolution
+ * where it's available.
+ */
+function now()
+{
+	var hrtime;
+
+	if (!process.hrtime)
+		return (new Date().getTime());
+
+	hrtime = process.hrtime();
+	return (hrtime[0] * 1000 + hrtime[1] / 1000000);
+}
+
+/*
+ * Creates the dataset for instrumentation "which" and a set of encoded values
+ * for it.  Values are chosen at random from this set when data is generated so
+ * that generating data doesn't dominate the benchmark.
+ */
+function createInst(which)
+{
+	var kind, spec, inst, targets, ii;
+
+	kind = cbKinds[which % cbKinds.length];
+	spec = mod_ca.caDeepCopy(cbSpecs[kind]);
+	spec['value-scope'] = 'interval';
+	spec['granularity'] = 1;
+	spec['nsources'] = cbConf['nhosts'];
+
+	inst = {
+	    id: 'bench' + which,
+	    kind: kind,
+	    dataset: mod_agg.caDatasetForInstrumentation(spec),
+	    values: []
+	};
+
+	for (ii = 0; ii < cbNvalues; ii++)
+		inst['values'].push(JSON.stringify(generate(kind)));
+
+	if ((targets = inst['dataset'].ingestTargets()) !== undefined)
+		cbIngest.register(inst['id'], targets);
+
+	return (inst);
+}
+
+var cbGenerators = {
+    scalar: new mod_dist.caDistrNormal(300),
+    key: new mod_dist.caDistrUniform(0, cbNkeys - 1),
+    nkeys: new mod_dist.caDistrUniform(1, 5),
+    count: new mod_dist.caDistrMemory(0, 100),
+    npoints: new mod_dist.caDistrNormal(80),
+    latency: new mod_dist.caDistrMulti([
+	{ pp: 0.6, dist: new mod_dist.caDistrUniform(0, 10 * 1000) },
+	{ pp: 0.397, dist: new mod_dist.caDistrNormal(7 * 1000 * 1000) },
+	{ dist: new mod_dist.caDistrNormal(12 * 1000 * 1000) }
+    ])
+};
+
+function generateDist()
+{
+	var npoints, rv, ii;
+
+	rv = [];
+	npoints = cbGenerators['npoints'].value();
+
+	for (ii = 0; ii < npoints; ii++)
+		cbBucketize(rv, cbGenerators['latency'].value(), 1);
+
+	return (rv);
+}
+
+function generate(kind)
+{
+	var rv, nkeys, ii;
+
+	if (kind == 'scalar')
+		return (cbGenerators['scalar'].value());
+
+	if (kind == 'heatmap')
+		return (generateDist());
+
+	rv = {};
+	nkeys = cbGenerators['nkeys'].value();
+
+	for (ii = 0; ii < nkeys; ii++) {
+		rv['key' + cbGenerators['key'].value()] = kind == 'decomp' ?
+		    cbGenerators['count'].value() : generateDist();
+	}
+
+	return (rv);
+}
+
+/*
+ * Returns the raw body of a data message as an instrumenter would send it.
+ */
+function encode(inst, hostname, time)
+{
+	var value;
+
+	value = inst['values'][Math.floor(Math.random() * cbNvalues)];
+
+	return (new Buffer('{"ca_type":"data","ca_subtype":"value",' +
+	    '"ca_id":0,"ca_source":"ca.instrumenter.' + hostname + '",' +
+	    '"ca_hostname":"' + hostname + '","ca_time":' + time * 1000 + ',' +
+	    '"d_inst_id":"' + inst['id'] + '","d_time":' + time * 1000 + ',' +
+	    '"d_value":' + value + '}'));
+}
+
+/*
+ * Replays the data for second "which", one batch at a time, and then moves on
+ * to the next second.
+ */
+function replay(which)
+{
+	var bodies, batches, time, ii, jj;
+
+	sampleMemory();
+
+	if (which == cbConf['seconds']) {
+		finish();
+		return;
+	}
+
+	time = cbTime + which;
+	bodies = [];
+
+	for (ii = 0; ii < cbConf['nhosts']; ii++) {
+		for (jj = 0; jj < cbInsts.length; jj++)
+			bodies.push(encode(cbInsts[jj], 'host' + ii, time));
+	}
+
+	batches = [];
+	for (ii = 0; ii < bodies.length; ii += cbConf['batchsize'])
+		batches.push(bodies.slice(ii, ii + cbConf['batchsize']));
+
+	ingestBatches(batches, function () {
+		setTimeout(replay, 0, which + 1);
+	});
+}
+
+/*
+ * Hands each batch to the Ingest, as the aggregator does when it receives raw
+ * messages, yielding to the event loop between batches.
+ */
+function ingestBatches(batches, callback)
+{
+	var batch, maxtime;
+
+	if (batches.length === 0) {
+		callback();
+		return;
+	}
+
+	batch = batches.shift();
+	maxtime = new Date().getTime() / 1000 + 10;
+
+	cbIngest.ingestAsync(batch, maxtime, function (rv) {
+		var data, ii;
+
+		data = rv['data'];
+
+		for (ii = 0; ii < data.length; ii++)
+			instById(data[ii][0])['dataset'].report(data[ii][1],
+			    data[ii][2]);
+
+		for (ii = 0; ii < rv['rest'].length; ii++)
+			decode(rv['rest'][ii]);
+
+		cbStats['nmessages'] += batch.length;
+		cbStats['nnative'] += batch.length - rv['rest'].length;
+		cbStats['ndecoded'] += rv['rest'].length;
+		setTimeout(ingestBatches, 0, batches, callback);
+	});
+}
+
+function instById(id)
+{
+	return (cbInsts[parseInt(id.substr('bench'.length), 10)]);
+}
+
+/*
+ * Processes a message the Ingest handed back, as aggData() does.
+ */
+function decode(body)
+{
+	var msg;
+
+	msg = JSON.parse(body.toString('utf8'));
+	instById(msg['d_inst_id'])['dataset'].update(msg['ca_hostname'],
+	    parseInt(msg['d_time'] / 1000, 10), msg['d_value']);
+}
+
+function sampleMemory()
+{
+	var usage = process.memoryUsage();
+
+	cbStats['maxheap'] = Math.max(cbStats['maxheap'], usage['heapUsed']);
+	cbStats['maxrss'] = Math.max(cbStats['maxrss'], usage['rss']);
+}
+
+/*
+ * Issues one query for client "client" against a random instrumentation for
+ * the most recent data, then issues another once that one completes.  Heatmap
+ * instrumentations get heatmap image requests (half of them with every key
+ * decomposed); the others get raw value requests.
+ */
+function query(client)
+{
+	var inst, start, duration, request, kind, begin, done;
+
+	if (cbDone)
+		return;
+
+	inst = cbInsts[Math.floor(Math.random() * cbInsts.length)];
+	duration = cbQueryWindow;
+	start = cbTime + Math.max(0, Math.min(cbConf['seconds'],
+	    Math.floor((now() - cbStats['start']) / 1000))) - duration;
+	request = { ca_params: {} };
+	kind = inst['kind'].substr(0, 'heatmap'.length) == 'heatmap' ?
+	    'heatmap' : 'raw';
+	begin = now();
+
+	done = function (err) {
+		if (err)
+			cbStats['nerrors']++;
+
+		cbStats['queries'][kind].push(now() - begin);
+		setTimeout(query, 0, client);
+	};
+
+	if (kind == 'raw') {
+		try {
+			mod_agg.caAggrRawImpl.ai_value(inst['dataset'], start,
+			    duration, xform, request);
+		} catch (ex) {
+			done(ex);
+			return;
+		}
+
+		done();
+		return;
+	}
+
+	if (Math.random() < 0.5)
+		request['ca_params']['decompose_all'] = 'true';
+
+	try {
+		mod_agg.caAggrHeatmapImageImpl.ai_value_async(inst['dataset'],
+		    start, duration, xform, request, done);
+	} catch (ex) {
+		done(ex);
+	}
+}
+
+function xform()
+{
+	return ({});
+}
+
+/*
+ * Returns the given percentiles of "values" (which is sorted in place).
+ */
+function percentiles(values)
+{
+	var rv, pcts, ii;
+
+	rv = { count: values.length };
+	pcts = [ 50, 90, 99, 100 ];
+	values.sort(function (a, b) { return (a - b); });
+
+	for (ii = 0; ii < pcts.length; ii++)
+		rv['p' + pcts[ii]] = values.length === 0 ? 0 :
+		    values[Math.min(values.length - 1,
+		    Math.floor(values.length * pcts[ii] / 100))];
+
+	return (rv);
+}
+
+function finish()
+{
+	var elapsed, results, kernel, rv, key, lat;
+
+	elapsed = now() - cbStats['start'];
+	cbDone = true;
+
+	results = {
+	    config: cbConf,
+	    ingest: {
+		nmessages: cbStats['nmessages'],
+		nnative: cbStats['nnative'],
+		ndecoded: cbStats['ndecoded'],
+		seconds: elapsed / 1000,
+		msgs_per_sec: Math.round(cbStats['nmessages'] /
+		    (elapsed / 1000))
+	    },
+	    queries: {},
+	    query_errors: cbStats['nerrors'],
+	    memory: {
+		max_heap_used: cbStats['maxheap'],
+		max_rss: cbStats['maxrss']
+	    },
+	    kernels: {}
+	};
+
+	for (key in cbStats['queries'])
+		results['queries'][key] = percentiles(cbStats['queries'][key]);
+
+	for (kernel in cbKernels) {
+		rv = mod_native.benchmark(kernel, cbKernels[kernel]);
+		results['kernels'][kernel] = {
+		    iterations: rv['iterations'],
+		    ns_per_op: Math.round(rv['nsec'] / rv['iterations'])
+		};
+	}
+
+	if (cbConf['json']) {
+		console.log(JSON.stringify(results, null, 4));
+		return;
+	}
+
+	console.log('%d hosts x %d instrumentations, %d seconds of data',
+	    cbConf['nhosts'], cbConf['ninsts'], cbConf['seconds']);
+	console.log('ingest: %d messages (%d native) in %ss: %d msgs/s',
+	    results['ingest']['nmessages'], results['ingest']['nnative'],
+	    results['ingest']['seconds'].toFixed(3),
+	    results['ingest']['msgs_per_sec']);
+
+	for (key in results['queries']) {
+		lat = results['queries'][key];
+		console.log('%s queries: %d, latency (ms) p50 %s p90 %s ' +
+		    'p99 %s max %s', key, lat['count'], lat['p50'].toFixed(3),
+		    lat['p90'].toFixed(3), lat['p99'].toFixed(3),
+		    lat['p100'].toFixed(3));
+	}
+
+	console.log('query errors: %d', results['query_errors']);
+	console.log('max heap used: %d KB, max rss: %d KB',
+	    Math.round(results['memory']['max_heap_used'] / 1024),
+	    Math.round(results['memory']['max_rss'] / 1024));
+
+	for (kernel in results['kernels'])
+		console.log('kernel %s: %d ns/op (%d iterations)', kernel,
+		    results['kernels'][kernel]['ns_per_op'],
+		    results['kernels'][kernel]['iterations']);
+}
+
+main(process.argv.slice(2));
@@ -0,0 +1,105 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright (c) 2014, Joyent, Inc.
+ */
+
+/*
+ * Tests the ca-native DataPoints class and computeValue().
+ */
+
+var mod_assert = require('assert');
+var mod_native = require('ca-native');
+
+var layout, points, ii;
+
+layout = new mod_native.DistLayout({ 'type': 'linear', 'step': 10 });
+
+/* bad arguments */
+mod_assert.throws(function () { new mod_native.DataPoints(); });
+mod_assert.throws(function () { new mod_native.DataPoints([ 3 ]); });
+mod_assert.throws(function () { new mod_native.DataPoints([], 'temp'); });
+
+points = new mod_native.DataPoints([ 'host', 'zone' ], [ 'temp' ]);
+mod_assert.equal(points.length(), 0);
+mod_assert.throws(function () { points.load(); });
+mod_assert.throws(function () { points.load([ 3 ]); });
+mod_assert.throws(function () { points.load([ { 'value': 3 } ]); });
+
+mod_assert.throws(function () { mod_native.computeValue(); });
+mod_assert.throws(function () { mod_native.computeValue([], []); });
+mod_assert.throws(function () { mod_native.computeValue(points, 'host'); });
+mod_assert.throws(function () {
+	mod_native.computeValue(points, [ 'junk' ]);
+});
+mod_assert.throws(function () {
+	mod_native.computeValue(points, [ 'temp', 'host' ], layout);
+});
+mod_assert.throws(function () {
+	mod_native.computeValue(points, [ 'temp' ]);
+});
+mod_assert.throws(function () {
+	mod_native.computeValue(points, [ 'temp' ],
+	    new mod_native.DistLayout({ 'type': 'ranges' }));
+});
+
+/* empty batches */
+mod_assert.strictEqual(mod_native.computeValue(points, []), 0);
+mod_assert.deepEqual(mod_native.computeValue(points, [ 'host' ]), {});
+mod_assert.deepEqual(mod_native.computeValue(points, [ 'temp' ], layout), []);
+
+/* loading points only stores the batch's fields */
+points.load([
+    { 'fields': { 'host': 'a', 'zone': 'z1', 'temp': 15, 'x': 1 },
+	'value': 1 },
+    { 'fields': { 'host': 'b', 'zone': 'z1', 'temp': 25 }, 'value': 2 },
+    { 'fields': { 'host': 'a', 'zone': 'z2', 'temp': 12 }, 'value': 4 },
+    { 'fields': { 'host': 'a', 'zone': 'z1', 'temp': 47 }, 'value': 8 }
+]);
+mod_assert.equal(points.length(), 4);
+mod_assert.throws(function () {
+	mod_native.computeValue(points, [ 'x' ]);
+});
+
+mod_assert.strictEqual(mod_native.computeValue(points, []), 15);
+mod_assert.deepEqual(mod_native.computeValue(points, [ 'host' ]),
+    { 'a': 13, 'b': 2 });
+mod_assert.deepEqual(mod_native.computeValue(points, [ 'zone', 'host' ]),
+    { 'z1': { 'a': 9, 'b': 2 }, 'z2': { 'a': 4 } });
+mod_assert.deepEqual(mod_native.computeValue(points, [ 'temp' ], layout),
+    [ [ [ 10, 19 ], 5 ], [ [ 20, 29 ], 2 ], [ [ 40, 49 ], 8 ] ]);
+mod_assert.deepEqual(
+    mod_native.computeValue(points, [ 'host', 'zone', 'temp' ], layout), {
+	'a': {
+	    'z1': [ [ [ 10, 19 ], 1 ], [ [ 40, 49 ], 8 ] ],
+	    'z2': [ [ [ 10, 19 ], 4 ] ]
+	},
+	'b': { 'z1': [ [ [ 20, 29 ], 2 ] ] }
+    });
+
+/* points that can't be bucketized exactly leave it to the caller */
+points.load([ { 'fields': { 'host': 'c', 'zone': 'z3', 'temp': -5 },
+    'value': 1 } ]);
+mod_assert.strictEqual(
+    mod_native.computeValue(points, [ 'host', 'temp' ], layout), undefined);
+mod_assert.deepEqual(mod_native.computeValue(points, [ 'host' ]),
+    { 'a': 13, 'b': 2, 'c': 1 });
+
+points = new mod_native.DataPoints([], [ 'temp' ]);
+points.load([ { 'fields': { 'temp': 5 }, 'value': 0 } ]);
+mod_assert.strictEqual(
+    mod_native.computeValue(points, [ 'temp' ], layout), undefined);
+
+/* points may be loaded in several calls */
+points = new mod_native.DataPoints([ 'host' ]);
+for (ii = 0; ii < 10; ii++) {
+	points.load([ { 'fields': { 'host': 'h' + (ii % 3) }, 'value': ii } ]);
+}
+mod_assert.deepEqual(mod_native.computeValue(points, [ 'host' ]),
+    { 'h0': 18, 'h1': 12, 'h2': 15 });
+
+console.log('test passed');
@@ -0,0 +1,155 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright (c) 2014, Joyent, Inc.
+ */
+
+/*
+ * Tests the ca-native DistLayout and Distribution classes, including
+ * conversion to and from the wire format and merging.
+ */
+
+var mod_assert = require('assert');
+var mod_native = require('ca-native');
+
+var layout, dist, other, series, ii;
+
+/* bad arguments */
+mod_assert.throws(function () { new mod_native.DistLayout(); });
+mod_assert.throws(function () {
+	new mod_native.DistLayout({ 'type': 'junk' });
+});
+mod_assert.throws(function () {
+	new mod_native.DistLayout({ 'type': 'linear', 'step': 0 });
+});
+mod_assert.throws(function () { new mod_native.Distribution({}); });
+
+/* "ranges" layouts learn buckets from the wire format */
+layout = new mod_native.DistLayout({ 'type': 'ranges' });
+dist = new mod_native.Distribution(layout);
+mod_assert.deepEqual(dist.toArray(), []);
+dist.add([ [ [ 10, 19 ], 5 ], [ [ 30, 39 ], 2 ] ]);
+dist.add([ [ [ 0, 9 ], 1 ], [ [ 10, 19 ], 3 ] ]);
+mod_assert.deepEqual(dist.toArray(),
+    [ [ [ 0, 9 ], 1 ], [ [ 10, 19 ], 8 ], [ [ 30, 39 ], 2 ] ]);
+mod_assert.equal(dist.total(), 11);
+mod_assert.throws(function () { dist.add([ [ 10, 19 ] ]); });
+mod_assert.throws(function () { dist.insert(5); });
+
+/* merging distributions with the same layout */
+other = new mod_native.Distribution(layout);
+other.add([ [ [ 20, 29 ], 4 ], [ [ 30, 39 ], 1 ] ]);
+dist.merge(other);
+mod_assert.deepEqual(dist.toArray(), [ [ [ 0, 9 ], 1 ], [ [ 10, 19 ], 8 ],
+    [ [ 20, 29 ], 4 ], [ [ 30, 39 ], 3 ] ]);
+mod_assert.deepEqual(other.toArray(),
+    [ [ [ 20, 29 ], 4 ], [ [ 30, 39 ], 1 ] ]);
+mod_assert.throws(function () {
+	dist.merge(new mod_native.Distribution());
+});
+
+/* linear layouts */
+layout = new mod_native.DistLayout({ 'type': 'linear', 'step': 10 });
+dist = new mod_native.Distribution(layout);
+dist.insert(3);
+dist.insert(17, 2);
+dist.insert(12);
+dist.insert(1000);
+mod_assert.deepEqual(dist.toArray(), [ [ [ 0, 9 ], 1 ], [ [ 10, 19 ], 3 ],
+    [ [ 1000, 1009 ], 1 ] ]);
+dist.add([ [ [ 20, 29 ], 6 ] ]);
+mod_assert.throws(function () { dist.add([ [ [ 20, 24 ], 6 ] ]); });
+
+/* dense and sparse distributions merge either way */
+other = new mod_native.Distribution(layout);
+for (ii = 0; ii < 50; ii++)
+	other.insert(ii * 10);
+dist.merge(other);
+mod_assert.equal(dist.total(), 61);
+other.merge(dist);
+mod_assert.equal(other.total(), 111);
+mod_assert.deepEqual(other.toArray()[1], [ [ 10, 19 ], 5 ]);
+mod_assert.deepEqual(other.toArray()[50], [ [ 1000, 1009 ], 1 ]);
+
+/* log-linear layouts match caInstrLogLinearBucketize() */
+layout = new mod_native.DistLayout({ 'type': 'loglinear', 'base': 10,
+    'min': 3, 'max': 11, 'nbuckets': 100 });
+dist = new mod_native.Distribution(layout);
+dist.insert(500);
+dist.insert(1234);
+dist.insert(1299);
+dist.insert(56789);
+mod_assert.deepEqual(dist.toArray(), [ [ [ 0, 1000 ], 1 ],
+    [ [ 1200, 1290 ], 2 ], [ [ 56000, 56900 ], 1 ] ]);
+
+/* distributions in a TimeSeries */
+series = new mod_native.TimeSeries('dist', 1, 8);
+mod_assert.deepEqual(series.value(100, 1), []);
+series.add(100, [ [ [ 10, 19 ], 5 ] ]);
+series.add(100, [ [ [ 0, 9 ], 1 ] ]);
+series.add(102, [ [ [ 10, 19 ], 2 ] ]);
+mod_assert.deepEqual(series.value(100, 3),
+    [ [ [ 0, 9 ], 1 ], [ [ 10, 19 ], 7 ] ]);
+mod_assert.deepEqual(series.byTime(), {
+	100: [ [ [ 0, 9 ], 1 ], [ [ 10, 19 ], 5 ] ],
+	102: [ [ [ 10, 19 ], 2 ] ]
+});
+mod_assert.deepEqual(series.byTime(101, 5), {
+	102: [ [ [ 10, 19 ], 2 ] ]
+});
+for (ii = 0; ii < 10; ii++)
+	series.add(110 + ii, [ [ [ 0, 9 ], ii ] ]);
+mod_assert.deepEqual(series.value(100, 3),
+    [ [ [ 0, 9 ], 1 ], [ [ 10, 19 ], 7 ] ]);
+series.expire(110);
+mod_assert.deepEqual(series.value(100, 100), [ [ [ 0, 9 ], 45 ] ]);
+
+/*
+ * Sums over an interval come from running totals.  Check them against the sum
+ * of the individual values, including after out-of-order updates and
+ * expiration.
+ */
+function sumByTime(bytime)
+{
+	var sum = {}, time, jj, key;
+
+	for (time in bytime) {
+		for (jj = 0; jj < bytime[time].length; jj++) {
+			key = bytime[time][jj][0].join(',');
+			sum[key] = (sum[key] || 0) + bytime[time][jj][1];
+		}
+	}
+
+	return (sum);
+}
+
+function checkSums(ts, start, duration)
+{
+	var expected, actual, value, jj;
+
+	expected = sumByTime(ts.byTime(start, duration));
+	value = ts.value(start, duration);
+	actual = {};
+	for (jj = 0; jj < value.length; jj++)
+		actual[value[jj][0].join(',')] = value[jj][1];
+
+	mod_assert.deepEqual(actual, expected);
+}
+
+series = new mod_native.TimeSeries('dist', 2, 8);
+for (ii = 0; ii < 200; ii++) {
+	series.add(1000 + ((ii * 37) % 101) * 2,
+	    [ [ [ (ii % 7) * 10, (ii % 7) * 10 + 9 ], ii % 5 + 1 ] ]);
+
+	if (ii % 25 === 0)
+		series.expire(1000 + ii);
+
+	checkSums(series, 0, 10000);
+	checkSums(series, 1000 + ii, 20);
+	checkSums(series, 1101, 51);
+	checkSums(series, 1150, 0);
+}
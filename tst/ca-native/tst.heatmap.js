@@ -0,0 +1,106 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright (c) 2014, Joyent, Inc.
+ */
+
+/*
+ * Tests the ca-native HeatmapDecomp class, particularly the per-key views and
+ * recycling of keys as data expires.
+ */
+
+var mod_assert = require('assert');
+var mod_native = require('ca-native');
+
+var hd, ii, datum;
+
+/* bad arguments */
+mod_assert.throws(function () { new mod_native.HeatmapDecomp(); });
+mod_assert.throws(function () { new mod_native.HeatmapDecomp(0, 10); });
+
+hd = new mod_native.HeatmapDecomp(1, 32);
+mod_assert.deepEqual(hd.value(100, 10), {});
+mod_assert.deepEqual(hd.keys(100, 10), []);
+mod_assert.deepEqual(hd.total(), {});
+mod_assert.deepEqual(hd.byKey('abe'), {});
+mod_assert.throws(function () { hd.add(100, 5); });
+mod_assert.throws(function () { hd.add(100, { abe: 5 }); });
+
+hd.add(100, {
+    abe: [ [ [ 10, 19 ], 5 ] ],
+    jasper: [ [ [ 0, 9 ], 1 ], [ [ 10, 19 ], 2 ] ]
+});
+hd.add(100, { abe: [ [ [ 0, 9 ], 3 ] ] });
+hd.add(101, { molloy: [ [ [ 20, 29 ], 4 ] ] });
+hd.add(103, { abe: [ [ [ 10, 19 ], 1 ] ] });
+
+mod_assert.deepEqual(hd.keys(100, 1).sort(), [ 'abe', 'jasper' ]);
+mod_assert.deepEqual(hd.keys(101, 3).sort(), [ 'abe', 'molloy' ]);
+mod_assert.deepEqual(hd.value(100, 4), {
+    abe: [ [ [ 0, 9 ], 3 ], [ [ 10, 19 ], 6 ] ],
+    jasper: [ [ [ 0, 9 ], 1 ], [ [ 10, 19 ], 2 ] ],
+    molloy: [ [ [ 20, 29 ], 4 ] ]
+});
+mod_assert.deepEqual(hd.byKey('abe'), {
+    100: [ [ [ 0, 9 ], 3 ], [ [ 10, 19 ], 5 ] ],
+    103: [ [ [ 10, 19 ], 1 ] ]
+});
+mod_assert.deepEqual(hd.byKey('abe', 101, 5), {
+    103: [ [ [ 10, 19 ], 1 ] ]
+});
+mod_assert.deepEqual(hd.total(100, 2), {
+    100: [ [ [ 0, 9 ], 4 ], [ [ 10, 19 ], 7 ] ],
+    101: [ [ [ 20, 29 ], 4 ] ]
+});
+
+/* expiration removes per-key data and recycles keys */
+hd.expire(101);
+mod_assert.deepEqual(hd.byKey('jasper'), {});
+mod_assert.deepEqual(hd.byKey('abe'), { 103: [ [ [ 10, 19 ], 1 ] ] });
+hd.add(104, { selma: [ [ [ 0, 9 ], 2 ] ] });
+mod_assert.deepEqual(hd.keys(0, 1000).sort(), [ 'abe', 'molloy', 'selma' ]);
+hd.expire(105);
+mod_assert.deepEqual(hd.keys(0, 1000), []);
+mod_assert.deepEqual(hd.total(), {});
+
+/* many keys and out-of-order data survive growth */
+for (ii = 0; ii < 100; ii++) {
+	datum = {};
+	datum['key' + ii] = [ [ [ 0, 9 ], 1 ] ];
+	datum['key' + (ii + 1)] = [ [ [ 10, 19 ], 1 ] ];
+	hd.add(300 - ii, datum);
+}
+mod_assert.equal(hd.keys(0, 1000).length, 101);
+mod_assert.deepEqual(hd.byKey('key50'), {
+    250: [ [ [ 0, 9 ], 1 ] ],
+    251: [ [ [ 10, 19 ], 1 ] ]
+});
+mod_assert.deepEqual(hd.value(201, 100)['key1'],
+    [ [ [ 0, 9 ], 1 ], [ [ 10, 19 ], 1 ] ]);
+hd.expire(251);
+mod_assert.equal(hd.keys(0, 1000).length, 51);
+mod_assert.deepEqual(hd.byKey('key50'), { 251: [ [ [ 10, 19 ], 1 ] ] });
+
+/* stale data is refused rather than growing the ring */
+hd.add(0, { stale: [ [ [ 0, 9 ], 1 ] ] });
+hd.add(100, { stale: [ [ [ 0, 9 ], 1 ] ] });
+mod_assert.deepEqual(hd.byKey('stale'), {});
+hd.add(100000, { fresh: [ [ [ 0, 9 ], 1 ] ] });
+mod_assert.deepEqual(hd.keys(0, 1000000), [ 'fresh' ]);
+
+/* totalValue() sums over all keys and times in the interval */
+hd = new mod_native.HeatmapDecomp(1, 8);
+hd.add(100, { abe: [ [ [ 0, 9 ], 3 ] ], jasper: [ [ [ 10, 19 ], 2 ] ] });
+hd.add(103, { abe: [ [ [ 10, 19 ], 1 ] ] });
+hd.add(101, { molloy: [ [ [ 0, 9 ], 4 ] ] });
+mod_assert.deepEqual(hd.totalValue(100, 4),
+    [ [ [ 0, 9 ], 7 ], [ [ 10, 19 ], 3 ] ]);
+mod_assert.deepEqual(hd.totalValue(101, 2), [ [ [ 0, 9 ], 4 ] ]);
+mod_assert.deepEqual(hd.totalValue(104, 10), []);
+hd.expire(101);
+mod_assert.deepEqual(hd.totalValue(0, 1000),
+    [ [ [ 0, 9 ], 4 ], [ [ 10, 19 ], 1 ] ]);
@@ -0,0 +1,218 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright (c) 2014, Joyent, Inc.
+ */
+
+/*
+ * Tests native ingest of raw data messages by comparing datasets populated by
+ * an Ingest with datasets populated with add().
+ */
+
+var mod_assert = require('assert');
+var mod_native = require('ca-native');
+
+var ingest, kinds, native, js, rv, values, bodies, key, ii;
+
+function message(id, hostname, time, value)
+{
+	return (new Buffer(JSON.stringify({
+	    ca_type: 'data',
+	    ca_source: 'ca.instrumenter.' + hostname,
+	    ca_hostname: hostname,
+	    ca_time: new Date(time),
+	    d_inst_id: id,
+	    d_value: value,
+	    d_time: time
+	})));
+}
+
+/* bad arguments */
+ingest = new mod_native.Ingest();
+mod_assert.throws(function () { ingest.register('1', {}); });
+mod_assert.throws(function () { ingest.ingest([ 'junk' ], 0); });
+mod_assert.throws(function () { ingest.ingest([]); });
+
+/*
+ * For each kind of dataset, ingest some values natively and add the same values
+ * to another dataset with add().  The results must be identical.
+ */
+kinds = {
+    scalar: [ 5, 7.5, 0 ],
+    decomp: [ { a: 1, b: 2 }, { b: 3, 'cé\n': 4 }, {} ],
+    dist: [ [ [ [ 0, 9 ], 3 ], [ [ 10, 19 ], 4 ] ], [ [ [ 10, 19 ], 1 ] ],
+	[] ],
+    sketch: [ [ [ [ 1, 9 ], 30 ], [ [ 100, 199 ], 4 ] ], [] ],
+    heatmap: [ { a: [ [ [ 0, 9 ], 3 ] ], b: [] },
+	{ a: [ [ [ 0, 9 ], 1 ], [ [ 20, 29 ], 2 ] ], c: [ [ [ 5, 5 ], 1 ] ] },
+	{} ]
+};
+
+for (key in kinds) {
+	if (key == 'heatmap') {
+		native = new mod_native.HeatmapDecomp(1, 10);
+		js = new mod_native.HeatmapDecomp(1, 10);
+	} else {
+		native = new mod_native.TimeSeries(key, 1, 10);
+		js = new mod_native.TimeSeries(key, 1, 10);
+	}
+
+	ingest.register(key, native);
+	values = kinds[key];
+	bodies = [];
+
+	for (ii = 0; ii < values.length; ii++) {
+		bodies.push(message(key, 'host' + (ii % 2), 12345678 + ii * 10,
+		    values[ii]));
+		js.add(12345, values[ii]);
+	}
+
+	rv = ingest.ingest(bodies, 20000);
+	mod_assert.deepEqual(rv['rest'], []);
+	mod_assert.deepEqual(rv['data'],
+	    [ [ key, 'host0', 12345 ], [ key, 'host1', 12345 ] ]);
+	mod_assert.deepEqual(native.value(12345, 1), js.value(12345, 1));
+
+	if (key == 'heatmap') {
+		mod_assert.deepEqual(native.keys(12345, 1), js.keys(12345, 1));
+		mod_assert.deepEqual(native.totalValue(12345, 1),
+		    js.totalValue(12345, 1));
+	}
+}
+
+mod_assert.deepEqual(ingest.stats(), {
+    ntargets: 5,
+    nmessages: 14,
+    ningested: 14,
+    nrest: 0,
+    nshards: 0,
+    nbatches: 0,
+    pending: 0
+});
+
+/*
+ * Messages that can't be ingested natively are returned untouched, and their
+ * datasets are unchanged.
+ */
+native = new mod_native.TimeSeries('scalar', 1, 10);
+ingest.register('scalar', native);
+bodies = [
+    message('scalar', 'host0', 5000, 3),
+    message('unknown', 'host0', 5000, 3),
+    message('scalar', 'host0', 25000, 3),
+    message('scalar', 'host0', 5000, { a: 1 }),
+    message('scalar', 'host0', 5000, null),
+    message('scalar', 'host0', 5000, '3'),
+    new Buffer(JSON.stringify({ ca_type: 'cmd', ca_subtype: 'ping' })),
+    new Buffer('{ "ca_type": "data", "d_inst_id": "scalar", "ca_hostname": ' +
+	'"host0", "d_time": 5000, "d_value": 3'),
+    new Buffer('{ "ca_type": "data", "d_inst_id": "scalar", "ca_hostname": ' +
+	'"host0", "d_time": 5000 }'),
+    new Buffer('{ "ca_type": "data", "d_inst_id": "scalar", "ca_hostname": ' +
+	'"host0", "d_time": 5000, "d_value": 3 } junk'),
+    new Buffer('{ "d_value" : 4, "d_time": 5999, "ca_hostname": "host1",' +
+	'"junk": [ { "a": [ null, true, false, "\\"\\u00e9" ] } ],' +
+	'"d_inst_id": "scalar", "ca_type": "data" }'),
+    message('scalar', 'host0', 5000, 5)
+];
+
+rv = ingest.ingest(bodies, 20);
+mod_assert.deepEqual(rv['data'],
+    [ [ 'scalar', 'host0', 5 ], [ 'scalar', 'host1', 5 ] ]);
+mod_assert.equal(rv['rest'].length, bodies.length - 3);
+for (ii = 0; ii < rv['rest'].length; ii++)
+	mod_assert.ok(rv['rest'][ii] === bodies[ii + 1]);
+mod_assert.equal(native.value(5, 1), 12);
+
+/* values are added to every dataset registered for an instrumentation */
+native = [ new mod_native.TimeSeries('scalar', 1, 10),
+    new mod_native.TimeSeries('scalar', 10, 10) ];
+ingest.register('tiers', native);
+rv = ingest.ingest([ message('tiers', 'host0', 5000, 3),
+    message('tiers', 'host0', 9000, 4) ], 20);
+mod_assert.equal(rv['rest'].length, 0);
+mod_assert.equal(native[0].value(5, 1), 3);
+mod_assert.equal(native[0].value(9, 1), 4);
+mod_assert.equal(native[1].value(0, 10), 7);
+mod_assert.throws(function () { ingest.register('tiers', []); });
+mod_assert.throws(function () { ingest.register('tiers', [ {} ]); });
+ingest.unregister('tiers');
+
+/* unregistered instrumentations are no longer ingested */
+ingest.unregister('scalar');
+rv = ingest.ingest([ message('scalar', 'host0', 5000, 3) ], 20);
+mod_assert.equal(rv['data'].length, 0);
+mod_assert.equal(rv['rest'].length, 1);
+
+mod_assert.throws(function () { ingest.ingestAsync([], 20); });
+mod_assert.throws(function () { ingest.ingestAsync([ 'junk' ], 20,
+    function () {}); });
+mod_assert.throws(function () { new mod_native.Ingest(-1); });
+
+/*
+ * Without shards, ingestAsync() completes immediately with the same results as
+ * ingest().
+ */
+native = new mod_native.TimeSeries('scalar', 1, 10);
+ingest.register('scalar', native);
+values = [];
+ingest.ingestAsync([ message('scalar', 'host0', 5000, 3) ], 20,
+    function (result) { values.push(result); });
+mod_assert.equal(values.length, 1);
+mod_assert.deepEqual(values[0]['data'], [ [ 'scalar', 'host0', 5 ] ]);
+mod_assert.equal(values[0]['rest'].length, 0);
+mod_assert.equal(native.value(5, 1), 3);
+
+/*
+ * With shards, large batches are parsed on other threads.  Batches complete in
+ * order and have the same effect as if they'd been ingested synchronously.
+ */
+ingest = new mod_native.Ingest(3);
+native = new mod_native.TimeSeries('scalar', 1, 10);
+js = new mod_native.TimeSeries('scalar', 1, 10);
+ingest.register('scalar', native);
+mod_assert.equal(ingest.stats()['nshards'], 3);
+
+values = [];
+kinds = [ 1000, 5, 300 ];
+for (ii = 0; ii < kinds.length; ii++) {
+	bodies = [];
+	for (key = 0; key < kinds[ii]; key++) {
+		bodies.push(message('scalar', 'host' + (key % 7),
+		    (key % 4) * 1000, key));
+		js.add(key % 4, key);
+	}
+
+	bodies.push(new Buffer('junk'));
+	ingest.ingestAsync(bodies, 20, function (result) {
+		values.push(result);
+	});
+}
+
+mod_assert.ok(ingest.stats()['nbatches'] > 0);
+
+process.on('exit', function () {
+	var stats, t;
+
+	mod_assert.equal(values.length, kinds.length);
+
+	for (ii = 0; ii < kinds.length; ii++) {
+		mod_assert.equal(values[ii]['rest'].length, 1);
+		mod_assert.equal(values[ii]['rest'][0].toString(), 'junk');
+		mod_assert.equal(values[ii]['data'].length,
+		    Math.min(kinds[ii], 28));
+	}
+
+	for (t = 0; t < 4; t++)
+		mod_assert.equal(native.value(t, 1), js.value(t, 1));
+
+	stats = ingest.stats();
+	mod_assert.equal(stats['pending'], 0);
+	mod_assert.equal(stats['ningested'], 1305);
+	mod_assert.equal(stats['nrest'], 3);
+	console.log('test passed');
+});
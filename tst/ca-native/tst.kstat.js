@@ -0,0 +1,158 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright (c) 2014, Joyent, Inc.
+ */
+
+/*
+ * Tests the ca-native KstatDiff class and the DataPoints batches it returns.
+ */
+
+var mod_assert = require('assert');
+var mod_native = require('ca-native');
+
+var fields, diff, points;
+
+function kstat(instance, name, snaptime, data)
+{
+	return ({
+	    module: 'sd',
+	    instance: instance,
+	    class: 'disk',
+	    name: name,
+	    snaptime: snaptime,
+	    data: data
+	});
+}
+
+function sorted(points)
+{
+	return (points.toArray().sort(function (a, b) {
+		a = JSON.stringify(a);
+		b = JSON.stringify(b);
+		return (a < b ? -1 : a > b ? 1 : 0);
+	}));
+}
+
+/* bad arguments */
+mod_assert.throws(function () { new mod_native.KstatDiff(); });
+mod_assert.throws(function () {
+	new mod_native.KstatDiff([], { type: 'junk' });
+});
+mod_assert.throws(function () {
+	new mod_native.KstatDiff([ { name: 'a', type: 'junk' } ],
+	    { type: 'constant', value: 1 });
+});
+mod_assert.throws(function () {
+	new mod_native.KstatDiff([ { name: 'a', type: 'ident',
+	    member: 'data' } ], { type: 'constant', value: 1 });
+});
+mod_assert.throws(function () {
+	new mod_native.KstatDiff([ { name: 'a', type: 'delta', stats: [] } ],
+	    { type: 'constant', value: 1 });
+});
+mod_assert.throws(function () {
+	new mod_native.KstatDiff([ { name: 'a', type: 'ident',
+	    member: 'name' } ], { type: 'delta', field: 'a',
+	    stats: { sd0: 'reads' } });
+});
+mod_assert.throws(function () {
+	new mod_native.KstatDiff([ { name: 'op', type: 'constant',
+	    values: [ 'read', 'write' ] } ], { type: 'delta', field: 'op',
+	    stats: { read: 'reads' } });
+});
+
+/*
+ * A metric like disk.disks: one point per kstat with numeric fields computed
+ * from the deltas between snapshots.
+ */
+fields = [
+    { name: 'hostname', type: 'constant', values: [ 'host' ] },
+    { name: 'disk', type: 'ident', member: 'name' },
+    { name: 'iops', type: 'delta', stats: [ 'reads', 'writes' ] },
+    { name: 'busytime', type: 'percent', stats: [ 'rtime' ] }
+];
+diff = new mod_native.KstatDiff(fields, { type: 'constant', value: 1 });
+
+mod_assert.ok(diff.update([
+    kstat(0, 'sd0', 1000, { reads: 10, writes: 5, rtime: 0 }),
+    kstat(1, 'sd1', 1000, { reads: 0, writes: 0, rtime: 100 })
+]) === undefined);
+
+points = diff.update([
+    kstat(0, 'sd0', 2000, { reads: 13, writes: 9, rtime: 500 }),
+    kstat(1, 'sd1', 3000, { reads: 1, writes: 0, rtime: 2099 }),
+    { error: 'bad kstat' },
+    3
+]);
+mod_assert.deepEqual(points.fields(),
+    { discrete: [ 'hostname', 'disk' ], numeric: [ 'iops', 'busytime' ] });
+mod_assert.equal(points.length(), 2);
+mod_assert.deepEqual(sorted(points), [
+    { fields: { hostname: 'host', disk: 'sd0', iops: 7, busytime: 50 },
+	value: 1 },
+    { fields: { hostname: 'host', disk: 'sd1', iops: 1, busytime: 99 },
+	value: 1 }
+]);
+
+/* new kstats only show up once they've been seen twice */
+points = diff.update([
+    kstat(2, 'sd2', 2000, { reads: 0, writes: 0, rtime: 0 }),
+    kstat(0, 'sd0', 3000, { reads: 13, writes: 9, rtime: 500 })
+]);
+mod_assert.deepEqual(sorted(points), [
+    { fields: { hostname: 'host', disk: 'sd0', iops: 0, busytime: 0 },
+	value: 1 }
+]);
+
+/* kstats that disappear start over if they come back */
+points = diff.update([
+    kstat(1, 'sd1', 4000, { reads: 5, writes: 0, rtime: 2099 }),
+    kstat(2, 'sd2', 3000, { reads: 2, writes: 2, rtime: 1000 })
+]);
+mod_assert.deepEqual(sorted(points), [
+    { fields: { hostname: 'host', disk: 'sd2', iops: 4, busytime: 100 },
+	value: 1 }
+]);
+
+/* filtering a batch keeps the points whose bits are set */
+points.filter(new Buffer([ 0 ]));
+mod_assert.equal(points.length(), 0);
+mod_assert.deepEqual(points.toArray(), []);
+
+/*
+ * A metric like disk.physio_ops: a point for each value of the constant field,
+ * whose value is the delta of the statistic for that value.  Kstats may be
+ * passed as an object, and the last of any duplicates wins.
+ */
+fields = [
+    { name: 'zonename', type: 'stat', stat: 'zonename' },
+    { name: 'optype', type: 'constant', values: [ 'read', 'write' ] }
+];
+diff = new mod_native.KstatDiff(fields, { type: 'delta', field: 'optype',
+    stats: { read: 'reads', write: 'writes' } });
+
+mod_assert.ok(diff.update({
+    a: kstat(0, 'sd0', 1000, { zonename: 'z0', reads: 1, writes: 2 })
+}) === undefined);
+
+points = diff.update({
+    a: kstat(0, 'sd0', 2000, { zonename: 'z0', reads: 100, writes: 100 }),
+    b: kstat(0, 'sd0', 2000, { zonename: 'z0', reads: 5, writes: 7 })
+});
+mod_assert.deepEqual(points.fields(),
+    { discrete: [ 'zonename', 'optype' ], numeric: [] });
+mod_assert.deepEqual(sorted(points), [
+    { fields: { zonename: 'z0', optype: 'read' }, value: 4 },
+    { fields: { zonename: 'z0', optype: 'write' }, value: 5 }
+]);
+
+/* the same batch is returned each time */
+mod_assert.ok(diff.update([]) === points);
+mod_assert.equal(points.length(), 0);
+
+console.log('test passed');
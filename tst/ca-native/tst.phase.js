@@ -0,0 +1,81 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright (c) 2014, Joyent, Inc.
+ */
+
+/*
+ * Tests phase latency histograms.
+ */
+
+var mod_assert = require('assert');
+var mod_native = require('ca-native');
+
+var stats, phase, start, prev, elapsed, sum, ii;
+
+/* the native phases exist from the start */
+stats = mod_native.phaseStats();
+[ 'ingest.parse', 'dataset.update', 'heatmap.bucketize', 'heatmap.render',
+    'png.encode', 'stash.encode', 'instr.compute', 'proc.scan',
+    'kstat.diff' ].forEach(function (name) {
+	mod_assert.ok(name in stats);
+	mod_assert.equal(stats[name]['count'], 0);
+	mod_assert.deepEqual(stats[name]['histogram'], []);
+});
+
+mod_assert.ok(!('test.phase' in stats));
+
+/* hrtime() is monotonic */
+prev = mod_native.hrtime();
+for (ii = 0; ii < 1000; ii++) {
+	start = mod_native.hrtime();
+	mod_assert.ok(start >= prev);
+	prev = start;
+}
+
+/* bad arguments */
+mod_assert.throws(function () { mod_native.phaseRecord(); });
+mod_assert.throws(function () { mod_native.phaseRecord('test.phase'); });
+mod_assert.throws(function () { mod_native.phaseRecord(3, 0); });
+mod_assert.throws(function () {
+	mod_native.phaseRecord('test.phase', 0, 'three');
+});
+mod_assert.throws(function () {
+	mod_native.phaseRecord('test.phase', mod_native.hrtime() + 1e12);
+});
+mod_assert.ok(!('test.phase' in mod_native.phaseStats()));
+
+/* recording a phase */
+start = mod_native.hrtime();
+elapsed = mod_native.phaseRecord('test.phase', start);
+mod_assert.ok(elapsed >= 0);
+elapsed += mod_native.phaseRecord('test.phase', start, 10);
+
+phase = mod_native.phaseStats()['test.phase'];
+mod_assert.equal(phase['count'], 11);
+mod_assert.equal(phase['total'], elapsed);
+mod_assert.ok(phase['max'] <= elapsed);
+mod_assert.ok(phase['p50'] <= phase['p90']);
+mod_assert.ok(phase['p90'] <= phase['p99']);
+mod_assert.ok(phase['p99'] <= phase['max']);
+
+sum = 0;
+phase['histogram'].forEach(function (entry) {
+	mod_assert.ok(entry[0][0] <= entry[0][1]);
+	mod_assert.ok(entry[1] > 0);
+	sum += entry[1];
+});
+mod_assert.equal(sum, 11);
+
+/* native phases are recorded as they happen */
+mod_native.pngEncodeBase64(new Buffer(3 * 16 * 16), 16, 16);
+phase = mod_native.phaseStats()['png.encode'];
+mod_assert.equal(phase['count'], 1);
+mod_assert.ok(phase['total'] > 0);
+mod_assert.equal(phase['max'], phase['total']);
+
+console.log('test passed');
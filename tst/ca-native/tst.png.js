@@ -0,0 +1,199 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright (c) 2014, Joyent, Inc.
+ */
+
+/*
+ * Tests native PNG encoding by decoding the resulting images and comparing
+ * them with the original pixels.
+ */
+
+var mod_assert = require('assert');
+var mod_zlib = require('zlib');
+var mod_native = require('ca-native');
+
+var few, many, ii, pending;
+
+/*
+ * Undoes the PNG row filter of the given type in place.
+ */
+function unfilter(type, row, prev, bpp)
+{
+	var ii, left, up, upleft, pa, pb, pc, pred;
+
+	for (ii = 0; ii < row.length; ii++) {
+		left = ii >= bpp ? row[ii - bpp] : 0;
+		up = prev ? prev[ii] : 0;
+		upleft = ii >= bpp && prev ? prev[ii - bpp] : 0;
+
+		switch (type) {
+		case 0:
+			pred = 0;
+			break;
+		case 1:
+			pred = left;
+			break;
+		case 2:
+			pred = up;
+			break;
+		case 3:
+			pred = (left + up) >> 1;
+			break;
+		case 4:
+			pred = left + up - upleft;
+			pa = Math.abs(pred - left);
+			pb = Math.abs(pred - up);
+			pc = Math.abs(pred - upleft);
+			if (pa <= pb && pa <= pc)
+				pred = left;
+			else if (pb <= pc)
+				pred = up;
+			else
+				pred = upleft;
+			break;
+		default:
+			throw (new Error('bad filter type ' + type));
+		}
+
+		row[ii] = (row[ii] + pred) & 0xff;
+	}
+}
+
+/*
+ * Decodes the base64 PNG in "text" and checks that it has the expected color
+ * type, filters, and pixels.
+ */
+function check(text, pixels, width, height, colortype, filtered, callback)
+{
+	var png, off, len, type, ihdr, palette, idat, chunks;
+
+	png = new Buffer(text, 'base64');
+	mod_assert.equal(png.toString('base64'), text);
+	mod_assert.equal(png.slice(0, 8).toString('binary'),
+	    '\x89PNG\r\n\x1a\n');
+
+	chunks = [];
+	idat = [];
+	off = 8;
+
+	while (off < png.length) {
+		len = png.readUInt32BE(off);
+		type = png.slice(off + 4, off + 8).toString('binary');
+		chunks.push(type);
+
+		if (type == 'IHDR')
+			ihdr = png.slice(off + 8, off + 8 + len);
+		else if (type == 'PLTE')
+			palette = png.slice(off + 8, off + 8 + len);
+		else if (type == 'IDAT')
+			idat.push(png.slice(off + 8, off + 8 + len));
+
+		off += len + 12;
+	}
+
+	mod_assert.equal(off, png.length);
+	mod_assert.deepEqual(chunks, colortype == 3 ?
+	    [ 'IHDR', 'PLTE', 'IDAT', 'IEND' ] : [ 'IHDR', 'IDAT', 'IEND' ]);
+	mod_assert.equal(ihdr.readUInt32BE(0), width);
+	mod_assert.equal(ihdr.readUInt32BE(4), height);
+	mod_assert.equal(ihdr[8], 8);
+	mod_assert.equal(ihdr[9], colortype);
+
+	mod_zlib.inflate(Buffer.concat(idat), function (err, raw) {
+		var bpp, rowlen, yy, xx, row, prev, pixel, nfiltered;
+
+		mod_assert.ok(!err);
+		bpp = colortype == 3 ? 1 : 3;
+		rowlen = width * bpp;
+		mod_assert.equal(raw.length, height * (rowlen + 1));
+
+		prev = null;
+		nfiltered = 0;
+
+		for (yy = 0; yy < height; yy++) {
+			row = raw.slice(yy * (rowlen + 1) + 1,
+			    (yy + 1) * (rowlen + 1));
+			if (raw[yy * (rowlen + 1)] !== 0)
+				nfiltered++;
+			unfilter(raw[yy * (rowlen + 1)], row, prev, bpp);
+			prev = row;
+
+			for (xx = 0; xx < width; xx++) {
+				pixel = colortype == 3 ? palette.slice(
+				    row[xx] * 3, row[xx] * 3 + 3) :
+				    row.slice(xx * 3, xx * 3 + 3);
+				mod_assert.deepEqual(Array.prototype.slice.call(
+				    pixel), Array.prototype.slice.call(
+				    pixels.slice((yy * width + xx) * 3,
+				    (yy * width + xx + 1) * 3)));
+			}
+		}
+
+		if (filtered)
+			mod_assert.ok(nfiltered > 0);
+		else
+			mod_assert.equal(nfiltered, 0);
+
+		callback();
+	});
+}
+
+function done()
+{
+	if (--pending === 0)
+		console.log('test passed');
+}
+
+/* bad arguments */
+mod_assert.throws(function () { mod_native.pngEncodeBase64(); });
+mod_assert.throws(function () {
+	mod_native.pngEncodeBase64('junk', 1, 1);
+});
+mod_assert.throws(function () {
+	mod_native.pngEncodeBase64(new Buffer(6), 1, 1);
+});
+mod_assert.throws(function () {
+	mod_native.pngEncodeBase64(new Buffer(0), 0, 0);
+});
+mod_assert.throws(function () {
+	mod_native.pngEncodeBase64(new Buffer(3), 1, 1, { 'level': 10 });
+});
+mod_assert.throws(function () {
+	mod_native.pngEncodeBase64(new Buffer(3), 1, 1, { 'filter': 'junk' });
+});
+
+/* a few colors: indexed */
+few = new Buffer(17 * 11 * 3);
+for (ii = 0; ii < 17 * 11; ii++) {
+	few[ii * 3] = (ii % 5) * 50;
+	few[ii * 3 + 1] = 20;
+	few[ii * 3 + 2] = Math.floor(ii / 17) * 20;
+}
+
+/* more than 256 colors: truecolor */
+many = new Buffer(40 * 30 * 3);
+for (ii = 0; ii < 40 * 30; ii++) {
+	many[ii * 3] = ii % 40;
+	many[ii * 3 + 1] = Math.floor(ii / 40) * 7;
+	many[ii * 3 + 2] = (ii * 13) & 0xff;
+}
+
+pending = 7;
+
+check(mod_native.pngEncodeBase64(few, 17, 11), few, 17, 11, 3, false, done);
+check(mod_native.pngEncodeBase64(few, 17, 11, { 'filter': 'adaptive' }),
+    few, 17, 11, 3, true, done);
+check(mod_native.pngEncodeBase64(few, 17, 11, { 'level': 0 }),
+    few, 17, 11, 3, false, done);
+check(mod_native.pngEncodeBase64(many, 40, 30), many, 40, 30, 2, true, done);
+check(mod_native.pngEncodeBase64(many, 40, 30, { 'filter': 'none' }),
+    many, 40, 30, 2, false, done);
+check(mod_native.pngEncodeBase64(many, 40, 30, { 'level': 9 }),
+    many, 40, 30, 2, true, done);
+check(mod_native.pngEncodeBase64(new Buffer([ 1, 2, 3 ]), 1, 1),
+    new Buffer([ 1, 2, 3 ]), 1, 1, 3, false, done);
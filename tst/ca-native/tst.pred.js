@@ -0,0 +1,97 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright (c) 2014, Joyent, Inc.
+ */
+
+/*
+ * Tests the ca-native Predicate class.
+ */
+
+var mod_assert = require('assert');
+var mod_native = require('ca-native');
+
+var points, pred, ii;
+
+/*
+ * Returns the indices of the points selected by "pred".
+ */
+function selected(pred, batch)
+{
+	var bits, rv, jj;
+
+	bits = pred.select(batch);
+	mod_assert.equal(bits.length, Math.ceil(batch.length() / 8));
+
+	rv = [];
+	for (jj = 0; jj < batch.length(); jj++) {
+		if (bits[jj >> 3] & (1 << (jj & 7)))
+			rv.push(jj);
+	}
+
+	return (rv);
+}
+
+/* bad arguments */
+mod_assert.throws(function () { new mod_native.Predicate(); });
+mod_assert.throws(function () { new mod_native.Predicate(3); });
+mod_assert.throws(function () {
+	new mod_native.Predicate({ eq: [ 'a', 'b' ], ne: [ 'a', 'b' ] });
+});
+mod_assert.throws(function () { new mod_native.Predicate({ junk: [] }); });
+mod_assert.throws(function () { new mod_native.Predicate({ eq: [ 'a' ] }); });
+mod_assert.throws(function () { new mod_native.Predicate({ eq: [ 3, 3 ] }); });
+mod_assert.throws(function () {
+	new mod_native.Predicate({ lt: [ 'a', 'b' ] });
+});
+mod_assert.throws(function () { new mod_native.Predicate({ and: [] }); });
+mod_assert.throws(function () {
+	new mod_native.Predicate({ or: [ { eq: [ 'a', 'b' ] },
+	    { eq: [ 'a', 3 ] } ] });
+});
+
+/* fields are reported by arity */
+pred = new mod_native.Predicate({ and: [
+    { or: [ { eq: [ 'zone', 'z1' ] }, { eq: [ 'zone', 'z3' ] } ] },
+    { gt: [ 'latency', 10 ] },
+    { ne: [ 'host', 'h2' ] },
+    { le: [ 'latency', 40 ] }
+] });
+mod_assert.deepEqual(pred.fields(),
+    { discrete: [ 'zone', 'host' ], numeric: [ 'latency' ] });
+
+points = new mod_native.DataPoints([ 'zone' ], [ 'latency' ]);
+mod_assert.throws(function () { pred.select(); });
+mod_assert.throws(function () { pred.select(points); });
+points = new mod_native.DataPoints([ 'zone', 'host', 'latency' ]);
+mod_assert.throws(function () { pred.select(points); });
+
+/* evaluation */
+points = new mod_native.DataPoints([ 'zone', 'host' ], [ 'latency' ]);
+mod_assert.deepEqual(selected(pred, points), []);
+
+for (ii = 0; ii < 100; ii++) {
+	points.load([ { fields: {
+	    zone: 'z' + (ii % 4),
+	    host: 'h' + (ii % 3),
+	    latency: ii
+	}, value: 1 } ]);
+}
+
+mod_assert.deepEqual(selected(pred, points),
+    [ 13, 15, 19, 21, 25, 27, 31, 33, 37, 39 ]);
+mod_assert.equal(selected(new mod_native.Predicate({}), points).length,
+    100);
+mod_assert.deepEqual(selected(new mod_native.Predicate(
+    { eq: [ 'zone', 'z9' ] }), points), []);
+mod_assert.equal(selected(new mod_native.Predicate(
+    { ne: [ 'zone', 'z9' ] }), points).length, 100);
+mod_assert.deepEqual(selected(new mod_native.Predicate(
+    { or: [ { lt: [ 'latency', 2 ] }, { ge: [ 'latency', 98 ] },
+    { eq: [ 'latency', 50 ] } ] }), points), [ 0, 1, 50, 98, 99 ]);
+
+console.log('test passed');
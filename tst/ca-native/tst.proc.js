@@ -0,0 +1,126 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright (c) 2014, Joyent, Inc.
+ */
+
+/*
+ * Tests scanning the process table against the fixtures in ./proc, which use
+ * the Linux layout of /proc.  "ok" has three readable processes (1, 42, and 77)
+ * as well as processes that can't be read (99 has no stat file and 100's is
+ * truncated) and a non-process entry.  In "bad", no process can be read.
+ */
+
+var mod_assert = require('assert');
+var mod_native = require('ca-native');
+
+var root = __dirname + '/proc';
+var nleft = 0;
+
+mod_native.procScan({ source: 'linux', root: root + '/ok' },
+    function (err, snapshot) {
+	var procs, ii;
+
+	mod_assert.ok(err === null);
+	mod_assert.equal(snapshot['length'], 3);
+
+	[ 'pid', 'ppid', 'zoneid', 'zonename', 'contract', 'rssize', 'nlwp',
+	    'dmodel', 'fname', 'psargs', 'timesec',
+	    'timensec' ].forEach(function (column) {
+		mod_assert.equal(snapshot[column].length, 3);
+	});
+
+	procs = {};
+	for (ii = 0; ii < snapshot['length']; ii++) {
+		mod_assert.equal(snapshot['zoneid'][ii], 0);
+		mod_assert.equal(snapshot['zonename'][ii], 'global');
+		mod_assert.equal(snapshot['contract'][ii], 0);
+		mod_assert.ok(snapshot['dmodel'][ii] == 1 ||
+		    snapshot['dmodel'][ii] == 2);
+		procs[snapshot['pid'][ii]] = ii;
+	}
+
+	/* arguments are separated by spaces; times assume 100 ticks/sec */
+	ii = procs[1];
+	mod_assert.equal(snapshot['ppid'][ii], 0);
+	mod_assert.equal(snapshot['fname'][ii], 'init');
+	mod_assert.equal(snapshot['psargs'][ii], '/sbin/init splash');
+	mod_assert.equal(snapshot['rssize'][ii], 12792);
+	mod_assert.equal(snapshot['nlwp'][ii], 1);
+	mod_assert.equal(snapshot['timesec'][ii], 5);
+	mod_assert.equal(snapshot['timensec'][ii], 0);
+
+	/* the command name may contain parens and is truncated, as is psargs */
+	ii = procs[42];
+	mod_assert.equal(snapshot['ppid'][ii], 1);
+	mod_assert.equal(snapshot['fname'][ii], 'a (weird) name ');
+	mod_assert.equal(snapshot['psargs'][ii], new Array(80).join('x'));
+	mod_assert.equal(snapshot['rssize'][ii], 40);
+	mod_assert.equal(snapshot['nlwp'][ii], 12);
+	mod_assert.equal(snapshot['timesec'][ii], 0);
+	mod_assert.equal(snapshot['timensec'][ii], 100000000);
+
+	/* kernel threads have neither an RSS nor arguments */
+	ii = procs[77];
+	mod_assert.equal(snapshot['ppid'][ii], 2);
+	mod_assert.equal(snapshot['fname'][ii], 'kworker/0:1');
+	mod_assert.equal(snapshot['psargs'][ii], 'kworker/0:1');
+	mod_assert.equal(snapshot['rssize'][ii], 0);
+	mod_assert.equal(snapshot['timensec'][ii], 10000000);
+
+	nleft--;
+});
+nleft++;
+
+/* the scan fails if no process can be read */
+mod_native.procScan({ source: 'linux', root: root + '/bad' },
+    function (err, snapshot) {
+	mod_assert.ok(err instanceof Error);
+	mod_assert.equal(err.code, 'EIO');
+	mod_assert.ok(snapshot === undefined);
+	nleft--;
+});
+nleft++;
+
+/* ... or if the directory can't be read */
+mod_native.procScan({ source: 'linux', root: root + '/enoent' },
+    function (err, snapshot) {
+	mod_assert.ok(err instanceof Error);
+	mod_assert.equal(err.code, 'ENOENT');
+	mod_assert.ok(snapshot === undefined);
+	nleft--;
+});
+nleft++;
+
+/* a directory with no processes is empty */
+mod_native.procScan({ source: 'linux', root: root + '/ok/self' },
+    function (err, snapshot) {
+	mod_assert.ok(err === null);
+	mod_assert.equal(snapshot['length'], 0);
+	mod_assert.deepEqual(snapshot['pid'], []);
+	nleft--;
+});
+nleft++;
+
+/* bad arguments */
+mod_assert.throws(function () { mod_native.procScan(); });
+mod_assert.throws(function () { mod_native.procScan({}); });
+mod_assert.throws(function () { mod_native.procScan(function () {}); });
+mod_assert.throws(function () {
+	mod_native.procScan({ source: 'kvm' }, function () {});
+});
+mod_assert.throws(function () {
+	mod_native.procScan({ source: 3 }, function () {});
+});
+mod_assert.throws(function () {
+	mod_native.procScan({ root: 3 }, function () {});
+});
+
+process.on('exit', function () {
+	mod_assert.equal(nleft, 0);
+	console.log('test passed');
+});
@@ -0,0 +1,114 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright (c) 2014, Joyent, Inc.
+ */
+
+/*
+ * Tests the ca-native Reporting class, which tracks the sources reporting at
+ * each time.
+ */
+
+var mod_assert = require('assert');
+var mod_native = require('ca-native');
+
+var reporting, hosts, ii;
+
+/* bad arguments */
+mod_assert.throws(function () { new mod_native.Reporting(); });
+mod_assert.throws(function () { new mod_native.Reporting(0, 10); });
+mod_assert.throws(function () { new mod_native.Reporting(1, 0); });
+
+reporting = new mod_native.Reporting(10, 6);
+mod_assert.throws(function () { reporting.report(12340); });
+mod_assert.throws(function () { reporting.report(-10, 'host0'); });
+mod_assert.throws(function () { reporting.min(12345, 10); });
+
+/* basic reporting */
+mod_assert.equal(reporting.count(12340), 0);
+mod_assert.equal(reporting.min(12340, 10), 0);
+mod_assert.equal(reporting.max(12340, 10), 0);
+mod_assert.equal(reporting.report(12340, 'host0'), true);
+mod_assert.equal(reporting.report(12345, 'host0'), false);
+mod_assert.equal(reporting.report(12340, 'host1'), true);
+mod_assert.equal(reporting.report(12350, 'host1'), true);
+mod_assert.equal(reporting.count(12340), 2);
+mod_assert.equal(reporting.count(12345), 2);
+mod_assert.equal(reporting.count(12350), 1);
+mod_assert.equal(reporting.count(12360), 0);
+
+mod_assert.equal(reporting.min(12340, 10), 2);
+mod_assert.equal(reporting.min(12340, 20), 1);
+mod_assert.equal(reporting.min(12340, 30), 0);
+mod_assert.equal(reporting.max(12340, 30), 2);
+mod_assert.equal(reporting.max(12350, 30), 1);
+mod_assert.equal(reporting.max(12340, 1), 2);
+mod_assert.equal(reporting.min(12340, 0), 0);
+
+mod_assert.deepEqual(reporting.times(), [ 12340, 12350 ]);
+mod_assert.deepEqual(reporting.byTime(), {
+    12340: { host0: true, host1: true },
+    12350: { host1: true }
+});
+mod_assert.deepEqual(reporting.byTime(12350, 10), { 12350: { host1: true } });
+
+/* expiration */
+reporting.expire(12341);
+mod_assert.deepEqual(reporting.times(), [ 12350 ]);
+mod_assert.equal(reporting.count(12340), 0);
+mod_assert.equal(reporting.count(12350), 1);
+
+/*
+ * Identifiers for sources that no longer appear anywhere are reused, so sources
+ * come and go without the bitsets growing.
+ */
+reporting.expire(12400);
+mod_assert.deepEqual(reporting.times(), []);
+mod_assert.equal(reporting.report(12400, 'host2'), true);
+mod_assert.equal(reporting.report(12400, 'host1'), true);
+mod_assert.deepEqual(reporting.byTime(), {
+    12400: { host1: true, host2: true }
+});
+
+/*
+ * Many sources, spanning more than one word of the bitsets, and more times than
+ * initially fit in the ring.
+ */
+reporting = new mod_native.Reporting(1, 4);
+for (ii = 0; ii < 200; ii++) {
+	reporting.report(1000, 'host' + ii);
+	reporting.report(1000 + ii % 10, 'host' + ii);
+}
+
+mod_assert.equal(reporting.count(1000), 200);
+mod_assert.equal(reporting.count(1005), 20);
+mod_assert.equal(reporting.min(1000, 10), 20);
+mod_assert.equal(reporting.max(1000, 10), 200);
+mod_assert.equal(reporting.min(1000, 11), 0);
+
+hosts = Object.keys(reporting.byTime(1003, 1)[1003]).sort();
+mod_assert.equal(hosts.length, 20);
+mod_assert.equal(hosts[0], 'host103');
+
+reporting.expire(1001);
+mod_assert.equal(reporting.count(1000), 0);
+mod_assert.equal(reporting.min(1001, 9), 20);
+mod_assert.equal(reporting.report(1001, 'host1'), false);
+mod_assert.equal(reporting.report(1001, 'host0'), true);
+mod_assert.equal(reporting.count(1001), 21);
+
+/* reports far behind the newest are refused */
+mod_assert.equal(reporting.report(0, 'host0'), false);
+mod_assert.equal(reporting.count(0), 0);
+mod_assert.deepEqual(reporting.times(),
+    [ 1001, 1002, 1003, 1004, 1005, 1006, 1007, 1008, 1009 ]);
+
+/* and a report far ahead of the oldest evicts it */
+mod_assert.equal(reporting.report(100000, 'host0'), true);
+mod_assert.deepEqual(reporting.times(), [ 100000 ]);
+
+console.log('test passed');
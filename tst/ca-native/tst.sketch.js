@@ -0,0 +1,131 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright (c) 2014, Joyent, Inc.
+ */
+
+/*
+ * Tests "sketch" TimeSeries: quantile accuracy, merging across time slots and
+ * from serialized sketches, and expiration.
+ */
+
+var mod_assert = require('assert');
+var mod_native = require('ca-native');
+
+var series, other, sketch, values, dist, qs, ii, jj;
+
+/*
+ * Checks that "actual" is within relative error "alpha" of "expected".
+ */
+function close(actual, expected, alpha)
+{
+	mod_assert.ok(Math.abs(actual - expected) <= alpha * expected + 1e-9,
+	    actual + ' is not within ' + alpha + ' of ' + expected);
+}
+
+/* bad arguments */
+mod_assert.throws(function () {
+	new mod_native.TimeSeries('sketch', 1, 10, 0);
+});
+mod_assert.throws(function () {
+	new mod_native.TimeSeries('sketch', 1, 10, 1);
+});
+mod_assert.throws(function () {
+	new mod_native.TimeSeries('dist', 1, 10).quantiles(0, 1, [ 0.5 ]);
+});
+
+series = new mod_native.TimeSeries('sketch', 1, 10, 0.01);
+mod_assert.throws(function () { series.quantiles(0, 1); });
+mod_assert.throws(function () { series.quantiles(0, 1, [ 1.5 ]); });
+mod_assert.throws(function () { series.add(0, [ 1 ]); });
+mod_assert.throws(function () {
+	series.add(0, { 'alpha': 0.02, 'zero': 0, 'offset': 0, 'counts': [] });
+});
+
+/* malformed data is rejected without adding anything */
+series.add(100, [ [ [ 10, 20 ], 1 ] ]);
+[ [ [ [ 'a', 'b' ], 1 ] ], [ [ [ 10, 'b' ], 1 ] ], [ [ [ 20, 10 ], 1 ] ],
+    [ [ [ 10, Infinity ], 1 ] ], [ [ [ NaN, 10 ], 1 ] ],
+    [ [ [ 10, 20 ], -1 ] ], [ [ [ 10, 20 ], NaN ] ], [ [ [ 10, 20 ], 'x' ] ],
+    [ [ [ 10, 20 ], 1 ], [ [ 30, 20 ], 1 ] ],
+    { 'alpha': 0.01, 'zero': NaN, 'offset': 0, 'counts': [] },
+    { 'alpha': 0.01, 'zero': 0, 'offset': -5, 'counts': [ 1 ] },
+    { 'alpha': 0.01, 'zero': 0, 'offset': 2147483647, 'counts': [ 1 ] },
+    { 'alpha': 0.01, 'zero': 0, 'offset': 0, 'counts': [ -1 ] }
+].forEach(function (datum) {
+	mod_assert.throws(function () { series.add(100, datum); });
+});
+close(series.value(100, 1)['counts'].reduce(function (a, b) {
+	return (a + b);
+}, 0), 1, 1e-9);
+series.expire(101);
+
+/* empty sketches */
+mod_assert.deepEqual(series.quantiles(0, 10, [ 0, 0.5, 1 ]), [ 0, 0, 0 ]);
+mod_assert.deepEqual(series.value(0, 10),
+    { 'alpha': 0.01, 'zero': 0, 'offset': 0, 'counts': [] });
+
+/*
+ * Exact values spread over six orders of magnitude, one value per wire bucket
+ * and split across several seconds.  Every quantile must be within alpha of
+ * the exact answer.
+ */
+values = [];
+for (ii = 0; ii < 5000; ii++) {
+	values.push(Math.floor(Math.pow(10, 6 * ii / 5000)));
+	series.add(100 + (ii % 5), [ [ [ values[ii], values[ii] ], 1 ] ]);
+}
+values.sort(function (a, b) { return (a - b); });
+
+qs = [ 0, 0.01, 0.25, 0.5, 0.9, 0.99, 0.999, 1 ];
+dist = series.quantiles(100, 5, qs);
+for (ii = 0; ii < qs.length; ii++) {
+	jj = Math.max(0, Math.ceil(qs[ii] * values.length) - 1);
+	close(dist[ii], values[jj], 0.01);
+}
+
+/* sub-intervals only see their own data */
+mod_assert.equal(series.quantiles(100, 1, [ 1 ]).length, 1);
+mod_assert.deepEqual(series.quantiles(200, 5, [ 0.5 ]), [ 0 ]);
+
+/*
+ * Wide buckets are spread uniformly: 1000 values in [0, 999] have a median
+ * near 500.
+ */
+series = new mod_native.TimeSeries('sketch', 1, 10, 0.01);
+series.add(10, [ [ [ 0, 999 ], 1000 ] ]);
+close(series.quantiles(10, 1, [ 0.5 ])[0], 500, 0.02);
+close(series.quantiles(10, 1, [ 0.9 ])[0], 900, 0.02);
+mod_assert.equal(series.quantiles(10, 1, [ 0 ])[0], 0);
+
+/*
+ * Serialized sketches round-trip, merge with wire data, and produce the same
+ * quantiles as the original.
+ */
+sketch = series.value(10, 1);
+mod_assert.equal(sketch['alpha'], 0.01);
+mod_assert.ok(sketch['counts'].length < 1000);
+
+other = new mod_native.TimeSeries('sketch', 1, 10, 0.01);
+other.add(10, sketch);
+mod_assert.deepEqual(other.quantiles(10, 1, qs),
+    series.quantiles(10, 1, qs));
+
+other.add(10, [ [ [ 0, 999 ], 1000 ] ]);
+mod_assert.deepEqual(other.quantiles(10, 1, qs),
+    series.quantiles(10, 1, qs));
+
+/* byTime returns one sketch per time index */
+dist = other.byTime(10, 2);
+mod_assert.deepEqual(Object.keys(dist), [ '10' ]);
+mod_assert.deepEqual(dist['10'], other.value(10, 1));
+
+/* expiration */
+other.expire(11);
+mod_assert.deepEqual(other.quantiles(10, 1, [ 0.5 ]), [ 0 ]);
+
+console.log('test passed');
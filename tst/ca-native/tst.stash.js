@@ -0,0 +1,266 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright (c) 2014, Joyent, Inc.
+ */
+
+/*
+ * Tests the binary stash encoding of native datasets.
+ */
+
+var mod_assert = require('assert');
+var mod_native = require('ca-native');
+
+var kinds, key, values, source, dest, reporting, restored, buf, header;
+var hosts, json, segment, ii;
+
+function create(kind, granularity)
+{
+	if (kind == 'heatmap')
+		return (new mod_native.HeatmapDecomp(granularity, 10));
+
+	return (new mod_native.TimeSeries(kind, granularity, 10));
+}
+
+/*
+ * Returns a native Reporting with the sources in "reporting", an object mapping
+ * each time to an object whose keys are the sources reporting at that time.
+ */
+function track(granularity, reporting)
+{
+	var rv, time, host;
+
+	rv = new mod_native.Reporting(granularity, 10);
+
+	for (time in reporting) {
+		for (host in reporting[time])
+			rv.report(Number(time), host);
+	}
+
+	return (rv);
+}
+
+/* bad arguments */
+mod_assert.throws(function () { mod_native.stashEncode(); });
+mod_assert.throws(function () {
+	mod_native.stashEncode(1, 1, {}, [ { reporting: {}, data: {} } ]);
+});
+mod_assert.throws(function () {
+	mod_native.stashEncode(1, 1, {}, [ { granularity: 1, reporting: {},
+	    data: create('scalar', 1) } ]);
+});
+mod_assert.throws(function () { mod_native.stashHeader('junk'); });
+mod_assert.throws(function () {
+	mod_native.stashHeader(new Buffer('junk'));
+});
+
+/*
+ * For each kind of dataset, stash some values and load them into another
+ * dataset.  The results must be identical.
+ */
+kinds = {
+    scalar: [ 5, -7.5, 0, 1e300, 1152921504606846976 ],
+    decomp: [ { a: 1, b: 2 }, { b: 3.25, 'cé\n': -4 }, {} ],
+    dist: [ [ [ [ 0, 9 ], 3 ], [ [ 10, 19 ], 4 ] ], [ [ [ 10, 19 ], 0.5 ] ],
+	[] ],
+    sketch: [ [ [ [ 1, 9 ], 30 ], [ [ 100, 199 ], 4 ] ], [] ],
+    heatmap: [ { a: [ [ [ 0, 9 ], 3 ] ], b: [] },
+	{ a: [ [ [ 0, 9 ], 1 ], [ [ 20, 29 ], 2 ] ], c: [ [ [ 5, 5 ], 1 ] ] },
+	{} ]
+};
+
+for (key in kinds) {
+	source = create(key, 1);
+	reporting = {};
+	values = kinds[key];
+
+	for (ii = 0; ii < values.length; ii++) {
+		source.add(1000 + ii * 3, values[ii]);
+		reporting[1000 + ii * 3] = { host0: true, host1: true };
+	}
+
+	buf = mod_native.stashEncode(1, 2, {
+	    host0: { s_last: 1006 },
+	    host1: { s_last: 1000.5 }
+	}, [ { granularity: 1, reporting: track(1, reporting),
+	    data: source } ]);
+
+	mod_assert.deepEqual(mod_native.stashHeader(buf), {
+	    version: 1,
+	    granularity: 1,
+	    nsources: 2,
+	    sources: { host0: { s_last: 1006 }, host1: { s_last: 1000.5 } },
+	    tiers: [ { granularity: 1 } ]
+	});
+
+	dest = create(key, 1);
+	restored = new mod_native.Reporting(1, 10);
+	mod_native.stashLoad(buf, 0, 1, true, restored, dest);
+	mod_assert.deepEqual(restored.byTime(), reporting);
+
+	for (ii = 0; ii < values.length; ii++) {
+		mod_assert.deepEqual(dest.value(1000 + ii * 3, 1),
+		    source.value(1000 + ii * 3, 1));
+	}
+
+	mod_assert.deepEqual(dest.value(0, 2000), source.value(0, 2000));
+
+	/* Loading into a dataset of a different kind fails. */
+	mod_assert.throws(function () {
+		mod_native.stashLoad(buf, 0, 1, true, track(1, {}),
+		    create(key == 'scalar' ? 'decomp' : 'scalar', 1));
+	});
+
+	/* So does loading truncated data. */
+	mod_assert.throws(function () {
+		mod_native.stashLoad(buf.slice(0, buf.length - 1), 0, 1, true,
+		    track(1, {}), create(key, 1));
+	});
+
+	/* Sketches only load into sketches with the same accuracy. */
+	if (key == 'sketch') {
+		mod_assert.throws(function () {
+			mod_native.stashLoad(buf, 0, 1, true, track(1, {}),
+			    new mod_native.TimeSeries('sketch', 1, 10, 0.05));
+		});
+	}
+}
+
+/*
+ * Loading into a coarser granularity combines data for each interval, unless
+ * "doadd" is false, in which case only data at the start of each interval is
+ * used.
+ */
+source = create('scalar', 1);
+reporting = {};
+for (ii = 0; ii < 20; ii++) {
+	source.add(1000 + ii, ii);
+	reporting[1000 + ii] = {};
+	reporting[1000 + ii]['host' + (ii % 3)] = true;
+}
+
+buf = mod_native.stashEncode(1, 3, {},
+    [ { granularity: 1, reporting: track(1, reporting), data: source } ]);
+
+dest = create('scalar', 10);
+restored = track(10, {});
+mod_native.stashLoad(buf, 0, 10, true, restored, dest);
+mod_assert.deepEqual(dest.byTime(), { 1000: 45, 1010: 145 });
+mod_assert.deepEqual(restored.byTime(), {
+    1000: { host0: true, host1: true, host2: true },
+    1010: { host0: true, host1: true, host2: true }
+});
+
+dest = create('scalar', 10);
+restored = track(10, {});
+mod_native.stashLoad(buf, 0, 10, false, restored, dest);
+mod_assert.deepEqual(dest.byTime(), { 1000: 0, 1010: 10 });
+mod_assert.deepEqual(restored.byTime(), { 1000: { host0: true },
+    1010: { host1: true } });
+
+mod_assert.throws(function () {
+	mod_native.stashLoad(buf, 1, 10, true, track(10, {}),
+	    create('scalar', 10));
+});
+
+/*
+ * A stash encoded "since" some time contains only the slots at or after the one
+ * containing that time, and those slots supersede the same slots in earlier
+ * stashes when loaded with "before".
+ */
+source = [ create('scalar', 1), create('scalar', 10) ];
+reporting = [ {}, {} ];
+for (ii = 0; ii < 20; ii++) {
+	source[0].add(1000 + ii, 1);
+	source[1].add(1000 + ii, 1);
+	reporting[0][1000 + ii] = { host0: true };
+	reporting[1][1000 + ii - ii % 10] = { host0: true };
+}
+
+buf = mod_native.stashEncode(1, 1, {}, [
+    { granularity: 1, reporting: track(1, reporting[0]), data: source[0] },
+    { granularity: 10, reporting: track(10, reporting[1]), data: source[1] }
+]);
+
+for (ii = 15; ii < 25; ii++) {
+	source[0].add(1000 + ii, 1);
+	source[1].add(1000 + ii, 1);
+	reporting[0][1000 + ii] = { host1: true };
+	reporting[1][1000 + ii - ii % 10] = { host0: true, host1: true };
+}
+
+segment = mod_native.stashEncode(1, 1, {}, [
+    { granularity: 1, reporting: track(1, reporting[0]), data: source[0] },
+    { granularity: 10, reporting: track(10, reporting[1]), data: source[1] }
+], 1015);
+mod_assert.ok(segment.length < buf.length);
+
+dest = create('scalar', 1);
+restored = track(1, {});
+mod_native.stashLoad(segment, 0, 1, true, restored, dest);
+mod_assert.equal(dest.value(1000, 15), 0);
+mod_assert.equal(dest.value(1015, 10), 15);
+mod_assert.deepEqual(restored.times().length, 10);
+
+dest = create('scalar', 10);
+mod_native.stashLoad(segment, 1, 10, true, track(10, {}), dest);
+mod_assert.deepEqual(dest.byTime(), { 1010: 15, 1020: 5 });
+
+for (ii = 0; ii < 2; ii++) {
+	dest = create('scalar', ii === 0 ? 1 : 10);
+	restored = track(ii === 0 ? 1 : 10, {});
+	mod_native.stashLoad(buf, ii, ii === 0 ? 1 : 10, true, restored,
+	    dest, 1015);
+	mod_native.stashLoad(segment, ii, ii === 0 ? 1 : 10, true, restored,
+	    dest);
+	mod_assert.deepEqual(dest.byTime(), source[ii].byTime());
+	mod_assert.deepEqual(restored.byTime(), reporting[ii]);
+}
+
+mod_assert.throws(function () {
+	mod_native.stashEncode(1, 1, {}, [], 'junk');
+});
+mod_assert.throws(function () {
+	mod_native.stashLoad(buf, 0, 1, true, track(1, {}),
+	    create('scalar', 1), 'junk');
+});
+
+/*
+ * A heatmap with many keys and hosts stashes much more compactly than the JSON
+ * representation the aggregator used to save.
+ */
+source = create('heatmap', 1);
+reporting = {};
+json = {};
+for (ii = 0; ii < 600; ii++) {
+	values = {};
+	hosts = {};
+	values['10.0.0.' + (ii % 50)] = [ [ [ 0, 9 ], ii ],
+	    [ [ 10, 19 ], 1 ] ];
+	values['10.0.1.' + (ii % 20)] = [ [ [ 100, 199 ], 2 ] ];
+	hosts['compute' + (ii % 10) + '.example.com'] = true;
+	hosts['compute' + (ii % 7) + '.example.com'] = true;
+	source.add(1400000000 + ii, values);
+	reporting[1400000000 + ii] = hosts;
+	json[1400000000 + ii] = { reporting: hosts, datum: values };
+}
+
+buf = mod_native.stashEncode(1, 10, {}, [ { granularity: 1,
+    reporting: track(1, reporting), data: source } ]);
+mod_assert.ok(buf.length * 4 < JSON.stringify(json).length);
+
+dest = create('heatmap', 1);
+mod_native.stashLoad(buf, 0, 1, true, track(1, {}), dest);
+mod_assert.deepEqual(dest.value(1400000000, 600),
+    source.value(1400000000, 600));
+mod_assert.deepEqual(dest.totalValue(1400000000, 600),
+    source.totalValue(1400000000, 600));
+
+header = mod_native.stashHeader(buf);
+mod_assert.equal(header['tiers'].length, 1);
+
+console.log('test passed');
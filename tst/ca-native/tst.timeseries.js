@@ -0,0 +1,220 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright (c) 2014, Joyent, Inc.
+ */
+
+/*
+ * Tests the ca-native TimeSeries class, particularly wraparound, growth, and
+ * expiration of the underlying ring.
+ */
+
+var mod_assert = require('assert');
+var mod_native = require('ca-native');
+
+var series, decomp, value, time, now, ii;
+
+/* bad arguments */
+mod_assert.throws(function () { new mod_native.TimeSeries(); });
+mod_assert.throws(function () {
+	new mod_native.TimeSeries('junk', 1, 10);
+});
+mod_assert.throws(function () {
+	new mod_native.TimeSeries('scalar', 0, 10);
+});
+
+/* scalars: basic add and sum */
+series = new mod_native.TimeSeries('scalar', 10, 6);
+mod_assert.equal(series.capacity(), 8);
+mod_assert.equal(series.value(12340, 10), 0);
+series.add(12340, 5);
+series.add(12340, 7);
+series.add(12350, 1);
+series.add(12360, undefined);
+mod_assert.equal(series.value(12340, 10), 12);
+mod_assert.equal(series.value(12350, 10), 1);
+mod_assert.equal(series.value(12340, 30), 13);
+mod_assert.deepEqual(series.times(), [ 12340, 12350, 12360 ]);
+
+/* wraparound after expiration reuses slots without growing */
+time = 12340;
+for (ii = 0; ii < 100; ii++) {
+	series.expire(time - 50);
+	series.add(time, 1);
+	time += 10;
+}
+mod_assert.equal(series.capacity(), 8);
+mod_assert.deepEqual(series.times(),
+    [ 13280, 13290, 13300, 13310, 13320, 13330 ]);
+mod_assert.equal(series.value(13280, 60), 6);
+mod_assert.equal(series.value(12340, 10), 0);
+
+/* data that doesn't fit causes the ring to grow rather than lose data */
+series.add(13400, 3);
+mod_assert.equal(series.capacity(), 16);
+mod_assert.equal(series.value(13280, 200), 9);
+
+/* ... but data too far behind the newest data is refused */
+series.add(12340, 3);
+mod_assert.equal(series.capacity(), 16);
+mod_assert.equal(series.value(12340, 10), 0);
+mod_assert.deepEqual(series.times(),
+    [ 13280, 13290, 13300, 13310, 13320, 13330, 13400 ]);
+
+/* data far ahead evicts the oldest data rather than growing the ring more */
+series.add(13600, 1);
+mod_assert.ok(series.capacity() <= 32);
+mod_assert.equal(series.value(13280, 10), 0);
+mod_assert.equal(series.value(13280, 400), 9);
+
+/* and shrinks back once expiration catches up */
+series.expire(13600);
+mod_assert.equal(series.capacity(), 8);
+mod_assert.deepEqual(series.times(), [ 13600 ]);
+
+/* expiring far into the future clears everything */
+series.expire(20000);
+mod_assert.deepEqual(series.times(), []);
+mod_assert.equal(series.value(12340, 1000), 0);
+
+/* decompositions */
+series = new mod_native.TimeSeries('decomp', 1, 4);
+mod_assert.deepEqual(series.value(100, 1), {});
+series.add(100, { abe: 10, jasper: 20 });
+series.add(100, { jasper: 5, molloy: 15 });
+series.add(101, { burns: 57 });
+series.add(102, {});
+mod_assert.deepEqual(series.value(100, 1), {
+	abe: 10, jasper: 25, molloy: 15
+});
+mod_assert.deepEqual(series.value(100, 3), {
+	abe: 10, burns: 57, jasper: 25, molloy: 15
+});
+
+/* keys are recycled when the data referencing them expires */
+series.expire(101);
+mod_assert.deepEqual(series.value(100, 3), { burns: 57 });
+series.add(105, { selma: 2 });
+mod_assert.deepEqual(series.value(100, 10), { burns: 57, selma: 2 });
+series.expire(106);
+mod_assert.deepEqual(series.value(100, 10), {});
+
+/* decompositions survive growth */
+for (ii = 0; ii < 10; ii++)
+	series.add(200 + ii, { patty: ii });
+mod_assert.equal(series.capacity(), 16);
+mod_assert.deepEqual(series.value(200, 10), { patty: 45 });
+
+/*
+ * A single stale datum doesn't grow the ring: once current data is present,
+ * data for a time more than four times the ring's size ago is refused, and
+ * current data evicts stale data that arrived first.
+ */
+now = 1400000000000;
+series = new mod_native.TimeSeries('scalar', 1000, 600);
+mod_assert.equal(series.capacity(), 1024);
+series.add(now, 1);
+series.add(now - 30 * 86400 * 1000, 1);
+series.add(0, 1);
+mod_assert.equal(series.capacity(), 1024);
+mod_assert.deepEqual(series.times(), [ now ]);
+
+series = new mod_native.TimeSeries('decomp', 1000, 600);
+series.add(0, { abe: 1 });
+series.add(now, { abe: 2 });
+mod_assert.equal(series.capacity(), 1024);
+mod_assert.deepEqual(series.times(), [ now ]);
+mod_assert.deepEqual(series.value(0, now + 1000), { abe: 2 });
+
+/* a malformed datum is rejected before it can evict anything */
+mod_assert.throws(function () { series.add(2 * now, 'junk'); });
+mod_assert.deepEqual(series.times(), [ now ]);
+mod_assert.deepEqual(series.value(0, now + 1000), { abe: 2 });
+
+/*
+ * Wide intervals are summed with sliding windows, which must match summing
+ * each time index separately, including when data arrives late, keys come and
+ * go, and data expires.
+ */
+function bruteforce(ts, start, duration)
+{
+	var sum, value, key, jj;
+
+	sum = ts === series ? 0 : {};
+
+	for (jj = start; jj < start + duration; jj++) {
+		value = ts.value(jj, 1);
+
+		if (typeof (value) == 'number') {
+			sum += value;
+			continue;
+		}
+
+		for (key in value)
+			sum[key] = (sum[key] || 0) + value[key];
+	}
+
+	return (sum);
+}
+
+function sortkeys(obj)
+{
+	var rv = {};
+
+	Object.keys(obj).sort().forEach(function (key) { rv[key] = obj[key]; });
+	return (rv);
+}
+
+series = new mod_native.TimeSeries('scalar', 1, 400);
+decomp = new mod_native.TimeSeries('decomp', 1, 400);
+
+for (time = 1000; time < 2000; time++) {
+	series.add(time, time % 7);
+	value = {};
+
+	if (time % 3 !== 0) {
+		value['key' + (time % 5)] = time % 4;
+		value['zero' + (time % 11)] = 0;
+	}
+
+	decomp.add(time, value);
+
+	/* late data for a time already in the windows */
+	if (time % 13 === 0) {
+		series.add(time - 30, 1.5);
+		decomp.add(time - 30, { late: 2 });
+	}
+
+	series.expire(time - 350);
+	decomp.expire(time - 350);
+
+	[ 16, 60, 300 ].forEach(function (width) {
+		if (time - width + 1 < 1000)
+			return;
+
+		mod_assert.equal(series.value(time - width + 1, width),
+		    bruteforce(series, time - width + 1, width));
+		mod_assert.deepEqual(
+		    sortkeys(decomp.value(time - width + 1, width)),
+		    sortkeys(bruteforce(decomp, time - width + 1, width)));
+	});
+}
+
+/* more widths than windows, and windows moving backward */
+for (ii = 20; ii < 30; ii++) {
+	mod_assert.equal(series.value(1700 - ii, ii * 10),
+	    bruteforce(series, 1700 - ii, ii * 10));
+	mod_assert.deepEqual(sortkeys(decomp.value(1700 - ii, ii * 10)),
+	    sortkeys(bruteforce(decomp, 1700 - ii, ii * 10)));
+}
+
+/* windows over expired data */
+series.expire(1990);
+decomp.expire(1990);
+mod_assert.equal(series.value(1700, 300), bruteforce(series, 1700, 300));
+mod_assert.deepEqual(sortkeys(decomp.value(1700, 300)),
+    sortkeys(bruteforce(decomp, 1700, 300)));
@@ -43,6 +43,14 @@ exports.spec_both = {
     'granularity': 1
 };
 
+exports.spec_sketch = {
+    'value-arity': mod_ca.ca_arity_numeric,
+    'value-dimension': 2,
+    'value-scope': 'interval',
+    'value-sketch': true,
+    'granularity': 1
+};
+
 exports.dataset_scalar = mod_agg.caDatasetForInstrumentation(
     exports.spec_scalar);
 exports.dataset_discrete = mod_agg.caDatasetForInstrumentation(
@@ -51,6 +59,8 @@ exports.dataset_numeric = mod_agg.caDatasetForInstrumentation(
     exports.spec_numeric);
 exports.dataset_both = mod_agg.caDatasetForInstrumentation(
     exports.spec_both);
+exports.dataset_sketch = mod_agg.caDatasetForInstrumentation(
+    exports.spec_sketch);
 
 exports.xform = function (keys)
 {
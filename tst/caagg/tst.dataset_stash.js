@@ -27,7 +27,7 @@ var spec = {
 };
 
 var dataset = mod_caagg.caDatasetForInstrumentation(spec);
-var stashed, restored;
+var stashed, restored, segment, segments;
 
 var source1 = 'source1';
 var source2 = 'source2';
@@ -56,3 +56,68 @@ try {
 stashed['metadata'].ca_agg_stash_vers_major--;
 stashed['metadata'].ca_agg_stash_vers_minor++;
 restored.unstash(stashed['metadata'], stashed['data']); /* should work */
+
+/* binary stashes may be passed as base64, as they come from the stash */
+dataset.update(source1, time1, 5);
+dataset.update(source2, time2, 7);
+stashed = dataset.stash();
+restored = mod_caagg.caDatasetForInstrumentation(spec);
+restored.unstash(stashed['metadata'], stashed['data'].toString('base64'));
+mod_assert.equal(restored.dataForTime(time1, 1), 5);
+mod_assert.equal(restored.dataForTime(time2, 1), 7);
+mod_assert.equal(restored.nreporting(time1, 1), 1);
+
+/* JSON stashes from older versions still load */
+restored = mod_caagg.caDatasetForInstrumentation(spec);
+restored.unstash({
+    ca_agg_stash_vers_major: 0,
+    ca_agg_stash_vers_minor: 1
+}, JSON.parse(JSON.stringify({
+    cs_granularity: 1,
+    cs_nsources: 2,
+    cs_sources: { source1: { s_last: time2 } },
+    cs_data: {
+	'12340': { reporting: { source1: true }, datum: 5 },
+	'12345': { reporting: { source1: true, source2: true }, datum: 7 }
+    }
+})));
+mod_assert.equal(restored.dataForTime(time1, 1), 5);
+mod_assert.equal(restored.dataForTime(time2, 1), 7);
+mod_assert.equal(restored.nreporting(time2, 1), 2);
+mod_assert.equal(restored.maxreporting(time1, 1), 1);
+
+/* garbage is rejected */
+mod_assert.throws(function () {
+	restored.unstash(stashed['metadata'], new Buffer('junk'));
+});
+mod_assert.throws(function () {
+	restored.unstash(stashed['metadata'],
+	    stashed['data'].slice(0, stashed['data'].length - 1));
+});
+
+/*
+ * Segments stashed "since" a time replace the data for that time and later in
+ * the stashes before them.
+ */
+dataset.update(source1, time2 + 1, 3);
+segment = dataset.stash(time2);
+mod_assert.equal(segment['metadata'].ca_agg_stash_since, time2);
+dataset.update(source2, time2 + 1, 4);
+dataset.update(source1, time2 + 2, 1);
+segments = [ segment, dataset.stash(time2 + 1) ];
+segments[1]['data'] = segments[1]['data'].toString('base64');
+
+restored = mod_caagg.caDatasetForInstrumentation(spec);
+restored.unstash(stashed['metadata'], stashed['data'], segments);
+mod_assert.equal(restored.dataForTime(time1, 1), 5);
+mod_assert.equal(restored.dataForTime(time2, 1), 7);
+mod_assert.equal(restored.dataForTime(time2 + 1, 1), 7);
+mod_assert.equal(restored.dataForTime(time2 + 2, 1), 1);
+mod_assert.equal(restored.nreporting(time2, 2), 1);
+mod_assert.equal(restored.maxreporting(time2, 2), 2);
+
+mod_assert.throws(function () {
+	restored.unstash(stashed['metadata'], stashed['data'],
+	    [ { metadata: { ca_agg_stash_vers_major: 0,
+		ca_agg_stash_vers_minor: 1 }, data: {} } ]);
+});
@@ -0,0 +1,156 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright (c) 2014, Joyent, Inc.
+ */
+
+/*
+ * Tests datasets for instrumentations with long retention times, which keep
+ * older data at coarser granularities.
+ */
+
+var mod_assert = require('assert');
+var mod_ca = require('../../lib/ca/ca-common');
+var mod_caagg = require('../../lib/ca/ca-agg');
+var mod_native = require('ca-native');
+var mod_tl = require('../../lib/tst/ca-test');
+
+var spec, dataset, restored, stashed, time0, now, tt;
+
+/* tier layouts */
+mod_assert.deepEqual(mod_ca.caDataTiers(1), [
+    { granularity: 1, span: undefined }
+]);
+mod_assert.deepEqual(mod_ca.caDataTiers(1, 600), [
+    { granularity: 1, span: 600 }
+]);
+mod_assert.deepEqual(mod_ca.caDataTiers(1, 7 * 86400), [
+    { granularity: 1, span: 3600 },
+    { granularity: 10, span: 36000 },
+    { granularity: 60, span: 216000 },
+    { granularity: 600, span: 7 * 86400 }
+]);
+mod_assert.deepEqual(mod_ca.caDataTiers(5, 86400), [
+    { granularity: 5, span: 18000 },
+    { granularity: 10, span: 36000 },
+    { granularity: 60, span: 86400 }
+]);
+mod_assert.deepEqual(mod_ca.caDataTiers(7, 86400), [
+    { granularity: 7, span: 86400 }
+]);
+
+/*
+ * Fill two hours of a dataset that keeps the last hour at per-second
+ * granularity, ten hours at 10-second granularity, and the rest at 60-second
+ * granularity.
+ */
+spec = {
+    'value-arity': mod_ca.ca_arity_scalar,
+    'value-dimension': 1,
+    'value-scope': 'interval',
+    'nsources': 1,
+    'granularity': 1,
+    'retention-time': 40000
+};
+
+time0 = 120000;
+now = time0 + 7200;
+dataset = mod_caagg.caDatasetForInstrumentation(spec);
+mod_assert.equal(dataset.ingestTargets().length, 3);
+
+for (tt = time0; tt < now; tt++)
+	dataset.update('source1', tt, 1);
+
+/* Before anything expires, every tier has all the data. */
+mod_assert.equal(dataset.dataForTime(time0, 1), 1);
+mod_assert.equal(dataset.dataForTime(time0, 60), 60);
+mod_assert.equal(dataset.dataForTime(time0, 7200), 7200);
+mod_assert.deepEqual(dataset.normalizeInterval(time0 + 5, 1),
+    { start_time: time0 + 5, duration: 1 });
+
+dataset.expireBefore(now - spec['retention-time']);
+
+/* Older per-second data is gone, but coarser data remains. */
+mod_assert.equal(dataset.dataForTime(time0, 1), 0);
+mod_assert.equal(dataset.dataForTime(time0, 10), 10);
+mod_assert.equal(dataset.dataForTime(time0, 60), 60);
+mod_assert.equal(dataset.dataForTime(time0, 7200), 7200);
+mod_assert.equal(dataset.dataForTime(now - 3600, 1), 1);
+mod_assert.equal(dataset.dataForTime(now - 3600, 3600), 3600);
+mod_assert.equal(dataset.dataForTime(now - 3599, 3599), 3599);
+
+mod_assert.deepEqual(dataset.normalizeInterval(time0 + 5, 1),
+    { start_time: time0, duration: 10 });
+mod_assert.deepEqual(dataset.normalizeInterval(time0 + 5, 25),
+    { start_time: time0, duration: 30 });
+mod_assert.deepEqual(dataset.normalizeInterval(now - 5, 1),
+    { start_time: now - 5, duration: 1 });
+
+mod_assert.equal(dataset.nreporting(time0, 60), 1);
+mod_assert.equal(dataset.maxreporting(time0, 60), 1);
+mod_assert.equal(dataset.nreporting(now - 10, 10), 1);
+mod_assert.equal(dataset.nreporting(now, 10), 0);
+
+/* heatmaps use the coarsest tier that fills the requested width */
+mod_assert.equal(dataset.step(time0, 7200, 600), 10);
+mod_assert.equal(dataset.step(time0, 7200, 100), 60);
+mod_assert.equal(dataset.step(time0, 7200, 1000), 10);
+mod_assert.equal(dataset.step(now - 600, 600, 600), 1);
+mod_assert.equal(dataset.step(now - 3600, 3600, 100), 10);
+
+/* stash / unstash preserves every tier */
+stashed = dataset.stash();
+mod_assert.equal(stashed['metadata']['ca_agg_stash_vers_minor'], 3);
+mod_assert.deepEqual(mod_native.stashHeader(stashed['data'])['tiers'], [
+    { granularity: 1 },
+    { granularity: 10 },
+    { granularity: 60 }
+]);
+
+restored = mod_caagg.caDatasetForInstrumentation(spec);
+restored.unstash(stashed['metadata'], stashed['data']);
+mod_assert.equal(restored.dataForTime(time0, 7200), 7200);
+mod_assert.equal(restored.dataForTime(now - 3600, 3600), 3600);
+mod_assert.equal(restored.dataForTime(now - 3600, 1), 1);
+
+/*
+ * When the tiers don't match, each tier is loaded from the coarsest stashed
+ * tier that divides it.
+ */
+spec['retention-time'] = 7 * 86400;
+restored = mod_caagg.caDatasetForInstrumentation(spec);
+restored.unstash(stashed['metadata'], stashed['data']);
+mod_assert.equal(restored.ingestTargets().length, 4);
+mod_assert.equal(restored.dataForTime(time0, 7200), 7200);
+mod_assert.equal(restored.dataForTime(time0, 600), 600);
+mod_assert.equal(restored.dataForTime(now - 3600, 1), 1);
+
+spec['retention-time'] = 600;
+restored = mod_caagg.caDatasetForInstrumentation(spec);
+restored.unstash(stashed['metadata'], stashed['data']);
+mod_assert.equal(restored.ingestTargets().length, 1);
+mod_assert.equal(restored.dataForTime(now - 3600, 3600), 3600);
+
+/*
+ * Datasets that don't add multiple data points keep the data point at the
+ * start of each interval in coarser tiers.
+ */
+spec['value-scope'] = 'point';
+spec['retention-time'] = 40000;
+dataset = mod_caagg.caDatasetForInstrumentation(spec);
+mod_assert.ok(dataset.ingestTargets() === undefined);
+
+for (tt = time0; tt < now; tt++) {
+	dataset.update('source1', tt, tt);
+	dataset.update('source1', tt, 1);
+}
+
+dataset.expireBefore(now - spec['retention-time']);
+mod_assert.equal(dataset.dataForTime(time0 + 120, 60), time0 + 120);
+mod_assert.equal(dataset.dataForTime(time0 + 130, 10), time0 + 130);
+mod_assert.equal(dataset.dataForTime(now - 5, 1), now - 5);
+mod_assert.equal(dataset.nreporting(time0, 60), 1);
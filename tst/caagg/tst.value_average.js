@@ -27,3 +27,12 @@ var value1;
 mod_atl.dataset_numeric.update('source', 12345, [[[1, 100], 100000]]);
 value1 = getval(mod_atl.dataset_numeric, 12345, 1, xform, request);
 mod_assert.ok(Math.abs(value1['average'] - 51) < 0.01);
+
+/*
+ * The average covers the whole requested interval, not just its first second.
+ */
+mod_atl.dataset_numeric.update('source', 12346, [[[201, 300], 100000]]);
+value1 = getval(mod_atl.dataset_numeric, 12346, 1, xform, request);
+mod_assert.ok(Math.abs(value1['average'] - 251) < 0.1);
+value1 = getval(mod_atl.dataset_numeric, 12345, 2, xform, request);
+mod_assert.ok(Math.abs(value1['average'] - 151) < 0.1);
@@ -0,0 +1,96 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright (c) 2014, Joyent, Inc.
+ */
+
+/*
+ * Tests caAggrValueHeatmapImageAsync, which must produce exactly the same
+ * values as caAggrValueHeatmapImage from the data present when it was invoked.
+ */
+
+var mod_assert = require('assert');
+var mod_agg = require('../../lib/ca/ca-agg');
+var mod_atl = require('./aggtestlib');
+
+var getval = mod_agg.caAggrHeatmapImageImpl.ai_value;
+var getval_async = mod_agg.caAggrHeatmapImageImpl.ai_value_async;
+var xform = mod_atl.xform;
+var cases, nleft, conf, ii;
+
+mod_atl.dataset_numeric.update('source', 12345, [[[10, 20], 5], [[30, 40], 3]]);
+mod_atl.dataset_numeric.update('source', 12346, [[[0, 10], 7], [[10, 20], 2]]);
+mod_atl.dataset_numeric.update('source', 12348, [[[10, 20], 100]]);
+
+mod_atl.dataset_both.update('source', 12345, {
+    selma: [[[10, 20], 5], [[30, 40], 3]]
+});
+
+mod_atl.dataset_both.update('source', 12347, {
+    selma: [[[0, 10], 7], [[10, 20], 2]],
+    patty: [[[10, 20], 100]]
+});
+
+cases = [
+    [ mod_atl.dataset_numeric, {} ],
+    [ mod_atl.dataset_numeric, { ymax: 50, width: 200, height: 150 } ],
+    [ mod_atl.dataset_both, {} ],
+    [ mod_atl.dataset_both, { selected: [ 'patty' ] } ],
+    [ mod_atl.dataset_both, { selected: [ 'patty' ], isolate: 'true' } ],
+    [ mod_atl.dataset_both, { selected: [ 'selma' ], exclude: 'true' } ],
+    [ mod_atl.dataset_both, { decompose_all: 'true' } ]
+];
+
+/* invalid parameters are reported synchronously */
+mod_assert.throws(function () {
+	getval_async(mod_atl.dataset_both, 12345, 3, xform, { ca_params: {
+	    decompose_all: 'true', isolate: 'true' } }, function () {});
+}, caValidationError);
+
+/*
+ * Each value is computed from the data present when the request was made, even
+ * if more data arrives before the image has been rendered.
+ */
+nleft = cases.length;
+cases.forEach(function (testcase) {
+	var dataset, request, expected;
+
+	dataset = testcase[0];
+	request = { ca_params: testcase[1] };
+	expected = getval(dataset, 12345, 4, xform, request);
+
+	getval_async(dataset, 12345, 4, xform, request, function (err, value) {
+		mod_assert.ok(!err);
+		mod_assert.deepEqual(value, expected);
+		nleft--;
+	});
+});
+
+mod_atl.dataset_numeric.update('source', 12347, [[[10, 20], 50]]);
+mod_atl.dataset_both.update('source', 12346, {
+    selma: [[[10, 20], 50]]
+});
+
+/* errors from rendering are passed to the callback */
+conf = { base: 12345, nsamples: 4, step: 1, width: 10, height: 10,
+    nbuckets: 10, max: 100, hue: [], saturation: [ 0, 0.9 ], value: 0.95 };
+mod_atl.dataset_numeric.renderAsync(conf, [], {}, function (err, image) {
+	mod_assert.ok(err instanceof Error);
+	mod_assert.ok(image === undefined);
+	nleft--;
+});
+nleft++;
+
+mod_assert.throws(function () {
+	mod_atl.dataset_numeric.renderAsync(conf, [], { level: 10 },
+	    function () {});
+});
+
+process.on('exit', function () {
+	mod_assert.equal(nleft, 0);
+	console.log('test passed');
+});
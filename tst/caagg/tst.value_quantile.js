@@ -0,0 +1,56 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright (c) 2014, Joyent, Inc.
+ */
+
+/*
+ * Tests caAggrValueQuantile
+ */
+
+var mod_assert = require('assert');
+var mod_agg = require('../../lib/ca/ca-agg');
+var mod_atl = require('./aggtestlib');
+
+var getval = mod_agg.caAggrQuantileImpl.ai_value;
+var xform = mod_atl.xform;
+var request = { ca_params: {} };
+var value1;
+
+mod_assert.ok(mod_agg.caAggrSupportsQuantiles(
+    { agi_instrumentation: mod_atl.spec_sketch }));
+mod_assert.ok(!mod_agg.caAggrSupportsHeatmap(
+    { agi_instrumentation: mod_atl.spec_sketch }));
+mod_assert.ok(!mod_agg.caAggrSupportsQuantiles(
+    { agi_instrumentation: mod_atl.spec_numeric }));
+
+mod_atl.dataset_sketch.update('source', 12345, [[[1, 100], 100000]]);
+mod_atl.dataset_sketch.update('source', 12346, [[[1001, 1100], 100000]]);
+
+value1 = getval(mod_atl.dataset_sketch, 12345, 1, xform, request);
+console.log(value1);
+mod_assert.deepEqual(Object.keys(value1['quantiles']),
+    [ '0.5', '0.9', '0.99' ]);
+mod_assert.equal(value1['relative_error'], 0.01);
+mod_assert.ok(Math.abs(value1['quantiles']['0.5'] - 51) < 1);
+mod_assert.ok(Math.abs(value1['quantiles']['0.99'] - 100) < 2);
+
+request.ca_params['quantiles'] = '0.25,0.75';
+value1 = getval(mod_atl.dataset_sketch, 12345, 2, xform, request);
+console.log(value1);
+mod_assert.ok(Math.abs(value1['quantiles']['0.25'] - 51) < 1);
+mod_assert.ok(Math.abs(value1['quantiles']['0.75'] - 1051) < 11);
+
+request.ca_params['quantiles'] = '0.5,2';
+mod_assert.throws(function () {
+	getval(mod_atl.dataset_sketch, 12345, 1, xform, request);
+});
+
+request.ca_params['quantiles'] = 'junk';
+mod_assert.throws(function () {
+	getval(mod_atl.dataset_sketch, 12345, 1, xform, request);
+});
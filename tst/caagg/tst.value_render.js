@@ -0,0 +1,195 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright (c) 2014, Joyent, Inc.
+ */
+
+/*
+ * Tests that native heatmap rendering produces exactly the same image as the
+ * node-heatmap pipeline it replaced.
+ */
+
+var mod_assert = require('assert');
+var mod_heatmap = require('heatmap');
+var mod_png = require('png');
+var mod_ca = require('../../lib/ca/ca-common');
+var mod_agg = require('../../lib/ca/ca-agg');
+
+var dataset_numeric, dataset_both, keys, time, ii, jj, datum, seed, misses;
+
+/*
+ * Renders a heatmap the way caAggrValueHeatmapImage used to.
+ */
+function render_js(dataset, conf, selected)
+{
+	var datasets, ii;
+
+	datasets = [ dataset.total() ];
+
+	for (ii = 0; ii < selected.length; ii++)
+		datasets.push(dataset.dataForKey(selected[ii]));
+
+	for (ii = 0; ii < datasets.length; ii++)
+		datasets[ii] = mod_heatmap.bucketize(datasets[ii], conf);
+
+	if (conf.isolate) {
+		datasets.shift();
+
+		if (datasets.length === 0) {
+			datasets = [ mod_heatmap.bucketize({}, conf) ];
+			conf.hue = [ 0 ];
+		}
+	} else {
+		for (ii = 1; ii < datasets.length; ii++)
+			mod_heatmap.deduct(datasets[0], datasets[ii]);
+
+		if (conf.exclude)
+			datasets = [ datasets[0] ];
+	}
+
+	conf.hue = conf.hue.slice(0, datasets.length);
+	mod_heatmap.normalize(datasets, conf);
+	conf.base = 0;
+	return (mod_heatmap.generate(datasets, conf).encodeSync());
+}
+
+function render_native(dataset, conf, selected)
+{
+	var pixels = dataset.render(conf, selected);
+	return (new mod_png.Png(pixels, conf.width, conf.height,
+	    'rgb').encodeSync());
+}
+
+function check(dataset, params, selected)
+{
+	var conf, jsconf, expected, actual;
+
+	conf = {
+	    base: 1000,
+	    nsamples: 60,
+	    step: 1,
+	    width: 300,
+	    height: 200,
+	    nbuckets: 50,
+	    min: 0,
+	    weighbyrange: false,
+	    linear: false,
+	    isolate: false,
+	    exclude: false,
+	    hue: [ 21, 112, 203, 294, 25 ],
+	    saturation: [ 0, 0.9 ],
+	    value: 0.95
+	};
+
+	mod_ca.caDeepCopyInto(conf, params);
+	jsconf = mod_ca.caDeepCopy(conf);
+
+	expected = render_js(dataset, jsconf, selected);
+	actual = render_native(dataset, conf, selected);
+	mod_assert.equal(conf.max, jsconf.max);
+	mod_assert.ok(expected.toString('base64') == actual.toString('base64'),
+	    'images differ for ' + JSON.stringify(params));
+}
+
+/*
+ * A deterministic pseudo-random sequence, so that failures are reproducible.
+ */
+seed = 1;
+function random(max)
+{
+	seed = (seed * 1103515245 + 12345) % 2147483648;
+	return (seed % max);
+}
+
+dataset_numeric = mod_agg.caDatasetForInstrumentation({
+    'value-arity': mod_ca.ca_arity_numeric,
+    'value-dimension': 2,
+    'value-scope': 'interval',
+    'granularity': 1
+});
+
+dataset_both = mod_agg.caDatasetForInstrumentation({
+    'value-arity': mod_ca.ca_arity_numeric,
+    'value-dimension': 3,
+    'value-scope': 'interval',
+    'granularity': 1
+});
+
+keys = [ 'abe', 'jasper', 'molloy', 'selma' ];
+
+for (time = 990; time < 1070; time++) {
+	if (random(10) === 0)
+		continue;
+
+	datum = {};
+
+	for (ii = 0; ii < keys.length; ii++) {
+		if (random(3) === 0)
+			continue;
+
+		datum[keys[ii]] = [];
+
+		for (jj = 0; jj < 100; jj += 1 + random(20)) {
+			datum[keys[ii]].push(
+			    [ [ jj * 10, jj * 10 + 9 ], 1 + random(50) ]);
+		}
+	}
+
+	dataset_both.update('source', time, datum);
+	dataset_numeric.update('source', time, datum['abe']);
+}
+
+check(dataset_numeric, {}, []);
+check(dataset_numeric, { max: 500 }, []);
+check(dataset_numeric, { max: 1000, min: 100, linear: true }, []);
+check(dataset_numeric, { weighbyrange: true, width: 173, height: 91 }, []);
+check(dataset_numeric, { nsamples: 1, max: 1000 }, []);
+check(dataset_numeric, {}, [ 'abe' ]);
+
+check(dataset_both, {}, []);
+check(dataset_both, { max: 700 }, [ 'abe', 'selma' ]);
+check(dataset_both, { linear: true }, [ 'jasper' ]);
+check(dataset_both, { isolate: true, hue: [ 0, 120 ] }, [ 'abe', 'molloy' ]);
+check(dataset_both, { isolate: true, max: 300 }, []);
+check(dataset_both, { exclude: true }, [ 'molloy', 'nobody' ]);
+check(dataset_both, { weighbyrange: true, nbuckets: 17, width: 50 },
+    [ 'selma', 'jasper', 'abe' ]);
+check(dataset_both, { base: 1050, nsamples: 40, max: 1200 }, keys);
+check(dataset_both, { width: 1000, height: 1000, nbuckets: 100 },
+    [ 'abe' ]);
+
+/*
+ * Columns are cached between renders.  Check that a repeated render is served
+ * entirely from the cache, and that changing the data for one column (or adding
+ * a new one) invalidates only that column.
+ */
+function cached(dataset, params, selected)
+{
+	var before, after;
+
+	before = dataset.renderStats();
+	check(dataset, params, selected);
+	after = dataset.renderStats();
+	return (after['misses'] - before['misses']);
+}
+
+mod_assert.equal(cached(dataset_both, { max: 700 }, [ 'abe', 'selma' ]), 0);
+mod_assert.ok(dataset_both.renderStats()['hits'] > 0);
+
+dataset_both.update('source2', 1020, { 'abe': [ [ [ 10, 19 ], 5 ] ] });
+mod_assert.equal(cached(dataset_both, { max: 700 }, [ 'abe', 'selma' ]), 2);
+mod_assert.equal(cached(dataset_both, { max: 700 }, [ 'abe', 'selma' ]), 0);
+
+dataset_numeric.update('source2', 1020, [ [ [ 10, 19 ], 5 ] ]);
+mod_assert.equal(cached(dataset_numeric, { max: 500 }, []), 1);
+
+/* Moving the window along only bucketizes the (at most 10) new columns. */
+misses = cached(dataset_both, { base: 1011, max: 700 }, [ 'abe', 'selma' ]);
+mod_assert.ok(misses > 0 && misses <= 2 * 10);
+dataset_both.update('source', 1070, { 'selma': [ [ [ 30, 39 ], 5 ] ] });
+mod_assert.equal(cached(dataset_both,
+    { base: 1011, max: 700 }, [ 'abe', 'selma' ]), 2);
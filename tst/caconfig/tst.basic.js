@@ -173,7 +173,12 @@ var http_test_cases = [ {
 }, {
 	name: 'illegal granularity: too long a retention-time',
 	input: { module: 'test_module', stat: 'ops1', granularity: '1',
-	    'retention-time': 3601 },
+	    'retention-time': 600 * 3600 + 1 },
+	error: HTTP.ECONFLICT
+}, {
+	name: 'illegal granularity: too long a retention-time without rollup',
+	input: { module: 'test_module', stat: 'ops1', granularity: '3600',
+	    'retention-time': 3600 * 3600 + 1 },
 	error: HTTP.ECONFLICT
 }, {
 	name: 'illegal value for persist-data',
@@ -188,6 +193,11 @@ var http_test_cases = [ {
 	input: { module: 'test_module', stat: 'ops1', granularity: '10',
 	    'retention-time': 3601 },
 	expect: { 'granularity': 10, 'retention-time': 3601 }
+}, {
+	name: 'per-second granularity and long retention time',
+	input: { module: 'test_module', stat: 'ops1', granularity: '1',
+	    'retention-time': 7 * 86400 },
+	expect: { 'granularity': 1, 'retention-time': 7 * 86400 }
 }, {
 	name: 'create with simple metric',
 	input: { module: 'test_module', stat: 'ops1' },
@@ -57,6 +57,7 @@ var instn_initial = {
 	'value-dimension': 2,
 	'value-arity': 'discrete-decomposition',
 	'value-scope': 'interval',
+	'value-sketch': false,
 	enabled: true,
 	transformations: []
     }
@@ -88,6 +89,7 @@ var instn_clones = [ {
 	'value-dimension': 2,
 	'value-arity': 'numeric-decomposition',
 	'value-scope': 'interval',
+	'value-sketch': false,
 	enabled: true,
 	transformations: []
     }
@@ -115,6 +117,7 @@ var instn_clones = [ {
 	'value-dimension': 3,
 	'value-arity': 'numeric-decomposition',
 	'value-scope': 'interval',
+	'value-sketch': false,
 	enabled: true,
 	transformations: []
     }
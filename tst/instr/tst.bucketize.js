@@ -61,3 +61,78 @@ mod_assert.deepEqual(rv, [[[100, 109], 5]]);
 rv = [];
 loglin(rv, 1000, 13);
 mod_assert.deepEqual(rv, [[[1000, 1090], 13]]);
+
+/*
+ * The bucketizers agree with ca-native's distributions, including for values
+ * at and just around powers of the base, where computing the log is delicate.
+ * The log-linear bucketizer emits a separate entry with the same range for
+ * values that fall between one bucket's upper bound and the next bucket's lower
+ * bound, so we merge those before comparing.  The powers used are ones that
+ * Math.pow() computes exactly, as the C library does, and exclude base^min,
+ * which the bucketizer puts in either [0, base^min] or the bucket starting at
+ * base^min depending on which one it's seen before.
+ */
+var mod_native = require('ca-native');
+
+function checkNative(bucketizer, params, values)
+{
+	var dist, result, expected, jj;
+
+	dist = new mod_native.Distribution(new mod_native.DistLayout(params));
+	result = [];
+
+	for (jj = 0; jj < values.length; jj++) {
+		bucketizer(result, values[jj], 1);
+		dist.insert(values[jj]);
+	}
+
+	expected = [];
+	for (jj = 0; jj < result.length; jj++) {
+		if (jj > 0 && result[jj - 1][0][0] == result[jj][0][0]) {
+			expected[expected.length - 1][1] += result[jj][1];
+			continue;
+		}
+
+		if (jj > 0)
+			mod_assert.ok(result[jj - 1][0][1] <= result[jj][0][0]);
+
+		expected.push(result[jj]);
+	}
+
+	mod_assert.deepEqual(dist.toArray(), expected);
+}
+
+function edges(base, min, max)
+{
+	var values = [], power, jj;
+
+	for (jj = min + 1; jj < max; jj++) {
+		power = Math.pow(base, jj);
+		values.push(power, power * (1 - 1e-15), power * (1 + 1e-15),
+		    power * (1 - 1e-12), power * (1 + 1e-12));
+	}
+
+	return (values);
+}
+
+var values, ii;
+
+values = [];
+for (ii = 0; ii < 2000; ii++)
+	values.push(3 + 2 * Math.floor(Math.random() * 5e6));
+
+checkNative(mod_instr.caInstrLinearBucketize(10),
+    { type: 'linear', step: 10 }, values);
+checkNative(mod_instr.caInstrLinearBucketize(1000),
+    { type: 'linear', step: 1000 }, values);
+checkNative(mod_instr.caInstrLogLinearBucketize(10, 0, 11, 100),
+    { type: 'loglinear', base: 10, min: 0, max: 11, nbuckets: 100 }, values);
+checkNative(mod_instr.caInstrLogLinearBucketize(10, 2, 11, 20),
+    { type: 'loglinear', base: 10, min: 2, max: 11, nbuckets: 20 },
+    values.concat(edges(10, 2, 23)));
+checkNative(mod_instr.caInstrLogLinearBucketize(2, 0, 11, 4),
+    { type: 'loglinear', base: 2, min: 0, max: 11, nbuckets: 4 },
+    edges(2, 0, 140));
+checkNative(mod_instr.caInstrLogLinearBucketize(1.5, 0, 11, 3),
+    { type: 'loglinear', base: 1.5, min: 0, max: 11, nbuckets: 3 },
+    edges(1.5, 0, 34));
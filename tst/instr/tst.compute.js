@@ -97,3 +97,89 @@ mod_assert.deepEqual(result, {
 	[[50, 59], 100]
     ]
 });
+
+/*
+ * Values computed natively match those computed by the bucketizers themselves,
+ * which are used when a bucketizer has no native equivalent.  The log-linear
+ * bucketizer may emit several entries for the same bucket when a value falls
+ * between one bucket's upper bound and the next bucket's lower bound, so we
+ * merge those before comparing.
+ */
+var random, linear, loglinear, jsonly, decomps, ii;
+
+random = [];
+for (ii = 0; ii < 500; ii++) {
+	random.push({
+	    fields: {
+		location: 'loc' + Math.floor(Math.random() * 7),
+		when: Math.random() < 0.5 ? 'day' : 'night',
+		person: 'p' + Math.floor(Math.random() * 40),
+		temp: Math.floor(Math.random() * 100000)
+	    },
+	    value: 1 + Math.floor(Math.random() * 10)
+	});
+}
+
+linear = mod_instr.caInstrLinearBucketize(10);
+loglinear = mod_instr.caInstrLogLinearBucketize(10, 0, 11, 100);
+
+function jsOnly(bucketizer)
+{
+	return (function (rv, value, card) {
+		return (bucketizer(rv, value, card));
+	});
+}
+
+function merged(value)
+{
+	var rv, key, ii;
+
+	if (typeof (value) == 'number')
+		return (value);
+
+	if (!Array.isArray(value)) {
+		rv = {};
+		for (key in value)
+			rv[key] = merged(value[key]);
+		return (rv);
+	}
+
+	rv = [];
+	for (ii = 0; ii < value.length; ii++) {
+		if (rv.length > 0 &&
+		    rv[rv.length - 1][0][0] == value[ii][0][0])
+			rv[rv.length - 1][1] += value[ii][1];
+		else
+			rv.push([ value[ii][0], value[ii][1] ]);
+	}
+
+	return (rv);
+}
+
+decomps = [ [ 'when' ], [ 'location', 'person' ], [ 'temp' ],
+    [ 'when', 'temp' ], [ 'location', 'when', 'temp' ] ];
+
+[ linear, loglinear ].forEach(function (bucketizer) {
+	jsonly = jsOnly(bucketizer);
+	decomps.forEach(function (decomp) {
+		mod_assert.deepEqual(
+		    mod_instr.caInstrComputeValue(metadata,
+			{ temp: bucketizer }, decomp, random),
+		    merged(mod_instr.caInstrComputeValue(metadata,
+			{ temp: jsonly }, decomp, random)));
+	});
+});
+
+/*
+ * Values that can't be bucketized natively fall back to the bucketizers.
+ */
+random.push({
+    fields: { location: 'loc0', when: 'day', person: 'p0', temp: -15 },
+    value: 3
+});
+
+mod_assert.deepEqual(
+    mod_instr.caInstrComputeValue(metadata, { temp: linear },
+	[ 'when', 'temp' ], random),
+    mod_instr.caInstrComputeValue(metadata, { temp: jsOnly(linear) },
+	[ 'when', 'temp' ], random));
@@ -60,3 +60,54 @@ result = mod_instr.caInstrApplyPredicate({ or: [
     { eq: [ 'person', 'mindy' ] }
 ] }, points);
 mod_assert.deepEqual(result, [ points[0], points[2] ]);
+
+/*
+ * compiled predicates agree with caPredEval
+ */
+var mod_capred = require('../../lib/ca/ca-pred');
+var random, zones, preds, ii;
+
+random = [];
+for (ii = 0; ii < 300; ii++) {
+	random.push({
+	    fields: {
+		zonename: 'zone' + Math.floor(Math.random() * 50),
+		hostname: 'host' + Math.floor(Math.random() * 5),
+		latency: Math.floor(Math.random() * 1000)
+	    },
+	    value: 1
+	});
+}
+
+zones = { or: [] };
+for (ii = 0; ii < 40; ii += 2)
+	zones['or'].push({ eq: [ 'zonename', 'zone' + ii ] });
+
+preds = [
+    { eq: [ 'zonename', 'zone7' ] },
+    { ne: [ 'hostname', 'host3' ] },
+    { lt: [ 'latency', 100 ] },
+    zones,
+    { and: [
+	zones,
+	{ ge: [ 'latency', 250 ] },
+	{ le: [ 'latency', 750 ] },
+	{ or: [ { ne: [ 'hostname', 'host1' ] }, { gt: [ 'latency', 500 ] } ] }
+    ] }
+];
+
+preds.forEach(function (pred) {
+	mod_assert.deepEqual(mod_instr.caInstrApplyPredicate(pred, random),
+	    random.filter(function (point) {
+		return (mod_capred.caPredEval(pred, point['fields']));
+	    }));
+});
+
+/*
+ * fields compared with both numbers and strings are evaluated loosely
+ */
+result = mod_instr.caInstrApplyPredicate({ or: [
+    { eq: [ 'when', 'night' ] },
+    { eq: [ 'when', 3 ] }
+] }, points);
+mod_assert.deepEqual(result, [ points[0], points[3] ]);
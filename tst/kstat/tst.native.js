@@ -0,0 +1,195 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright (c) 2014, Joyent, Inc.
+ */
+
+/*
+ * tst.native.js: tests that metrics whose fields and extract function carry
+ * parameters for the native KstatDiff compute the same values as metrics
+ * defined with plain functions.
+ */
+
+var mod_assert = require('assert');
+var ASSERT = mod_assert.ok;
+
+var mod_ca = require('../../lib/ca/ca-common');
+var mod_instr = require('../../lib/ca/ca-instr');
+var mod_metric = require('../../lib/ca/ca-metric');
+var mod_tl = require('../../lib/tst/ca-test');
+var mod_cakstat = require('../../cmd/cainst/modules/kstat');
+
+mod_tl.ctSetTimeout(10 * 1000);	/* 10s */
+
+function params(func, kparams)
+{
+	var rv = function () { return (func.apply(null, arguments)); };
+	rv.caKstatParams = kparams;
+	return (rv);
+}
+
+var hostname = function () { return ([ 'testhostname' ]); };
+var disk = function (kstat) { return ([ kstat['name'] ]); };
+var optype = function () { return ([ 'read', 'write' ]); };
+var bytes = function (kstat, klast) {
+	return ([ kstat['data']['nread'] + kstat['data']['nwritten'] -
+	    klast['data']['nread'] - klast['data']['nwritten'] ]);
+};
+var busytime = function (kstat, klast, interval) {
+	return ([ Math.floor(100 * (kstat['data']['rtime'] -
+	    klast['data']['rtime']) / interval) ]);
+};
+var extract = function (fields, kstat, klast) {
+	var key = fields['optype'] == 'read' ? 'nread' : 'nwritten';
+	return (kstat['data'][key] - klast['data'][key]);
+};
+
+var jsdesc = {
+	module: 'disk',
+	stat: 'physio_bytes',
+	kstat: { class: 'disk' },
+	extract: extract,
+	fields: {
+		hostname: { values: hostname },
+		disk: { values: disk },
+		optype: { values: optype },
+		bytes: {
+			bucketize: mod_instr.caInstrLogLinearBucketize(
+			    10, 2, 11, 100),
+			values: bytes
+		},
+		busytime: {
+			bucketize: mod_instr.caInstrLinearBucketize(1),
+			values: busytime
+		}
+	}
+};
+
+var nativedesc = {
+	module: 'disk',
+	stat: 'physio_bytes',
+	kstat: { class: 'disk' },
+	extract: params(extract, { type: 'delta', field: 'optype',
+	    stats: { read: 'nread', write: 'nwritten' } }),
+	fields: {
+		hostname: { values: params(hostname,
+		    { type: 'constant', values: [ 'testhostname' ] }) },
+		disk: { values: params(disk,
+		    { type: 'ident', member: 'name' }) },
+		optype: { values: params(optype,
+		    { type: 'constant', values: [ 'read', 'write' ] }) },
+		bytes: {
+			bucketize: mod_instr.caInstrLogLinearBucketize(
+			    10, 2, 11, 100),
+			values: params(bytes, { type: 'delta',
+			    stats: [ 'nread', 'nwritten' ] })
+		},
+		busytime: {
+			bucketize: mod_instr.caInstrLinearBucketize(1),
+			values: params(busytime, { type: 'percent',
+			    stats: [ 'rtime' ] })
+		}
+	}
+};
+
+var metadata = new mod_metric.caMetricMetadata();
+metadata.addFromHost({
+	modules: { 'disk': { label: 'Disk I/O' } },
+	types: {
+		number: { arity: 'numeric' },
+		percent: { arity: 'numeric' }
+	},
+	fields: {
+		hostname:	{ label: 'system name' },
+		disk:		{ label: 'disk name' },
+		optype:		{ label: 'operation type' },
+		bytes:		{ label: 'bytes', type: 'number' },
+		busytime:	{ label: 'busy time', type: 'percent' }
+	},
+	metrics: [ {
+		module: 'disk',
+		stat: 'physio_bytes',
+		label: 'bytes',
+		unit: 'bytes',
+		fields: [ 'hostname', 'disk', 'optype', 'bytes', 'busytime' ]
+	} ]
+}, 'in-core');
+ASSERT(metadata.problems().length === 0);
+
+var instrbei = new mod_tl.caFakeInstrBackendInterface(metadata);
+
+/*
+ * Each snapshot is a function of the iteration number.  Disk sd2 disappears
+ * after the second snapshot and reappears on the fourth.
+ */
+function snapshot(nreads)
+{
+	var rv, ii;
+
+	rv = {};
+	for (ii = 0; ii < 3; ii++) {
+		if (ii == 2 && nreads == 3)
+			continue;
+
+		rv['sd:' + ii + ':disk:sd' + ii] = {
+			class: 'disk',
+			module: 'sd',
+			name: 'sd' + ii,
+			instance: ii,
+			snaptime: nreads * 1000,
+			data: {
+			    nread: nreads * nreads * (101 + ii),
+			    nwritten: nreads * 37 * ii,
+			    rtime: nreads * nreads * 10 * (ii + 1)
+			}
+		};
+	}
+
+	return (rv);
+}
+
+function make_metric(desc, decomp, pred)
+{
+	var metric = new mod_cakstat.insKstatAutoMetric(desc, {
+		is_module: desc['module'],
+		is_stat: desc['stat'],
+		is_predicate: pred,
+		is_decomposition: decomp
+	}, instrbei);
+
+	metric.nreads = 0;
+	metric.read = function () { return (snapshot(++this.nreads)); };
+	return (metric);
+}
+
+var decomps = [ [], [ 'hostname' ], [ 'optype' ], [ 'disk', 'optype' ],
+    [ 'bytes' ], [ 'busytime' ], [ 'disk', 'bytes' ] ];
+var preds = [ {}, { ne: [ 'disk', 'sd1' ] }, { eq: [ 'optype', 'write' ] },
+    { and: [ { gt: [ 'bytes', 100 ] }, { ne: [ 'optype', 'read' ] } ] } ];
+var ii, jj, kk, jsmetric, nativemetric, jsvalue, nativevalue;
+
+for (ii = 0; ii < decomps.length; ii++) {
+	for (jj = 0; jj < preds.length; jj++) {
+		jsmetric = make_metric(jsdesc, decomps[ii], preds[jj]);
+		nativemetric = make_metric(nativedesc, decomps[ii], preds[jj]);
+		ASSERT(jsmetric.iam_diff === null);
+		ASSERT(nativemetric.iam_diff !== null);
+
+		for (kk = 0; kk < 5; kk++) {
+			jsmetric.value(function (value) { jsvalue = value; });
+			nativemetric.value(function (value) {
+				nativevalue = value;
+			});
+
+			mod_tl.ctStdout.dbg('decomp %j pred %j: %j',
+			    decomps[ii], preds[jj], nativevalue);
+			mod_assert.deepEqual(nativevalue, jsvalue);
+		}
+	}
+}
+
+process.exit(0);
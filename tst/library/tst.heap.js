@@ -0,0 +1,68 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright (c) 2014, Joyent, Inc.
+ */
+
+/*
+ * tst.heap.js: tests min-heap
+ */
+
+var mod_assert = require('assert');
+var mod_heap = require('../../lib/ca/ca-heap.js');
+
+var heap, entries, keys, removed, values, ii;
+
+heap = new mod_heap.caHeap();
+mod_assert.equal(heap.size(), 0);
+mod_assert.equal(heap.peek(), undefined);
+mod_assert.equal(heap.peekKey(), undefined);
+mod_assert.throws(function () { heap.pop(); });
+
+/* values come out in key order, including duplicate keys */
+keys = [ 5, 3, 8, 1, 9, 3, 7, 2, 6, 4, 0 ];
+for (ii = 0; ii < keys.length; ii++)
+	heap.insert(keys[ii], 'value' + keys[ii]);
+
+mod_assert.equal(heap.size(), keys.length);
+mod_assert.equal(heap.peekKey(), 0);
+mod_assert.equal(heap.peek(), 'value0');
+
+values = [];
+while (heap.size() > 0)
+	values.push(heap.pop());
+
+mod_assert.deepEqual(values, [ 'value0', 'value1', 'value2', 'value3',
+    'value3', 'value4', 'value5', 'value6', 'value7', 'value8', 'value9' ]);
+
+/* entries can be removed from anywhere in the heap */
+entries = [];
+for (ii = 0; ii < 100; ii++)
+	entries.push(heap.insert((ii * 37) % 100, ii));
+
+removed = {};
+for (ii = 0; ii < 100; ii += 3) {
+	heap.remove(entries[ii]);
+	removed[(ii * 37) % 100] = true;
+}
+
+mod_assert.throws(function () { heap.remove(entries[0]); });
+
+keys = [];
+while (heap.size() > 0) {
+	keys.push(heap.peekKey());
+	mod_assert.equal((heap.pop() * 37) % 100, keys[keys.length - 1]);
+}
+
+for (ii = 1; ii < keys.length; ii++)
+	mod_assert.ok(keys[ii - 1] < keys[ii]);
+
+for (ii = 0; ii < keys.length; ii++)
+	mod_assert.ok(!removed[keys[ii]]);
+
+mod_assert.equal(keys.length + Object.keys(removed).length, 100);
+console.log('test passed');
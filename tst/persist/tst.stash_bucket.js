@@ -14,6 +14,8 @@
 
 var mod_assert = require('assert');
 var ASSERT = mod_assert.ok;
+var mod_fs = require('fs');
+var mod_path = require('path');
 
 var mod_ca = require('../../lib/ca/ca-common');
 var mod_calog = require('../../lib/ca/ca-log');
@@ -137,6 +139,89 @@ function check_removed()
 	});
 }
 
+function fill_binary()
+{
+	expected = { friend: 'nelson' };
+	stash.bucketFill('janey', expected, new Buffer([ 0, 0xff, 0x80, 10 ]),
+	    mod_tl.advance);
+}
+
+function check_binary(err)
+{
+	ASSERT(!err, caSprintf('unexpected error: %j', err));
+	mod_assert.deepEqual(expected, stash.bucketMetadata('janey'));
+
+	stash.bucketContents('janey', function (err2, result) {
+		ASSERT(!err2, caSprintf('unexpected error: %j', err2));
+		mod_assert.deepEqual(expected, result['metadata']);
+		ASSERT(Buffer.isBuffer(result['data']));
+		mod_assert.deepEqual([ 0, 0xff, 0x80, 10 ],
+		    Array.prototype.slice.call(result['data']));
+		ASSERT(!('segments' in result));
+		mod_tl.advance();
+	});
+}
+
+function fill_bad()
+{
+	stash.bucketFill('janey', {}, { not: 'data' }, function (err) {
+		ASSERT(err);
+		ASSERT(err.code() == ECA_INVAL);
+		mod_tl.advance();
+	});
+}
+
+function append()
+{
+	stash.bucketAppend('nobody', {}, new Buffer(1), function (err) {
+		ASSERT(err);
+		ASSERT(err.code() == ECA_NOENT);
+
+		stash.bucketAppend('janey', { friend: 'jimbo' },
+		    new Buffer([ 1, 2 ]), function (err2) {
+			ASSERT(!err2, caSprintf('unexpected error: %j', err2));
+			stash.bucketAppend('janey', { friend: 'kearney' },
+			    new Buffer([ 10, 3 ]), mod_tl.advance);
+		    });
+	});
+}
+
+function check_segments(err)
+{
+	ASSERT(!err, caSprintf('unexpected error: %j', err));
+	mod_assert.deepEqual({ friend: 'kearney' },
+	    stash.bucketMetadata('janey'));
+
+	stash.bucketContents('janey', function (err2, result) {
+		ASSERT(!err2, caSprintf('unexpected error: %j', err2));
+		mod_assert.deepEqual(expected, result['metadata']);
+		mod_assert.deepEqual([ 0, 0xff, 0x80, 10 ],
+		    Array.prototype.slice.call(result['data']));
+		mod_assert.equal(result['segments'].length, 2);
+		mod_assert.deepEqual({ friend: 'jimbo' },
+		    result['segments'][0]['metadata']);
+		mod_assert.deepEqual([ 1, 2 ],
+		    Array.prototype.slice.call(result['segments'][0]['data']));
+		mod_assert.deepEqual({ friend: 'kearney' },
+		    result['segments'][1]['metadata']);
+		mod_assert.deepEqual([ 10, 3 ],
+		    Array.prototype.slice.call(result['segments'][1]['data']));
+
+		/* leave behind a segment that was never completed */
+		mod_capersist.caSaveFile(mod_path.join(tmpdir, 'bucket-janey',
+		    'newsegment-3'), 'junk', mod_tl.advance);
+	});
+}
+
+function check_segments_again(err)
+{
+	ASSERT(!err, caSprintf('unexpected error: %j', err));
+	mod_assert.deepEqual(mod_fs.readdirSync(mod_path.join(tmpdir,
+	    'bucket-janey')).sort(), [ 'data.bin', 'metadata.json',
+	    'segment-1', 'segment-2' ]);
+	check_segments(null);
+}
+
 function cleanup()
 {
 	log.info('removing "%s"', tmpdir);
@@ -154,6 +239,19 @@ mod_tl.ctPushFunc(remove);
 mod_tl.ctPushFunc(check_removed);
 mod_tl.ctPushFunc(newstash);
 mod_tl.ctPushFunc(check_removed);
+mod_tl.ctPushFunc(fill_binary);
+mod_tl.ctPushFunc(check_binary);
+mod_tl.ctPushFunc(newstash);
+mod_tl.ctPushFunc(check_binary);
+mod_tl.ctPushFunc(fill_bad);
+mod_tl.ctPushFunc(append);
+mod_tl.ctPushFunc(check_segments);
+mod_tl.ctPushFunc(newstash);
+mod_tl.ctPushFunc(check_segments_again);
+mod_tl.ctPushFunc(fill_binary);
+mod_tl.ctPushFunc(check_binary);
+mod_tl.ctPushFunc(newstash);
+mod_tl.ctPushFunc(check_binary);
 mod_tl.ctPushFunc(cleanup);
 mod_tl.ctPushFunc(mod_tl.ctDoExitSuccess);
 mod_tl.advance();
@@ -0,0 +1,171 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright (c) 2014, Joyent, Inc.
+ */
+
+/*
+ * tst.stash_index.js: test loading bucket metadata from the bucket index
+ */
+
+var mod_assert = require('assert');
+var ASSERT = mod_assert.ok;
+var mod_fs = require('fs');
+var mod_path = require('path');
+
+var mod_ca = require('../../lib/ca/ca-common');
+var mod_calog = require('../../lib/ca/ca-log');
+var mod_capersist = require('../../lib/ca/ca-persist');
+var mod_tl = require('../../lib/tst/ca-test');
+
+var stash, tmpdir, log;
+
+mod_tl.ctSetTimeout(10 * 1000);
+
+function setup()
+{
+	var sysinfo;
+
+	tmpdir = mod_tl.ctTmpdir();
+	log = new mod_calog.caLog({ out: process.stderr });
+	log.info('using tmpdir "%s"', tmpdir);
+
+	sysinfo = mod_ca.caSysinfo(process.argv[1], '0.0');
+	stash = new mod_capersist.caStash(log, sysinfo);
+	stash.init(tmpdir, mod_tl.advance);
+}
+
+function fill(err)
+{
+	ASSERT(!err, caSprintf('unexpected error: %j', err));
+
+	stash.bucketFill('lisa', { instrument: 'sax' }, 'contents',
+	    function (err2) {
+		ASSERT(!err2, caSprintf('unexpected error: %j', err2));
+		stash.bucketFill('maggie', { instrument: 'none' },
+		    new Buffer([ 1, 2, 3 ]), function (err3) {
+			ASSERT(!err3, caSprintf('unexpected error: %j', err3));
+			stash.bucketAppend('maggie', { instrument: 'pacifier' },
+			    new Buffer([ 4 ]), mod_tl.advance);
+		    });
+	});
+}
+
+/*
+ * Buckets that changed very recently aren't saved in the index, so wait a bit
+ * before saving it.
+ */
+function save_index(err)
+{
+	ASSERT(!err, caSprintf('unexpected error: %j', err));
+	setTimeout(function () { stash.indexSave(mod_tl.advance); }, 1500);
+}
+
+/*
+ * Clobber the metadata of one bucket without changing its directory.  Since
+ * the bucket is in the index, we won't even read the metadata file when we
+ * load the stash, so this shouldn't affect anything.  Then append to the other
+ * bucket, which means we won't use the index for it.
+ */
+function change(err)
+{
+	var index;
+
+	ASSERT(!err, caSprintf('unexpected error: %j', err));
+	index = JSON.parse(mod_fs.readFileSync(
+	    mod_path.join(tmpdir, 'index.json')));
+	mod_assert.deepEqual(Object.keys(index['ca_index_buckets']).sort(),
+	    [ 'lisa', 'maggie' ]);
+
+	mod_fs.writeFileSync(mod_path.join(tmpdir, 'bucket-lisa',
+	    'metadata.json'), 'garbage');
+	stash.bucketAppend('maggie', { instrument: 'rattle' },
+	    new Buffer([ 5 ]), mod_tl.advance);
+}
+
+function newstash(err)
+{
+	ASSERT(!err, caSprintf('unexpected error: %j', err));
+	stash = new mod_capersist.caStash(log, {});
+	stash.init(tmpdir, mod_tl.advance);
+}
+
+/*
+ * The stash is usable before the indexed buckets have been checked, but each
+ * one is checked before it's first used, so we get the current metadata and
+ * contents for the bucket that changed.
+ */
+function check(err)
+{
+	ASSERT(!err, caSprintf('unexpected error: %j', err));
+	mod_assert.deepEqual(stash.bucketMetadata('lisa'),
+	    { instrument: 'sax' });
+
+	stash.bucketContents('maggie', function (err2, result) {
+		ASSERT(!err2, caSprintf('unexpected error: %j', err2));
+		mod_assert.deepEqual(stash.bucketMetadata('maggie'),
+		    { instrument: 'rattle' });
+		mod_assert.deepEqual(result['metadata'],
+		    { instrument: 'none' });
+		mod_assert.equal(result['segments'].length, 2);
+		mod_assert.deepEqual(result['segments'][1]['metadata'],
+		    { instrument: 'rattle' });
+
+		stash.bucketContents('lisa', function (err3, result2) {
+			ASSERT(!err3, caSprintf('unexpected error: %j', err3));
+			mod_assert.equal(result2['data'], 'contents');
+			mod_tl.advance();
+		});
+	});
+}
+
+/*
+ * Once the bucket changes, we read its metadata from disk again.
+ */
+function refill()
+{
+	stash.bucketFill('lisa', { instrument: 'violin' }, 'more',
+	    function (err) {
+		ASSERT(!err, caSprintf('unexpected error: %j', err));
+		newstash();
+	    });
+}
+
+/*
+ * Listing all buckets waits until they've all been checked.
+ */
+function check_refilled(err)
+{
+	ASSERT(!err, caSprintf('unexpected error: %j', err));
+
+	stash.bucketContents('.contents', function (err2, result) {
+		ASSERT(!err2, caSprintf('unexpected error: %j', err2));
+		mod_assert.deepEqual(JSON.parse(result['data'])['lisa'],
+		    { instrument: 'violin' });
+		mod_assert.deepEqual(stash.bucketMetadata('lisa'),
+		    { instrument: 'violin' });
+		mod_tl.advance();
+	});
+}
+
+function cleanup()
+{
+	log.info('removing "%s"', tmpdir);
+	mod_capersist.caRemoveTree(log, tmpdir, mod_tl.advance);
+}
+
+mod_tl.ctPushFunc(setup);
+mod_tl.ctPushFunc(fill);
+mod_tl.ctPushFunc(save_index);
+mod_tl.ctPushFunc(change);
+mod_tl.ctPushFunc(newstash);
+mod_tl.ctPushFunc(check);
+mod_tl.ctPushFunc(refill);
+mod_tl.ctPushFunc(check_refilled);
+mod_tl.ctPushFunc(cleanup);
+mod_tl.ctPushFunc(mod_tl.ctDoExitSuccess);
+mod_tl.advance();
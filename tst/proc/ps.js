@@ -23,16 +23,8 @@ var timeout = 1 * 1000; /* 1 s */
 
 function createBackend()
 {
-	mod_proc.caProcLoadCTF(function (err, ctype) {
-		if (err) {
-			process.stderr.write(caSprintf('failed to load CTF ' +
-			    'data: %r', err));
-			process.exit(1);
-		}
-
-		g_back = new mod_proc.caProcDataCache(ctype, timeout);
-		mod_tl.advance();
-	});
+	g_back = new mod_proc.caProcDataCache(timeout);
+	mod_tl.advance();
 }
 
 function getData()
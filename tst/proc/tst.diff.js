@@ -52,16 +52,8 @@ function getZonename()
 function createBackend()
 {
 	g_pid = process.pid;
-	mod_proc.caProcLoadCTF(function (err, ctype) {
-		if (err) {
-			mod_tl.ctStdout.error(caSprintf('failed to load CTF ' +
-			    'data: %r', err));
-			process.exit(1);
-		}
-
-		g_back = new mod_proc.caProcDataCache(ctype, timeout);
-		mod_tl.advance();
-	});
+	g_back = new mod_proc.caProcDataCache(timeout);
+	mod_tl.advance();
 }
 
 /*